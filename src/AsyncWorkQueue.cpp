@@ -20,8 +20,15 @@ void AsyncWorkQueue::WorkerThreadMain()
 
     m_mutex.lock();
     m_vecpthreadVars.push_back(&vars);
+    size_t ithread = m_vecpthreadVars.size() - 1;
     m_mutex.unlock();
 
+    if (cserver.jemalloc_thread_arenas) {
+        char label[32];
+        snprintf(label, sizeof(label), "async-worker-%zu", ithread);
+        zmalloc_thread_arena_bind(label);
+    }
+
     while (!m_fQuitting)
     {
         std::unique_lock<std::mutex> lock(m_mutex);
@@ -28,11 +28,13 @@
  */
 
 #include "server.h"
+#include "aclmatch.h"
 extern "C" {
 #include "sha256.h"
 }
 #include <fcntl.h>
 #include <ctype.h>
+#include <mutex>
 
 /* =============================================================================
  * Global state for ACLs
@@ -268,6 +270,8 @@ user *ACLCreateUser(const char *name, size_t namelen) {
     listSetMatchMethod(u->channels,ACLListMatchSds);
     listSetFreeMethod(u->channels,ACLListFreeSds);
     listSetDupMethod(u->channels,ACLListDupSds);
+    u->compiled_patterns = NULL;
+    u->compiled_channels = NULL;
     memset(u->allowed_commands,0,sizeof(u->allowed_commands));
     raxInsert(Users,(unsigned char*)name,namelen,u,NULL);
     return u;
@@ -290,13 +294,84 @@ user *ACLCreateUnlinkedUser(void) {
     }
 }
 
+/* Return the matcher compiled from the patterns list, building it the first
+ * time it is needed. ACL changes happen under the global lock but permission
+ * checks also run for async commands, so the build is serialized and the
+ * result published with a release store. Code changing the patterns or
+ * channels lists holds mutexACLCompile across the change and the reset of
+ * the matchers, so a build never reads a list being modified nor publishes
+ * a matcher for patterns that were replaced meanwhile. */
+static std::mutex mutexACLCompile;
+static const aclMatcher *ACLGetCompiledMatcher(aclMatcher **compiled, list *patterns) {
+    aclMatcher *m = __atomic_load_n(compiled,__ATOMIC_ACQUIRE);
+    if (m != NULL) return m;
+
+    std::unique_lock<std::mutex> lock(mutexACLCompile);
+    m = __atomic_load_n(compiled,__ATOMIC_RELAXED);
+    if (m == NULL) {
+        listIter li;
+        listNode *ln;
+        m = aclMatcherCreate();
+        listRewind(patterns,&li);
+        while((ln = listNext(&li))) {
+            sds pattern = (sds)listNodeValue(ln);
+            aclMatcherAddPattern(m,pattern,sdslen(pattern));
+        }
+        aclMatcherCompile(m);
+        __atomic_store_n(compiled,m,__ATOMIC_RELEASE);
+    }
+    return m;
+}
+
+/* Frees a retired matcher once the garbage collector knows no thread can
+ * still be matching against it. */
+class ACLMatcherCollectable : public ICollectable
+{
+    aclMatcher *m_matcher;
+
+public:
+    ACLMatcherCollectable(aclMatcher *matcher)
+        : m_matcher(matcher)
+        {}
+
+    virtual ~ACLMatcherCollectable() {
+        aclMatcherFree(m_matcher);
+    }
+};
+
+/* Async commands check permissions without the global lock, so a matcher
+ * replaced or dropped under the lock may still be in use by another thread.
+ * Hand it to the garbage collector instead of freeing it right away. */
+static void ACLRetireMatcher(aclMatcher *m) {
+    if (m == NULL) return;
+    if (serverTL == nullptr || serverTL->gcEpoch.isReset())
+        aclMatcherFree(m);
+    else
+        g_pserver->garbageCollector.enqueue(serverTL->gcEpoch,
+            std::make_unique<ACLMatcherCollectable>(m));
+}
+
+/* Drop the compiled key and channel matchers of the user, to be called every
+ * time its patterns or channels lists change. The caller must hold
+ * mutexACLCompile since before the lists were changed. */
+static void ACLResetCompiledPatternsLocked(user *u) {
+    aclMatcher *patterns = __atomic_exchange_n(&u->compiled_patterns,(aclMatcher*)NULL,__ATOMIC_ACQ_REL);
+    aclMatcher *channels = __atomic_exchange_n(&u->compiled_channels,(aclMatcher*)NULL,__ATOMIC_ACQ_REL);
+    ACLRetireMatcher(patterns);
+    ACLRetireMatcher(channels);
+}
+
 /* Release the memory used by the user structure. Note that this function
  * will not remove the user from the Users global radix tree. */
 void ACLFreeUser(user *u) {
     sdsfree(u->name);
     listRelease(u->passwords);
-    listRelease(u->patterns);
-    listRelease(u->channels);
+    {
+        std::unique_lock<std::mutex> lock(mutexACLCompile);
+        listRelease(u->patterns);
+        listRelease(u->channels);
+        ACLResetCompiledPatternsLocked(u);
+    }
     ACLResetSubcommands(u);
     zfree(u);
 }
@@ -336,11 +411,15 @@ void ACLFreeUserAndKillClients(user *u) {
  * same rules (but the names will continue to be the original ones). */
 void ACLCopyUser(user *dst, user *src) {
     listRelease(dst->passwords);
-    listRelease(dst->patterns);
-    listRelease(dst->channels);
     dst->passwords = listDup(src->passwords);
-    dst->patterns = listDup(src->patterns);
-    dst->channels = listDup(src->channels);
+    {
+        std::unique_lock<std::mutex> lock(mutexACLCompile);
+        listRelease(dst->patterns);
+        listRelease(dst->channels);
+        dst->patterns = listDup(src->patterns);
+        dst->channels = listDup(src->channels);
+        ACLResetCompiledPatternsLocked(dst);
+    }
     memcpy(dst->allowed_commands,src->allowed_commands,
            sizeof(dst->allowed_commands));
     dst->flags = src->flags;
@@ -850,18 +929,26 @@ int ACLSetUser(user *u, const char *op, ssize_t oplen) {
                !strcasecmp(op,"~*"))
     {
         u->flags |= USER_FLAG_ALLKEYS;
+        std::unique_lock<std::mutex> lock(mutexACLCompile);
         listEmpty(u->patterns);
+        ACLResetCompiledPatternsLocked(u);
     } else if (!strcasecmp(op,"resetkeys")) {
         u->flags &= ~USER_FLAG_ALLKEYS;
+        std::unique_lock<std::mutex> lock(mutexACLCompile);
         listEmpty(u->patterns);
+        ACLResetCompiledPatternsLocked(u);
     } else if (!strcasecmp(op,"allchannels") ||
                !strcasecmp(op,"&*"))
     {
         u->flags |= USER_FLAG_ALLCHANNELS;
+        std::unique_lock<std::mutex> lock(mutexACLCompile);
         listEmpty(u->channels);
+        ACLResetCompiledPatternsLocked(u);
     } else if (!strcasecmp(op,"resetchannels")) {
         u->flags &= ~USER_FLAG_ALLCHANNELS;
+        std::unique_lock<std::mutex> lock(mutexACLCompile);
         listEmpty(u->channels);
+        ACLResetCompiledPatternsLocked(u);
     } else if (!strcasecmp(op,"allcommands") ||
                !strcasecmp(op,"+@all"))
     {
@@ -928,12 +1015,14 @@ int ACLSetUser(user *u, const char *op, ssize_t oplen) {
             return C_ERR;
         }
         sds newpat = sdsnewlen(op+1,oplen-1);
+        std::unique_lock<std::mutex> lock(mutexACLCompile);
         listNode *ln = listSearchKey(u->patterns,newpat);
         /* Avoid re-adding the same key pattern multiple times. */
         if (ln == NULL)
             listAddNodeTail(u->patterns,newpat);
         else
             sdsfree(newpat);
+        ACLResetCompiledPatternsLocked(u);
         u->flags &= ~USER_FLAG_ALLKEYS;
     } else if (op[0] == '&') {
         if (u->flags & USER_FLAG_ALLCHANNELS) {
@@ -945,12 +1034,14 @@ int ACLSetUser(user *u, const char *op, ssize_t oplen) {
             return C_ERR;
         }
         sds newpat = sdsnewlen(op+1,oplen-1);
+        std::unique_lock<std::mutex> lock(mutexACLCompile);
         listNode *ln = listSearchKey(u->channels,newpat);
         /* Avoid re-adding the same channel pattern multiple times. */
         if (ln == NULL)
             listAddNodeTail(u->channels,newpat);
         else
             sdsfree(newpat);
+        ACLResetCompiledPatternsLocked(u);
         u->flags &= ~USER_FLAG_ALLCHANNELS;
     } else if (op[0] == '+' && op[1] != '@') {
         if (strchr(op,'|') == NULL) {
@@ -1227,25 +1318,12 @@ int ACLCheckCommandPerm(client *c, int *keyidxptr) {
         getKeysResult result = GETKEYS_RESULT_INIT;
         int numkeys = getKeysFromCommand(c->cmd,c->argv,c->argc,&result);
         int *keyidx = result.keys;
+        const aclMatcher *matcher = numkeys ?
+            ACLGetCompiledMatcher(&u->compiled_patterns,u->patterns) : NULL;
         for (int j = 0; j < numkeys; j++) {
-            listIter li;
-            listNode *ln;
-            listRewind(u->patterns,&li);
-
-            /* Test this key against every pattern. */
-            int match = 0;
-            while((ln = listNext(&li))) {
-                sds pattern = (sds)listNodeValue(ln);
-                size_t plen = sdslen(pattern);
-                int idx = keyidx[j];
-                if (stringmatchlen(pattern,plen,szFromObj(c->argv[idx]),
-                                   sdslen(szFromObj(c->argv[idx])),0))
-                {
-                    match = 1;
-                    break;
-                }
-            }
-            if (!match) {
+            /* Test this key against all the patterns at once. */
+            sds key = szFromObj(c->argv[keyidx[j]]);
+            if (!aclMatcherMatch(matcher,key,sdslen(key))) {
                 if (keyidxptr) *keyidxptr = keyidx[j];
                 getKeysFreeResult(&result);
                 return ACL_DENIED_KEY;
@@ -1357,9 +1435,14 @@ int ACLCheckPubsubPerm(client *c, int idx, int count, int literal, int *idxptr)
     /* Check if the user can access the channels mentioned in the command's
      * arguments. */
     if (!(c->user->flags & USER_FLAG_ALLCHANNELS)) {
+        const aclMatcher *matcher = literal ? NULL :
+            ACLGetCompiledMatcher(&u->compiled_channels,u->channels);
         for (int j = idx; j < idx+count; j++) {
-            if (ACLCheckPubsubChannelPerm(szFromObj(c->argv[j]),u->channels,literal)
-                != ACL_OK) {
+            sds channel = szFromObj(c->argv[j]);
+            int allowed = literal ?
+                ACLCheckPubsubChannelPerm(channel,u->channels,1) == ACL_OK :
+                aclMatcherMatch(matcher,channel,sdslen(channel));
+            if (!allowed) {
                 if (idxptr) *idxptr = j;
                 return ACL_DENIED_CHANNEL;
             }
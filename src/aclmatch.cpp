@@ -0,0 +1,303 @@
+/* Compiled ACL pattern matcher, see aclmatch.h.
+ *
+ * Patterns are first parsed into atoms the same way stringmatchlen() walks
+ * them: '*' (consecutive stars collapse into one), or a set of bytes that
+ * consumes exactly one character ('?', '[...]', an escaped or plain literal).
+ * For a non empty string, stringmatchlen() then behaves as a plain glob over
+ * these atoms: the '*' branch never tries the empty suffix, but what follows
+ * a star always consumes at least one byte, so nothing is lost. An empty
+ * string is special: it only matches an empty pattern, not even "*". */
+
+#include "aclmatch.h"
+#include "util.h"
+#include <string.h>
+#include <algorithm>
+#include <bitset>
+#include <map>
+#include <string>
+#include <vector>
+
+struct aclAtom {
+    bool star = false;
+    std::bitset<256> set;       /* Bytes a non star atom consumes */
+};
+
+struct aclTrieNode {
+    bool exact = false;         /* A literal pattern ends here */
+    bool prefix = false;        /* A "<literal>*" pattern ends here */
+    std::string labels;         /* Byte of the edge to each child */
+    std::vector<unsigned> children;
+};
+
+struct aclMatcher {
+    std::vector<std::string> patterns;
+
+    /* Literal and literal prefix patterns */
+    std::vector<aclTrieNode> trie {1};
+
+    /* Glob patterns as a DFA over byte classes. State 0 is the dead state. */
+    unsigned char classOf[256];
+    unsigned nclasses = 0;
+    unsigned start = 0;
+    std::vector<int> trans;             /* state*nclasses + class -> state */
+    std::vector<unsigned char> accept;  /* The string so far matches */
+    std::vector<unsigned char> sink;    /* ...and so does any continuation */
+
+    /* Glob patterns left to stringmatchlen() when the DFA got too big */
+    std::vector<std::string> fallback;
+};
+
+/* Mirrors the pattern walk of stringmatchlen() with nocase=0. */
+static std::vector<aclAtom> aclParsePattern(const char *pattern, int patternLen) {
+    std::vector<aclAtom> atoms;
+    while (patternLen) {
+        aclAtom atom;
+        switch (pattern[0]) {
+        case '*':
+            atom.star = true;
+            break;
+        case '?':
+            atom.set.set();
+            break;
+        case '[':
+        {
+            pattern++;
+            patternLen--;
+            bool negate = patternLen && pattern[0] == '^';
+            if (negate) {
+                pattern++;
+                patternLen--;
+            }
+            while (1) {
+                if (patternLen == 0) {
+                    pattern--;
+                    patternLen++;
+                    break;
+                } else if (pattern[0] == '\\' && patternLen >= 2) {
+                    pattern++;
+                    patternLen--;
+                    atom.set.set((unsigned char)pattern[0]);
+                } else if (pattern[0] == ']') {
+                    break;
+                } else if (patternLen >= 3 && pattern[1] == '-') {
+                    /* stringmatchlen() compares plain (signed) chars */
+                    int start = pattern[0];
+                    int end = pattern[2];
+                    if (start > end) std::swap(start,end);
+                    for (int b = 0; b < 256; b++) {
+                        int c = (char)b;
+                        if (c >= start && c <= end) atom.set.set(b);
+                    }
+                    pattern += 2;
+                    patternLen -= 2;
+                } else {
+                    atom.set.set((unsigned char)pattern[0]);
+                }
+                pattern++;
+                patternLen--;
+            }
+            if (negate) atom.set.flip();
+            break;
+        }
+        case '\\':
+            if (patternLen >= 2) {
+                pattern++;
+                patternLen--;
+            }
+            /* fall through */
+        default:
+            atom.set.set((unsigned char)pattern[0]);
+            break;
+        }
+        pattern++;
+        patternLen--;
+        if (!(atom.star && !atoms.empty() && atoms.back().star))
+            atoms.push_back(atom);
+    }
+    return atoms;
+}
+
+aclMatcher *aclMatcherCreate(void) {
+    return new aclMatcher;
+}
+
+void aclMatcherFree(aclMatcher *m) {
+    delete m;
+}
+
+void aclMatcherAddPattern(aclMatcher *m, const char *pattern, size_t len) {
+    m->patterns.emplace_back(pattern,len);
+}
+
+static void aclTrieInsert(aclMatcher *m, const std::vector<aclAtom> &atoms, size_t nliteral, bool prefix) {
+    unsigned node = 0;
+    for (size_t j = 0; j < nliteral; j++) {
+        char label = 0;
+        for (int b = 0; b < 256; b++) {
+            if (atoms[j].set.test(b)) { label = (char)b; break; }
+        }
+        size_t idx = m->trie[node].labels.find(label);
+        if (idx == std::string::npos) {
+            m->trie[node].labels.push_back(label);
+            m->trie[node].children.push_back(m->trie.size());
+            m->trie.emplace_back();
+            node = m->trie.size()-1;
+        } else {
+            node = m->trie[node].children[idx];
+        }
+    }
+    if (prefix) m->trie[node].prefix = true;
+    else m->trie[node].exact = true;
+}
+
+/* Subset construction. NFA position p means "the atoms before p matched",
+ * every pattern has one position per atom plus a final accepting one. */
+static bool aclBuildDfa(aclMatcher *m, const std::vector<std::vector<aclAtom>> &globs) {
+    std::vector<const aclAtom*> atomAt;     /* nullptr: accepting position */
+    std::vector<unsigned> starts;
+    for (auto &atoms : globs) {
+        starts.push_back(atomAt.size());
+        for (auto &atom : atoms) atomAt.push_back(&atom);
+        atomAt.push_back(nullptr);
+    }
+
+    /* Bytes no pattern tells apart share a class */
+    memset(m->classOf,0,sizeof(m->classOf));
+    m->nclasses = 1;
+    for (const aclAtom *atom : atomAt) {
+        if (atom == nullptr || atom->star) continue;
+        std::vector<int> split(m->nclasses*2, -1);
+        unsigned nclasses = 0;
+        for (int b = 0; b < 256; b++) {
+            int &id = split[m->classOf[b]*2 + atom->set.test(b)];
+            if (id < 0) id = nclasses++;
+            m->classOf[b] = id;
+        }
+        m->nclasses = nclasses;
+    }
+    unsigned char representative[256];
+    for (int b = 255; b >= 0; b--) representative[m->classOf[b]] = b;
+
+    auto closure = [&](std::vector<unsigned> &set) {
+        for (size_t j = 0; j < set.size(); j++) {
+            unsigned p = set[j];
+            if (atomAt[p] && atomAt[p]->star) set.push_back(p+1);
+        }
+        std::sort(set.begin(),set.end());
+        set.erase(std::unique(set.begin(),set.end()),set.end());
+    };
+
+    std::map<std::vector<unsigned>,int> ids;
+    std::vector<std::vector<unsigned>> states;
+    auto intern = [&](std::vector<unsigned> &&set) -> int {
+        auto itr = ids.find(set);
+        if (itr != ids.end()) return itr->second;
+        int id = states.size();
+        ids.emplace(set,id);
+        bool accept = false, sink = false;
+        for (unsigned p : set) {
+            if (atomAt[p] == nullptr) accept = true;
+            else if (atomAt[p]->star && atomAt[p+1] == nullptr) sink = true;
+        }
+        m->accept.push_back(accept);
+        m->sink.push_back(sink);
+        states.push_back(std::move(set));
+        return id;
+    };
+
+    intern(std::vector<unsigned>());    /* Dead state */
+    std::vector<unsigned> startSet(starts);
+    closure(startSet);
+    m->start = intern(std::move(startSet));
+
+    for (size_t s = 1; s < states.size(); s++) {
+        if (states.size() > ACLMATCH_MAX_DFA_STATES) return false;
+        m->trans.resize(states.size()*m->nclasses, 0);
+        for (unsigned cls = 0; cls < m->nclasses; cls++) {
+            unsigned char b = representative[cls];
+            std::vector<unsigned> next;
+            for (unsigned p : states[s]) {
+                const aclAtom *atom = atomAt[p];
+                if (atom == nullptr) continue;
+                if (atom->star) next.push_back(p);
+                else if (atom->set.test(b)) next.push_back(p+1);
+            }
+            closure(next);
+            int t = intern(std::move(next));
+            m->trans[s*m->nclasses + cls] = t;
+        }
+    }
+    m->trans.resize(states.size()*m->nclasses, 0);
+    return true;
+}
+
+void aclMatcherCompile(aclMatcher *m) {
+    m->trie.assign(1, aclTrieNode());
+    m->trans.clear();
+    m->accept.clear();
+    m->sink.clear();
+    m->fallback.clear();
+    m->start = 0;
+
+    std::vector<std::vector<aclAtom>> globs;
+    std::vector<const std::string*> globPatterns;
+    for (auto &pattern : m->patterns) {
+        std::vector<aclAtom> atoms = aclParsePattern(pattern.c_str(),pattern.size());
+        size_t nliteral = 0;
+        while (nliteral < atoms.size() && !atoms[nliteral].star && atoms[nliteral].set.count() == 1)
+            nliteral++;
+        if (nliteral == atoms.size()) {
+            aclTrieInsert(m,atoms,nliteral,false);
+        } else if (nliteral == atoms.size()-1 && atoms.back().star) {
+            aclTrieInsert(m,atoms,nliteral,true);
+        } else {
+            globs.push_back(std::move(atoms));
+            globPatterns.push_back(&pattern);
+        }
+    }
+    if (!globs.empty() && !aclBuildDfa(m,globs)) {
+        m->trans.clear();
+        m->accept.clear();
+        m->sink.clear();
+        m->start = 0;
+        for (auto pattern : globPatterns) m->fallback.push_back(*pattern);
+    }
+}
+
+int aclMatcherMatch(const aclMatcher *m, const char *s, size_t len) {
+    if (len == 0) return m->trie[0].exact;
+
+    /* Literal and prefix patterns */
+    unsigned node = 0;
+    size_t j = 0;
+    for (; j < len; j++) {
+        const aclTrieNode &n = m->trie[node];
+        if (n.prefix) return 1;
+        const void *label = memchr(n.labels.data(),s[j],n.labels.size());
+        if (label == nullptr) break;
+        node = n.children[(const char*)label - n.labels.data()];
+    }
+    if (j == len && (m->trie[node].exact || m->trie[node].prefix)) return 1;
+
+    /* Glob patterns */
+    if (m->start != 0) {
+        unsigned state = m->start;
+        for (j = 0; j < len && !m->sink[state]; j++) {
+            state = m->trans[state*m->nclasses + m->classOf[(unsigned char)s[j]]];
+            if (state == 0) break;
+        }
+        if (m->accept[state] || m->sink[state]) return 1;
+    }
+    for (auto &pattern : m->fallback) {
+        if (stringmatchlen(pattern.c_str(),pattern.size(),s,len,0)) return 1;
+    }
+    return 0;
+}
+
+size_t aclMatcherDfaStates(const aclMatcher *m) {
+    return m->accept.size();
+}
+
+size_t aclMatcherFallbackPatterns(const aclMatcher *m) {
+    return m->fallback.size();
+}
@@ -0,0 +1,41 @@
+/* Compiled matcher for the key and channel patterns of an ACL user.
+ *
+ * ACLCheckCommandPerm() used to test every key of a command against every
+ * pattern of the user with stringmatchlen(). An aclMatcher instead compiles
+ * all the patterns of a user into:
+ *
+ *   - a trie of the literal patterns ("user:1000") and of the patterns that
+ *     are a literal prefix followed by stars only ("tenant:42:*"), which is
+ *     what most key patterns look like, walked once per key;
+ *   - a DFA of the remaining glob patterns ('?', '[...]', inner stars), built
+ *     by subset construction over the byte classes the patterns distinguish.
+ *     When the DFA would get too large those patterns are matched one by one
+ *     with stringmatchlen() instead.
+ *
+ * aclMatcherMatch() gives exactly the result stringmatchlen() (nocase=0) gives
+ * for at least one of the patterns, including its corner cases: an empty
+ * string only matches an empty pattern, ranges compare signed chars, and an
+ * unterminated '[' class extends to the end of the pattern.
+ *
+ * A compiled matcher is immutable, so any number of threads can use it. */
+
+#ifndef __ACLMATCH_H
+#define __ACLMATCH_H
+
+#include <stddef.h>
+
+#define ACLMATCH_MAX_DFA_STATES 1024
+
+typedef struct aclMatcher aclMatcher;
+
+aclMatcher *aclMatcherCreate(void);
+void aclMatcherAddPattern(aclMatcher *m, const char *pattern, size_t len);
+void aclMatcherCompile(aclMatcher *m);
+int aclMatcherMatch(const aclMatcher *m, const char *s, size_t len);
+void aclMatcherFree(aclMatcher *m);
+
+/* Introspection, for tests and benchmarks. */
+size_t aclMatcherDfaStates(const aclMatcher *m);
+size_t aclMatcherFallbackPatterns(const aclMatcher *m);
+
+#endif /* __ACLMATCH_H */
@@ -37,6 +37,7 @@
 #include <condition_variable>
 #include <atomic>
 #include <mutex>
+#include <algorithm>
 #include <stdio.h>
 #include <fcntl.h>
 #include <sys/time.h>
@@ -91,6 +92,291 @@ fastlock g_lock("AE (global)");
 readWriteLock g_forkLock("Fork (global)");
 thread_local aeEventLoop *g_eventLoopThisThread = NULL;
 
+/* ---------------------------- Global lock profiler ---------------------------
+ * Every acquisition of g_lock is attributed to its call site (the caller of
+ * aeAcquireLock(), aeTryAcquireLock() or AeLocker::arm()). Sites get a dense
+ * id the first time they are seen, and each thread accumulates the wait and
+ * hold times of its acquisitions in its own table indexed by that id, so the
+ * hot path only writes thread local memory. aeLockProfileReport() merges the
+ * tables on demand. Only the outermost acquisition of a thread is profiled,
+ * recursive ones are part of its hold time. Tables stay registered when their
+ * thread exits, with its samples, and are handed to the next new thread, so
+ * short lived threads don't use up the AE_LOCK_MAX_THREADS slots. */
+
+#define AE_LOCK_MAX_SITES 192           /* Distinct sites, the rest share the last slot */
+#define AE_LOCK_SITE_TABLE 512          /* Must be a power of two > AE_LOCK_MAX_SITES */
+#define AE_LOCK_MAX_THREADS 256
+
+struct aeLockSite {
+    std::atomic<const char*> file {nullptr};
+    int line = 0;
+    const char *func = nullptr;
+    int id = 0;
+};
+
+struct aeLockSiteStats {
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t wait_us, wait_max_us;
+    uint64_t hold_us, hold_max_us;
+    uint32_t wait_hist[AE_HIST_BUCKETS];
+    uint32_t hold_hist[AE_HIST_BUCKETS];
+};
+
+struct aeLockThreadStats {
+    std::atomic<uint64_t> epoch;        /* Stale tables are cleared by their owner */
+    aeLockThreadStats *next_free;       /* Free list link, once the owner exited */
+    aeLockSiteStats rgsite[AE_LOCK_MAX_SITES+1];
+};
+
+static aeLockSite g_rglockSiteTable[AE_LOCK_SITE_TABLE];
+static aeLockSite *g_rglockSiteById[AE_LOCK_MAX_SITES];
+static std::atomic<int> g_clockSites {0};
+static std::mutex g_lockSiteMutex;
+static aeLockThreadStats *g_rglockThreadStats[AE_LOCK_MAX_THREADS];
+static std::atomic<int> g_clockThreadStats {0};
+static std::atomic<uint64_t> g_lockProfileEpoch {0};
+static aeLockThreadStats *g_plockThreadStatsFree = nullptr;    /* Protected by g_lockSiteMutex */
+
+static thread_local aeLockThreadStats *tl_lockStats = nullptr;
+static thread_local bool tl_fLockStatsFull = false;  /* Too many threads, this one isn't profiled */
+static thread_local int tl_lockDepth = 0;
+static thread_local int tl_lockSite = AE_LOCK_MAX_SITES;
+static thread_local monotime tl_lockAcquired = 0;
+
+/* Gives the table of an exiting thread back for reuse */
+struct aeLockThreadStatsOwner {
+    ~aeLockThreadStatsOwner() {
+        if (tl_lockStats == nullptr) return;
+        std::lock_guard<std::mutex> guard(g_lockSiteMutex);
+        tl_lockStats->next_free = g_plockThreadStatsFree;
+        g_plockThreadStatsFree = tl_lockStats;
+        tl_lockStats = nullptr;
+        tl_fLockStatsFull = true;   /* Acquisitions later in the thread's exit aren't profiled */
+    }
+};
+
+/* The lock is taken before monotonicInit() during startup */
+static inline monotime aeLockProfileNow() {
+    return getMonotonicUs != nullptr ? getMonotonicUs() : 0;
+}
+
+static int aeLockSiteId(const char *file, int line, const char *func) {
+    unsigned h = ((unsigned)((uintptr_t)file >> 3) * 2654435761u) ^ ((unsigned)line * 40503u);
+    for (int probe = 0; probe < AE_LOCK_SITE_TABLE; ++probe) {
+        aeLockSite &site = g_rglockSiteTable[(h + probe) & (AE_LOCK_SITE_TABLE-1)];
+        const char *fileT = site.file.load(std::memory_order_acquire);
+        if (fileT == nullptr) {
+            std::lock_guard<std::mutex> guard(g_lockSiteMutex);
+            fileT = site.file.load(std::memory_order_relaxed);
+            if (fileT == nullptr) {
+                int id = g_clockSites.load(std::memory_order_relaxed);
+                if (id >= AE_LOCK_MAX_SITES) return AE_LOCK_MAX_SITES;
+                site.line = line;
+                site.func = func;
+                site.id = id;
+                site.file.store(file, std::memory_order_release);
+                g_rglockSiteById[id] = &site;
+                g_clockSites.store(id+1, std::memory_order_release);
+                return id;
+            }
+        }
+        /* The same header may be compiled in several units with distinct
+         * copies of its file name. */
+        if (site.line == line && (fileT == file || !strcmp(fileT, file)))
+            return site.id;
+    }
+    return AE_LOCK_MAX_SITES;
+}
+
+static aeLockSiteStats *aeLockSiteStatsThisThread(int site) {
+    if (tl_lockStats == nullptr) {
+        if (tl_fLockStatsFull) return nullptr;
+        {
+            std::lock_guard<std::mutex> guard(g_lockSiteMutex);
+            tl_lockStats = g_plockThreadStatsFree;
+            if (tl_lockStats != nullptr)
+                g_plockThreadStatsFree = tl_lockStats->next_free;
+        }
+        if (tl_lockStats == nullptr) {
+            int idx = g_clockThreadStats.fetch_add(1, std::memory_order_relaxed);
+            if (idx >= AE_LOCK_MAX_THREADS) {
+                tl_fLockStatsFull = true;
+                return nullptr;
+            }
+            tl_lockStats = (aeLockThreadStats*)zcalloc(sizeof(aeLockThreadStats), MALLOC_LOCAL);
+            tl_lockStats->epoch.store(g_lockProfileEpoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            __atomic_store_n(&g_rglockThreadStats[idx], tl_lockStats, __ATOMIC_RELEASE);
+        }
+        static thread_local aeLockThreadStatsOwner owner;
+        (void)owner;
+    }
+    uint64_t epoch = g_lockProfileEpoch.load(std::memory_order_relaxed);
+    if (tl_lockStats->epoch.load(std::memory_order_relaxed) != epoch) {
+        memset(tl_lockStats->rgsite, 0, sizeof(tl_lockStats->rgsite));
+        tl_lockStats->epoch.store(epoch, std::memory_order_release);
+    }
+    return &tl_lockStats->rgsite[site];
+}
+
+static void aeLockProfileAcquired(int site, monotime waitStart) {
+    monotime now = aeLockProfileNow();
+    tl_lockSite = site;
+    tl_lockAcquired = now;
+    aeLockSiteStats *stats = aeLockSiteStatsThisThread(site);
+    if (stats == nullptr) return;
+    uint64_t wait = now - waitStart;
+    stats->acquisitions++;
+    if (wait > 0) stats->contended++;
+    stats->wait_us += wait;
+    if (wait > stats->wait_max_us) stats->wait_max_us = wait;
+    stats->wait_hist[aeHistBucket(wait)]++;
+}
+
+static void aeLockProfileReleasing() {
+    if (tl_lockAcquired == 0) return;   /* Taken before the clock was initialized */
+    aeLockSiteStats *stats = aeLockSiteStatsThisThread(tl_lockSite);
+    if (stats == nullptr) return;
+    uint64_t hold = aeLockProfileNow() - tl_lockAcquired;
+    stats->hold_us += hold;
+    if (hold > stats->hold_max_us) stats->hold_max_us = hold;
+    stats->hold_hist[aeHistBucket(hold)]++;
+}
+
+static inline void aeGlobalLockAcquire(spin_worker worker, const char *file, int line, const char *func) {
+    if (tl_lockDepth++ > 0) {
+        g_lock.lock(worker);
+        return;
+    }
+    monotime waitStart = aeLockProfileNow();
+    g_lock.lock(worker);
+    aeLockProfileAcquired(aeLockSiteId(file, line, func), waitStart);
+}
+
+static inline bool aeGlobalLockTryAcquire(bool fWeak, const char *file, int line, const char *func) {
+    if (!g_lock.try_lock(fWeak))
+        return false;
+    if (tl_lockDepth++ == 0)
+        aeLockProfileAcquired(aeLockSiteId(file, line, func), aeLockProfileNow());
+    return true;
+}
+
+static inline void aeGlobalLockRelease() {
+    if (tl_lockDepth > 0 && --tl_lockDepth == 0)
+        aeLockProfileReleasing();
+    g_lock.unlock();
+}
+
+/* Like std::unique_lock<decltype(g_lock)> with std::defer_lock, but profiled
+ * under the location of each lock() call. */
+class aeGlobalLockGuard {
+    bool m_fOwns = false;
+public:
+    aeGlobalLockGuard() = default;
+    aeGlobalLockGuard(const aeGlobalLockGuard &) = delete;
+    ~aeGlobalLockGuard() {
+        if (m_fOwns)
+            unlock();
+    }
+
+    void lock(const char *file = __builtin_FILE(), int line = __builtin_LINE(), const char *func = __builtin_FUNCTION()) {
+        aeGlobalLockAcquire(nullptr, file, line, func);
+        m_fOwns = true;
+    }
+
+    void unlock() {
+        aeGlobalLockRelease();
+        m_fOwns = false;
+    }
+
+    bool owns_lock() const { return m_fOwns; }
+};
+
+int aeLockProfileReport(aeLockSiteReport **preports) {
+    int csites = g_clockSites.load(std::memory_order_acquire);
+    aeLockSiteReport *rgreport = (aeLockSiteReport*)zcalloc(sizeof(aeLockSiteReport)*(AE_LOCK_MAX_SITES+1), MALLOC_LOCAL);
+    for (int id = 0; id < csites; ++id) {
+        rgreport[id].file = g_rglockSiteById[id]->file.load(std::memory_order_acquire);
+        rgreport[id].func = g_rglockSiteById[id]->func;
+        rgreport[id].line = g_rglockSiteById[id]->line;
+    }
+    rgreport[AE_LOCK_MAX_SITES].file = "(other)";
+    rgreport[AE_LOCK_MAX_SITES].func = "(other)";
+
+    /* The owners update their tables while we read them, a report may be
+     * off by the acquisitions in flight. */
+    uint64_t epoch = g_lockProfileEpoch.load(std::memory_order_relaxed);
+    int cthreads = std::min(g_clockThreadStats.load(std::memory_order_relaxed), AE_LOCK_MAX_THREADS);
+    for (int ithread = 0; ithread < cthreads; ++ithread) {
+        aeLockThreadStats *tstats = __atomic_load_n(&g_rglockThreadStats[ithread], __ATOMIC_ACQUIRE);
+        if (tstats == nullptr || tstats->epoch.load(std::memory_order_acquire) != epoch)
+            continue;
+        for (int id = 0; id <= AE_LOCK_MAX_SITES; ++id) {
+            const aeLockSiteStats &stats = tstats->rgsite[id];
+            if (stats.acquisitions == 0) continue;
+            aeLockSiteReport &report = rgreport[id];
+            report.threads++;
+            report.acquisitions += stats.acquisitions;
+            report.contended += stats.contended;
+            report.wait_us += stats.wait_us;
+            report.hold_us += stats.hold_us;
+            report.wait_max_us = std::max<unsigned long long>(report.wait_max_us, stats.wait_max_us);
+            report.hold_max_us = std::max<unsigned long long>(report.hold_max_us, stats.hold_max_us);
+            for (int bucket = 0; bucket < AE_HIST_BUCKETS; ++bucket) {
+                report.wait_hist[bucket] += stats.wait_hist[bucket];
+                report.hold_hist[bucket] += stats.hold_hist[bucket];
+            }
+        }
+    }
+
+    /* Compact away the sites with no samples */
+    int creport = 0;
+    for (int id = 0; id <= AE_LOCK_MAX_SITES; ++id) {
+        if (rgreport[id].acquisitions == 0) continue;
+        if (creport != id) rgreport[creport] = rgreport[id];
+        creport++;
+    }
+    *preports = rgreport;
+    return creport;
+}
+
+/* Acquisitions of all sites since the last reset, without building a report. */
+unsigned long long aeLockProfileAcquisitions(void) {
+    unsigned long long acquisitions = 0;
+    uint64_t epoch = g_lockProfileEpoch.load(std::memory_order_relaxed);
+    int cthreads = std::min(g_clockThreadStats.load(std::memory_order_relaxed), AE_LOCK_MAX_THREADS);
+    for (int ithread = 0; ithread < cthreads; ++ithread) {
+        aeLockThreadStats *tstats = __atomic_load_n(&g_rglockThreadStats[ithread], __ATOMIC_ACQUIRE);
+        if (tstats == nullptr || tstats->epoch.load(std::memory_order_acquire) != epoch)
+            continue;
+        for (int id = 0; id <= AE_LOCK_MAX_SITES; ++id)
+            acquisitions += tstats->rgsite[id].acquisitions;
+    }
+    return acquisitions;
+}
+
+/* Upper bound (usec) of the bucket holding the given percentile. */
+unsigned long long aeHistPercentile(const unsigned long long *hist, double percentile) {
+    unsigned long long total = 0;
+    for (int bucket = 0; bucket < AE_HIST_BUCKETS; ++bucket)
+        total += hist[bucket];
+    if (total == 0) return 0;
+    unsigned long long target = (unsigned long long)(total * percentile / 100.0);
+    if (target == 0) target = 1;
+    unsigned long long cumulative = 0;
+    for (int bucket = 0; bucket < AE_HIST_BUCKETS; ++bucket) {
+        cumulative += hist[bucket];
+        if (cumulative >= target)
+            return bucket == 0 ? 0 : (1ULL << bucket) - 1;
+    }
+    return (1ULL << (AE_HIST_BUCKETS-1)) - 1;
+}
+
+/* Each thread clears its own table the next time it takes the lock. */
+void aeLockProfileReset(void) {
+    g_lockProfileEpoch.fetch_add(1, std::memory_order_relaxed);
+}
+
 /* Include the best multiplexing layer supported by this system.
  * The following should be ordered by performances, descending. */
 #ifdef HAVE_EVPORT
@@ -138,7 +424,7 @@ static_assert(sizeof(aeCommand) <= PIPE_BUF, "aeCommand must be small enough to
 
 void aeProcessCmd(aeEventLoop *eventLoop, int fd, void *, int )
 {
-    std::unique_lock<decltype(g_lock)> ulock(g_lock, std::defer_lock);
+    aeGlobalLockGuard ulock;
     aeCommand cmd;
     for (;;)
     {
@@ -351,6 +637,7 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     eventLoop->maxfd = -1;
     eventLoop->beforesleep = NULL;
     eventLoop->aftersleep = NULL;
+    eventLoop->loopphase = NULL;
     eventLoop->flags = 0;
     if (aeApiCreate(eventLoop) == -1) goto err;
     /* Events with mask == AE_NONE are not set. So let's initialize the
@@ -580,7 +867,7 @@ static int64_t usUntilEarliestTimer(aeEventLoop *eventLoop) {
 
 /* Process time events */
 static int processTimeEvents(aeEventLoop *eventLoop) {
-    std::unique_lock<decltype(g_lock)> ulock(g_lock, std::defer_lock);
+    aeGlobalLockGuard ulock;
     int processed = 0;
     aeTimeEvent *te;
     long long maxId;
@@ -659,7 +946,7 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
 extern "C" void ProcessEventCore(aeEventLoop *eventLoop, aeFileEvent *fe, int mask, int fd)
 {
 #define LOCK_IF_NECESSARY(fe, tsmask) \
-    std::unique_lock<decltype(g_lock)> ulock(g_lock, std::defer_lock); \
+    aeGlobalLockGuard ulock; \
     if (!(fe->mask & tsmask)) { \
         g_forkLock.releaseRead(); \
         ulock.lock(); \
@@ -716,6 +1003,13 @@ extern "C" void ProcessEventCore(aeEventLoop *eventLoop, aeFileEvent *fe, int ma
 #undef LOCK_IF_NECESSARY
 }
 
+static inline void aeLoopPhaseEnd(aeEventLoop *eventLoop, int phase, monotime *start) {
+    if (eventLoop->loopphase == NULL) return;
+    monotime now = getMonotonicUs();
+    eventLoop->loopphase(eventLoop, phase, now - *start);
+    *start = now;
+}
+
 /* Process every pending time event, then every pending file event
  * (that may be registered by time event callbacks just processed).
  * Without special flags the function sleeps until some file event
@@ -739,6 +1033,8 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
     /* Nothing to do? return ASAP */
     if (!(flags & AE_TIME_EVENTS) && !(flags & AE_FILE_EVENTS)) return 0;
 
+    monotime mtimePhase = eventLoop->loopphase ? getMonotonicUs() : 0;
+
     /* Note that we want to call select() even if there are no
      * file events to process as long as we want to process time
      * events, in order to sleep until the next time event is ready
@@ -770,13 +1066,14 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
         }
 
         if (eventLoop->beforesleep != NULL && flags & AE_CALL_BEFORE_SLEEP) {
-            std::unique_lock<decltype(g_lock)> ulock(g_lock, std::defer_lock);
+            aeGlobalLockGuard ulock;
             if (!(eventLoop->beforesleepFlags & AE_SLEEP_THREADSAFE)) {
                 g_forkLock.releaseRead();
                 ulock.lock();
                 g_forkLock.acquireRead();
             }
             eventLoop->beforesleep(eventLoop);
+            aeLoopPhaseEnd(eventLoop, AE_PHASE_BEFORE_SLEEP, &mtimePhase);
         }
 
         if (eventLoop->flags & AE_DONT_WAIT) {
@@ -787,16 +1084,18 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
         /* Call the multiplexing API, will return only on timeout or when
          * some event fires. */
         numevents = aeApiPoll(eventLoop, tvp);
+        aeLoopPhaseEnd(eventLoop, AE_PHASE_POLL, &mtimePhase);
 
         /* After sleep callback. */
         if (eventLoop->aftersleep != NULL && flags & AE_CALL_AFTER_SLEEP) {
-            std::unique_lock<decltype(g_lock)> ulock(g_lock, std::defer_lock);
+            aeGlobalLockGuard ulock;
             if (!(eventLoop->aftersleepFlags & AE_SLEEP_THREADSAFE)) {
                 g_forkLock.releaseRead();
                 ulock.lock();
                 g_forkLock.acquireRead();
             }
             eventLoop->aftersleep(eventLoop);
+            aeLoopPhaseEnd(eventLoop, AE_PHASE_AFTER_SLEEP, &mtimePhase);
         }
 
         for (j = 0; j < numevents; j++) {
@@ -808,15 +1107,53 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
 
             processed++;
         }
+        if (numevents > 0)
+            aeLoopPhaseEnd(eventLoop, AE_PHASE_FILE_EVENTS, &mtimePhase);
     }
     /* Check time events */
-    if (flags & AE_TIME_EVENTS)
+    if (flags & AE_TIME_EVENTS) {
         processed += processTimeEvents(eventLoop);
+        aeLoopPhaseEnd(eventLoop, AE_PHASE_TIME_EVENTS, &mtimePhase);
+    }
 
     eventLoop->cevents += processed;
     return processed; /* return the number of processed file/time events */
 }
 
+/* Poll without blocking and fire only the file events whose handlers are
+ * thread safe, i.e. can run without the global lock. Everything else (handlers
+ * that need the lock, AE_BARRIER events and posted functions) is left alone:
+ * the poll is level triggered so those fire again on the next regular
+ * iteration. This lets a thread keep doing socket I/O while it waits for the
+ * global lock. It reuses the fired array, so it must not be called from
+ * inside the dispatch loop of aeProcessEvents (a thread safe beforesleep
+ * callback is fine, it runs before the poll).
+ *
+ * The function returns the number of events processed. */
+int aeProcessThreadSafeFileEvents(aeEventLoop *eventLoop)
+{
+    serverAssert(g_eventLoopThisThread == NULL || g_eventLoopThisThread == eventLoop);
+    if (eventLoop->maxfd == -1) return 0;
+
+    struct timeval tv = {0, 0};
+    int numevents = aeApiPoll(eventLoop, &tv);
+    int processed = 0;
+    for (int j = 0; j < numevents; j++) {
+        int fd = eventLoop->fired[j].fd;
+        int mask = eventLoop->fired[j].mask;
+        aeFileEvent *fe = &eventLoop->events[fd];
+
+        if (fd == eventLoop->fdCmdRead || (fe->mask & AE_BARRIER)) continue;
+        if ((fe->mask & mask & AE_READABLE) && !(fe->mask & AE_READ_THREADSAFE)) continue;
+        if ((fe->mask & mask & AE_WRITABLE) && !(fe->mask & AE_WRITE_THREADSAFE)) continue;
+
+        ProcessEventCore(eventLoop, fe, mask, fd);
+        processed++;
+    }
+    eventLoop->cevents += processed;
+    return processed;
+}
+
 /* Wait for milliseconds until the given file descriptor becomes
  * writable/readable/exception */
 int aeWait(int fd, int mask, long long milliseconds) {
@@ -863,6 +1200,11 @@ void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep,
     eventLoop->aftersleepFlags = flags;
 }
 
+/* 'loopphase' is called with the duration of each part of every iteration */
+void aeSetLoopPhaseProc(aeEventLoop *eventLoop, aeLoopPhaseProc *loopphase) {
+    eventLoop->loopphase = loopphase;
+}
+
 thread_local spin_worker tl_worker = nullptr;
 thread_local bool fOwnLockOverride = false;
 void setAeLockSetThreadSpinWorker(spin_worker worker)
@@ -875,10 +1217,10 @@ void aeThreadOnline()
     g_forkLock.acquireRead();
 }
 
-void aeAcquireLock()
+void aeAcquireLock(const char *file, int line, const char *func)
 {
     g_forkLock.releaseRead();
-    g_lock.lock(tl_worker);
+    aeGlobalLockAcquire(tl_worker, file, line, func);
     g_forkLock.acquireRead();
 }
 
@@ -887,9 +1229,9 @@ void aeAcquireForkLock()
     g_forkLock.upgradeWrite();
 }
 
-int aeTryAcquireLock(int fWeak)
+int aeTryAcquireLock(int fWeak, const char *file, int line, const char *func)
 {
-    return g_lock.try_lock(!!fWeak);
+    return aeGlobalLockTryAcquire(!!fWeak, file, line, func);
 }
 
 /**
@@ -907,7 +1249,7 @@ void aeThreadOffline()
 
 void aeReleaseLock()
 {
-    g_lock.unlock();
+    aeGlobalLockRelease();
 }
 
 void aeSetThreadOwnsLockOverride(int fOverride)
@@ -110,6 +110,15 @@ typedef struct aeFiredEvent {
 } aeFiredEvent;
 
 /* State of an event based program */
+/* Parts of an event loop iteration reported to the loop phase callback */
+#define AE_PHASE_BEFORE_SLEEP 0
+#define AE_PHASE_POLL 1
+#define AE_PHASE_AFTER_SLEEP 2
+#define AE_PHASE_FILE_EVENTS 3
+#define AE_PHASE_TIME_EVENTS 4
+#define AE_PHASE_COUNT 5
+typedef void aeLoopPhaseProc(struct aeEventLoop *eventLoop, int phase, monotime us);
+
 typedef struct aeEventLoop {
     int maxfd;   /* highest file descriptor currently registered */
     int setsize; /* max number of file descriptors tracked */
@@ -123,6 +132,7 @@ typedef struct aeEventLoop {
     int beforesleepFlags;
     aeBeforeSleepProc *aftersleep;
     int aftersleepFlags;
+    aeLoopPhaseProc *loopphase;
     struct fastlock flock;
     int fdCmdWrite;
     int fdCmdRead;
@@ -156,11 +166,13 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeEventFinalizerProc *finalizerProc);
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id);
 int aeProcessEvents(aeEventLoop *eventLoop, int flags);
+int aeProcessThreadSafeFileEvents(aeEventLoop *eventLoop);
 int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
 const char *aeGetApiName(void);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep, int flags);
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep, int flags);
+void aeSetLoopPhaseProc(aeEventLoop *eventLoop, aeLoopPhaseProc *loopphase);
 int aeGetSetSize(aeEventLoop *eventLoop);
 aeEventLoop *aeGetCurrentEventLoop();
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
@@ -169,9 +181,19 @@ void aeClosePipesForForkChild(aeEventLoop *eventLoop);
 
 void setAeLockSetThreadSpinWorker(spin_worker worker);
 void aeThreadOnline();
-void aeAcquireLock();
+/* The global lock functions take the caller's location so the lock profiler
+ * can attribute wait and hold times to it, C++ callers get it for free. */
+#ifdef __cplusplus
+void aeAcquireLock(const char *file = __builtin_FILE(), int line = __builtin_LINE(), const char *func = __builtin_FUNCTION());
+#else
+void aeAcquireLock(const char *file, int line, const char *func);
+#endif
 void aeAcquireForkLock();
-int aeTryAcquireLock(int fWeak);
+#ifdef __cplusplus
+int aeTryAcquireLock(int fWeak, const char *file = __builtin_FILE(), int line = __builtin_LINE(), const char *func = __builtin_FUNCTION());
+#else
+int aeTryAcquireLock(int fWeak, const char *file, int line, const char *func);
+#endif
 void aeThreadOffline();
 void aeReleaseLock();
 void aeReleaseForkLock();
@@ -181,6 +203,35 @@ void aeSetThreadOwnsLockOverride(int fOverride);
 int aeLockContested(int threshold);
 int aeLockContention(); // returns the number of instantaneous threads waiting on the lock
 
+/* Timing histograms of the lock profiler and the loop phases. Times are in
+ * microseconds, in log2 buckets: bucket 0 counts zero durations, bucket N
+ * (N > 0) the values in [2^(N-1), 2^N), the last bucket everything above. */
+#define AE_HIST_BUCKETS 24
+static inline int aeHistBucket(unsigned long long us) {
+    if (us == 0) return 0;
+    int bucket = 64 - __builtin_clzll(us);
+    return bucket < AE_HIST_BUCKETS ? bucket : AE_HIST_BUCKETS-1;
+}
+unsigned long long aeHistPercentile(const unsigned long long *hist, double percentile);
+
+/* Global lock profiler */
+typedef struct aeLockSiteReport {
+    const char *file;
+    const char *func;
+    int line;
+    int threads;                        /* Threads that acquired the lock here */
+    unsigned long long acquisitions;
+    unsigned long long contended;       /* Acquisitions that had to wait */
+    unsigned long long wait_us, wait_max_us;
+    unsigned long long hold_us, hold_max_us;
+    unsigned long long wait_hist[AE_HIST_BUCKETS];
+    unsigned long long hold_hist[AE_HIST_BUCKETS];
+} aeLockSiteReport;
+
+int aeLockProfileReport(aeLockSiteReport **preports);  /* Returns the number of sites, free with zfree() */
+void aeLockProfileReset(void);
+unsigned long long aeLockProfileAcquisitions(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -9,7 +9,8 @@ public:
     {
     }
 
-    void arm(client *c = nullptr, bool fIfNeeded = false) // if a client is passed, then the client is already locked
+    // if a client is passed, then the client is already locked. The caller's location is used by the lock profiler
+    void arm(client *c = nullptr, bool fIfNeeded = false, const char *file = __builtin_FILE(), int line = __builtin_LINE(), const char *func = __builtin_FUNCTION())
     {
         if (m_fArmed)
             return;
@@ -23,7 +24,7 @@ public:
         {
             serverAssert(c->lock.fOwnLock());
 
-            if (!aeTryAcquireLock(true /*fWeak*/))    // avoid locking the client if we can
+            if (!aeTryAcquireLock(true /*fWeak*/, file, line, func))    // avoid locking the client if we can
             {
                 bool fOwnClientLock = true;
                 int clientNesting = 1;
@@ -34,7 +35,7 @@ public:
                         clientNesting = c->lock.unlock_recursive();
                         fOwnClientLock = false;
                     }
-                    aeAcquireLock();
+                    aeAcquireLock(file, line, func);
                     if (!c->lock.try_lock(false))   // ensure a strong try because aeAcquireLock is expensive
                     {
                         aeReleaseLock();
@@ -52,10 +53,18 @@ public:
         else if (!m_fArmed)
         {
             m_fArmed = true;
-            aeAcquireLock();
+            aeAcquireLock(file, line, func);
         }
     }
 
+    // Take the global lock only if it is free right now
+    bool tryArm(const char *file = __builtin_FILE(), int line = __builtin_LINE(), const char *func = __builtin_FUNCTION())
+    {
+        if (!m_fArmed && aeTryAcquireLock(true /*fWeak*/, file, line, func))
+            m_fArmed = true;
+        return m_fArmed;
+    }
+
     void disarm()
     {
         serverAssert(m_fArmed);
@@ -191,6 +191,12 @@ void *bioProcessBackgroundJobs(void *arg) {
 
     redisSetCpuAffinity(g_pserver->bio_cpulist);
 
+    if (cserver.jemalloc_thread_arenas) {
+        char label[32];
+        snprintf(label, sizeof(label), "bio-%lu", type);
+        zmalloc_thread_arena_bind(label);
+    }
+
     makeThreadKillable();
 
     pthread_mutex_lock(&bio_mutex[type]);
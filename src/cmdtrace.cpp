@@ -0,0 +1,313 @@
+/* Command trace recorder, see cmdtrace.h for the file format.
+ *
+ * call() serializes each command into the ring of the thread executing it.
+ * Rings are single producer (the owning thread, or whoever holds the global
+ * lock for the module thread) and single consumer (the writer thread), so
+ * publishing a record is a plain release store of the head offset. When a
+ * ring is full the record is dropped and counted rather than stalling the
+ * command path. */
+
+#include "server.h"
+#include "cmdtrace.h"
+#include "crc64.h"
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <sys/stat.h>
+
+struct commandTraceRing {
+    char *buf;
+    size_t size;                            /* Power of two */
+    std::atomic<uint64_t> head {0};         /* Written by the producer */
+    std::atomic<uint64_t> tail {0};         /* Written by the writer thread */
+    std::atomic<unsigned long long> records {0};
+    std::atomic<unsigned long long> dropped {0};
+};
+
+static std::mutex mutexRings;
+static std::vector<commandTraceRing*> vecRings;
+
+static std::atomic<bool> fTraceActive {false};  /* Producers may record */
+static std::atomic<bool> fWriterRun {false};
+static pthread_t threadWriter;
+static FILE *fpTrace = nullptr;
+static sds traceFile = nullptr;         /* command-trace-file when started */
+static size_t cbTraceFile = 0;
+static std::atomic<unsigned long long> cbTraceWritten {0};
+static std::atomic<unsigned long long> cTraceRotations {0};
+static bool fWriteErrorLogged = false;
+
+/* -------------------------------------------------------------------------
+ * Producer side
+ * ---------------------------------------------------------------------- */
+
+static commandTraceRing *commandTraceThreadRing() {
+    if (serverTL->trace_ring != nullptr) return serverTL->trace_ring;
+    size_t size = 4096;
+    while (size < g_pserver->command_trace_buffer_size) size <<= 1;
+    commandTraceRing *ring = new commandTraceRing();
+    ring->buf = (char*)zmalloc(size);
+    ring->size = size;
+    std::unique_lock<std::mutex> lock(mutexRings);
+    vecRings.push_back(ring);
+    serverTL->trace_ring = ring;
+    return ring;
+}
+
+static void ringCopyIn(commandTraceRing *ring, uint64_t &pos, const void *p, size_t len) {
+    size_t off = pos & (ring->size-1);
+    size_t first = std::min(len, ring->size - off);
+    memcpy(ring->buf+off, p, first);
+    memcpy(ring->buf, (const char*)p+first, len-first);
+    pos += len;
+}
+
+/* Integer encoded arguments are expanded in 'tmp'. */
+static void traceArg(robj *o, const char **p, size_t *len, char *tmp) {
+    if (sdsEncodedObject(o)) {
+        *p = szFromObj(o);
+        *len = sdslen(szFromObj(o));
+    } else {
+        *len = ll2string(tmp,LONG_STR_SIZE,(long)ptrFromObj(o));
+        *p = tmp;
+    }
+}
+
+void commandTraceRecord(client *c, struct redisCommand *cmd, robj **argv, int argc,
+                        long long start_us, long long duration, unsigned long long reply_bytes) {
+    if (!fTraceActive.load(std::memory_order_relaxed)) return;
+    commandTraceRing *ring = commandTraceThreadRing();
+
+    cmdtraceRecordHeader hdr;
+    memset(&hdr,0,sizeof(hdr));
+    /* Administrative commands and the ones carrying credentials (AUTH and
+     * HELLO, the only ones allowed before authentication) keep their
+     * arguments to themselves. */
+    bool fHidden = cmd->flags & (CMD_ADMIN|CMD_NO_AUTH);
+    if (c->flags & CLIENT_LUA) hdr.flags |= CMDTRACE_F_SCRIPT;
+    if (serverTL->in_exec) hdr.flags |= CMDTRACE_F_EXEC;
+    if (c->flags & CLIENT_MASTER) hdr.flags |= CMDTRACE_F_MASTER;
+    hdr.db = c->db ? c->db->id : 0;
+    hdr.ts_us = start_us;
+    hdr.client_id = c->id;
+    hdr.duration_us = (uint32_t)std::min(duration, (long long)UINT32_MAX);
+    hdr.reply_bytes = (uint32_t)std::min(reply_bytes, (unsigned long long)UINT32_MAX);
+    hdr.thread = c->iel;
+    hdr.argc = (uint16_t)std::min(argc, (int)UINT16_MAX);
+    hdr.cmdlen = (uint8_t)std::min(strlen(cmd->name), (size_t)UINT8_MAX);
+
+    getKeysResult keys = GETKEYS_RESULT_INIT;
+    if (!fHidden) getKeysFromCommand(cmd,argv,argc,&keys);
+    hdr.nkeys = (uint16_t)std::min(keys.numkeys, (int)UINT16_MAX);
+
+    size_t len = sizeof(hdr) + hdr.cmdlen + hdr.nkeys*sizeof(uint64_t);
+    if (g_pserver->command_trace_args == CMDTRACE_ARGS_ALL && !fHidden && argc <= UINT16_MAX) {
+        size_t cbArgs = 0;
+        char tmp[LONG_STR_SIZE];
+        for (int j = 1; j < argc; j++) {
+            const char *p; size_t cb;
+            traceArg(argv[j],&p,&cb,tmp);
+            cbArgs += sizeof(uint32_t) + cb;
+        }
+        /* Huge values would monopolize the ring, keep their keys only */
+        if (len + cbArgs <= ring->size/4) {
+            hdr.flags |= CMDTRACE_F_ARGS;
+            len += cbArgs;
+        }
+    }
+    hdr.len = (uint32_t)len;
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head + len - ring->tail.load(std::memory_order_acquire) > ring->size) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        getKeysFreeResult(&keys);
+        return;
+    }
+
+    ringCopyIn(ring,head,&hdr,sizeof(hdr));
+    ringCopyIn(ring,head,cmd->name,hdr.cmdlen);
+    for (int j = 0; j < hdr.nkeys; j++) {
+        robj *key = argv[keys.keys[j]];
+        const char *p; size_t cb;
+        char tmp[LONG_STR_SIZE];
+        traceArg(key,&p,&cb,tmp);
+        uint64_t hash = crc64(0,(const unsigned char*)p,cb);
+        ringCopyIn(ring,head,&hash,sizeof(hash));
+    }
+    if (hdr.flags & CMDTRACE_F_ARGS) {
+        for (int j = 1; j < argc; j++) {
+            const char *p; size_t cb;
+            char tmp[LONG_STR_SIZE];
+            traceArg(argv[j],&p,&cb,tmp);
+            uint32_t cb32 = (uint32_t)cb;
+            ringCopyIn(ring,head,&cb32,sizeof(cb32));
+            ringCopyIn(ring,head,p,cb);
+        }
+    }
+    getKeysFreeResult(&keys);
+    ring->head.store(head, std::memory_order_release);
+    ring->records.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------
+ * Writer side
+ * ---------------------------------------------------------------------- */
+
+/* Shift file -> file.1 -> file.2 ... keeping command-trace-max-files old
+ * files. With zero rotated files the current one is simply discarded. */
+static void commandTraceRotateFiles() {
+    int keep = g_pserver->command_trace_max_files;
+    if (keep == 0) {
+        unlink(traceFile);
+        return;
+    }
+    for (int i = keep-1; i >= 1; i--) {
+        sds from = sdscatprintf(sdsempty(),"%s.%d",traceFile,i);
+        sds to = sdscatprintf(sdsempty(),"%s.%d",traceFile,i+1);
+        rename(from,to);
+        sdsfree(from);
+        sdsfree(to);
+    }
+    sds to = sdscatprintf(sdsempty(),"%s.1",traceFile);
+    rename(traceFile,to);
+    sdsfree(to);
+}
+
+static int commandTraceOpenFile() {
+    fpTrace = fopen(traceFile,"w");
+    if (fpTrace == nullptr) return C_ERR;
+    setvbuf(fpTrace,nullptr,_IOFBF,1024*1024);
+    cmdtraceFileHeader hdr;
+    memcpy(hdr.magic,CMDTRACE_MAGIC,sizeof(hdr.magic));
+    hdr.version = CMDTRACE_VERSION;
+    hdr.hdrlen = sizeof(hdr);
+    hdr.start_us = ustime();
+    fwrite(&hdr,sizeof(hdr),1,fpTrace);
+    cbTraceFile = sizeof(hdr);
+    return C_OK;
+}
+
+static void commandTraceWrite(const char *p, size_t cb) {
+    if (fpTrace == nullptr) return;
+    if (fwrite(p,cb,1,fpTrace) != 1) {
+        if (!fWriteErrorLogged) {
+            serverLog(LL_WARNING,"Error writing the command trace file %s: %s",
+                traceFile, strerror(errno));
+            fWriteErrorLogged = true;
+        }
+        return;
+    }
+    cbTraceFile += cb;
+    cbTraceWritten.fetch_add(cb, std::memory_order_relaxed);
+}
+
+/* Move everything published so far to the file. The rings only ever hold
+ * whole records so rotating between two rings never splits one. */
+static size_t commandTraceDrain() {
+    std::vector<commandTraceRing*> rings;
+    {
+        std::unique_lock<std::mutex> lock(mutexRings);
+        rings = vecRings;
+    }
+    size_t cbTotal = 0;
+    for (commandTraceRing *ring : rings) {
+        if (g_pserver->command_trace_max_size > 0 && cbTraceFile >= g_pserver->command_trace_max_size) {
+            if (fpTrace) fclose(fpTrace);
+            commandTraceRotateFiles();
+            cTraceRotations.fetch_add(1, std::memory_order_relaxed);
+            if (commandTraceOpenFile() == C_ERR && !fWriteErrorLogged) {
+                serverLog(LL_WARNING,"Unable to reopen the command trace file %s: %s",
+                    traceFile, strerror(errno));
+                fWriteErrorLogged = true;
+            }
+        }
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        while (tail < head) {
+            size_t off = tail & (ring->size-1);
+            size_t cb = std::min((size_t)(head-tail), ring->size-off);
+            commandTraceWrite(ring->buf+off,cb);
+            tail += cb;
+            cbTotal += cb;
+        }
+        ring->tail.store(tail, std::memory_order_release);
+    }
+    if (cbTotal && fpTrace) fflush(fpTrace);
+    return cbTotal;
+}
+
+static void *commandTraceWriterMain(void *) {
+    redis_set_thread_title("keydb_cmdtrace");
+    while (fWriterRun.load(std::memory_order_acquire)) {
+        if (commandTraceDrain() == 0)
+            usleep(10000);
+    }
+    return nullptr;
+}
+
+int commandTraceStart(const char **err) {
+    if (fTraceActive) return C_OK;
+    sdsfree(traceFile);
+    traceFile = sdsnew(g_pserver->command_trace_file);
+    fWriteErrorLogged = false;
+
+    struct stat st;
+    if (stat(traceFile,&st) == 0 && st.st_size > 0)
+        commandTraceRotateFiles();
+    if (commandTraceOpenFile() == C_ERR) {
+        serverLog(LL_WARNING,"Unable to open the command trace file %s: %s",
+            traceFile, strerror(errno));
+        if (err) *err = "Unable to open the command trace file. Check server logs.";
+        return C_ERR;
+    }
+
+    /* Forget whatever was recorded after the previous stop */
+    {
+        std::unique_lock<std::mutex> lock(mutexRings);
+        for (commandTraceRing *ring : vecRings)
+            ring->tail.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    fWriterRun = true;
+    if (pthread_create(&threadWriter,nullptr,commandTraceWriterMain,nullptr) != 0) {
+        fWriterRun = false;
+        fclose(fpTrace);
+        fpTrace = nullptr;
+        if (err) *err = "Unable to start the command trace thread.";
+        return C_ERR;
+    }
+    fTraceActive = true;
+    serverLog(LL_NOTICE,"Command tracing started, writing to %s", traceFile);
+    return C_OK;
+}
+
+/* Stop recording and flush what the rings still hold. */
+void commandTraceStop(void) {
+    if (!fTraceActive) return;
+    fTraceActive = false;
+    fWriterRun.store(false, std::memory_order_release);
+    pthread_join(threadWriter,nullptr);
+    commandTraceDrain();
+    if (fpTrace) fclose(fpTrace);
+    fpTrace = nullptr;
+    serverLog(LL_NOTICE,"Command tracing stopped");
+}
+
+sds genCommandTraceInfoString(sds info) {
+    unsigned long long records = 0, dropped = 0;
+    {
+        std::unique_lock<std::mutex> lock(mutexRings);
+        for (commandTraceRing *ring : vecRings) {
+            records += ring->records.load(std::memory_order_relaxed);
+            dropped += ring->dropped.load(std::memory_order_relaxed);
+        }
+    }
+    return sdscatprintf(info,
+        "command_trace_records:%llu\r\n"
+        "command_trace_dropped:%llu\r\n"
+        "command_trace_bytes:%llu\r\n"
+        "command_trace_rotations:%llu\r\n",
+        records, dropped,
+        cbTraceWritten.load(std::memory_order_relaxed),
+        cTraceRotations.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,61 @@
+/* Binary command trace format.
+ *
+ * When "command-trace" is enabled every command executed through call() is
+ * appended to a per-thread ring buffer, and a background thread drains the
+ * rings into "command-trace-file", rotating it once it grows past
+ * "command-trace-max-size". The files are meant to be read offline (for
+ * instance by keydb-benchmark --replay) so the layout is kept dumb: a file
+ * header followed by self-delimited records, all fields in host byte order.
+ *
+ *   record := cmdtraceRecordHeader
+ *             name[cmdlen]                     command name, lower case
+ *             uint64 keyhash[nkeys]            crc64 of every key argument
+ *             if (flags & CMDTRACE_F_ARGS)
+ *                 { uint32 len; char data[len]; } * (argc-1)
+ *
+ * Records from different threads are interleaved in chunks, so they are not
+ * globally ordered: sort by ts_us when the order matters. Arguments are only
+ * present with "command-trace-args all", and never for administrative
+ * commands or AUTH and HELLO. */
+
+#ifndef __CMDTRACE_H
+#define __CMDTRACE_H
+
+#include <stdint.h>
+
+#define CMDTRACE_MAGIC "KDBTRACE"
+#define CMDTRACE_VERSION 1
+
+#define CMDTRACE_ARGS_KEYS 0        /* Only key hashes are recorded */
+#define CMDTRACE_ARGS_ALL 1         /* The full argument vector is recorded */
+
+#define CMDTRACE_F_ARGS (1<<0)      /* The arguments follow the key hashes */
+#define CMDTRACE_F_SCRIPT (1<<1)    /* Called from a Lua script */
+#define CMDTRACE_F_EXEC (1<<2)      /* Called from inside MULTI/EXEC */
+#define CMDTRACE_F_MASTER (1<<3)    /* Sent by our master */
+
+#pragma pack(push, 1)
+typedef struct cmdtraceFileHeader {
+    char magic[8];                  /* CMDTRACE_MAGIC, not null terminated */
+    uint32_t version;
+    uint32_t hdrlen;                /* Records start at this offset */
+    uint64_t start_us;              /* Unix time the file was opened */
+} cmdtraceFileHeader;
+
+typedef struct cmdtraceRecordHeader {
+    uint32_t len;                   /* Whole record, this header included */
+    uint16_t flags;                 /* CMDTRACE_F_* */
+    uint16_t db;
+    uint64_t ts_us;                 /* Unix time the command started */
+    uint64_t client_id;
+    uint32_t duration_us;
+    uint32_t reply_bytes;           /* Protocol bytes queued by the command */
+    uint16_t thread;                /* Server thread index */
+    uint16_t argc;                  /* Including the command name */
+    uint16_t nkeys;
+    uint8_t cmdlen;
+    uint8_t reserved;
+} cmdtraceRecordHeader;
+#pragma pack(pop)
+
+#endif /* __CMDTRACE_H */
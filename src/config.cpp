@@ -32,6 +32,7 @@
 #include "storage/rocksdbfactory.h"
 #include "storage/teststorageprovider.h"
 #include "cluster.h"
+#include "cmdtrace.h"
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -39,7 +40,6 @@
 #ifdef __linux__
 #include <sys/sysinfo.h>
 #endif
-#define ENABLE_ROCKSDB 1
 
 const char *KEYDB_SET_VERSION = KEYDB_REAL_VERSION;
 size_t g_semiOrderedSetTargetBucketSize = 0;    // Its a header only class so nowhere else for this to go
@@ -134,6 +134,26 @@ configEnum acl_pubsub_default_enum[] = {
     {NULL, 0}
 };
 
+configEnum command_trace_args_enum[] = {
+    {"keys", CMDTRACE_ARGS_KEYS},
+    {"all", CMDTRACE_ARGS_ALL},
+    {NULL, 0}
+};
+
+configEnum lock_spin_policy_enum[] = {
+    {"fixed", FASTLOCK_POLICY_FIXED},
+    {"adaptive", FASTLOCK_POLICY_ADAPTIVE},
+    {"queued", FASTLOCK_POLICY_QUEUED},
+    {NULL, 0}
+};
+
+configEnum rdb_compression_algorithm_enum[] = {
+    {"lzf", RDB_COMPRESSION_LZF},
+    {"lz4", RDB_COMPRESSION_LZ4},
+    {"zstd", RDB_COMPRESSION_ZSTD},
+    {NULL, 0}
+};
+
 configEnum sanitize_dump_payload_enum[] = {
     {"no", SANITIZE_DUMP_NO},
     {"yes", SANITIZE_DUMP_YES},
@@ -655,6 +675,7 @@ void loadServerConfigFromString(char *config) {
                     err = "Target command name already exists"; goto loaderr;
                 }
             }
+            commandTableChanged();
         } else if (!strcasecmp(argv[0],"cluster-config-file") && argc == 2) {
             zfree(g_pserver->cluster_configfile);
             g_pserver->cluster_configfile = zstrdup(argv[1]);
@@ -2466,6 +2487,15 @@ static int isValidActiveDefrag(int val, const char **err) {
     return 1;
 }
 
+static int isValidRdbCompressionAlgorithm(int val, const char **err) {
+    if (!rdbCompressionSupported(val)) {
+        *err = "This KeyDB server was compiled without support for this "
+               "compression algorithm (see USE_LZ4 and USE_ZSTD)";
+        return 0;
+    }
+    return 1;
+}
+
 static int isValidDBfilename(char *val, const char **err) {
     if (!pathIsBaseName(val)) {
         *err = "dbfilename can't be a path, just a filename";
@@ -2637,6 +2667,23 @@ static int updateAppendonly(int val, int prev, const char **err) {
     return 1;
 }
 
+static int updateCommandTrace(int val, int prev, const char **err) {
+    UNUSED(prev);
+    if (val) {
+        if (commandTraceStart(err) == C_ERR) return 0;
+    } else {
+        commandTraceStop();
+    }
+    return 1;
+}
+
+static int updateLockSpinPolicy(int val, int prev, const char **err) {
+    UNUSED(err);
+    UNUSED(prev);
+    fastlock_set_policy(val);
+    return 1;
+}
+
 static int updateSighandlerEnabled(int val, int prev, const char **err) {
     UNUSED(err);
     UNUSED(prev);
@@ -2837,6 +2884,8 @@ standardConfig configs[] = {
     createBoolConfig("replica-read-only", "slave-read-only", MODIFIABLE_CONFIG, g_pserver->repl_slave_ro, 1, NULL, NULL),
     createBoolConfig("replica-ignore-maxmemory", "slave-ignore-maxmemory", MODIFIABLE_CONFIG, g_pserver->repl_slave_ignore_maxmemory, 1, NULL, NULL),
     createBoolConfig("jemalloc-bg-thread", NULL, MODIFIABLE_CONFIG, cserver.jemalloc_bg_thread, 1, NULL, updateJemallocBgThread),
+    createBoolConfig("jemalloc-thread-arenas", NULL, IMMUTABLE_CONFIG, cserver.jemalloc_thread_arenas, 0, NULL, NULL),
+    createBoolConfig("jemalloc-keyspace-arena", NULL, IMMUTABLE_CONFIG, cserver.jemalloc_keyspace_arena, 0, NULL, NULL),
     createBoolConfig("activedefrag", NULL, MODIFIABLE_CONFIG, cserver.active_defrag_enabled, 0, isValidActiveDefrag, NULL),
     createBoolConfig("syslog-enabled", NULL, IMMUTABLE_CONFIG, g_pserver->syslog_enabled, 0, NULL, NULL),
     createBoolConfig("cluster-enabled", NULL, IMMUTABLE_CONFIG, g_pserver->cluster_enabled, 0, NULL, NULL),
@@ -2848,6 +2897,8 @@ standardConfig configs[] = {
     createBoolConfig("time-thread-priority", NULL, IMMUTABLE_CONFIG, cserver.time_thread_priority, 0, NULL, NULL),
     createBoolConfig("prefetch-enabled", NULL, MODIFIABLE_CONFIG, g_pserver->prefetch_enabled, 1, NULL, NULL),
     createBoolConfig("allow-rdb-resize-op", NULL, MODIFIABLE_CONFIG, g_pserver->allowRdbResizeOp, 1, NULL, NULL),
+    createBoolConfig("latency-tracking", NULL, MODIFIABLE_CONFIG, g_pserver->latency_tracking_enabled, 1, NULL, NULL),
+    createBoolConfig("command-trace", NULL, MODIFIABLE_CONFIG, g_pserver->command_trace_enabled, 0, NULL, updateCommandTrace),
     createBoolConfig("crash-log-enabled", NULL, MODIFIABLE_CONFIG, g_pserver->crashlog_enabled, 1, NULL, updateSighandlerEnabled),
     createBoolConfig("crash-memcheck-enabled", NULL, MODIFIABLE_CONFIG, g_pserver->memcheck_enabled, 1, NULL, NULL),
     createBoolConfig("use-exit-on-panic", NULL, MODIFIABLE_CONFIG, g_pserver->use_exit_on_panic, 0, NULL, NULL),
@@ -2857,6 +2908,7 @@ standardConfig configs[] = {
     createBoolConfig("enable-async-commands", NULL, MODIFIABLE_CONFIG, g_pserver->enable_async_commands, 0, NULL, NULL),
     createBoolConfig("multithread-load-enabled", NULL, MODIFIABLE_CONFIG, g_pserver->multithread_load_enabled, 0, NULL, NULL),
     createBoolConfig("active-client-balancing", NULL, MODIFIABLE_CONFIG, g_pserver->active_client_balancing, 1, NULL, NULL),
+    createBoolConfig("thread-rebalance", NULL, MODIFIABLE_CONFIG, g_pserver->thread_rebalance, 0, NULL, NULL),
 
     /* String Configs */
     createStringConfig("aclfile", NULL, IMMUTABLE_CONFIG, ALLOW_EMPTY_STRING, g_pserver->acl_filename, "", NULL, NULL),
@@ -2868,6 +2920,7 @@ standardConfig configs[] = {
     createStringConfig("syslog-ident", NULL, IMMUTABLE_CONFIG, ALLOW_EMPTY_STRING, g_pserver->syslog_ident, "redis", NULL, NULL),
     createStringConfig("dbfilename", NULL, MODIFIABLE_CONFIG, ALLOW_EMPTY_STRING, g_pserver->rdb_filename, CONFIG_DEFAULT_RDB_FILENAME, isValidDBfilename, NULL),
     createStringConfig("db-s3-object", NULL, MODIFIABLE_CONFIG, EMPTY_STRING_IS_NULL, g_pserver->rdb_s3bucketpath, NULL, isValidS3Bucket, NULL),
+    createStringConfig("command-trace-file", NULL, MODIFIABLE_CONFIG, ALLOW_EMPTY_STRING, g_pserver->command_trace_file, "commands.ktrace", NULL, NULL),
     createStringConfig("appendfilename", NULL, IMMUTABLE_CONFIG, ALLOW_EMPTY_STRING, g_pserver->aof_filename, "appendonly.aof", isValidAOFfilename, NULL),
     createStringConfig("server_cpulist", NULL, IMMUTABLE_CONFIG, EMPTY_STRING_IS_NULL, g_pserver->server_cpulist, NULL, NULL, NULL),
     createStringConfig("bio_cpulist", NULL, IMMUTABLE_CONFIG, EMPTY_STRING_IS_NULL, g_pserver->bio_cpulist, NULL, NULL, NULL),
@@ -2891,6 +2944,8 @@ standardConfig configs[] = {
     createEnumConfig("storage-cache-mode", NULL, IMMUTABLE_CONFIG, storage_memory_model_enum, cserver.storage_memory_model, STORAGE_WRITETHROUGH, NULL, NULL),
     createEnumConfig("oom-score-adj", NULL, MODIFIABLE_CONFIG, oom_score_adj_enum, g_pserver->oom_score_adj, OOM_SCORE_ADJ_NO, NULL, updateOOMScoreAdj),
     createEnumConfig("acl-pubsub-default", NULL, MODIFIABLE_CONFIG, acl_pubsub_default_enum, g_pserver->acl_pubsub_default, USER_FLAG_ALLCHANNELS, NULL, NULL),
+    createEnumConfig("command-trace-args", NULL, MODIFIABLE_CONFIG, command_trace_args_enum, g_pserver->command_trace_args, CMDTRACE_ARGS_KEYS, NULL, NULL),
+    createEnumConfig("rdb-compression-algorithm", NULL, MODIFIABLE_CONFIG, rdb_compression_algorithm_enum, g_pserver->rdb_compression_algorithm, RDB_COMPRESSION_LZF, isValidRdbCompressionAlgorithm, NULL),
     createEnumConfig("sanitize-dump-payload", NULL, MODIFIABLE_CONFIG, sanitize_dump_payload_enum, cserver.sanitize_dump_payload, SANITIZE_DUMP_NO, NULL, NULL),
 
     /* Integer configs */
@@ -2903,6 +2958,7 @@ standardConfig configs[] = {
     createIntConfig("cluster-migration-barrier", NULL, MODIFIABLE_CONFIG, 0, INT_MAX, g_pserver->cluster_migration_barrier, 1, INTEGER_CONFIG, NULL, NULL),
     createIntConfig("active-defrag-cycle-min", NULL, MODIFIABLE_CONFIG, 1, 99, cserver.active_defrag_cycle_min, 1, INTEGER_CONFIG, NULL, NULL), /* Default: 1% CPU min (at lower threshold) */
     createIntConfig("active-defrag-cycle-max", NULL, MODIFIABLE_CONFIG, 1, 99, cserver.active_defrag_cycle_max, 25, INTEGER_CONFIG, NULL, NULL), /* Default: 25% CPU max (at upper threshold) */
+    createIntConfig("active-defrag-threads", NULL, MODIFIABLE_CONFIG, 1, 64, cserver.active_defrag_threads, 1, INTEGER_CONFIG, NULL, NULL),
     createIntConfig("active-defrag-threshold-lower", NULL, MODIFIABLE_CONFIG, 0, 1000, cserver.active_defrag_threshold_lower, 10, INTEGER_CONFIG, NULL, NULL), /* Default: don't defrag when fragmentation is below 10% */
     createIntConfig("active-defrag-threshold-upper", NULL, MODIFIABLE_CONFIG, 0, 1000, cserver.active_defrag_threshold_upper, 100, INTEGER_CONFIG, NULL, NULL), /* Default: maximum defrag force at 100% fragmentation */
     createIntConfig("lfu-log-factor", NULL, MODIFIABLE_CONFIG, 0, INT_MAX, g_pserver->lfu_log_factor, 10, INTEGER_CONFIG, NULL, NULL),
@@ -2927,8 +2983,15 @@ standardConfig configs[] = {
     createIntConfig("min-replicas-to-write", "min-slaves-to-write", MODIFIABLE_CONFIG, 0, INT_MAX, g_pserver->repl_min_slaves_to_write, 0, INTEGER_CONFIG, NULL, updateGoodSlaves),
     createIntConfig("min-replicas-max-lag", "min-slaves-max-lag", MODIFIABLE_CONFIG, 0, INT_MAX, g_pserver->repl_min_slaves_max_lag, 10, INTEGER_CONFIG, NULL, updateGoodSlaves),
     createIntConfig("min-clients-per-thread", NULL, MODIFIABLE_CONFIG, 0, 400, cserver.thread_min_client_threshold, 20, INTEGER_CONFIG, NULL, NULL),
+    createIntConfig("thread-rebalance-threshold", NULL, MODIFIABLE_CONFIG, 1, 100, g_pserver->thread_rebalance_threshold, 25, INTEGER_CONFIG, NULL, NULL),
+    createIntConfig("thread-rebalance-max-clients", NULL, MODIFIABLE_CONFIG, 1, 1000, g_pserver->thread_rebalance_max_clients, 8, INTEGER_CONFIG, NULL, NULL),
+    createIntConfig("lock-wait-io-rounds", NULL, MODIFIABLE_CONFIG, 0, 1000, g_pserver->lock_wait_io_rounds, 0, INTEGER_CONFIG, NULL, NULL),
+    createIntConfig("lock-batch-max-commands", NULL, MODIFIABLE_CONFIG, 0, INT_MAX, g_pserver->lock_batch_max_commands, 0, INTEGER_CONFIG, NULL, NULL),
+    createIntConfig("lock-batch-max-usec", NULL, MODIFIABLE_CONFIG, 0, 1000000, g_pserver->lock_batch_max_usec, 0, INTEGER_CONFIG, NULL, NULL),
+    createEnumConfig("lock-spin-policy", NULL, MODIFIABLE_CONFIG, lock_spin_policy_enum, g_pserver->lock_spin_policy, FASTLOCK_POLICY_FIXED, NULL, updateLockSpinPolicy),
     createIntConfig("storage-flush-period", NULL, MODIFIABLE_CONFIG, 1, 10000, g_pserver->storage_flush_period, 500, INTEGER_CONFIG, NULL, NULL),
     createIntConfig("replica-quorum", NULL, MODIFIABLE_CONFIG, -1, INT_MAX, g_pserver->repl_quorum, -1, INTEGER_CONFIG, NULL, NULL),
+    createIntConfig("command-trace-max-files", NULL, MODIFIABLE_CONFIG, 0, 1000, g_pserver->command_trace_max_files, 4, INTEGER_CONFIG, NULL, NULL),
     createIntConfig("replica-weighting-factor", NULL, MODIFIABLE_CONFIG, 1, INT_MAX, g_pserver->replicaIsolationFactor, 2, INTEGER_CONFIG, NULL, NULL),
     /* Unsigned int configs */
     createUIntConfig("maxclients", NULL, MODIFIABLE_CONFIG, 1, UINT_MAX, g_pserver->maxclients, 10000, INTEGER_CONFIG, NULL, updateMaxclients),
@@ -2964,9 +3027,14 @@ standardConfig configs[] = {
     createSizeTConfig("hash-max-ziplist-value", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, g_pserver->hash_max_ziplist_value, 64, MEMORY_CONFIG, NULL, NULL),
     createSizeTConfig("stream-node-max-bytes", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, g_pserver->stream_node_max_bytes, 4096, MEMORY_CONFIG, NULL, NULL),
     createSizeTConfig("zset-max-ziplist-value", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, g_pserver->zset_max_ziplist_value, 64, MEMORY_CONFIG, NULL, NULL),
+    createSizeTConfig("nested-hash-max-listpack-entries", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, g_pserver->nested_hash_max_listpack_entries, 0, INTEGER_CONFIG, NULL, NULL),
+    createSizeTConfig("nested-hash-max-listpack-value", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, g_pserver->nested_hash_max_listpack_value, 64, MEMORY_CONFIG, NULL, NULL),
     createSizeTConfig("hll-sparse-max-bytes", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, g_pserver->hll_sparse_max_bytes, 3000, MEMORY_CONFIG, NULL, NULL),
     createSizeTConfig("tracking-table-max-keys", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, g_pserver->tracking_table_max_keys, 1000000, INTEGER_CONFIG, NULL, NULL), /* Default: 1 million keys max. */
     createSizeTConfig("client-query-buffer-limit", NULL, MODIFIABLE_CONFIG, 1024*1024, LONG_MAX, cserver.client_max_querybuf_len, 1024*1024*1024, MEMORY_CONFIG, NULL, NULL), /* Default: 1GB max query buffer. */
+    createSizeTConfig("command-trace-max-size", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, g_pserver->command_trace_max_size, 64*1024*1024, MEMORY_CONFIG, NULL, NULL),
+    createSizeTConfig("command-trace-buffer-size", NULL, IMMUTABLE_CONFIG, 64*1024, LONG_MAX, g_pserver->command_trace_buffer_size, 4*1024*1024, MEMORY_CONFIG, NULL, NULL), /* Per thread ring */
+    createSizeTConfig("snapshot-consolidation-sync-limit", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, g_pserver->snapshot_consolidate_sync_limit, 100000, INTEGER_CONFIG, NULL, NULL), /* Tombstones merged under the global lock before handing off to a background thread */
 
     /* Other configs */
     createTimeTConfig("repl-backlog-ttl", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, g_pserver->repl_backlog_time_limit, 60*60, INTEGER_CONFIG, NULL, NULL), /* Default: 1 hour */
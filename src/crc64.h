@@ -7,8 +7,22 @@
 extern "C" {
 #endif
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC64_HAVE_PCLMUL 1
+#endif
+
 void crc64_init(void);
 uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
+uint64_t crc64_combine(uint64_t crc1, uint64_t crc2, uint64_t len2);
+const char *crc64_implementation(void);
+
+/* The implementations crc64() dispatches to, all giving the same result.
+ * crc64_pclmul() falls back to crc64_interleaved() on CPUs without
+ * PCLMULQDQ. Exposed for tests and benchmarks. */
+uint64_t crc64_slice8(uint64_t crc, const unsigned char *s, uint64_t l);
+uint64_t crc64_interleaved(uint64_t crc, const unsigned char *s, uint64_t l);
+uint64_t crc64_pclmul(uint64_t crc, const unsigned char *s, uint64_t l);
+int crc64_pclmul_supported(void);
 
 #ifdef REDIS_TEST
 int crc64Test(int argc, char *argv[], int accurate);
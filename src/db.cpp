@@ -2933,13 +2933,11 @@ void redisDbPersistentData::ensure(const char *sdsKey, dictEntry **pde)
                 }
                 else
                 {
-                    sds strT = serializeStoredObject(itr.val());
-                    robj *objNew = deserializeStoredObject(strT, sdslen(strT));
+                    robj *objNew = dupObjectForSnapshot(itr.val());
                     if (itr->FExpires()) {
                         objNew->expire = itr->expire;
                         objNew->SetFExpires(true);
                     }
-                    sdsfree(strT);
                     dictAdd(m_pdict, keyNew, objNew);
                     serverAssert(objNew->getrefcount(std::memory_order_relaxed) == 1);
                     serverAssert(mvccFromObj(objNew) == mvccFromObj(itr.val()));
@@ -3415,7 +3413,7 @@ void redisDbPersistentData::prefetchKeysAsync(client *c, parsed_command &command
     std::vector<robj*> veckeys;
     lock.arm(c);
     getKeysResult result = GETKEYS_RESULT_INIT;
-    auto cmd = lookupCommand(szFromObj(command.argv[0]));
+    auto cmd = lookupParsedCommand(command);
     if (cmd == nullptr)
         return; // Bad command? It's not for us to judge, just bail
     
@@ -398,6 +398,8 @@ void mallctl_string(client *c, robj **argv, int argc) {
 }
 #endif
 
+void profilerCommand(client *c);
+
 void debugCommand(client *c) {
     if (c->argc == 2 && !strcasecmp(szFromObj(c->argv[1]),"help")) {
         const char *help[] = {
@@ -443,6 +445,10 @@ void debugCommand(client *c) {
 "    Crash the server simulating an out-of-memory error.",
 "PANIC",
 "    Crash the server simulating a panic.",
+"PROFILE START [<hz>]|STOP|STATUS|DUMP|RESET",
+"    Sample the stacks of the event loop threads <hz> (default 99) times per",
+"    second of CPU time. DUMP returns the samples as collapsed stacks (one",
+"    'thread;frame;...;frame count' line per stack) for flame graph tools.",
 "POPULATE <count> [<prefix>] [<size>]",
 "    Create <count> string keys named key:<num>. If <prefix> is specified then",
 "    it is used instead of the 'key' prefix.",
@@ -513,6 +519,8 @@ NULL
     } else if (!strcasecmp(szFromObj(c->argv[1]),"log") && c->argc == 3) {
         serverLog(LL_WARNING, "DEBUG LOG: %s", (char*)ptrFromObj(c->argv[2]));
         addReply(c,shared.ok);
+    } else if (!strcasecmp(szFromObj(c->argv[1]),"profile") && c->argc >= 3) {
+        profilerCommand(c);
     } else if (!strcasecmp(szFromObj(c->argv[1]),"leak") && c->argc == 3) {
         sdsdup(szFromObj(c->argv[2]));
         addReply(c,shared.ok);
@@ -2208,6 +2216,269 @@ void disableWatchdog(void) {
     g_pserver->watchdog_period = 0;
 }
 
+/* =========================== Sampling profiler ============================
+ * DEBUG PROFILE START arms a CPU time timer on every event loop thread. Each
+ * expiry delivers SIGPROF to that thread, whose handler records a backtrace()
+ * into a lock free ring. serverCron drains the ring into a table of unique
+ * stacks, and DEBUG PROFILE DUMP symbolizes it as collapsed stacks ready to
+ * feed to flamegraph.pl. Only threads burning CPU are sampled. */
+#if defined(HAVE_BACKTRACE) && defined(__linux__)
+#define HAVE_SAMPLING_PROFILER 1
+#include <sys/syscall.h>
+#include <unordered_map>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define PROFILER_RING_SIZE 4096         /* Power of two */
+#define PROFILER_MAX_FRAMES 48
+#define PROFILER_SKIP_FRAMES 2          /* The handler and the signal trampoline */
+#define PROFILER_DEFAULT_HZ 99
+#define PROFILER_MAX_HZ 1000
+
+struct profilerSample {
+    /* Seqlock: 2*idx+1 while sample idx is written, 2*idx+2 once done */
+    std::atomic<uint64_t> seq;
+    int thread;
+    int depth;
+    void *frames[PROFILER_MAX_FRAMES];
+};
+
+static struct {
+    std::atomic<bool> running {false};
+    int hz = 0;
+    profilerSample *ring = nullptr;
+    std::atomic<uint64_t> head {0};     /* Next sample to write */
+    uint64_t tail = 0;                  /* Next sample to drain */
+    unsigned long long samples = 0;     /* Drained since the last reset */
+    unsigned long long dropped = 0;     /* Overwritten before being drained */
+    std::unordered_map<std::string, unsigned long long> stacks;
+} g_profiler;
+
+static thread_local int tl_profilerThread = -1;
+static thread_local timer_t tl_profilerTimer;
+
+static void profilerSignalHandler(int sig, siginfo_t *info, void *secret) {
+    UNUSED(sig);
+    UNUSED(info);
+    UNUSED(secret);
+    if (tl_profilerThread < 0 || !g_profiler.running.load(std::memory_order_relaxed))
+        return;
+    int savedErrno = errno;
+    uint64_t idx = g_profiler.head.fetch_add(1, std::memory_order_relaxed);
+    profilerSample &sample = g_profiler.ring[idx & (PROFILER_RING_SIZE-1)];
+    sample.seq.store(idx*2+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    sample.thread = tl_profilerThread;
+    sample.depth = backtrace(sample.frames, PROFILER_MAX_FRAMES);
+    sample.seq.store(idx*2+2, std::memory_order_release);
+    errno = savedErrno;
+}
+
+/* Runs on the event loop thread 'iel'. Returns C_ERR with errno set if the
+ * timer can't be created or armed. */
+static int profilerArmThisThread(int iel, int hz) {
+    if (tl_profilerThread >= 0) return C_OK;
+    serverAssert(hz >= 1 && hz <= PROFILER_MAX_HZ);
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &tl_profilerTimer) == -1) {
+        int savedErrno = errno;
+        serverLog(LL_WARNING, "Unable to create the profiler timer of thread %d: %s", iel, strerror(errno));
+        errno = savedErrno;
+        return C_ERR;
+    }
+    long long period = 1000000000LL / hz;
+    struct itimerspec its;
+    its.it_interval.tv_sec = period / 1000000000LL;
+    its.it_interval.tv_nsec = period % 1000000000LL;
+    its.it_value = its.it_interval;
+    if (timer_settime(tl_profilerTimer, 0, &its, NULL) == -1) {
+        int savedErrno = errno;
+        serverLog(LL_WARNING, "Unable to arm the profiler timer of thread %d: %s", iel, strerror(errno));
+        timer_delete(tl_profilerTimer);
+        errno = savedErrno;
+        return C_ERR;
+    }
+    tl_profilerThread = iel;
+    return C_OK;
+}
+
+static void profilerDisarmThisThread(void) {
+    if (tl_profilerThread < 0) return;
+    timer_delete(tl_profilerTimer);
+    tl_profilerThread = -1;
+}
+
+/* Arms the calling thread right away so a failure can be reported to the
+ * client, the other threads arm themselves from their event loops. */
+static int profilerStart(int hz) {
+    if (g_profiler.ring == nullptr) {
+        struct sigaction act;
+        g_profiler.ring = (profilerSample*)zcalloc(sizeof(profilerSample)*PROFILER_RING_SIZE, MALLOC_LOCAL);
+        /* backtrace() lazily loads libgcc, which isn't async signal safe */
+        void *frames[1];
+        backtrace(frames, 1);
+        sigemptyset(&act.sa_mask);
+        act.sa_flags = SA_SIGINFO | SA_RESTART;
+        act.sa_sigaction = profilerSignalHandler;
+        sigaction(SIGPROF, &act, NULL);
+    }
+    if (serverTL != nullptr &&
+        profilerArmThisThread(serverTL - g_pserver->rgthreadvar, hz) == C_ERR)
+        return C_ERR;
+    g_profiler.hz = hz;
+    g_profiler.running = true;
+    for (int iel = 0; iel < cserver.cthreads; ++iel)
+        aePostFunction(g_pserver->rgthreadvar[iel].el, [iel, hz]{ profilerArmThisThread(iel, hz); });
+    return C_OK;
+}
+
+static void profilerStop(void) {
+    g_profiler.running = false;
+    for (int iel = 0; iel < cserver.cthreads; ++iel)
+        aePostFunction(g_pserver->rgthreadvar[iel].el, []{ profilerDisarmThisThread(); });
+    profilerDrainSamples();
+}
+
+/* Move the samples of the ring into the table of unique stacks, called
+ * periodically from serverCron so the ring never wraps. */
+void profilerDrainSamples(void) {
+    if (g_profiler.ring == nullptr) return;
+    uint64_t head = g_profiler.head.load(std::memory_order_acquire);
+    if (head - g_profiler.tail > PROFILER_RING_SIZE) {
+        g_profiler.dropped += head - g_profiler.tail - PROFILER_RING_SIZE;
+        g_profiler.tail = head - PROFILER_RING_SIZE;
+    }
+    for (; g_profiler.tail < head; ++g_profiler.tail) {
+        uint64_t idx = g_profiler.tail;
+        const profilerSample &sample = g_profiler.ring[idx & (PROFILER_RING_SIZE-1)];
+        uint64_t seq = sample.seq.load(std::memory_order_acquire);
+        if (seq < idx*2+2) break;   /* Still being written, pick it up next time */
+        if (seq != idx*2+2) {
+            g_profiler.dropped++;
+            continue;
+        }
+        int depth = std::min(std::max(sample.depth, 0), PROFILER_MAX_FRAMES);
+        std::string key((const char*)&sample.thread, sizeof(sample.thread));
+        key.append((const char*)sample.frames, depth*sizeof(void*));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sample.seq.load(std::memory_order_relaxed) != seq) {
+            g_profiler.dropped++;
+            continue;
+        }
+        g_profiler.stacks[key]++;
+        g_profiler.samples++;
+    }
+}
+
+static sds profilerSymbolize(sds out, void *addr, std::unordered_map<void*, std::string> &cache) {
+    auto itr = cache.find(addr);
+    if (itr == cache.end()) {
+        Dl_info info;
+        std::string name;
+        if (dladdr(addr, &info) && info.dli_sname != nullptr) {
+            int status;
+            char *demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+            name = (status == 0 && demangled) ? demangled : info.dli_sname;
+            free(demangled);
+        } else if (info.dli_fname != nullptr) {
+            /* Static functions have no dynamic symbol, leave the offset for
+             * addr2line. The executable's name may be the process title. */
+            const char *module = strrchr(info.dli_fname, '/');
+            module = module ? module+1 : info.dli_fname;
+            char buf[64];
+            snprintf(buf, sizeof(buf), "+0x%lx]", (unsigned long)((char*)addr - (char*)info.dli_fbase));
+            name = std::string("[") + std::string(module, strcspn(module, " ")) + buf;
+        } else {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "[%p]", addr);
+            name = buf;
+        }
+        /* ';' separates the frames of a collapsed stack */
+        std::replace(name.begin(), name.end(), ';', ':');
+        itr = cache.emplace(addr, std::move(name)).first;
+    }
+    return sdscatlen(out, itr->second.data(), itr->second.size());
+}
+
+/* One "thread;outermost;...;innermost count" line per unique stack. */
+static sds profilerGenCollapsedStacks(void) {
+    std::unordered_map<void*, std::string> cache;
+    sds out = sdsempty();
+    for (const auto &pair : g_profiler.stacks) {
+        int thread;
+        memcpy(&thread, pair.first.data(), sizeof(thread));
+        void *const *frames = (void *const *)(pair.first.data() + sizeof(thread));
+        int depth = (pair.first.size() - sizeof(thread)) / sizeof(void*);
+        out = sdscatprintf(out, "event-loop-%d", thread);
+        for (int j = depth-1; j >= PROFILER_SKIP_FRAMES; --j) {
+            out = sdscatlen(out, ";", 1);
+            out = profilerSymbolize(out, frames[j], cache);
+        }
+        out = sdscatprintf(out, " %llu\n", pair.second);
+    }
+    return out;
+}
+
+void profilerCommand(client *c) {
+    if (!strcasecmp(szFromObj(c->argv[2]),"start") && c->argc <= 4) {
+        long hz = PROFILER_DEFAULT_HZ;
+        if (c->argc == 4 &&
+            getRangeLongFromObjectOrReply(c,c->argv[3],1,PROFILER_MAX_HZ,&hz,NULL) != C_OK)
+            return;
+        if (g_profiler.running) {
+            addReplyError(c,"The profiler is already running");
+            return;
+        }
+        if (profilerStart(hz) == C_ERR) {
+            addReplyErrorFormat(c,"Unable to arm the profiler timer: %s",strerror(errno));
+            return;
+        }
+        addReply(c,shared.ok);
+    } else if (!strcasecmp(szFromObj(c->argv[2]),"stop") && c->argc == 3) {
+        if (g_profiler.running) profilerStop();
+        addReply(c,shared.ok);
+    } else if (!strcasecmp(szFromObj(c->argv[2]),"dump") && c->argc == 3) {
+        profilerDrainSamples();
+        sds stacks = profilerGenCollapsedStacks();
+        addReplyVerbatim(c,stacks,sdslen(stacks),"txt");
+        sdsfree(stacks);
+    } else if (!strcasecmp(szFromObj(c->argv[2]),"reset") && c->argc == 3) {
+        profilerDrainSamples();
+        g_profiler.stacks.clear();
+        g_profiler.samples = 0;
+        g_profiler.dropped = 0;
+        addReply(c,shared.ok);
+    } else if (!strcasecmp(szFromObj(c->argv[2]),"status") && c->argc == 3) {
+        profilerDrainSamples();
+        addReplyMapLen(c,5);
+        addReplyBulkCString(c,"running");
+        addReplyBool(c,g_profiler.running);
+        addReplyBulkCString(c,"hz");
+        addReplyLongLong(c,g_profiler.hz);
+        addReplyBulkCString(c,"samples");
+        addReplyLongLong(c,g_profiler.samples);
+        addReplyBulkCString(c,"dropped");
+        addReplyLongLong(c,g_profiler.dropped);
+        addReplyBulkCString(c,"stacks");
+        addReplyLongLong(c,g_profiler.stacks.size());
+    } else {
+        addReplySubcommandSyntaxError(c);
+    }
+}
+#else
+void profilerDrainSamples(void) {}
+
+void profilerCommand(client *c) {
+    addReplyError(c,"The sampling profiler is not supported on this platform");
+}
+#endif
+
 /* Positive input is sleep time in microseconds. Negative input is fractions
  * of microseconds, i.e. -10 means 100 nanoseconds. */
 void debugDelay(int usec) {
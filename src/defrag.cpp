@@ -37,6 +37,9 @@
 #include <time.h>
 #include <assert.h>
 #include <stddef.h>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
 
 #ifdef HAVE_DEFRAG
 
@@ -48,6 +51,20 @@ extern "C" int je_get_defrag_hint(void* ptr);
 void defragDictBucketCallback(void *privdata, dictEntry **bucketref);
 dictEntry* replaceSatelliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sds newkey, uint64_t hash, long *defragged);
 
+/* Counters for keys defragged on a parallel scan thread, they are merged into
+ * the server stats once all the threads of the cycle have joined. */
+struct defragThreadStats {
+    long long hits = 0;
+    long long misses = 0;
+    long long key_hits = 0;
+    long long key_misses = 0;
+    long long scanned = 0;
+};
+static thread_local defragThreadStats *tl_defragStats = nullptr;
+#define DEFRAG_STAT(field) (tl_defragStats ? tl_defragStats->field : g_pserver->stat_active_defrag_##field)
+
+static fastlock s_defragLaterLock {"defrag_later"};    // guards db->defrag_later during parallel scans
+
 /* Defrag helper for generic allocations.
  *
  * returns NULL in case the allocation wasn't moved.
@@ -58,7 +75,7 @@ TPTR* activeDefragAlloc(TPTR *ptr) {
     size_t size;
     void *newptr;
     if(!je_get_defrag_hint(ptr)) {
-        g_pserver->stat_active_defrag_misses++;
+        DEFRAG_STAT(misses)++;
         return NULL;
     }
     /* move this allocation to a new allocation.
@@ -82,7 +99,7 @@ void* activeDefragAlloc(void *ptr) {
     size_t size;
     void *newptr;
     if(!je_get_defrag_hint(ptr)) {
-        g_pserver->stat_active_defrag_misses++;
+        DEFRAG_STAT(misses)++;
         return NULL;
     }
     /* move this allocation to a new allocation.
@@ -101,6 +118,10 @@ void* activeDefragAlloc(void *ptr) {
  * when it returns a non-null value, the old pointer was already released
  * and should NOT be accessed. */
 sds activeDefragSds(sds sdsptr) {
+    /* Refcounted strings may be shared with a snapshot copy of the same
+     * object, moving them would leave the other owner dangling. */
+    if (sdsrefcount(sdsptr) > 1)
+        return NULL;
     void* ptr = sdsAllocPtr(sdsptr);
     void* newptr = activeDefragAlloc(ptr);
     if (newptr) {
@@ -460,6 +481,7 @@ long activeDefragQuickListNodes(quicklist *ql) {
  * spikes when handling large items */
 void defragLater(redisDb *db, dictEntry *kde) {
     sds key = sdsdup((sds)dictGetKey(kde));
+    std::unique_lock<fastlock> lock(s_defragLaterLock);
     listAddNodeTail(db->defrag_later, key);
 }
 
@@ -908,12 +930,12 @@ long defragKey(redisDb *db, dictEntry *de) {
 /* Defrag scan callback for the main db dictionary. */
 void defragScanCallback(void *privdata, const dictEntry *de) {
     long defragged = defragKey((redisDb*)privdata, (dictEntry*)de);
-    g_pserver->stat_active_defrag_hits += defragged;
+    DEFRAG_STAT(hits) += defragged;
     if(defragged)
-        g_pserver->stat_active_defrag_key_hits++;
+        DEFRAG_STAT(key_hits)++;
     else
-        g_pserver->stat_active_defrag_key_misses++;
-    g_pserver->stat_active_defrag_scanned++;
+        DEFRAG_STAT(key_misses)++;
+    DEFRAG_STAT(scanned)++;
 }
 
 /* Defrag scan callback for each hash table bucket,
@@ -929,6 +951,113 @@ void defragDictBucketCallback(void *privdata, dictEntry **bucketref) {
     }
 }
 
+/* Parallel scans only pay off on big tables, smaller ones use dictScan on the main thread */
+static const unsigned long c_defragParallelMinBuckets = 1UL << 16;
+static const unsigned long c_defragParallelBlock = 256;   /* buckets claimed by a thread at a time */
+
+/* Should the main dictionary of this db be scanned by several threads? The
+ * scan walks the buckets of ht[0] linearly so the table must not be rehashing. */
+static bool FDefragParallel(dict *d) {
+    return cserver.active_defrag_threads > 1 && !dictIsRehashing(d) &&
+        d->ht[0].size >= c_defragParallelMinBuckets;
+}
+
+/* A parallel scan of the main dictionary. The helpers run as jobs on the async
+ * work queue, so one may only start once the scan is over: it then finds the
+ * scan closed and returns without touching anything, which is why the state is
+ * shared with the jobs rather than living on the caller's stack. */
+struct defragParallelScanState {
+    redisDb *db;
+    dictht *ht;
+    long long endtime;
+    std::atomic<unsigned long> idxNext;
+    std::vector<defragThreadStats> vecstats;
+    std::vector<std::vector<dictEntry*>> vecdeMainThread;
+
+    std::mutex mutex;
+    std::condition_variable cvDone;
+    bool fOpen = true;          /* Helpers may still join */
+    int cactive = 0;            /* Helpers currently scanning */
+
+    defragParallelScanState(redisDb *db, unsigned long idxStart, long long endtime, int cthreads)
+        : db(db), ht(&db->dictUnsafeKeyOnly()->ht[0]), endtime(endtime), idxNext(idxStart),
+          vecstats(cthreads), vecdeMainThread(cthreads)
+        {}
+
+    void scan(int ithread) {
+        tl_defragStats = &vecstats[ithread];
+        for (;;) {
+            unsigned long idx = idxNext.fetch_add(c_defragParallelBlock, std::memory_order_relaxed);
+            if (idx >= ht->size)
+                break;
+            unsigned long idxMax = std::min(idx + c_defragParallelBlock, ht->size);
+            for (; idx < idxMax; ++idx) {
+                defragDictBucketCallback(nullptr, &ht->table[idx]);
+                for (dictEntry *de = ht->table[idx]; de != nullptr; de = de->next) {
+                    robj *o = (robj*)dictGetVal(de);
+                    /* module defrag callbacks aren't known to be thread safe */
+                    if (o != nullptr && o->type == OBJ_MODULE) {
+                        vecdeMainThread[ithread].push_back(de);
+                        continue;
+                    }
+                    defragScanCallback(db, de);
+                }
+            }
+            if (ustime() > endtime)
+                break;
+        }
+        tl_defragStats = nullptr;
+    }
+};
+
+/* Defrag the buckets of the main dictionary starting at 'idxStart' with the
+ * calling thread and up to active-defrag-threads-1 helpers from the async work
+ * queue.  The global lock is held by the caller for the whole scan so no command
+ * can touch the keys being moved, and snapshots never reference the top level
+ * dict.  Threads claim blocks of buckets until the table is done or 'endtime' is
+ * reached, every claimed block is completed so all buckets before the returned
+ * index are done.  Returns 0 once the whole table was scanned. */
+static unsigned long defragParallelScan(redisDb *db, unsigned long idxStart, long long endtime) {
+    int cthreads = cserver.active_defrag_threads;
+    auto spstate = std::make_shared<defragParallelScanState>(db, idxStart, endtime, cthreads);
+
+    for (int ithread = 1; ithread < cthreads; ++ithread) {
+        g_pserver->asyncworkqueue->AddWorkFunction([spstate, ithread]{
+            {
+                std::unique_lock<std::mutex> lock(spstate->mutex);
+                if (!spstate->fOpen)
+                    return;
+                spstate->cactive++;
+            }
+            spstate->scan(ithread);
+            std::unique_lock<std::mutex> lock(spstate->mutex);
+            if (--spstate->cactive == 0)
+                spstate->cvDone.notify_all();
+        }, true /*fHiPri*/);
+    }
+    spstate->scan(0);
+
+    /* Close the scan to helpers that didn't start yet and wait for the others */
+    {
+        std::unique_lock<std::mutex> lock(spstate->mutex);
+        spstate->fOpen = false;
+        spstate->cvDone.wait(lock, [&]{ return spstate->cactive == 0; });
+    }
+
+    for (int ithread = 0; ithread < cthreads; ++ithread) {
+        g_pserver->stat_active_defrag_hits += spstate->vecstats[ithread].hits;
+        g_pserver->stat_active_defrag_misses += spstate->vecstats[ithread].misses;
+        g_pserver->stat_active_defrag_key_hits += spstate->vecstats[ithread].key_hits;
+        g_pserver->stat_active_defrag_key_misses += spstate->vecstats[ithread].key_misses;
+        g_pserver->stat_active_defrag_scanned += spstate->vecstats[ithread].scanned;
+        for (dictEntry *de : spstate->vecdeMainThread[ithread])
+            defragScanCallback(db, de);
+    }
+
+    unsigned long idx = spstate->idxNext.load(std::memory_order_relaxed);
+    return (idx >= spstate->ht->size) ? 0 : idx;
+}
+
 /* Utility function to get the fragmentation ratio from jemalloc.
  * It is critical to do that by comparing only heap maps that belong to
  * jemalloc, and skip ones the jemalloc keeps as spare. Since we use this
@@ -1099,6 +1228,8 @@ void activeDefragCycle(void) {
     static int current_db = -1;
     static unsigned long cursor = 0;
     static redisDb *db = NULL;
+    static bool fParallel = false;
+    static unsigned long parallel_size = 0;
     static long long start_scan, start_stat;
     unsigned int iterations = 0;
     unsigned long long prev_defragged = g_pserver->stat_active_defrag_hits;
@@ -1180,6 +1311,8 @@ void activeDefragCycle(void) {
 
             db = g_pserver->db[current_db];
             cursor = 0;
+            fParallel = FDefragParallel(db->dictUnsafeKeyOnly());
+            parallel_size = db->dictUnsafeKeyOnly()->ht[0].size;
         }
 
         do {
@@ -1189,8 +1322,18 @@ void activeDefragCycle(void) {
                 break; /* this will exit the function and we'll continue on the next cycle */
             }
 
-            // we actually look at the objects too but defragScanCallback can handle missing values
-            cursor = dictScan(db->dictUnsafeKeyOnly(), cursor, defragScanCallback, defragDictBucketCallback, db);
+            if (fParallel) {
+                /* The linear bucket index is meaningless once the table was resized,
+                 * the scan is best effort so just move on to the next db. */
+                dict *d = db->dictUnsafeKeyOnly();
+                if (dictIsRehashing(d) || d->ht[0].size != parallel_size)
+                    cursor = 0;
+                else
+                    cursor = defragParallelScan(db, cursor, endtime);
+            } else {
+                // we actually look at the objects too but defragScanCallback can handle missing values
+                cursor = dictScan(db->dictUnsafeKeyOnly(), cursor, defragScanCallback, defragDictBucketCallback, db);
+            }
 
             /* Once in 16 scan iterations, 512 pointer reallocations. or 64 keys
              * (if we have a lot of pointers in one hash bucket or rehasing),
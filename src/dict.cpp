@@ -1578,7 +1578,7 @@ char *stringFromLongLong(long long value) {
     char *s;
 
     len = snprintf(buf,sizeof(buf),"%lld",value);
-    s = zmalloc(len+1);
+    s = (char*)zmalloc(len+1);
     memcpy(s, buf, len);
     s[len] = '\0';
     return s;
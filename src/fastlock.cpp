@@ -78,6 +78,8 @@ __attribute__((weak)) void logStackTrace(void *, int) {
 extern int g_fInCrash;
 extern int g_fTestMode;
 int g_fHighCpuPressure = false;
+extern "C" int g_fastlockPolicy;
+int g_fastlockPolicy = FASTLOCK_POLICY_FIXED;   // read by the ASM spinlock as well
 
 /****************************************************
  *
@@ -302,12 +304,62 @@ uint64_t fastlock_getlongwaitcount()
     return rval;
 }
 
-extern "C" void fastlock_sleep(fastlock *lock, pid_t pid, unsigned wake, unsigned myticket)
+/****************************************************
+ *
+ *      Adaptive spinning.  With FASTLOCK_POLICY_ADAPTIVE (and QUEUED) every
+ *      lock learns how long it is worth spinning for it: a contended
+ *      acquisition that got the lock while spinning feeds the number of spins
+ *      it took into a running average (weight 1/8, as glibc's adaptive
+ *      mutex), a waiter that exhausted its spin budget and parked cuts the
+ *      average by a quarter.  Locks held briefly keep a spin budget just
+ *      above their typical wait, locks held long, or by threads that got
+ *      preempted because there are more threads than cores, quickly end up
+ *      parking right away instead of burning CPU.
+ *
+ *      With FASTLOCK_POLICY_QUEUED only the next ticket spins.  Waiters
+ *      further back park right away, and each unlock wakes the waiter that
+ *      just became next in line so it spins while the new owner runs.  These
+ *      parks say nothing about the spin budget and aren't long waits.
+ *
+ ****************************************************/
+
+#define FASTLOCK_SPIN_MIN 256           // spins, the budget never goes below this
+#define FASTLOCK_SPIN_MAX 0x100000      // spins, the FASTLOCK_POLICY_FIXED budget
+
+static void fastlock_set_spin_avg(struct fastlock *lock, unsigned avg)
+{
+    unsigned long long budget = 2ULL * avg + FASTLOCK_SPIN_MIN;
+    if (budget > FASTLOCK_SPIN_MAX) budget = FASTLOCK_SPIN_MAX;
+    unsigned step = (unsigned)((1ULL << 32) / budget);
+    __atomic_store_n(&lock->m_spinAvg, avg, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock->m_spinStep, step, __ATOMIC_RELAXED);
+}
+
+/* Called by a waiter that got the lock after spinning, counter is its loop
+ * counter: spins * step */
+extern "C" void fastlock_spin_adapt(struct fastlock *lock, unsigned counter, unsigned step)
+{
+    if (step == 0) return;
+    int spins = counter / step;
+    int avg = __atomic_load_n(&lock->m_spinAvg, __ATOMIC_RELAXED);
+    avg += (spins - avg) / 8;
+    fastlock_set_spin_avg(lock, std::max(avg, 0));
+}
+
+/* fSpunOut is set when the waiter parks because it exhausted its spin budget */
+extern "C" void fastlock_sleep(fastlock *lock, pid_t pid, unsigned wake, unsigned myticket, int fSpunOut)
 {
     UNUSED(lock);
     UNUSED(pid);
     UNUSED(wake);
     UNUSED(myticket);
+    int policy;
+    __atomic_load(&g_fastlockPolicy, &policy, __ATOMIC_RELAXED);
+    if (fSpunOut && policy != FASTLOCK_POLICY_FIXED) {
+        /* Racy with other waiters, an approximate average is all we need */
+        unsigned avg = __atomic_load_n(&lock->m_spinAvg, __ATOMIC_RELAXED);
+        fastlock_set_spin_avg(lock, avg - avg / 4);
+    }
 #ifdef __linux__
     g_dlock.registerwait(lock, pid);
     unsigned mask = (1U << (myticket % 32));
@@ -324,7 +376,8 @@ extern "C" void fastlock_sleep(fastlock *lock, pid_t pid, unsigned wake, unsigne
     __atomic_fetch_and(&lock->futex, ~mask, __ATOMIC_RELEASE);
     g_dlock.clearwait(lock, pid);
 #endif
-    __atomic_fetch_add(&g_longwaits, 1, __ATOMIC_RELAXED);
+    if (fSpunOut)
+        __atomic_fetch_add(&g_longwaits, 1, __ATOMIC_RELAXED);
 }
 
 extern "C" void fastlock_init(struct fastlock *lock, const char *name)
@@ -334,6 +387,7 @@ extern "C" void fastlock_init(struct fastlock *lock, const char *name)
     lock->m_depth = 0;
     lock->m_pidOwner = -1;
     lock->futex = 0;
+    fastlock_set_spin_avg(lock, FASTLOCK_SPIN_MAX / 2);
     int cch = strlen(name);
     cch = std::min<int>(cch, sizeof(lock->szName)-1);
     memcpy(lock->szName, name, cch);
@@ -356,9 +410,15 @@ extern "C" void fastlock_lock(struct fastlock *lock, spin_worker worker)
     unsigned myticket = __atomic_fetch_add(&lock->m_ticket.m_avail, 1, __ATOMIC_RELEASE);
     unsigned cloops = 0;
     ticket ticketT;
-    int fHighPressure;
+    int fHighPressure, policy;
     __atomic_load(&g_fHighCpuPressure, &fHighPressure, __ATOMIC_RELAXED);
-    unsigned loopLimit = fHighPressure ? 0x10000 : 0x100000;
+    __atomic_load(&g_fastlockPolicy, &policy, __ATOMIC_RELAXED);
+    unsigned loopLimit = FASTLOCK_SPIN_MAX;
+    unsigned step = __atomic_load_n(&lock->m_spinStep, __ATOMIC_RELAXED);
+    if (policy != FASTLOCK_POLICY_FIXED && step != 0)
+        loopLimit = (unsigned)((1ULL << 32) / step);
+    if (fHighPressure)
+        loopLimit = std::min(loopLimit, 0x10000U);
 
     if (worker != nullptr) {
         for (;;) {
@@ -376,6 +436,13 @@ LNormalLoop:
             if ((ticketT.u & 0xffff) == myticket)
                 break;
 
+            if (policy == FASTLOCK_POLICY_QUEUED && cloops == 0 && (uint16_t)(myticket - ticketT.m_active) > 1)
+            {
+                /* Not next in line: wait for the unlock that hands us the lock */
+                fastlock_sleep(lock, tid, ticketT.u, myticket, false);
+                continue;
+            }
+
 #if defined(__i386__) || defined(__amd64__)
             __asm__ __volatile__ ("pause");
 #elif defined(__aarch64__)
@@ -384,9 +451,12 @@ LNormalLoop:
 
             if ((++cloops % loopLimit) == 0)
             {
-                fastlock_sleep(lock, tid, ticketT.u, myticket);
+                fastlock_sleep(lock, tid, ticketT.u, myticket, true);
+                cloops = 0;
             }
         }
+        if (cloops != 0 && policy != FASTLOCK_POLICY_FIXED)
+            fastlock_spin_adapt(lock, cloops, 1);
     }
 
     lock->m_depth = 1;
@@ -466,6 +536,19 @@ extern "C" void unlock_futex(struct fastlock *lock, uint16_t ifutex)
         if (futex(&lock->m_ticket.u, FUTEX_WAKE_BITSET_PRIVATE, INT_MAX, nullptr, mask) == 1)
             break;
     }
+
+    /* A queued waiter parks until it is next in line, wake the one that just
+     * became next so it is already spinning when the new owner unlocks.  If
+     * it hasn't reached the futex yet its wait fails on the changed ticket. */
+    int policy;
+    __atomic_load(&g_fastlockPolicy, &policy, __ATOMIC_RELAXED);
+    if (policy == FASTLOCK_POLICY_QUEUED)
+    {
+        unsigned maskNext = (1U << ((uint16_t)(ifutex + 1) % 32));
+        __atomic_load(&lock->futex, &futexT, __ATOMIC_ACQUIRE);
+        if (futexT & maskNext)
+            futex(&lock->m_ticket.u, FUTEX_WAKE_BITSET_PRIVATE, INT_MAX, nullptr, maskNext);
+    }
 }
 #endif
 
@@ -501,6 +584,11 @@ void fastlock_lock_recursive(struct fastlock *lock, int nesting)
     lock->m_depth = nesting;
 }
 
+void fastlock_set_policy(int policy)
+{
+    __atomic_store(&g_fastlockPolicy, &policy, __ATOMIC_RELEASE);
+}
+
 void fastlock_auto_adjust_waits()
 {
 #ifdef __linux__
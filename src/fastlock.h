@@ -8,6 +8,12 @@ extern "C" {
 
 typedef int (*spin_worker)();
 
+/* How a waiter splits its time between spinning and parking on the futex */
+#define FASTLOCK_POLICY_FIXED 0     /* Spin a fixed budget (shorter under CPU pressure), then park */
+#define FASTLOCK_POLICY_ADAPTIVE 1  /* Spin budget learned per lock from its recent waits */
+#define FASTLOCK_POLICY_QUEUED 2    /* Adaptive, and only the next ticket spins: the waiters behind it park
+                                       until the unlock that hands them the lock wakes them */
+
 /* Begin C API */
 struct fastlock;
 void fastlock_init(struct fastlock *lock, const char *name);
@@ -22,6 +28,7 @@ void fastlock_free(struct fastlock *lock);
 int fastlock_unlock_recursive(struct fastlock *lock);
 void fastlock_lock_recursive(struct fastlock *lock, int nesting);
 void fastlock_auto_adjust_waits();
+void fastlock_set_policy(int policy);
 
 uint64_t fastlock_getlongwaitcount();   // this is a global value
 
@@ -50,7 +57,9 @@ struct fastlock
 {
     volatile int m_pidOwner;
     volatile int m_depth;
-    char szName[56];
+    unsigned m_spinStep;    // loop counter increment, a waiter parks after 2^32/m_spinStep spins (adaptive policies)
+    unsigned m_spinAvg;     // running average of the spins a contended acquisition needed, written by the new owner
+    char szName[48];
     /* Volatile data on seperate cache line */
     volatile struct ticket m_ticket;
     unsigned futex;
@@ -4,6 +4,8 @@
 .extern gettid
 .extern fastlock_sleep
 .extern g_fHighCpuPressure
+.extern g_fastlockPolicy
+.extern fastlock_spin_adapt
 
 #	This is the first use of assembly in this codebase, a valid question is WHY?
 #	The spinlock we implement here is performance critical, and simply put GCC
@@ -19,6 +21,8 @@ fastlock_lock:
 	# RDI points to the struct:
 	#	int32_t m_pidOwner
 	#	int32_t m_depth
+	#	uint32_t m_spinStep
+	#	uint32_t m_spinAvg
 	# [rdi+64] ...
 	#	uint16_t active
 	#	uint16_t avail
@@ -43,9 +47,18 @@ fastlock_lock:
 	je .LLocked             # Don't spin in that case
 
 	mov r9d, 0x1000         #	1000h is set so we overflow on the 1024*1024'th iteration (like the C code)
+	cmp dword ptr [rip+g_fastlockPolicy], 0
+	je .LFixedPolicy        # FASTLOCK_POLICY_FIXED
+	mov eax, [rdi+8]        # otherwise use the step this lock learned (see fastlock_spin_adapt)
+	test eax, eax
+	jz .LFixedPolicy        # lock never initialized with fastlock_init
+	mov r9d, eax
+.LFixedPolicy:
 	mov eax, [rip+g_fHighCpuPressure]
 	test eax, eax
 	jz .LNoTestMode
+	cmp r9d, 0x10000        # spin at most 64K iterations under CPU pressure
+	jae .LNoTestMode
 	mov r9d, 0x10000
 .LNoTestMode:
 
@@ -57,11 +70,19 @@ fastlock_lock:
 	xor ecx, ecx
 	test r8, r8
 	jnz .LLoopFunction
+.LQueueCheck:
+	cmp dword ptr [rip+g_fastlockPolicy], 2
+	jne .LLoop              # only FASTLOCK_POLICY_QUEUED parks waiters that aren't next in line
+	mov edx, [rdi+64]
+	mov r10d, eax
+	sub r10w, dx            # how many tickets are ahead of ours?
+	cmp r10w, 1
+	ja .LQueueSleep         # more than the owner: wait for the unlock that hands us the lock
 .ALIGN 16
 .LLoop:
 	mov edx, [rdi+64]
 	cmp dx, ax              # is our ticket up?
-	je .LLocked             # leave the loop
+	je .LLockedSpun         # leave the loop
 	pause
 	add ecx, r9d            # Have we been waiting a long time? (oflow if we have)
 	jnc .LLoop              # If so, give up our timeslice to someone who's doing real work
@@ -70,24 +91,51 @@ fastlock_lock:
 	#	taking a long time to be released anyways.  We optimize for the common case of short
 	#	lock intervals.  That's why we're using a spinlock in the first place
 	# If we get here we're going to sleep in the kernel with a futex
+	mov r8d, 1              # ARG5: we exhausted our spin budget
+	jmp .LSleep
+.LQueueSleep:
+	xor r8d, r8d            # ARG5: parked without spinning, the spin budget isn't to blame
+.LSleep:
 	push rdi
 	push rsi
 	push rax
-	.cfi_adjust_cfa_offset 24
+	push r9                 # the step is caller saved
+	sub rsp, 8              # keep the stack aligned for the call
+	.cfi_adjust_cfa_offset 40
 	# Setup the syscall args
 
                             # rdi ARG1 futex (already in rdi)
 	                        # rsi ARG2 tid (already in esi)
                             # rdx ARG3 ticketT.u (already in edx)
 	mov ecx, eax            # rcx ARG4 myticket
+	                        # r8 ARG5 fSpunOut (already in r8d)
 	call fastlock_sleep
 	# cleanup and continue
+	add rsp, 8
+	pop r9
 	pop rax
 	pop rsi
 	pop rdi
-	.cfi_adjust_cfa_offset -24
+	.cfi_adjust_cfa_offset -40
 	xor ecx, ecx            # Reset our loop counter
-	jmp .LLoop              # Get back in the game
+	jmp .LQueueCheck        # Get back in the game
+.ALIGN 16
+.LLockedSpun:
+	test ecx, ecx           # did we spin at all since we started (or last woke up)?
+	jz .LLocked
+	cmp dword ptr [rip+g_fastlockPolicy], 0
+	je .LLocked
+	push rdi
+	push rsi
+	sub rsp, 8              # keep the stack aligned for the call
+	.cfi_adjust_cfa_offset 24
+	mov esi, ecx            # ARG2 loop counter
+	mov edx, r9d            # ARG3 step
+	call fastlock_spin_adapt
+	add rsp, 8
+	pop rsi
+	pop rdi
+	.cfi_adjust_cfa_offset -24
 .ALIGN 16
 .LLocked:
 	mov [rdi], esi          # lock->m_pidOwner = gettid()
@@ -197,6 +245,12 @@ fastlock_unlock:
 	shr rdx, 32                  # isolate the mask
 	bt edx, esi                  # is the next thread waiting on a futex?
 	jc unlock_futex              # unlock the futex if necessary
+	cmp dword ptr [rip+g_fastlockPolicy], 2
+	jne .LUnlocked               # only FASTLOCK_POLICY_QUEUED parks the waiter behind the next one
+	lea ecx, [esi+1]
+	bt edx, ecx                  # is the waiter that just became next in line parked?
+	jc unlock_futex              # wake it so it spins (unlock_futex wakes it in the QUEUED policy)
+.LUnlocked:
 	ret                          # if not we're done.
 .ALIGN 16
 .LDone:
@@ -0,0 +1,139 @@
+#include "server.h"
+
+#ifdef REDIS_TEST
+#include <thread>
+#include <vector>
+
+namespace {
+
+const uint64_t c_magicLive = 0x6c6976656f626a31ULL;
+const uint64_t c_magicDead = 0xdeaddeaddeaddeadULL;
+
+std::atomic<long long> s_cliveObjs {0};
+
+struct TestCollectable : public ICollectable
+{
+    uint64_t magic = c_magicLive;
+    long long value;
+
+    TestCollectable(long long value) : value(value) { ++s_cliveObjs; }
+    virtual ~TestCollectable() {
+        magic = c_magicDead;
+        --s_cliveObjs;
+    }
+};
+
+/* Readers hold an epoch while dereferencing the shared pointer, writers swap it and retire
+ * the old object.  If anything is free'd early a reader sees the poisoned magic. */
+void gcStressTest(int cthreads, long long iterations)
+{
+    GarbageCollector<TestCollectable> gc;
+    std::atomic<TestCollectable*> shared {new TestCollectable(0)};
+    std::atomic<long long> cviolations {0};
+    std::vector<std::thread> vecthreads;
+
+    long long start = ustime();
+    for (int ithread = 0; ithread < cthreads; ++ithread) {
+        vecthreads.emplace_back([&, ithread]{
+            for (long long i = 0; i < iterations; ++i) {
+                uint64_t epoch = gc.startEpoch();
+                TestCollectable *p = shared.load();
+                if (p->magic != c_magicLive)
+                    ++cviolations;
+                if ((i % 4) == ithread % 4) {
+                    TestCollectable *pold = shared.exchange(new TestCollectable(i));
+                    gc.enqueue(epoch, std::unique_ptr<TestCollectable>(pold));
+                }
+                if (p->magic != c_magicLive)
+                    ++cviolations;
+                /* Mirror the server: most threads never free, a few do the work */
+                gc.endEpoch(epoch, ithread != 0);
+            }
+        });
+    }
+    for (auto &thread : vecthreads)
+        thread.join();
+    long long elapsed = ustime() - start;
+
+    /* One last epoch with nobody else around must drain everything */
+    gc.endEpoch(gc.startEpoch());
+    printf("gc stress %d threads: %lld epochs in %lld ms, %llu objects free'd\n",
+        cthreads, cthreads*iterations, elapsed/1000, (unsigned long long)gc.objectsFreed());
+    assert(cviolations == 0);
+    assert(gc.empty());
+    assert(gc.pendingCount() == 0);
+    delete shared.load();
+    assert(s_cliveObjs == 0);
+}
+
+/* Measures the cost of the epoch bookkeeping alone as the thread count goes up */
+void gcContentionBenchmark(int cthreadsMax, long long iterations)
+{
+    GarbageCollector<TestCollectable> gc;
+    for (int cthreads = 1; cthreads <= cthreadsMax; cthreads *= 2) {
+        std::vector<std::thread> vecthreads;
+        long long start = ustime();
+        for (int ithread = 0; ithread < cthreads; ++ithread) {
+            vecthreads.emplace_back([&]{
+                for (long long i = 0; i < iterations; ++i) {
+                    uint64_t epoch = gc.startEpoch();
+                    if ((i & 15) == 0)
+                        gc.enqueue(epoch, std::make_unique<TestCollectable>(i));
+                    gc.endEpoch(epoch, (i & 255) != 0);
+                }
+            });
+        }
+        for (auto &thread : vecthreads)
+            thread.join();
+        long long elapsed = std::max(ustime() - start, 1LL);
+        printf("gc contention %d threads: %lld ns/epoch, %.2f M epochs/sec\n",
+            cthreads, (elapsed*1000)/iterations, (double)(cthreads*iterations)/elapsed);
+    }
+    gc.endEpoch(gc.startEpoch());
+    assert(gc.empty());
+}
+
+}   // anonymous namespace
+
+int gcTest(int argc, char **argv, int accurate)
+{
+    long long iterations = 100000;
+    if (argc == 4) {
+        if (accurate)
+            iterations = 5000000;
+        else
+            iterations = strtoll(argv[3], NULL, 10);
+    }
+
+    unsigned cthreadsMax = std::max(std::thread::hardware_concurrency(), 2U);
+    gcStressTest(1, iterations);
+    gcStressTest(cthreadsMax, iterations);
+    /* Nested epochs on one thread (async work started inside a command) */
+    {
+        GarbageCollector<TestCollectable> gc;
+        uint64_t outer = gc.startEpoch();
+        uint64_t inner = gc.startEpoch();
+        assert(inner != outer);
+        gc.enqueue(inner, std::make_unique<TestCollectable>(1));
+        gc.endEpoch(inner);
+        assert(!gc.empty());    // outer epoch still pins the object
+        gc.endEpoch(outer);
+        assert(gc.empty());
+        assert(s_cliveObjs == 0);
+    }
+    /* A thread exiting before it published what it retired hands it over */
+    {
+        GarbageCollector<TestCollectable> gc;
+        uint64_t epoch = gc.startEpoch();
+        std::thread([&]{
+            gc.enqueue(epoch, std::make_unique<TestCollectable>(2));
+        }).join();
+        assert(gc.pendingCount() == 1);
+        gc.endEpoch(epoch);
+        assert(gc.empty());
+        assert(s_cliveObjs == 0);
+    }
+    gcContentionBenchmark(cthreadsMax, iterations);
+    return 0;
+}
+#endif
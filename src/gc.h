@@ -1,8 +1,11 @@
 #pragma once
 #include <vector>
 #include <assert.h>
-#include <unordered_set>
+#include <atomic>
 #include <list>
+#include <memory>
+#include <algorithm>
+#include <sched.h>
 
 struct ICollectable
 {
@@ -10,9 +13,57 @@ struct ICollectable
     bool FWillFreeChildDebug() { return false; }
 };
 
+/* Epoch based reclamation
+ *
+ * A thread entering a section where it may read shared structures takes an epoch, objects
+ *  unlinked from those structures are retired with the epoch counter at the time they were
+ *  unlinked and are only free'd once every epoch started before that point has ended.
+ *
+ * Outstanding epochs live in a fixed table of slots so starting and ending an epoch is a
+ *  couple of atomic operations, the slot index is encoded in the low bits of the epoch id.
+ *  Each slot has its own cache line and starting an epoch only reads the shared counter, the
+ *  counter is advanced by the thread collecting garbage, so readers never write a shared line.
+ *  Retired objects go to a per-thread list that is published to the shared list in batches
+ *  (at the latest when the thread ends its epoch), so the lock below is only taken once per
+ *  batch instead of once per object.  Frees happen on whichever thread calls endEpoch()
+ *  without fNoFree: the async work queue, the background save and load threads, and the
+ *  main thread while it loads an RDB.  Server threads serving clients pass fNoFree. */
 template<typename T>
 class GarbageCollector
 {
+    static const unsigned c_slotBits = 8;
+    static const unsigned c_cslots = 1U << c_slotBits;
+    static const uint64_t c_slotMask = c_cslots - 1;
+    static const size_t c_cretireBatch = 64;
+
+    struct RetiredObj
+    {
+        uint64_t epochRetire;
+        std::unique_ptr<T> sp;
+    };
+
+    struct ThreadRetireList
+    {
+        GarbageCollector *pgc = nullptr;
+        std::vector<RetiredObj> vecretired;
+
+        ~ThreadRetireList() {
+            // A thread exiting before its next endEpoch() hands what it retired to the
+            //  shared list, the next endEpoch() of any thread frees it
+            if (pgc != nullptr)
+                pgc->publish(*this);
+        }
+    };
+    static thread_local ThreadRetireList s_tlretire;
+    static thread_local unsigned s_tlslotHint;
+
+    struct alignas(64) EpochSlot
+    {
+        std::atomic<uint64_t> epoch {0};
+        // Only written by whoever holds the slot
+        std::atomic<uint64_t> cstarted {0};
+    };
+
     struct EpochHolder
     {
         uint64_t tstamp;
@@ -39,6 +90,51 @@ class GarbageCollector
         }
     };
 
+    // Lowest epoch counter still outstanding (or a lower bound of it for an epoch being started),
+    //  UINT64_MAX >> c_slotBits if there are none
+    uint64_t minOutstanding() const
+    {
+        uint64_t minepoch = UINT64_MAX >> c_slotBits;
+        for (auto &slot : m_rgslots)
+        {
+            uint64_t epoch = slot.epoch.load(std::memory_order_seq_cst);
+            if (epoch != 0)
+                minepoch = std::min(minepoch, epoch >> c_slotBits);
+        }
+        return minepoch;
+    }
+
+    // Move the retired objects of a thread to the shared list
+    void publish(ThreadRetireList &tl)
+    {
+        if (tl.vecretired.empty())
+            return;
+        serverAssert(tl.pgc == this);
+
+        std::unique_lock<fastlock> lock(m_lock);
+        for (auto &retired : tl.vecretired)
+        {
+            // Objects are retired in increasing order so the matching holder is almost always the last one
+            auto itr = m_listepochs.rbegin();
+            while (itr != m_listepochs.rend() && itr->tstamp > retired.epochRetire)
+                ++itr;
+            if (itr == m_listepochs.rend() || itr->tstamp != retired.epochRetire)
+            {
+                EpochHolder e;
+                e.tstamp = retired.epochRetire;
+                e.m_spvecObjs->push_back(std::move(retired.sp));
+                m_listepochs.emplace(itr.base(), std::move(e));
+            }
+            else
+            {
+                itr->m_spvecObjs->push_back(std::move(retired.sp));
+            }
+        }
+        m_cpending.fetch_add(tl.vecretired.size(), std::memory_order_relaxed);
+        lock.unlock();
+        tl.vecretired.clear();
+    }
+
 public:
     ~GarbageCollector() {
         // Silence TSAN errors
@@ -47,90 +143,118 @@ public:
 
     uint64_t startEpoch()
     {
-        std::unique_lock<fastlock> lock(m_lock);
-        ++m_epochNext;
-        m_setepochOutstanding.insert(m_epochNext);
-        return m_epochNext;
+        unsigned islotStart = s_tlslotHint;
+        for (;;)
+        {
+            for (unsigned i = 0; i < c_cslots; ++i)
+            {
+                unsigned islot = (islotStart + i) & c_slotMask;
+                EpochSlot &slot = m_rgslots[islot];
+                // Several epochs may share a counter value, the slot index keeps the ids apart
+                uint64_t expected = 0;
+                uint64_t epoch = (m_epochCur.load(std::memory_order_seq_cst) << c_slotBits) | islot;
+                if (slot.epoch.load(std::memory_order_relaxed) != 0 || !slot.epoch.compare_exchange_strong(expected, epoch))
+                    continue;
+
+                slot.cstarted.store(slot.cstarted.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                s_tlslotHint = islot;
+                return epoch;
+            }
+            // Every slot is held, this needs hundreds of concurrent epochs so just wait it out
+            sched_yield();
+        }
     }
 
     void shutdown()
     {
         std::unique_lock<fastlock> lock(m_lock);
         m_listepochs.clear();
-        m_setepochOutstanding.clear();
+        m_cpending = 0;
     }
 
     bool empty() const
     {
-        std::unique_lock<fastlock> lock(m_lock);
-        return m_listepochs.empty();
+        return m_cpending.load(std::memory_order_relaxed) == 0;
     }
 
+    size_t pendingCount() const { return m_cpending.load(std::memory_order_relaxed); }
+    uint64_t epochsStarted() const
+    {
+        uint64_t cstarted = 0;
+        for (auto &slot : m_rgslots)
+            cstarted += slot.cstarted.load(std::memory_order_relaxed);
+        return cstarted;
+    }
+    uint64_t objectsFreed() const { return m_cfreed.load(std::memory_order_relaxed); }
+
     void endEpoch(uint64_t epoch, bool fNoFree = false)
     {
-        std::unique_lock<fastlock> lock(m_lock);
-        serverAssert(m_setepochOutstanding.find(epoch) != m_setepochOutstanding.end());
-        bool fMinElement = *std::min_element(m_setepochOutstanding.begin(), m_setepochOutstanding.end());
-        m_setepochOutstanding.erase(epoch);
-        if (fNoFree)
+        unsigned islot = epoch & c_slotMask;
+        serverAssert(m_rgslots[islot].epoch.load(std::memory_order_relaxed) == epoch);
+        m_rgslots[islot].epoch.store(0, std::memory_order_seq_cst);
+
+        if (s_tlretire.pgc == this)
+            publish(s_tlretire);
+        if (fNoFree || empty())
             return;
+
+        // Objects are retired with the counter current when they were unlinked, epochs holding
+        //  that same counter may or may not see them so the counter is moved on first.  The
+        //  scan below misses epochs claiming a slot after it passed that slot, those only read
+        //  shared structures after everything retired so far was unlinked.  Objects retired
+        //  after the advance carry the new counter and stay put.
         std::list<EpochHolder> listclean;
-        
-        // No outstanding epochs?
-        if (m_setepochOutstanding.empty())
-        {
-            listclean = std::move(m_listepochs);  // Everything goes!
-        }
-        else
+        uint64_t epochAdvanced = m_epochCur.fetch_add(1, std::memory_order_seq_cst) + 1;
+        uint64_t minepoch = std::min(minOutstanding(), epochAdvanced);
         {
-            uint64_t minepoch = *std::min_element(m_setepochOutstanding.begin(), m_setepochOutstanding.end());
-            if (minepoch == 0)
-                return; // No available epochs to free
-
-            // Clean any epochs available (after the lock)
-            for (auto itr = m_listepochs.begin(); itr != m_listepochs.end(); /* itr incremented in loop*/)
-            {
-                auto &e = *itr;
-                auto itrNext = itr;
-                ++itrNext;
-                if (e < minepoch)
-                {
-                    listclean.emplace_back(std::move(e));
-                    m_listepochs.erase(itr);
-                }
-                itr = itrNext;
-            }
-
-            assert(listclean.empty() || fMinElement);
+        std::unique_lock<fastlock> lock(m_lock);
+        // Clean any epochs available (after the lock), the list is ordered by epoch
+        while (!m_listepochs.empty() && m_listepochs.front() < minepoch)
+            listclean.splice(listclean.end(), m_listepochs, m_listepochs.begin());
+        size_t cfree = 0;
+        for (auto &e : listclean)
+            cfree += e.m_spvecObjs->size();
+        m_cpending.fetch_sub(cfree, std::memory_order_relaxed);
+        m_cfreed.fetch_add(cfree, std::memory_order_relaxed);
         }
-
-        lock.unlock();  // don't hold it for the potentially long delete of vecclean
+        // don't hold the lock for the potentially long delete of listclean
     }
 
     void enqueue(uint64_t epoch, std::unique_ptr<T> &&sp)
     {
-        std::unique_lock<fastlock> lock(m_lock);
-        serverAssert(m_setepochOutstanding.find(epoch) != m_setepochOutstanding.end());
+        serverAssert(m_rgslots[epoch & c_slotMask].epoch.load(std::memory_order_relaxed) == epoch);
         serverAssert(sp->FWillFreeChildDebug() == false);
 
-        auto itr = std::find(m_listepochs.begin(), m_listepochs.end(), m_epochNext+1);
-        if (itr == m_listepochs.end())
+        auto &tl = s_tlretire;
+        if (tl.pgc != this)
         {
-            EpochHolder e;
-            e.tstamp = m_epochNext+1;
-            e.m_spvecObjs->push_back(std::move(sp));
-            m_listepochs.emplace_back(std::move(e));
-        }
-        else
-        {
-            itr->m_spvecObjs->push_back(std::move(sp));
+            if (tl.pgc != nullptr)
+                tl.pgc->publish(tl);
+            tl.pgc = this;
         }
+        // Anyone holding the current counter or an older one may still see the object
+        tl.vecretired.push_back({m_epochCur.load(std::memory_order_seq_cst), std::move(sp)});
+        if (tl.vecretired.size() >= c_cretireBatch)
+            publish(tl);
     }
 
 private:
     mutable fastlock m_lock { "Garbage Collector"};
 
     std::list<EpochHolder> m_listepochs;
-    std::unordered_set<uint64_t> m_setepochOutstanding;
-    uint64_t m_epochNext = 0;
+    EpochSlot m_rgslots[c_cslots];
+    // Starts at 1 so no epoch id is ever 0, which means "no epoch" to callers
+    alignas(64) std::atomic<uint64_t> m_epochCur {1};
+    std::atomic<size_t> m_cpending {0};
+    std::atomic<uint64_t> m_cfreed {0};
 };
+
+template<typename T>
+thread_local typename GarbageCollector<T>::ThreadRetireList GarbageCollector<T>::s_tlretire;
+
+template<typename T>
+thread_local unsigned GarbageCollector<T>::s_tlslotHint = 0;
+
+#ifdef REDIS_TEST
+int gcTest(int argc, char *argv[], int accurate);
+#endif
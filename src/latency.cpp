@@ -34,6 +34,7 @@
  */
 
 #include "server.h"
+#include "hdr_histogram.h"
 
 /* Dictionary type for latency events. */
 int dictStringKeyCompare(void *privdata, const void *key1, const void *key2) {
@@ -488,6 +489,260 @@ sds createLatencyReport(void) {
     return report;
 }
 
+/* ---------------------- Command latency histograms ------------------------
+ * Every command keeps one hdr histogram per event loop thread (plus a shared
+ * slot for module and other threads), and every thread keeps its own
+ * histograms for the execution phases. Writers never take a lock: a slot is
+ * only ever written by its owning thread, readers merge all the slots on
+ * demand and may miss a sample being recorded concurrently.
+ *
+ * Resetting only bumps g_pserver->latency_histogram_epoch. Every slot carries
+ * the epoch it was last cleared in, readers skip the slots behind and the
+ * owning thread clears its histogram before the next sample. */
+
+#define LATENCY_HISTOGRAM_MIN_VALUE 1L          /* >= 1 usec */
+#define LATENCY_HISTOGRAM_MAX_VALUE 100000000L  /* <= 100 secs */
+#define LATENCY_HISTOGRAM_PRECISION 2           /* 2 significant figures */
+
+static const char *latencyPhaseNames[LATENCY_PHASE_COUNT] = {
+    "queue", "lock", "execute", "write"
+};
+
+static struct hdr_histogram *latencyHistogramCreate(void) {
+    struct hdr_histogram *h = NULL;
+    hdr_init(LATENCY_HISTOGRAM_MIN_VALUE, LATENCY_HISTOGRAM_MAX_VALUE,
+             LATENCY_HISTOGRAM_PRECISION, &h);
+    return h;
+}
+
+/* Record 'us' into '*slot', creating the histogram the first time around.
+ * Only the thread owning the slot ever calls this. */
+static void latencyHistogramRecord(struct hdr_histogram **slot, unsigned long long *slotEpoch, long long us) {
+    unsigned long long epoch = g_pserver->latency_histogram_epoch.load(std::memory_order_relaxed);
+    struct hdr_histogram *h = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    if (h == NULL) {
+        if ((h = latencyHistogramCreate()) == NULL) return;
+        __atomic_store_n(slotEpoch, epoch, __ATOMIC_RELAXED);
+        __atomic_store_n(slot, h, __ATOMIC_RELEASE);
+    } else if (__atomic_load_n(slotEpoch, __ATOMIC_RELAXED) != epoch) {
+        hdr_reset(h);
+        __atomic_store_n(slotEpoch, epoch, __ATOMIC_RELEASE);
+    }
+    if (us < LATENCY_HISTOGRAM_MIN_VALUE) us = LATENCY_HISTOGRAM_MIN_VALUE;
+    if (us > LATENCY_HISTOGRAM_MAX_VALUE) us = LATENCY_HISTOGRAM_MAX_VALUE;
+    hdr_record_value(h, us);
+}
+
+/* Sum 'src' into '*dst', creating '*dst' if needed. */
+static void latencyHistogramMerge(struct hdr_histogram **dst, struct hdr_histogram *const *src, const unsigned long long *srcEpoch) {
+    struct hdr_histogram *h = __atomic_load_n(src, __ATOMIC_ACQUIRE);
+    if (h == NULL) return;
+    if (__atomic_load_n(srcEpoch, __ATOMIC_ACQUIRE) != g_pserver->latency_histogram_epoch.load(std::memory_order_relaxed))
+        return;     /* Reset since, the owner clears it on its next sample */
+    if (*dst == NULL && (*dst = latencyHistogramCreate()) == NULL) return;
+    hdr_add(*dst, h);
+}
+
+void latencyHistogramRecordCommand(struct redisCommand *cmd, long long us) {
+    int slot = MAX_EVENT_LOOPS;
+    if (serverTL != nullptr) {
+        ptrdiff_t idx = serverTL - g_pserver->rgthreadvar;
+        if (idx >= 0 && idx < MAX_EVENT_LOOPS) slot = (int)idx;
+    }
+    /* Threads without an event loop (modules) only run commands while
+     * holding the global lock, which serializes writers to the shared slot. */
+    latencyHistogramRecord(&cmd->latency_histogram[slot], &cmd->latency_histogram_epoch[slot], us);
+}
+
+void latencyHistogramRecordPhase(int phase, long long us) {
+    serverAssert(phase >= 0 && phase < LATENCY_PHASE_COUNT);
+    if (serverTL == nullptr) return;
+    latencyHistogramRecord(&serverTL->latency_phase_histogram[phase],
+        &serverTL->latency_phase_histogram_epoch[phase], us);
+}
+
+/* Called when a module command is unregistered. */
+void latencyHistogramFreeCommand(struct redisCommand *cmd) {
+    for (int i = 0; i <= MAX_EVENT_LOOPS; i++) {
+        if (cmd->latency_histogram[i]) hdr_close(cmd->latency_histogram[i]);
+        cmd->latency_histogram[i] = NULL;
+    }
+}
+
+/* Returns a newly allocated histogram with the samples of all the threads,
+ * or NULL if 'cmd' was never recorded. */
+static struct hdr_histogram *latencyHistogramMergeCommand(struct redisCommand *cmd) {
+    struct hdr_histogram *merged = NULL;
+    for (int i = 0; i <= MAX_EVENT_LOOPS; i++)
+        latencyHistogramMerge(&merged, &cmd->latency_histogram[i], &cmd->latency_histogram_epoch[i]);
+    return merged;
+}
+
+static struct hdr_histogram *latencyHistogramMergePhase(int phase) {
+    struct hdr_histogram *merged = NULL;
+    for (int i = 0; i < cserver.cthreads; i++)
+        latencyHistogramMerge(&merged, &g_pserver->rgthreadvar[i].latency_phase_histogram[phase],
+            &g_pserver->rgthreadvar[i].latency_phase_histogram_epoch[phase]);
+    latencyHistogramMerge(&merged, &g_pserver->modulethreadvar.latency_phase_histogram[phase],
+        &g_pserver->modulethreadvar.latency_phase_histogram_epoch[phase]);
+    return merged;
+}
+
+/* The histograms are still being written by their threads, see above. */
+void latencyHistogramResetAll(void) {
+    g_pserver->latency_histogram_epoch++;
+}
+
+static sds latencyHistogramCatPercentiles(sds info, struct hdr_histogram *h) {
+    return sdscatprintf(info, "p50=%lld,p99=%lld,p99.9=%lld,max=%lld,count=%lld\r\n",
+        (long long)hdr_value_at_percentile(h, 50.0),
+        (long long)hdr_value_at_percentile(h, 99.0),
+        (long long)hdr_value_at_percentile(h, 99.9),
+        (long long)hdr_max(h),
+        (long long)h->total_count);
+}
+
+/* The INFO latencystats section. */
+sds genLatencyStatsInfoString(sds info) {
+    dictIterator *di = dictGetSafeIterator(g_pserver->commands);
+    dictEntry *de;
+    while ((de = dictNext(di)) != NULL) {
+        struct redisCommand *cmd = (struct redisCommand*)dictGetVal(de);
+        struct hdr_histogram *h = latencyHistogramMergeCommand(cmd);
+        if (h == NULL) continue;
+        if (h->total_count > 0) {
+            char *tmpsafe;
+            info = sdscatprintf(info, "latency_percentiles_usec_%s:",
+                getSafeInfoString(cmd->name, strlen(cmd->name), &tmpsafe));
+            info = latencyHistogramCatPercentiles(info, h);
+            if (tmpsafe != NULL) zfree(tmpsafe);
+        }
+        hdr_close(h);
+    }
+    dictReleaseIterator(di);
+
+    for (int phase = 0; phase < LATENCY_PHASE_COUNT; phase++) {
+        struct hdr_histogram *h = latencyHistogramMergePhase(phase);
+        if (h == NULL) continue;
+        if (h->total_count > 0) {
+            info = sdscatprintf(info, "latency_phase_usec_%s:", latencyPhaseNames[phase]);
+            info = latencyHistogramCatPercentiles(info, h);
+        }
+        hdr_close(h);
+    }
+    return info;
+}
+
+/* Reply with the cumulative distribution of 'cmd', as a map of the upper
+ * bound (usec) of each power of two bucket to the count of calls at or
+ * below it. Returns 0 (and replies nothing) if there is no data. */
+static int latencyCommandReplyWithHistogram(client *c, struct redisCommand *cmd) {
+    struct hdr_histogram *h = latencyHistogramMergeCommand(cmd);
+    if (h == NULL) return 0;
+    if (h->total_count == 0) {
+        hdr_close(h);
+        return 0;
+    }
+
+    addReplyBulkCString(c, cmd->name);
+    addReplyMapLen(c, 2);
+    addReplyBulkCString(c, "calls");
+    addReplyLongLong(c, h->total_count);
+    addReplyBulkCString(c, "histogram_usec");
+    void *replylen = addReplyDeferredLen(c);
+    int buckets = 0;
+    struct hdr_iter iter;
+    hdr_iter_log_init(&iter, h, 1, 2);
+    int64_t prev = 0;
+    while (hdr_iter_next(&iter)) {
+        int64_t cumulative = iter.cumulative_count;
+        if (cumulative == prev) continue;
+        addReplyLongLong(c, iter.highest_equivalent_value);
+        addReplyLongLong(c, cumulative);
+        prev = cumulative;
+        buckets++;
+    }
+    setDeferredMapLen(c, replylen, buckets);
+    hdr_close(h);
+    return 1;
+}
+
+/* LATENCY HISTOGRAM [command ...] */
+void latencyCommandReplyWithHistograms(client *c) {
+    void *replylen = addReplyDeferredLen(c);
+    int commands = 0;
+
+    if (c->argc == 2) {
+        dictIterator *di = dictGetSafeIterator(g_pserver->commands);
+        dictEntry *de;
+        while ((de = dictNext(di)) != NULL)
+            commands += latencyCommandReplyWithHistogram(c, (struct redisCommand*)dictGetVal(de));
+        dictReleaseIterator(di);
+    } else {
+        for (int j = 2; j < c->argc; j++) {
+            struct redisCommand *cmd = lookupCommandByCString(szFromObj(c->argv[j]));
+            /* Unknown commands and commands without samples are skipped. */
+            if (cmd == NULL) continue;
+            commands += latencyCommandReplyWithHistogram(c, cmd);
+        }
+    }
+    setDeferredMapLen(c, replylen, commands);
+}
+
+/* LATENCY LOCKSTATS [RESET | <count>]: the <count> (default 10) call sites
+ * that held the global lock the longest, with their wait and hold times. */
+#define LATENCY_LOCKSTATS_DEFAULT_COUNT 10
+void latencyCommandReplyWithLockStats(client *c) {
+    long count = LATENCY_LOCKSTATS_DEFAULT_COUNT;
+
+    if (c->argc == 3 && !strcasecmp(szFromObj(c->argv[2]),"reset")) {
+        aeLockProfileReset();
+        addReply(c,shared.ok);
+        return;
+    }
+    if (c->argc == 3 &&
+        getRangeLongFromObjectOrReply(c,c->argv[2],1,LONG_MAX,&count,NULL) != C_OK)
+        return;
+
+    aeLockSiteReport *rgreport;
+    int creport = aeLockProfileReport(&rgreport);
+    std::sort(rgreport, rgreport + creport, [](const aeLockSiteReport &a, const aeLockSiteReport &b) {
+        return a.hold_us > b.hold_us;
+    });
+    if (count > creport) count = creport;
+
+    addReplyArrayLen(c,count);
+    for (long j = 0; j < count; j++) {
+        const aeLockSiteReport &report = rgreport[j];
+        addReplyMapLen(c,12);
+        addReplyBulkCString(c,"site");
+        addReplyBulkSds(c,sdscatprintf(sdsempty(),"%s (%s:%d)",report.func,report.file,report.line));
+        addReplyBulkCString(c,"threads");
+        addReplyLongLong(c,report.threads);
+        addReplyBulkCString(c,"acquisitions");
+        addReplyLongLong(c,report.acquisitions);
+        addReplyBulkCString(c,"contended");
+        addReplyLongLong(c,report.contended);
+        addReplyBulkCString(c,"wait_usec");
+        addReplyLongLong(c,report.wait_us);
+        addReplyBulkCString(c,"wait_p50_usec");
+        addReplyLongLong(c,aeHistPercentile(report.wait_hist,50.0));
+        addReplyBulkCString(c,"wait_p99_usec");
+        addReplyLongLong(c,aeHistPercentile(report.wait_hist,99.0));
+        addReplyBulkCString(c,"wait_max_usec");
+        addReplyLongLong(c,report.wait_max_us);
+        addReplyBulkCString(c,"hold_usec");
+        addReplyLongLong(c,report.hold_us);
+        addReplyBulkCString(c,"hold_p50_usec");
+        addReplyLongLong(c,aeHistPercentile(report.hold_hist,50.0));
+        addReplyBulkCString(c,"hold_p99_usec");
+        addReplyLongLong(c,aeHistPercentile(report.hold_hist,99.0));
+        addReplyBulkCString(c,"hold_max_usec");
+        addReplyLongLong(c,report.hold_max_us);
+    }
+    zfree(rgreport);
+}
+
 /* ---------------------- Latency command implementation -------------------- */
 
 /* latencyCommand() helper to produce a time-delay reply for all the samples
@@ -582,6 +837,8 @@ sds latencyCommandGenSparkeline(char *event, struct latencyTimeSeries *ts) {
  * LATENCY DOCTOR: returns a human readable analysis of instance latency.
  * LATENCY GRAPH: provide an ASCII graph of the latency of the specified event.
  * LATENCY RESET: reset data of a specified event or all the data if no event provided.
+ * LATENCY HISTOGRAM: return the latency distribution of the specified commands.
+ * LATENCY LOCKSTATS: report (or reset) the global lock wait/hold times per call site.
  */
 void latencyCommand(client *c) {
     struct latencyTimeSeries *ts;
@@ -628,16 +885,28 @@ void latencyCommand(client *c) {
                 resets += latencyResetEvent(szFromObj(c->argv[j]));
             addReplyLongLong(c,resets);
         }
+    } else if (!strcasecmp(szFromObj(c->argv[1]),"histogram") && c->argc >= 2) {
+        /* LATENCY HISTOGRAM [command ...] */
+        latencyCommandReplyWithHistograms(c);
+    } else if (!strcasecmp(szFromObj(c->argv[1]),"lockstats") && c->argc <= 3) {
+        /* LATENCY LOCKSTATS [RESET | <count>] */
+        latencyCommandReplyWithLockStats(c);
     } else if (!strcasecmp(szFromObj(c->argv[1]),"help") && c->argc == 2) {
         const char *help[] = {
 "DOCTOR",
 "    Return a human readable latency analysis report.",
 "GRAPH <event>",
 "    Return an ASCII latency graph for the <event> class.",
+"HISTOGRAM [<command> ...]",
+"    Return the cumulative latency distribution (usec) of the given commands.",
+"    (default: all the commands with samples)",
 "HISTORY <event>",
 "    Return time-latency samples for the <event> class.",
 "LATEST",
 "    Return the latest latency samples for all events.",
+"LOCKSTATS [RESET | <count>]",
+"    Return the <count> (default 10) call sites holding the global lock the",
+"    longest, with their wait and hold times (usec). RESET clears them.",
 "RESET [<event> ...]",
 "    Reset latency data of one or more <event> classes.",
 "    (default: reset all data for all event classes)",
@@ -70,6 +70,22 @@ void latencyAddSample(const char *event, mstime_t latency);
 int THPIsEnabled(void);
 int THPDisable(void);
 
+/* Per command latency histograms. Each command is further split into the
+ * phases below, every thread records into its own histograms and readers
+ * merge them on demand. All the values are in microseconds. */
+#define LATENCY_PHASE_QUEUE 0   /* Parsed -> dispatched (waiting on the pipeline) */
+#define LATENCY_PHASE_LOCK 1    /* Waiting to acquire the global lock */
+#define LATENCY_PHASE_EXECUTE 2 /* Inside the command implementation */
+#define LATENCY_PHASE_WRITE 3   /* Reply queued -> reply fully written */
+#define LATENCY_PHASE_COUNT 4
+
+struct redisCommand;
+void latencyHistogramRecordCommand(struct redisCommand *cmd, long long us);
+void latencyHistogramRecordPhase(int phase, long long us);
+void latencyHistogramFreeCommand(struct redisCommand *cmd);
+void latencyHistogramResetAll(void);
+sds genLatencyStatsInfoString(sds info);
+
 /* Latency monitoring macros. */
 
 /* Start monitoring an event. We just set the current time. */
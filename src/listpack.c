@@ -629,6 +629,52 @@ unsigned char *lpGet(unsigned char *p, int64_t *count, unsigned char *intbuf) {
     }
 }
 
+/* Find the element equal to the string 's' of length 'slen' starting at 'p',
+ * comparing one element every 'skip'+1 ones (so skip=1 only looks at the
+ * keys of a key/value listpack). Returns the matching element or NULL.
+ *
+ * Unlike a lpNext() loop this does not fully validate every entry it walks:
+ * only the entries close enough to the end of the listpack for their header
+ * to reach past it are, the others are just bounds checked. Integers are
+ * compared as numbers instead of being converted to strings. */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s, uint32_t slen, unsigned int skip) {
+    unsigned int skipcnt = 0;
+    int vencoding = 0;  /* 0: not tried yet, 1: 's' is an integer, -1: it is not. */
+    int64_t ll, vll = 0;
+    uint32_t lp_bytes = lpBytes(lp);
+
+    assert(p);
+    while (1) {
+        if (skipcnt == 0) {
+            unsigned char *value = lpGet(p, &ll, NULL);
+            if (value) {
+                if ((int64_t)slen == ll && memcmp(value, s, slen) == 0) return p;
+            } else {
+                if (vencoding == 0) {
+                    if (slen >= 32 || slen == 0 || !lpStringToInt64((const char*)s, slen, &vll))
+                        vencoding = -1;
+                    else
+                        vencoding = 1;
+                }
+                if (vencoding == 1 && ll == vll) return p;
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+        p = lpSkip(p);
+
+        /* lpGet() reads at most 9 header bytes past 'p', only entries that
+         * close to the end need the slower full validation. */
+        if (p + 9 >= lp + lp_bytes)
+            lpAssertValidEntry(lp, lp_bytes, p);
+        else
+            assert(p >= lp + LP_HDR_SIZE && p < lp + lp_bytes);
+        if (p[0] == LP_EOF) break;
+    }
+    return NULL;
+}
+
 /* Insert, delete or replace the specified element 'ele' of length 'len' at
  * the specified position 'p', with 'p' being a listpack element pointer
  * obtained with lpFirst(), lpLast(), lpNext(), lpPrev() or lpSeek().
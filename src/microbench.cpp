@@ -0,0 +1,1007 @@
+/* Micro-benchmarks of the core data structures.
+ *
+ *   keydb-server bench <group|all|list> [--runs N] [--warmup N] [--time ms] [--json]
+ *
+ * Every case is a loop over one primitive. The iteration count is first
+ * calibrated so that a run lasts about --time milliseconds, then --warmup runs
+ * are thrown away and --runs runs are timed. The median time per operation is
+ * reported together with its median absolute deviation (MAD), which unlike the
+ * mean and standard deviation is not dragged around by the odd run that got
+ * preempted. With --json the raw samples are printed too, so two builds can
+ * be compared offline. */
+
+#include "server.h"
+#include "listpack.h"
+#include "aclmatch.h"
+#include "crc64.h"
+#include "t_nhash.h"
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <sys/resource.h>
+
+/* Not exported by hyperloglog.cpp and networking.cpp */
+#define BENCH_HLL_REGISTERS 16384
+struct hllhdr;
+robj *createHLLObject(void);
+int hllAdd(robj *o, unsigned char *ele, size_t elesize);
+int hllMerge(uint8_t *max, size_t cmax, robj_roptr hll);
+int hllSparseToDense(robj *o);
+uint64_t hllCount(struct hllhdr *hdr, int *invalid);
+int processMultibulkBuffer(client *c);
+
+struct benchOptions {
+    int runs = 10;
+    int warmup = 2;
+    long long target_ns = 50*1000*1000LL;
+    bool json = false;
+};
+
+struct benchResult {
+    std::string group;
+    std::string name;
+    long long iterations;           /* Per run */
+    std::vector<double> samples;    /* ns per operation, one per run */
+    double median, mad, min, max;
+};
+
+/* Keeps the compiler from optimizing the measured work away. */
+static volatile uint64_t benchSink;
+
+typedef std::function<void(long long)> benchBody;
+
+static long long benchTime(const benchBody &body, long long n) {
+    auto start = std::chrono::steady_clock::now();
+    body(n);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count();
+}
+
+static double benchMedian(std::vector<double> v) {
+    std::sort(v.begin(),v.end());
+    size_t n = v.size();
+    return (n % 2) ? v[n/2] : (v[n/2-1]+v[n/2])/2;
+}
+
+class benchContext {
+public:
+    benchOptions opt;
+    std::vector<benchResult> results;
+    const char *group = "";
+
+    void run(const char *name, const benchBody &body) {
+        /* Calibrate: grow n until a run is long enough to be measured
+         * reliably, then scale it to the target duration. */
+        long long n = 1, ns = 0;
+        while (n < (1LL<<40)) {
+            ns = benchTime(body,n);
+            if (ns >= opt.target_ns/8) break;
+            n *= 2;
+        }
+        ns = std::min(ns, benchTime(body,n));   /* The first runs are often cold */
+        n = std::max(1LL, (long long)((double)n * opt.target_ns / std::max(ns,1LL)));
+
+        for (int i = 0; i < opt.warmup; i++) benchTime(body,n);
+
+        benchResult r;
+        r.group = group;
+        r.name = name;
+        r.iterations = n;
+        for (int i = 0; i < opt.runs; i++)
+            r.samples.push_back((double)benchTime(body,n) / n);
+        r.median = benchMedian(r.samples);
+        std::vector<double> dev;
+        for (double s : r.samples) dev.push_back(fabs(s - r.median));
+        r.mad = benchMedian(dev);
+        r.min = *std::min_element(r.samples.begin(),r.samples.end());
+        r.max = *std::max_element(r.samples.begin(),r.samples.end());
+        if (!opt.json) {
+            printf("%-28s %10.2f ns/op  +/- %7.2f (%4.1f%%)  min %10.2f  %12.0f ops/sec\n",
+                name, r.median, r.mad, r.median > 0 ? r.mad*100/r.median : 0,
+                r.min, r.median > 0 ? 1e9/r.median : 0);
+            fflush(stdout);
+        }
+        results.push_back(std::move(r));
+    }
+};
+
+/* Cheap deterministic scrambling of a loop counter into an index. */
+static inline uint64_t benchMix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/* -------------------------------------------------------------------------
+ * dict
+ * ---------------------------------------------------------------------- */
+
+static dict *benchBuildDict(std::vector<sds> &keys, long count) {
+    dict *d = dictCreate(&setDictType,NULL);
+    for (long i = 0; i < count; i++) {
+        sds key = sdscatprintf(sdsempty(),"key:%ld",i);
+        dictAdd(d,key,NULL);
+        keys.push_back(key);
+    }
+    while (dictIsRehashing(d)) dictRehashMilliseconds(d,100);
+    return d;
+}
+
+static void benchDict(benchContext &ctx) {
+    for (long count : {1000L, 1000000L}) {
+        std::vector<sds> keys;
+        dict *d = benchBuildDict(keys,count);
+        std::string name = std::string("dict-find-hit-") + (count == 1000 ? "1k" : "1m");
+        ctx.run(name.c_str(), [&](long long n) {
+            uint64_t found = 0;
+            for (long long i = 0; i < n; i++)
+                found += dictFind(d,keys[benchMix(i) % count]) != NULL;
+            benchSink += found;
+        });
+        if (count == 1000000) {
+            std::vector<sds> missing;
+            for (long i = 0; i < 4096; i++)
+                missing.push_back(sdscatprintf(sdsempty(),"missing:%ld",i));
+            ctx.run("dict-find-miss-1m", [&](long long n) {
+                uint64_t found = 0;
+                for (long long i = 0; i < n; i++)
+                    found += dictFind(d,missing[i & 4095]) != NULL;
+                benchSink += found;
+            });
+            /* The dict keeps its size so no resize is ever measured. The
+             * key is owned (and freed) by the dict once added. */
+            ctx.run("dict-add-delete-1m", [&](long long n) {
+                for (long long i = 0; i < n; i++) {
+                    sds key = missing[i & 4095];
+                    dictAdd(d,sdsdup(key),NULL);
+                    dictDelete(d,key);
+                }
+            });
+            for (sds s : missing) sdsfree(s);
+        }
+        dictRelease(d);     /* Frees the keys as well */
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * sds
+ * ---------------------------------------------------------------------- */
+
+static void benchSds(benchContext &ctx) {
+    const char payload[] = "0123456789abcdef";
+    ctx.run("sds-new-free-16b", [&](long long n) {
+        for (long long i = 0; i < n; i++) {
+            sds s = sdsnewlen(payload,16);
+            benchSink += s[0];
+            sdsfree(s);
+        }
+    });
+    sds grow = sdsempty();
+    ctx.run("sds-catlen-16b", [&](long long n) {
+        for (long long i = 0; i < n; i++) {
+            if (sdslen(grow) >= 64*1024) sdsclear(grow);
+            grow = sdscatlen(grow,payload,16);
+        }
+    });
+    sdsfree(grow);
+    sds src = sdsnewlen(SDS_NOINIT,1024);
+    memset(src,'x',1024);
+    sds dst = sdsempty();
+    ctx.run("sds-cpy-range-1k", [&](long long n) {
+        for (long long i = 0; i < n; i++) {
+            dst = sdscpylen(dst,src,1024);
+            sdsrange(dst,i & 511,-1);
+        }
+    });
+    sdsfree(src);
+    sdsfree(dst);
+    ctx.run("sds-fromlonglong", [&](long long n) {
+        for (long long i = 0; i < n; i++) {
+            sds s = sdsfromlonglong(i*7919);
+            benchSink += sdslen(s);
+            sdsfree(s);
+        }
+    });
+    sds a = sdsnew("user:1000:profile:name"), b = sdsnew("user:1000:profile:nbme");
+    ctx.run("sds-cmp-22b", [&](long long n) {
+        int acc = 0;
+        for (long long i = 0; i < n; i++) acc += sdscmp(a,b);
+        benchSink += acc;
+    });
+    sdsfree(a);
+    sdsfree(b);
+}
+
+/* -------------------------------------------------------------------------
+ * ziplist / listpack
+ * ---------------------------------------------------------------------- */
+
+#define BENCH_SMALL_ENTRIES 128
+
+static void benchZiplist(benchContext &ctx) {
+    unsigned char value[16];
+    memset(value,'v',sizeof(value));
+    for (int where : {ZIPLIST_TAIL, ZIPLIST_HEAD}) {
+        ctx.run(where == ZIPLIST_TAIL ? "ziplist-push-tail-128" : "ziplist-push-head-128", [&](long long n) {
+            unsigned char *zl = ziplistNew();
+            for (long long i = 0; i < n; i++) {
+                if (i % BENCH_SMALL_ENTRIES == 0) {
+                    zfree(zl);
+                    zl = ziplistNew();
+                }
+                zl = ziplistPush(zl,value,sizeof(value),where);
+            }
+            zfree(zl);
+        });
+    }
+    unsigned char *zl = ziplistNew();
+    for (int i = 0; i < BENCH_SMALL_ENTRIES; i++) {
+        char buf[32];
+        int len = snprintf(buf,sizeof(buf),"field:%d",i);
+        zl = ziplistPush(zl,(unsigned char*)buf,len,ZIPLIST_TAIL);
+    }
+    ctx.run("ziplist-find-128", [&](long long n) {
+        uint64_t found = 0;
+        for (long long i = 0; i < n; i++) {
+            char buf[32];
+            int len = snprintf(buf,sizeof(buf),"field:%d",(int)(benchMix(i) % BENCH_SMALL_ENTRIES));
+            found += ziplistFind(zl,ziplistIndex(zl,0),(unsigned char*)buf,len,0) != NULL;
+        }
+        benchSink += found;
+    });
+    zfree(zl);
+}
+
+static void benchListpack(benchContext &ctx) {
+    unsigned char value[16];
+    memset(value,'v',sizeof(value));
+    ctx.run("listpack-append-128", [&](long long n) {
+        unsigned char *lp = lpNew(0);
+        for (long long i = 0; i < n; i++) {
+            if (i % BENCH_SMALL_ENTRIES == 0) {
+                lpFree(lp);
+                lp = lpNew(0);
+            }
+            lp = lpAppend(lp,value,sizeof(value));
+        }
+        lpFree(lp);
+    });
+    ctx.run("listpack-insert-head-128", [&](long long n) {
+        unsigned char *lp = lpNew(0);
+        for (long long i = 0; i < n; i++) {
+            if (i % BENCH_SMALL_ENTRIES == 0) {
+                lpFree(lp);
+                lp = lpAppend(lpNew(0),value,sizeof(value));
+            }
+            lp = lpInsert(lp,value,sizeof(value),lpFirst(lp),LP_BEFORE,NULL);
+        }
+        lpFree(lp);
+    });
+    unsigned char *lp = lpNew(0);
+    for (int i = 0; i < BENCH_SMALL_ENTRIES; i++) lp = lpAppend(lp,value,sizeof(value));
+    ctx.run("listpack-iterate-128", [&](long long n) {
+        uint64_t acc = 0;
+        for (long long i = 0; i < n; i += BENCH_SMALL_ENTRIES) {
+            for (unsigned char *p = lpFirst(lp); p; p = lpNext(lp,p)) {
+                int64_t len;
+                unsigned char intbuf[LP_INTBUF_SIZE];
+                acc += lpGet(p,&len,intbuf)[0];
+            }
+        }
+        benchSink += acc;
+    });
+    lpFree(lp);
+}
+
+/* -------------------------------------------------------------------------
+ * skiplist
+ * ---------------------------------------------------------------------- */
+
+static void benchSkiplist(benchContext &ctx) {
+    const long count = 1000000;
+    zskiplist *zsl = zslCreate();
+    for (long i = 0; i < count; i++)
+        zslInsert(zsl,(double)i,sdscatprintf(sdsempty(),"member:%ld",i));
+
+    ctx.run("zsl-range-100-of-1m", [&](long long n) {
+        uint64_t acc = 0;
+        for (long long i = 0; i < n; i++) {
+            zrangespec range;
+            range.min = (double)(benchMix(i) % (count-100));
+            range.max = range.min + 99;
+            range.minex = range.maxex = 0;
+            zskiplistNode *node = zslFirstInRange(zsl,&range);
+            for (int j = 0; node && j < 100; j++) {
+                acc += sdslen(node->ele);
+                node = node->level(0)->forward;
+            }
+        }
+        benchSink += acc;
+    });
+    sds member = sdsnew("member:new");
+    ctx.run("zsl-insert-delete-1m", [&](long long n) {
+        for (long long i = 0; i < n; i++) {
+            double score = (double)(benchMix(i) % count) + 0.5;
+            zslInsert(zsl,score,sdsdup(member));
+            zslDelete(zsl,score,member,NULL);
+        }
+    });
+    sdsfree(member);
+    zslFree(zsl);
+}
+
+/* -------------------------------------------------------------------------
+ * HyperLogLog
+ * ---------------------------------------------------------------------- */
+
+static void benchHll(benchContext &ctx) {
+    robj *hll = createHLLObject();
+    hllSparseToDense(hll);
+    ctx.run("hll-add-dense", [&](long long n) {
+        for (long long i = 0; i < n; i++) {
+            uint64_t ele = benchMix(i);
+            hllAdd(hll,(unsigned char*)&ele,sizeof(ele));
+        }
+    });
+    ctx.run("hll-count-dense", [&](long long n) {
+        int invalid = 0;
+        uint64_t acc = 0;
+        for (long long i = 0; i < n; i++)
+            acc += hllCount((struct hllhdr*)ptrFromObj(hll),&invalid);
+        benchSink += acc;
+    });
+    std::vector<uint8_t> max(BENCH_HLL_REGISTERS);
+    ctx.run("hll-merge-dense", [&](long long n) {
+        for (long long i = 0; i < n; i++) hllMerge(max.data(),max.size(),hll);
+        benchSink += max[0];
+    });
+    decrRefCount(hll);
+}
+
+/* -------------------------------------------------------------------------
+ * RESP parsing
+ * ---------------------------------------------------------------------- */
+
+static void benchRespCase(benchContext &ctx, const char *name, int argc, const char **argv) {
+    client *c = new client;
+    c->querybuf = sdsempty();
+    for (int j = -1; j < argc; j++) {
+        if (j < 0) c->querybuf = sdscatprintf(c->querybuf,"*%d\r\n",argc);
+        else c->querybuf = sdscatprintf(c->querybuf,"$%d\r\n%s\r\n",(int)strlen(argv[j]),argv[j]);
+    }
+    c->qb_pos = 0;
+    c->argc = 0;
+    c->multibulklen = 0;
+    c->bulklen = -1;
+    c->flags = 0;
+    c->authenticated = 1;
+    /* Parse and then free the arguments the way the server does after
+     * executing a command, through the argument pools of the thread. */
+    ctx.run(name, [&](long long n) {
+        for (long long i = 0; i < n; i++) {
+            c->qb_pos = 0;
+            processMultibulkBuffer(c);
+            auto &cmd = c->vecqueuedcmd.front();
+            for (int j = 0; j < cmd.argc; j++) argvPoolRelease(cmd.argv[j]);
+            cmd.argc = 0;
+            c->vecqueuedcmd.clear();
+        }
+    });
+    sdsfree(c->querybuf);
+    delete c;
+}
+
+static void benchResp(benchContext &ctx) {
+    serverTL = &g_pserver->rgthreadvar[IDX_EVENT_LOOP_MAIN];
+    const char *get[] = {"GET","key:000000001234"};
+    benchRespCase(ctx,"resp-parse-get",2,get);
+    const char *set[] = {"SET","key:000000001234","xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"};
+    benchRespCase(ctx,"resp-parse-set-64b",3,set);
+    const char *mset[21] = {"MSET"};
+    std::vector<std::string> args;
+    for (int j = 0; j < 20; j++) args.push_back("key:" + std::to_string(j));
+    for (int j = 0; j < 20; j++) mset[j+1] = args[j].c_str();
+    benchRespCase(ctx,"resp-parse-mset-10",21,mset);
+}
+
+/* -------------------------------------------------------------------------
+ * Command lookup
+ * ---------------------------------------------------------------------- */
+
+/* The command dict lookup lookupCommand() used to do against the perfect
+ * hash it does now, over a mix of names as clients send them. */
+static void benchCmdLookup(benchContext &ctx) {
+    const char *names[] = {"GET","set","HGETALL","zadd","Publish","xreadgroup","ping","nosuchcmd"};
+    const size_t count = sizeof(names)/sizeof(names[0]);
+    std::vector<sds> sdsnames;
+    for (const char *name : names) sdsnames.push_back(sdsnew(name));
+    ctx.run("cmd-lookup-dict", [&](long long n) {
+        uint64_t acc = 0;
+        for (long long i = 0; i < n; i++)
+            acc += (uintptr_t)dictFetchValue(g_pserver->commands,sdsnames[i % count]);
+        benchSink += acc;
+    });
+    ctx.run("cmd-lookup-perfect-hash", [&](long long n) {
+        uint64_t acc = 0;
+        for (long long i = 0; i < n; i++)
+            acc += (uintptr_t)lookupCommand(sdsnames[i % count]);
+        benchSink += acc;
+    });
+    for (sds name : sdsnames) sdsfree(name);
+}
+
+/* -------------------------------------------------------------------------
+ * fastlock
+ * ---------------------------------------------------------------------- */
+
+static void benchFastlock(benchContext &ctx) {
+    fastlock lock("bench");
+    ctx.run("fastlock-uncontended", [&](long long n) {
+        for (long long i = 0; i < n; i++) {
+            fastlock_lock(&lock);
+            fastlock_unlock(&lock);
+        }
+    });
+    /* A second thread hammers the same lock while we measure. With a single
+     * CPU the ticket lock degenerates into one context switch per handoff
+     * (after a full spin), so the numbers would be meaningless. */
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        if (!ctx.opt.json) printf("%-28s skipped, needs at least 2 CPUs\n", "fastlock-contended-2t");
+        return;
+    }
+    std::atomic<bool> stop {false};
+    std::thread other([&] {
+        while (!stop.load(std::memory_order_relaxed)) {
+            fastlock_lock(&lock);
+            fastlock_unlock(&lock);
+        }
+    });
+    ctx.run("fastlock-contended-2t", [&](long long n) {
+        for (long long i = 0; i < n; i++) {
+            fastlock_lock(&lock);
+            fastlock_unlock(&lock);
+        }
+    });
+    stop = true;
+    other.join();
+}
+
+/* -------------------------------------------------------------------------
+ * lockstress
+ * ---------------------------------------------------------------------- */
+
+static const char *benchPolicyName(int policy) {
+    switch (policy) {
+    case FASTLOCK_POLICY_ADAPTIVE: return "adaptive";
+    case FASTLOCK_POLICY_QUEUED: return "queued";
+    default: return "fixed";
+    }
+}
+
+static double benchCpuSeconds(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF,&ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6;
+}
+
+/* Every thread takes the lock, touches a few shared cache lines as the
+ * critical section and does some private work before the next round, so the
+ * lock is hot but not held all the time. The ns/op are per acquisition of the
+ * measuring thread; with a ticket lock every thread gets its turn, so the
+ * aggregate throughput is threads times the reported ops/sec. The cores line
+ * is the CPU the process burned while measuring, that is the cost of
+ * spinning: it should drop when the threads outnumber the CPUs. */
+static void benchLockstress(benchContext &ctx) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    std::vector<int> threadCounts {2, 4};
+    if (cpus*2 > 4) threadCounts.push_back(cpus*2);
+    for (int threads : threadCounts) {
+        for (int policy : {FASTLOCK_POLICY_FIXED, FASTLOCK_POLICY_ADAPTIVE, FASTLOCK_POLICY_QUEUED}) {
+            std::string name = std::string("lockstress-") + benchPolicyName(policy) + "-" +
+                std::to_string(threads) + "t";
+            /* A fixed policy waiter spins about a million times before it
+             * parks, with fewer CPUs than threads that is a preempted owner
+             * away from every single handoff. */
+            if (policy == FASTLOCK_POLICY_FIXED && cpus < threads) {
+                if (!ctx.opt.json) printf("%-28s skipped, needs at least %d CPUs\n", name.c_str(), threads);
+                continue;
+            }
+            fastlock_set_policy(policy);
+            fastlock lock("lockstress");
+            uint64_t shared[32] = {0};
+            auto round = [&](uint64_t i) {
+                fastlock_lock(&lock);
+                for (int j = 0; j < 32; j += 8) shared[j] += i;
+                fastlock_unlock(&lock);
+                uint64_t x = i;
+                for (int j = 0; j < 16; j++) x = benchMix(x);
+                benchSink += x;
+            };
+            std::atomic<bool> stop {false};
+            std::vector<std::thread> others;
+            for (int t = 1; t < threads; t++) {
+                others.emplace_back([&, t] {
+                    for (uint64_t i = t; !stop.load(std::memory_order_relaxed); i++) round(i);
+                });
+            }
+            double cpu = benchCpuSeconds();
+            auto start = std::chrono::steady_clock::now();
+            ctx.run(name.c_str(), [&](long long n) {
+                for (long long i = 0; i < n; i++) round(i);
+            });
+            std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+            cpu = benchCpuSeconds() - cpu;
+            stop = true;
+            for (auto &t : others) t.join();
+            if (!ctx.opt.json) printf("%-28s %10.2f cores\n", "", wall.count() > 0 ? cpu/wall.count() : 0);
+            benchSink += shared[0];
+        }
+    }
+    fastlock_set_policy(FASTLOCK_POLICY_FIXED);
+}
+
+/* -------------------------------------------------------------------------
+ * serializeStoredObject
+ * ---------------------------------------------------------------------- */
+
+static void benchSerialize(benchContext &ctx) {
+    robj *str = createStringObject("xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx",64);
+    ctx.run("serialize-string-64b", [&](long long n) {
+        for (long long i = 0; i < n; i++) {
+            sds s = serializeStoredObject(str);
+            benchSink += sdslen(s);
+            sdsfree(s);
+        }
+    });
+    decrRefCount(str);
+
+    robj *hash = createHashObject();
+    for (int j = 0; j < 32; j++) {
+        sds field = sdscatprintf(sdsempty(),"field:%d",j);
+        sds value = sdscatprintf(sdsempty(),"value:%d",j*7919);
+        hashTypeSet(hash,field,value,HASH_SET_TAKE_FIELD|HASH_SET_TAKE_VALUE);
+    }
+    ctx.run("serialize-hash-ziplist-32", [&](long long n) {
+        for (long long i = 0; i < n; i++) {
+            sds s = serializeStoredObject(hash);
+            benchSink += sdslen(s);
+            sdsfree(s);
+        }
+    });
+    decrRefCount(hash);
+}
+
+/* -------------------------------------------------------------------------
+ * crc64
+ * ---------------------------------------------------------------------- */
+
+static void benchCrc64(benchContext &ctx) {
+    std::vector<unsigned char> buf(1<<20);
+    for (size_t j = 0; j < buf.size(); j++) buf[j] = (unsigned char)benchMix(j);
+    static const struct {
+        const char *name;
+        uint64_t (*fn)(uint64_t, const unsigned char*, uint64_t);
+    } impls[] = {
+        {"slice8", crc64_slice8},
+        {"slice8x3", crc64_interleaved},
+        {"pclmul", crc64_pclmul},
+    };
+    for (size_t len : {64, 1024, 65536, 1<<20}) {
+        for (auto &impl : impls) {
+            if (impl.fn == crc64_pclmul && !crc64_pclmul_supported()) continue;
+            char name[64];
+            snprintf(name,sizeof(name),"crc64-%s-%zu",impl.name,len);
+            ctx.run(name, [&](long long n) {
+                uint64_t crc = 0;
+                for (long long i = 0; i < n; i++) crc = impl.fn(crc,buf.data(),len);
+                benchSink += crc;
+            });
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * RDB save/load
+ * ---------------------------------------------------------------------- */
+
+static void benchRdbUpdateChecksumSlice8(rio *r, const void *buf, size_t len) {
+    r->cksum = crc64_slice8(r->cksum,(const unsigned char*)buf,len);
+}
+
+/* Serialize and load back 64 string values through a checksummed memory
+ * rio, once with the checksum crc64() picks (see crc64_implementation())
+ * and once with the slice-by-8 table it used to be limited to. Compression
+ * is off so the checksum is not hidden behind LZF. */
+static void benchRdbCase(benchContext &ctx, size_t valuelen) {
+    const int count = 64;
+    std::vector<robj*> values;
+    for (int j = 0; j < count; j++) {
+        sds s = sdsnewlen(SDS_NOINIT,valuelen);
+        for (size_t k = 0; k < valuelen; k++) s[k] = (char)benchMix(j*valuelen+k);
+        values.push_back(createObject(OBJ_STRING,s));
+    }
+    int compression = g_pserver->rdb_compression;
+    g_pserver->rdb_compression = 0;
+    sds key = sdsnew("key");
+
+    for (int slice8 = 0; slice8 < 2; slice8++) {
+        auto update = slice8 ? benchRdbUpdateChecksumSlice8 : rioGenericUpdateChecksum;
+        const char *impl = slice8 ? "slice8" : crc64_implementation();
+        sds payload = sdsempty();
+        char name[64];
+        snprintf(name,sizeof(name),"rdb-save-%zub-%s",valuelen,impl);
+        ctx.run(name, [&](long long n) {
+            for (long long i = 0; i < n; i++) {
+                rio r;
+                sdsclear(payload);
+                rioInitWithBuffer(&r,payload);
+                r.update_cksum = update;
+                for (robj *o : values) {
+                    rdbSaveObjectType(&r,o);
+                    rdbSaveObject(&r,o,nullptr);
+                }
+                payload = r.io.buffer.ptr;
+                benchSink += r.cksum;
+            }
+        });
+        snprintf(name,sizeof(name),"rdb-load-%zub-%s",valuelen,impl);
+        ctx.run(name, [&](long long n) {
+            for (long long i = 0; i < n; i++) {
+                rio r;
+                rioInitWithBuffer(&r,payload);
+                r.update_cksum = update;
+                for (int j = 0; j < count; j++) {
+                    int error;
+                    robj *o = rdbLoadObject(rdbLoadObjectType(&r),&r,key,&error,0);
+                    decrRefCount(o);
+                }
+                benchSink += r.cksum;
+            }
+        });
+        sdsfree(payload);
+    }
+    sdsfree(key);
+    g_pserver->rdb_compression = compression;
+    for (robj *o : values) decrRefCount(o);
+}
+
+static void benchRdb(benchContext &ctx) {
+    serverTL = &g_pserver->rgthreadvar[IDX_EVENT_LOOP_MAIN];
+    benchRdbCase(ctx,1024);
+    benchRdbCase(ctx,65536);
+}
+
+/* -------------------------------------------------------------------------
+ * RDB string compression
+ * ---------------------------------------------------------------------- */
+
+/* Values shaped like what usually ends up in string keys: JSON records,
+ * natural language text, and random bytes that don't compress at all. */
+static std::vector<robj*> benchCompressValues(const char *kind, int count, size_t valuelen) {
+    static const char *words[] = {"the","of","and","to","in","is","was","that","for","on",
+        "with","as","by","at","from","his","her","they","which","were","this","time",
+        "people","year","would","about","there","could","after","system","network"};
+    std::vector<robj*> values;
+    for (int j = 0; j < count; j++) {
+        sds s = sdsempty();
+        uint64_t seed = (uint64_t)j << 32;
+        while (sdslen(s) < valuelen) {
+            uint64_t x = benchMix(seed++);
+            if (!strcmp(kind,"json")) {
+                s = sdscatprintf(s,"{\"id\":%llu,\"user\":\"user%llu\",\"active\":%s,"
+                    "\"score\":%llu.%02llu,\"tags\":[\"%s\",\"%s\"]},",
+                    (unsigned long long)(x % 1000000), (unsigned long long)(x % 5000),
+                    (x & 1) ? "true" : "false", (unsigned long long)(x % 100),
+                    (unsigned long long)((x >> 8) % 100),
+                    words[(x >> 16) % 31], words[(x >> 24) % 31]);
+            } else if (!strcmp(kind,"text")) {
+                s = sdscat(s,words[x % 31]);
+                s = sdscat(s,(x >> 8) % 11 ? " " : ". ");
+            } else {
+                s = sdscatlen(s,&x,sizeof(x));
+            }
+        }
+        sdsrange(s,0,valuelen-1);
+        values.push_back(createObject(OBJ_STRING,s));
+    }
+    return values;
+}
+
+/* Save and load back a set of string values with every compression
+ * algorithm this build supports, and report the payload size. */
+static void benchRdbCompressCase(benchContext &ctx, const char *kind, int count, size_t valuelen) {
+    static const char *algorithms[] = {"lzf","lz4","zstd"};
+    std::vector<robj*> values = benchCompressValues(kind,count,valuelen);
+    int compression = g_pserver->rdb_compression;
+    g_pserver->rdb_compression = 1;
+    sds key = sdsnew("key");
+
+    for (int algorithm = RDB_COMPRESSION_LZF; algorithm <= RDB_COMPRESSION_ZSTD; algorithm++) {
+        if (!rdbCompressionSupported(algorithm)) continue;
+        sds payload = sdsempty();
+        char name[64];
+        snprintf(name,sizeof(name),"save-%s-%zub-%s",kind,valuelen,algorithms[algorithm]);
+        ctx.run(name, [&](long long n) {
+            for (long long i = 0; i < n; i++) {
+                rio r;
+                sdsclear(payload);
+                rioInitWithBuffer(&r,payload);
+                r.compression = algorithm;
+                for (robj *o : values) rdbSaveObject(&r,o,nullptr);
+                payload = r.io.buffer.ptr;
+            }
+        });
+        snprintf(name,sizeof(name),"load-%s-%zub-%s",kind,valuelen,algorithms[algorithm]);
+        ctx.run(name, [&](long long n) {
+            for (long long i = 0; i < n; i++) {
+                rio r;
+                rioInitWithBuffer(&r,payload);
+                for (int j = 0; j < count; j++) {
+                    int error;
+                    robj *o = rdbLoadObject(RDB_TYPE_STRING,&r,key,&error,0);
+                    decrRefCount(o);
+                }
+            }
+        });
+        if (!ctx.opt.json) {
+            printf("%-28s %10zu bytes (%5.1f%% of %zu)\n", "  size", sdslen(payload),
+                sdslen(payload)*100.0/(count*valuelen), count*valuelen);
+        }
+        sdsfree(payload);
+    }
+    sdsfree(key);
+    g_pserver->rdb_compression = compression;
+    for (robj *o : values) decrRefCount(o);
+}
+
+static void benchRdbCompress(benchContext &ctx) {
+    serverTL = &g_pserver->rgthreadvar[IDX_EVENT_LOOP_MAIN];
+    benchRdbCompressCase(ctx,"json",64,1024);
+    benchRdbCompressCase(ctx,"text",16,16384);
+    benchRdbCompressCase(ctx,"random",64,1024);
+}
+
+/* -------------------------------------------------------------------------
+ * Nested hashes
+ * ---------------------------------------------------------------------- */
+
+/* 1024 JSON-like documents: every level is an object with six short string
+ * fields and a child object "c", five levels deep. A path of depth d has d
+ * components, e.g. depth 3 is "doc:<n>.c.f3", and depth 1 is a string stored
+ * at the top level. KEYDB.NHGET and KEYDB.NHSET resolve such paths through
+ * fetchFromKey() and setWithKey(), which is what is measured here, with every
+ * object a dict (the default) or with the innermost objects, which only hold
+ * strings, as listpacks. Every field gets its own value object, as it would
+ * from KEYDB.NHSET, so the memory per document compares the encodings. */
+static void benchNhashCase(benchContext &ctx, const char *encoding, size_t maxentries) {
+    const int ndocs = 1024, depth = 6;
+    size_t maxentriesSave = g_pserver->nested_hash_max_listpack_entries;
+    g_pserver->nested_hash_max_listpack_entries = maxentries;
+
+    redisDb *db = new (MALLOC_LOCAL) redisDb();
+    db->initialize(0);
+    robj *val = createStringObject("value:0123456789",16);
+    size_t used = zmalloc_used_memory();
+    for (int i = 0; i < ndocs; i++) {
+        std::string prefix = "doc:" + std::to_string(i);
+        for (int d = 2; d <= depth; d++) {
+            for (int f = 0; f < 6; f++) {
+                std::string path = prefix + ".f" + std::to_string(f);
+                robj *o = createStringObject(path.data(),path.size());
+                robj *v = createStringObject("value:0123456789",16);
+                setWithKey(db,o,v,true);
+                decrRefCount(v);
+                decrRefCount(o);
+            }
+            prefix += ".c";
+        }
+    }
+    used = zmalloc_used_memory() - used;
+
+    std::vector<std::vector<robj*>> paths(depth+1);
+    for (int i = 0; i < ndocs; i++) {
+        std::string path = "str:" + std::to_string(i);
+        paths[1].push_back(createStringObject(path.data(),path.size()));
+        setWithKey(db,paths[1].back(),val,true);
+        path = "doc:" + std::to_string(i);
+        for (int d = 2; d <= depth; d++) {
+            std::string leaf = path + ".f3";
+            paths[d].push_back(createStringObject(leaf.data(),leaf.size()));
+            path += ".c";
+        }
+    }
+
+    for (int d = 1; d <= depth; d++) {
+        char name[64];
+        snprintf(name,sizeof(name),"nhget-depth%d-%s",d,encoding);
+        ctx.run(name, [&](long long n) {
+            for (long long i = 0; i < n; i++)
+                benchSink += fetchFromKey(db,paths[d][benchMix(i) & (ndocs-1)]).len;
+        });
+        snprintf(name,sizeof(name),"nhset-depth%d-%s",d,encoding);
+        ctx.run(name, [&](long long n) {
+            for (long long i = 0; i < n; i++)
+                benchSink += setWithKey(db,paths[d][benchMix(i) & (ndocs-1)],val,true);
+        });
+    }
+    if (!ctx.opt.json)
+        printf("%-28s %10zu bytes per document\n", "  memory", used/ndocs);
+
+    for (auto &v : paths)
+        for (robj *o : v) decrRefCount(o);
+    decrRefCount(val);
+    delete db;
+    g_pserver->nested_hash_max_listpack_entries = maxentriesSave;
+}
+
+static void benchNhash(benchContext &ctx) {
+    serverTL = &g_pserver->rgthreadvar[IDX_EVENT_LOOP_MAIN];
+    benchNhashCase(ctx,"dict",0);
+    benchNhashCase(ctx,"listpack",128);
+}
+
+/* -------------------------------------------------------------------------
+ * ACL key patterns
+ * ---------------------------------------------------------------------- */
+
+/* A user with one "tenant:<id>:*" prefix pattern per tenant plus one glob,
+ * matched the way ACLCheckCommandPerm() used to (stringmatchlen() on
+ * every pattern in turn) and with the compiled matcher. The allowed key hits
+ * the last pattern, the denied one none. */
+static void benchAclCase(benchContext &ctx, int npatterns) {
+    std::vector<sds> patterns;
+    for (int j = 0; j < npatterns-1; j++)
+        patterns.push_back(sdscatprintf(sdsempty(),"tenant:%d:*",j));
+    patterns.push_back(sdsnew("cache:[a-f]*:meta"));
+    aclMatcher *m = aclMatcherCreate();
+    for (sds p : patterns) aclMatcherAddPattern(m,p,sdslen(p));
+    aclMatcherCompile(m);
+
+    sds allowed = sdsnew("cache:deadbeef:meta");
+    sds denied = sdsnew("session:1234567:token");
+    auto linear = [&](sds key) {
+        for (sds p : patterns)
+            if (stringmatchlen(p,sdslen(p),key,sdslen(key),0)) return 1;
+        return 0;
+    };
+    for (sds key : {allowed, denied}) {
+        const char *kind = key == allowed ? "allowed" : "denied";
+        char name[64];
+        snprintf(name,sizeof(name),"list-%d-%s",npatterns,kind);
+        ctx.run(name, [&](long long n) {
+            uint64_t acc = 0;
+            for (long long i = 0; i < n; i++) acc += linear(key);
+            benchSink += acc;
+        });
+        snprintf(name,sizeof(name),"compiled-%d-%s",npatterns,kind);
+        ctx.run(name, [&](long long n) {
+            uint64_t acc = 0;
+            for (long long i = 0; i < n; i++) acc += aclMatcherMatch(m,key,sdslen(key));
+            benchSink += acc;
+        });
+    }
+    sdsfree(allowed);
+    sdsfree(denied);
+    aclMatcherFree(m);
+    for (sds p : patterns) sdsfree(p);
+}
+
+static void benchAcl(benchContext &ctx) {
+    for (int npatterns : {1, 50, 500}) benchAclCase(ctx,npatterns);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static struct benchGroup {
+    const char *name;
+    void (*proc)(benchContext &ctx);
+    const char *desc;
+} benchGroups[] = {
+    {"dict", benchDict, "lookups, misses and add/delete in sds keyed dicts"},
+    {"sds", benchSds, "allocation, append, copy/range, formatting, compare"},
+    {"ziplist", benchZiplist, "push head/tail and find in 128 entry ziplists"},
+    {"listpack", benchListpack, "append, insert at head and iterate 128 entries"},
+    {"skiplist", benchSkiplist, "range scans and insert/delete on 1M members"},
+    {"hll", benchHll, "dense add, count and merge"},
+    {"resp", benchResp, "multibulk parsing of GET, SET and MSET requests"},
+    {"cmdlookup", benchCmdLookup, "command name lookup, dict vs perfect hash"},
+    {"fastlock", benchFastlock, "uncontended and two thread lock/unlock"},
+    {"lockstress", benchLockstress, "contended lock/unlock under each lock-spin-policy"},
+    {"serialize", benchSerialize, "serializeStoredObject of strings and hashes"},
+    {"crc64", benchCrc64, "crc64 implementations from 64B to 1MB"},
+    {"rdb", benchRdb, "checksummed RDB save/load of strings per crc64 implementation"},
+    {"rdbcompress", benchRdbCompress, "RDB save/load and size of strings per compression algorithm"},
+    {"nhash", benchNhash, "KEYDB.NHGET/NHSET path resolution at depth 1-6, listpack vs dict objects"},
+    {"acl", benchAcl, "key pattern checks, pattern list walk vs compiled matcher"},
+};
+
+static void benchPrintJsonString(const char *s) {
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') putchar('\\');
+        putchar(*s);
+    }
+    putchar('"');
+}
+
+static void benchPrintJson(benchContext &ctx) {
+    printf("{\"version\":");
+    benchPrintJsonString(KEYDB_REAL_VERSION);
+    printf(",\"git_sha1\":");
+    benchPrintJsonString(redisGitSHA1());
+    printf(",\"runs\":%d,\"warmup\":%d,\"target_ms\":%lld,\"results\":[",
+        ctx.opt.runs, ctx.opt.warmup, ctx.opt.target_ns/1000000);
+    for (size_t i = 0; i < ctx.results.size(); i++) {
+        const benchResult &r = ctx.results[i];
+        printf("%s\n  {\"group\":", i ? "," : "");
+        benchPrintJsonString(r.group.c_str());
+        printf(",\"name\":");
+        benchPrintJsonString(r.name.c_str());
+        printf(",\"iterations\":%lld,\"median_ns\":%.3f,\"mad_ns\":%.3f,\"min_ns\":%.3f,\"max_ns\":%.3f,\"ops_per_sec\":%.0f,\"samples_ns\":[",
+            r.iterations, r.median, r.mad, r.min, r.max, r.median > 0 ? 1e9/r.median : 0);
+        for (size_t j = 0; j < r.samples.size(); j++)
+            printf("%s%.3f", j ? "," : "", r.samples[j]);
+        printf("]}");
+    }
+    printf("\n]}\n");
+}
+
+static void benchUsage(void) {
+    fprintf(stderr,"Usage: keydb-server bench <group|all|list> [--runs <n>] [--warmup <n>] [--time <ms>] [--json]\n\n");
+    fprintf(stderr,"Groups:\n");
+    for (auto &g : benchGroups)
+        fprintf(stderr,"  %-12s %s\n", g.name, g.desc);
+}
+
+int microbenchMain(int argc, char **argv) {
+    benchContext ctx;
+    std::vector<benchGroup*> groups;
+    if (argc < 1) {
+        benchUsage();
+        return 1;
+    }
+    for (int j = 1; j < argc; j++) {
+        int lastarg = (j == argc-1);
+        if (!strcasecmp(argv[j],"--runs") && !lastarg) {
+            ctx.opt.runs = std::max(1, atoi(argv[++j]));
+        } else if (!strcasecmp(argv[j],"--warmup") && !lastarg) {
+            ctx.opt.warmup = std::max(0, atoi(argv[++j]));
+        } else if (!strcasecmp(argv[j],"--time") && !lastarg) {
+            ctx.opt.target_ns = std::max(1LL, atoll(argv[++j])) * 1000000;
+        } else if (!strcasecmp(argv[j],"--json")) {
+            ctx.opt.json = true;
+        } else {
+            benchUsage();
+            return 1;
+        }
+    }
+
+    if (!strcasecmp(argv[0],"list")) {
+        benchUsage();
+        return 0;
+    }
+    for (auto &g : benchGroups)
+        if (!strcasecmp(argv[0],"all") || !strcasecmp(argv[0],g.name))
+            groups.push_back(&g);
+    if (groups.empty()) {
+        fprintf(stderr,"Unknown benchmark group '%s'\n\n", argv[0]);
+        benchUsage();
+        return 1;
+    }
+
+    if (!ctx.opt.json)
+        printf("%d runs of ~%lld ms after %d warmup runs, median and MAD per operation\n\n",
+            ctx.opt.runs, ctx.opt.target_ns/1000000, ctx.opt.warmup);
+    for (benchGroup *g : groups) {
+        ctx.group = g->name;
+        g->proc(ctx);
+    }
+    if (ctx.opt.json) benchPrintJson(ctx);
+    return 0;
+}
@@ -943,8 +943,11 @@ int RM_CreateCommand(RedisModuleCtx *ctx, const char *name, RedisModuleCmdFunc c
     cp->rediscmd->calls = 0;
     cp->rediscmd->rejected_calls = 0;
     cp->rediscmd->failed_calls = 0;
+    memset(cp->rediscmd->latency_histogram,0,sizeof(cp->rediscmd->latency_histogram));
+    memset(cp->rediscmd->latency_histogram_epoch,0,sizeof(cp->rediscmd->latency_histogram_epoch));
     dictAdd(g_pserver->commands,sdsdup(cmdname),cp->rediscmd);
     dictAdd(g_pserver->orig_commands,sdsdup(cmdname),cp->rediscmd);
+    commandTableChanged();
     cp->rediscmd->id = ACLGetCommandID(cmdname); /* ID used for ACL. */
     return REDISMODULE_OK;
 }
@@ -8730,12 +8733,14 @@ void moduleUnregisterCommands(struct RedisModule *module) {
                 dictDelete(g_pserver->commands,cmdname);
                 dictDelete(g_pserver->orig_commands,cmdname);
                 sdsfree(cmdname);
+                latencyHistogramFreeCommand(cp->rediscmd);
                 zfree(cp->rediscmd);
                 zfree(cp);
             }
         }
     }
     dictReleaseIterator(di);
+    commandTableChanged();
 }
 
 /* Load a module and initialize it. On success C_OK is returned, otherwise
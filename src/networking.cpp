@@ -160,6 +160,7 @@ client *createClient(connection *conn, int iel) {
     c->original_argc = 0;
     c->original_argv = NULL;
     c->cmd = c->lastcmd = NULL;
+    c->parsed_cmd = NULL;
     c->multibulklen = 0;
     c->bulklen = -1;
     c->sentlen = 0;
@@ -377,6 +378,7 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
         }
         memcpy(c->replyAsync->buf() + c->replyAsync->used,s,len);
         c->replyAsync->used += len;
+        c->reply_queued_total += len;
     }
     else
     {
@@ -391,6 +393,7 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
 
         memcpy(c->buf+c->bufpos,s,len);
         c->bufpos+=len;
+        c->reply_queued_total += len;
     }
     return C_OK;
 }
@@ -400,6 +403,7 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
 void _addReplyProtoToList(client *c, const char *s, size_t len) {
     if (c->flags.load(std::memory_order_relaxed) & CLIENT_CLOSE_AFTER_REPLY) return;
     AssertCorrectThread(c);
+    c->reply_queued_total += len;
 
     listNode *ln = listLast(c->reply);
     clientReplyBlock *tail = (clientReplyBlock*) (ln? listNodeValue(ln): NULL);
@@ -717,6 +721,7 @@ void setDeferredReply(client *c, void *node, const char *s, size_t length) {
      * we return NULL in addReplyDeferredLen() */
     if (node == NULL) return;
     serverAssert(!listNodeValue(ln));
+    c->reply_queued_total += length;
 
     /* Normally we fill this dummy NULL node, added by addReplyDeferredLen(),
      * with a new buffer structure containing the protocol needed to specify
@@ -1121,9 +1126,18 @@ void AddReplyFromClient(client *dst, client *src) {
      * checks in it. */
     if (dst->flags & CLIENT_CLOSE_AFTER_REPLY) return;
 
-    /* Concatenate the reply list into the dest */
-    if (listLength(src->reply))
+    /* Concatenate the reply list into the dest, the blocks were queued on
+     * 'src' so they are accounted to 'dst' here */
+    if (listLength(src->reply)) {
+        listIter li;
+        listNode *ln;
+        listRewind(src->reply,&li);
+        while ((ln = listNext(&li))) {
+            clientReplyBlock *block = (clientReplyBlock*)listNodeValue(ln);
+            if (block) dst->reply_queued_total += block->used;
+        }
         listJoin(dst->reply,src->reply);
+    }
     dst->reply_bytes += src->reply_bytes;
     src->reply_bytes = 0;
     src->bufpos = 0;
@@ -1173,6 +1187,117 @@ int chooseBestThreadForAccept()
     return ielMinLoad;
 }
 
+/* Return true if the client can be moved to another event loop right now.
+ * Only idle, plain socket connections qualify: nothing may be queued for the
+ * current thread (parsed commands, pending or async writes, posted
+ * functions) and the client may not take part in replication or be blocked,
+ * since all of those keep thread specific references to it. */
+static bool clientCanMigrate(client *c) {
+    if (c->conn == nullptr || connGetType(c->conn) != CONN_TYPE_SOCKET) return false;
+    if (connGetState(c->conn) != CONN_STATE_CONNECTED) return false;
+    if (c->flags & (CLIENT_SLAVE|CLIENT_MASTER|CLIENT_MONITOR|CLIENT_BLOCKED|CLIENT_UNBLOCKED|
+                    CLIENT_PENDING_WRITE|CLIENT_PENDING_COMMAND|CLIENT_EXECUTING_COMMAND|
+                    CLIENT_PROTECTED|CLIENT_CLOSE_ASAP|CLIENT_CLOSE_AFTER_REPLY|
+                    CLIENT_LUA|CLIENT_MODULE))
+        return false;
+    if (c->casyncOpsPending || c->fPendingAsyncWrite || c->fPendingAsyncWriteHandler) return false;
+    if (!c->vecqueuedcmd.empty() || clientHasPendingReplies(c) || c->replyAsync != nullptr) return false;
+    if (serverTL->current_client == c) return false;
+    if (std::find(serverTL->vecclientsProcess.begin(), serverTL->vecclientsProcess.end(), c) != serverTL->vecclientsProcess.end())
+        return false;
+    return true;
+}
+
+/* Move a client from the current event loop to ielTarget. Must be called on
+ * the client's thread with the global lock and the client lock held.
+ *
+ * The connection is removed from our event loop and c->iel is switched
+ * immediately, so from now on every other thread treats the target as the
+ * owner. The target registers the connection when it runs the posted
+ * function; until then casyncOpsPending keeps the client from being freed
+ * under it. */
+static bool migrateClientToThread(client *c, int ielTarget) {
+    int ielSrc = c->iel;
+    serverAssert(GlobalLocksAcquired() && c->lock.fOwnLock());
+    AssertCorrectThread(c);
+    if (ielTarget == ielSrc || !clientCanMigrate(c)) return false;
+
+    connSetReadHandler(c->conn, nullptr);
+    connSetWriteHandler(c->conn, nullptr);
+    atomicDecr(g_pserver->rgthreadvar[ielSrc].cclients, 1);
+    atomicIncr(g_pserver->rgthreadvar[ielTarget].cclients, 1);
+    c->iel = ielTarget;
+    c->casyncOpsPending++;
+    int res = aePostFunction(g_pserver->rgthreadvar[ielTarget].el, [c] {
+        std::lock_guard<decltype(c->lock)> lock(c->lock);
+        c->casyncOpsPending--;
+        connMarshalThread(c->conn);
+        if (connSetReadHandler(c->conn, readQueryFromClient, true) == C_ERR) {
+            freeClientAsync(c);
+            return;
+        }
+        if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+    });
+    if (res != AE_OK) {
+        /* Undo: the target never saw the client */
+        c->casyncOpsPending--;
+        c->iel = ielSrc;
+        atomicDecr(g_pserver->rgthreadvar[ielTarget].cclients, 1);
+        atomicIncr(g_pserver->rgthreadvar[ielSrc].cclients, 1);
+        if (connSetReadHandler(c->conn, readQueryFromClient, true) == C_ERR)
+            freeClientAsync(c);
+        return false;
+    }
+    g_pserver->stat_thread_migrations++;
+    return true;
+}
+
+/* Called on a busy thread by threadRebalanceCron(): move clients that
+ * account for about 'fraction' of the commands this thread executed since
+ * the previous call to ielTarget.
+ *
+ * Clients whose own share is larger than the target are left alone, so a
+ * single hot connection is not bounced between threads forever. */
+void rebalanceClientsToThread(int ielTarget, double fraction) {
+    int ielSrc = serverTL - g_pserver->rgthreadvar;
+    serverAssert(GlobalLocksAcquired());
+    std::vector<std::pair<unsigned long long, client*>> vecCandidates;
+    unsigned long long total = 0;
+    listIter li;
+    listNode *ln;
+    listRewind(g_pserver->clients, &li);
+    while ((ln = listNext(&li)) != nullptr) {
+        client *c = (client*)listNodeValue(ln);
+        if (c->iel != ielSrc) continue;
+        unsigned long long delta = c->commands_processed - c->commands_processed_mark;
+        c->commands_processed_mark = c->commands_processed;
+        total += delta;
+        if (delta > 0) vecCandidates.emplace_back(delta, c);
+    }
+
+    std::sort(vecCandidates.begin(), vecCandidates.end(),
+        [](const std::pair<unsigned long long, client*> &a, const std::pair<unsigned long long, client*> &b) {
+            return a.first > b.first;
+        });
+    /* Allow a 10% overshoot so two equally busy clients can still be split */
+    double target = total * fraction * 1.1;
+    unsigned long long moved = 0;
+    int cmoved = 0;
+    for (auto &candidate : vecCandidates) {
+        if (cmoved >= g_pserver->thread_rebalance_max_clients) break;
+        if (moved + candidate.first > target) continue;
+        client *c = candidate.second;
+        std::unique_lock<decltype(c->lock)> lock(c->lock);
+        if (migrateClientToThread(c, ielTarget)) {
+            moved += candidate.first;
+            cmoved++;
+        }
+    }
+    if (cmoved)
+        serverLog(LL_VERBOSE, "Moved %d client(s) from thread %d to thread %d (%llu of %llu recent commands)",
+            cmoved, ielSrc, ielTarget, moved, total);
+}
+
 void clientAcceptHandler(connection *conn) {
     client *c = (client*)connGetPrivateData(conn);
 
@@ -1506,12 +1631,99 @@ void freeClientOriginalArgv(client *c) {
     c->original_argc = 0;
 }
 
+/* Argument pools.
+ *
+ * Every argument the RESP parser reads becomes a string object and every
+ * command gets an argv array, all freed again right after the command ran.
+ * Short arguments are EMBSTR objects (one allocation each), so instead of
+ * freeing them a server thread keeps the ones nobody retained -- refcount
+ * still 1, that is not stored in the keyspace, a MULTI queue, the
+ * replication stream... -- bucketed by the size class of their allocation,
+ * and rewrites them in place for the next arguments it parses. The argv
+ * arrays are recycled the same way. The pools live in serverTL, so there is
+ * no locking; threads that are not server threads just allocate. */
+
+extern size_t OBJ_ENCODING_EMBSTR_SIZE_LIMIT;
+
+robj *argvPoolCreateString(const char *ptr, size_t len) {
+    if (serverTL != nullptr && len <= OBJ_ENCODING_EMBSTR_SIZE_LIMIT) {
+        /* The first class whose objects all have room for this one, when
+         * it's empty try the larger ones: the size classes of the allocator
+         * may be coarser than ours. */
+        size_t cls = (embeddedStringObjectAllocSize(len)-1) / 8;
+        if (cls < ARGV_POOL_CLASSES) {
+            for (; cls < ARGV_POOL_CLASSES; cls++) {
+                auto &pool = serverTL->argvObjPool[cls];
+                if (!pool.empty()) {
+                    robj *o = pool.back();
+                    pool.pop_back();
+                    serverTL->stat_argv_pool_hits++;
+                    return resetEmbeddedStringObject(o,ptr,len);
+                }
+            }
+            serverTL->stat_argv_pool_misses++;
+        }
+    }
+    return createStringObject(ptr,len);
+}
+
+void argvPoolRelease(robj *o) {
+    if (serverTL != nullptr && o->type == OBJ_STRING && o->encoding == OBJ_ENCODING_EMBSTR &&
+        o->getrefcount(std::memory_order_relaxed) == 1)
+    {
+        /* Class N holds allocations with room for at least 8*(N+1) bytes */
+        size_t usable = zmalloc_size(allocPtrFromObj(o));
+        if (usable >= 8 && usable/8 <= ARGV_POOL_CLASSES) {
+            auto &pool = serverTL->argvObjPool[usable/8-1];
+            if (pool.size() < ARGV_POOL_SIZE) {
+                pool.push_back(o);
+                return;
+            }
+        }
+    }
+    decrRefCount(o);
+}
+
+/* Usable size of an ARGV_POOL_ARRAY_SLOTS array, as reported by zmalloc_size */
+static std::atomic<size_t> s_argvPoolArrayUsable {0};
+
+robj **argvPoolAllocArray(int argc) {
+    if (argc > ARGV_POOL_ARRAY_SLOTS)
+        return (robj**)zmalloc(sizeof(robj*)*argc);
+    if (serverTL != nullptr) {
+        if (!serverTL->argvArrayPool.empty()) {
+            robj **argv = serverTL->argvArrayPool.back();
+            serverTL->argvArrayPool.pop_back();
+            serverTL->stat_argv_pool_hits++;
+            return argv;
+        }
+        serverTL->stat_argv_pool_misses++;
+    }
+    robj **argv = (robj**)zmalloc(sizeof(robj*)*ARGV_POOL_ARRAY_SLOTS);
+    s_argvPoolArrayUsable.store(zmalloc_size(argv), std::memory_order_relaxed);
+    return argv;
+}
+
+/* Only arrays of the pooled size are kept, larger ones (long commands, or
+ * argv grown by rewriteClientCommandArgument) go back to the allocator. */
+void argvPoolReleaseArray(robj **argv) {
+    if (argv == nullptr) return;
+    if (serverTL != nullptr && serverTL->argvArrayPool.size() < ARGV_POOL_SIZE &&
+        zmalloc_size(argv) == s_argvPoolArrayUsable.load(std::memory_order_relaxed))
+    {
+        serverTL->argvArrayPool.push_back(argv);
+        return;
+    }
+    zfree(argv);
+}
+
 static void freeClientArgv(client *c) {
     int j;
     for (j = 0; j < c->argc; j++)
-        decrRefCount(c->argv[j]);
+        argvPoolRelease(c->argv[j]);
     c->argc = 0;
     c->cmd = NULL;
+    c->parsed_cmd = NULL;
     c->argv_len_sumActive = 0;
 }
 
@@ -1998,6 +2210,11 @@ int writeToClient(client *c, int handler_installed) {
         c->sentlen = 0;
         if (handler_installed) connSetWriteHandler(c->conn, NULL);
 
+        if (c->mtimeReplyPending) {
+            latencyHistogramRecordPhase(LATENCY_PHASE_WRITE, getMonotonicUs() - c->mtimeReplyPending);
+            c->mtimeReplyPending = 0;
+        }
+
         /* Close connection after entire reply has been sent. */
         if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
             freeClientAsync(c);
@@ -2030,6 +2247,10 @@ void ProcessPendingAsyncWrites()
 
     serverAssert(GlobalLocksAcquired());
 
+    if (listLength(serverTL->clients_pending_asyncwrite) == 0)
+        return;
+    monotime mtimeStart = getMonotonicUs();
+
     while(listLength(serverTL->clients_pending_asyncwrite)) {
         client *c = (client*)listNodeValue(listFirst(serverTL->clients_pending_asyncwrite));
         listDelNode(serverTL->clients_pending_asyncwrite, listFirst(serverTL->clients_pending_asyncwrite));
@@ -2101,6 +2322,7 @@ void ProcessPendingAsyncWrites()
             }
         }
     }
+    threadPhaseEnd(THREAD_PHASE_ASYNC_WRITES, mtimeStart);
 }
 
 /* This function is called just before entering the event loop, in the hope
@@ -2484,7 +2706,7 @@ int processMultibulkBuffer(client *c) {
                 sdsclear(c->querybuf);
             } else {
                 cmd.argv[cmd.argc++] =
-                    createStringObject(c->querybuf+c->qb_pos,c->bulklen);
+                    argvPoolCreateString(c->querybuf+c->qb_pos,c->bulklen);
                 cmd.argv_len_sum += c->bulklen;
                 c->qb_pos += c->bulklen+2;
             }
@@ -2515,6 +2737,7 @@ void commandProcessed(client *c, int flags) {
      *    since we have not applied the command. */
     if (c->flags & CLIENT_BLOCKED) return;
 
+    c->commands_processed++;
     resetClient(c);
 
     long long prev_offset = c->reploff;
@@ -2639,6 +2862,12 @@ void parseClientCommandBuffer(client *c) {
         } else if (!c->vecqueuedcmd.empty()) {
             if (c->flags & CLIENT_MASTER) c->vecqueuedcmd.back().reploff = c->read_reploff - sdslen(c->querybuf) + c->qb_pos;
             serverAssert(c->vecqueuedcmd.back().reploff >= 0);
+            auto &parsed = c->vecqueuedcmd.back();
+            if (parsed.argc == parsed.argcMax) {
+                lookupParsedCommand(parsed);
+                if (g_pserver->latency_tracking_enabled && parsed.mtimeParsed == 0)
+                    parsed.mtimeParsed = getMonotonicUs();
+            }
         }
 
         /* Prefetch outside the lock for better perf */
@@ -2666,7 +2895,7 @@ bool FAsyncCommand(parsed_command &cmd)
 {
     if (serverTL->in_eval || serverTL->in_exec)
         return false;
-    auto parsedcmd = lookupCommand(szFromObj(cmd.argv[0]));
+    auto parsedcmd = lookupParsedCommand(cmd);
     if (parsedcmd == nullptr)
         return false;
     static const long long expectedFlags = CMD_ASYNC_OK | CMD_READONLY;
@@ -2700,12 +2929,29 @@ bool FAsyncCommand(parsed_command &cmd)
  *    - 空命令处理（resetClient）
  *    - 命令实际执行（processCommandAndResetClient）
  */
+/* True once the processClients() batch in progress used up its command or
+ * time budget (lock-batch-max-commands / lock-batch-max-usec). The remaining
+ * commands wait for the next batch so other threads get the global lock.
+ * Every batch runs at least one command, a deadline that passed before the
+ * first one would otherwise leave the thread spinning without progress. */
+static bool lockBatchExhausted() {
+    if (!serverTL->lock_batch_active || serverTL->lock_batch_commands == 0)
+        return false;
+    if (g_pserver->lock_batch_max_commands > 0 && serverTL->lock_batch_commands >= g_pserver->lock_batch_max_commands)
+        return true;
+    return serverTL->lock_batch_deadline != 0 && getMonotonicUs() >= serverTL->lock_batch_deadline;
+}
+
 void processInputBuffer(client *c, bool fParse, int callFlags) {
     AssertCorrectThread(c);
 
     if (fParse)
         parseClientCommandBuffer(c);
 
+    /* The lock wait is shared by every command of this batch, it is
+     * attributed once, to the first one. */
+    bool fLockWaitRecorded = (callFlags & CMD_CALL_ASYNC) || serverTL->lock_wait_us < 0;
+
     /* Keep processing while there is something in the input buffer */
     while (!c->vecqueuedcmd.empty()) {
         /* Return if we're still parsing this command */
@@ -2718,16 +2964,29 @@ void processInputBuffer(client *c, bool fParse, int callFlags) {
         if ((callFlags & CMD_CALL_ASYNC) && !FAsyncCommand(cmd))
             break;
 
-        zfree(c->argv);
+        if (!(callFlags & CMD_CALL_ASYNC) && lockBatchExhausted()) break;
+
+        argvPoolReleaseArray(c->argv);
         c->argc = cmd.argc;
         c->argv = cmd.argv;
         cmd.argv = nullptr;
         c->argv_len_sumActive = cmd.argv_len_sum;
         cmd.argv_len_sum = 0;
         c->reploff_cmd = cmd.reploff;
+        c->parsed_cmd = lookupParsedCommand(cmd);
         serverAssert(c->argv != nullptr);
 
+        if (g_pserver->latency_tracking_enabled) {
+            if (cmd.mtimeParsed)
+                latencyHistogramRecordPhase(LATENCY_PHASE_QUEUE, getMonotonicUs() - cmd.mtimeParsed);
+            if (!fLockWaitRecorded) {
+                latencyHistogramRecordPhase(LATENCY_PHASE_LOCK, serverTL->lock_wait_us);
+                fLockWaitRecorded = true;
+            }
+        }
+
         c->vecqueuedcmd.erase(c->vecqueuedcmd.begin());
+        if (serverTL->lock_batch_active) serverTL->lock_batch_commands++;
 
         /* Multibulk processing could see a <= 0 length. */
         if (c->argc == 0) {
@@ -2861,8 +3120,11 @@ void readQueryFromClient(connection *conn) {
         // If we're single threaded its actually better to just process the command here while the query is hot in the cache
         //  multithreaded lock contention dominates and batching is better
         AeLocker locker;
+        monotime mtimeLockStart = getMonotonicUs();
         locker.arm(c);
+        serverTL->lock_wait_us = (long long)(getMonotonicUs() - mtimeLockStart);
         runAndPropogateToReplicas(processInputBuffer, c, true /*fParse*/, CMD_CALL_FULL);
+        serverTL->lock_wait_us = -1;
     }
 }
 
@@ -2870,8 +3132,22 @@ void processClients()
 {
     serverAssert(GlobalLocksAcquired());
 
+    /* Everything parsed since the last batch runs under this one lock hold,
+     * bounded by lock-batch-max-commands and lock-batch-max-usec. */
+    bool fBatchOuter = !serverTL->lock_batch_active;
+    if (fBatchOuter) {
+        serverTL->lock_batch_active = true;
+        serverTL->lock_batch_commands = 0;
+        serverTL->lock_batch_deadline = g_pserver->lock_batch_max_usec > 0 ? getMonotonicUs() + g_pserver->lock_batch_max_usec : 0;
+    }
+
     // Note that this function is reentrant and vecclients may be modified by code called from processInputBuffer
     while (!serverTL->vecclientsProcess.empty()) {
+        if (lockBatchExhausted()) {
+            /* beforeSleep() won't sleep while clients are left in the queue */
+            if (fBatchOuter) g_pserver->stat_lock_batches_truncated++;
+            break;
+        }
         client *c = serverTL->vecclientsProcess.front();
         serverTL->vecclientsProcess.erase(serverTL->vecclientsProcess.begin());
 
@@ -2879,6 +3155,19 @@ void processClients()
         * in case to check if there is a full command to execute. */
         std::unique_lock<fastlock> ul(c->lock);
         processInputBuffer(c, false /*fParse*/, CMD_CALL_FULL);
+
+        /* Out of budget in the middle of a pipeline: the rest of it goes
+         * behind the other clients of this thread */
+        if (!c->vecqueuedcmd.empty() && lockBatchExhausted() && !(c->flags & CLIENT_CLOSE_ASAP))
+            serverTL->vecclientsProcess.push_back(c);
+    }
+
+    if (fBatchOuter) {
+        serverTL->lock_batch_active = false;
+        if (serverTL->lock_batch_commands > 0) {
+            g_pserver->stat_lock_batches++;
+            g_pserver->stat_lock_batch_commands += serverTL->lock_batch_commands;
+        }
     }
 
     if (listLength(serverTL->clients_pending_asyncwrite))
@@ -93,22 +93,9 @@ robj *createRawStringObject(const char *ptr, size_t len) {
     return createObject(OBJ_STRING, sdsnewlen(ptr,len));
 }
 
-/* Create a string object with encoding OBJ_ENCODING_EMBSTR, that is
- * an object where the sds string is actually an unmodifiable string
- * allocated in the same chunk as the object itself. */
-robj *createEmbeddedStringObject(const char *ptr, size_t len) {
-    serverAssert(len <= UINT8_MAX);
-    // Note: If the size changes update serializeStoredStringObject
-    size_t allocsize = sizeof(struct sdshdr8)+len+1;
-    if (allocsize < sizeof(void*))
-        allocsize = sizeof(void*);
-
-    size_t mvccExtraBytes = g_pserver->fActiveReplica ? sizeof(redisObjectExtended) : 0;
-    char *oB = (char*)zmalloc(sizeof(robj)+allocsize-sizeof(redisObject::m_ptr)+mvccExtraBytes, MALLOC_SHARED);
-    robj *o = reinterpret_cast<robj*>(oB + mvccExtraBytes);
+static robj *initEmbeddedStringObject(robj *o, const char *ptr, size_t len) {
     struct sdshdr8 *sh = (sdshdr8*)(&o->m_ptr);
 
-    new (o) redisObject;
     o->type = OBJ_STRING;
     o->encoding = OBJ_ENCODING_EMBSTR;
     o->setrefcount(1);
@@ -134,6 +121,38 @@ robj *createEmbeddedStringObject(const char *ptr, size_t len) {
     return o;
 }
 
+/* Create a string object with encoding OBJ_ENCODING_EMBSTR, that is
+ * an object where the sds string is actually an unmodifiable string
+ * allocated in the same chunk as the object itself. */
+robj *createEmbeddedStringObject(const char *ptr, size_t len) {
+    serverAssert(len <= UINT8_MAX);
+    size_t mvccExtraBytes = g_pserver->fActiveReplica ? sizeof(redisObjectExtended) : 0;
+    char *oB = (char*)zmalloc(embeddedStringObjectAllocSize(len), MALLOC_SHARED);
+    robj *o = reinterpret_cast<robj*>(oB + mvccExtraBytes);
+    new (o) redisObject;
+    return initEmbeddedStringObject(o, ptr, len);
+}
+
+/* Size of the allocation createEmbeddedStringObject() makes for a string of
+ * len bytes. */
+size_t embeddedStringObjectAllocSize(size_t len) {
+    // Note: If the size changes update serializeStoredStringObject
+    size_t allocsize = sizeof(struct sdshdr8)+len+1;
+    if (allocsize < sizeof(void*))
+        allocsize = sizeof(void*);
+    size_t mvccExtraBytes = g_pserver->fActiveReplica ? sizeof(redisObjectExtended) : 0;
+    return sizeof(robj)+allocsize-sizeof(redisObject::m_ptr)+mvccExtraBytes;
+}
+
+/* Reuse the EMBSTR object o, which nobody else references, for a new string
+ * of len bytes. The caller makes sure embeddedStringObjectAllocSize(len) fits
+ * in the allocation of o. */
+robj *resetEmbeddedStringObject(robj *o, const char *ptr, size_t len) {
+    o->~redisObject();
+    new (o) redisObject;
+    return initEmbeddedStringObject(o, ptr, len);
+}
+
 /* Create a string object with EMBSTR encoding if it is smaller than
  * OBJ_ENCODING_EMBSTR_SIZE_LIMIT, otherwise the RAW encoding is
  * used.
@@ -889,6 +908,7 @@ const char *strEncoding(int encoding) {
     case OBJ_ENCODING_SKIPLIST: return "skiplist";
     case OBJ_ENCODING_EMBSTR: return "embstr";
     case OBJ_ENCODING_STREAM: return "stream";
+    case OBJ_ENCODING_LISTPACK: return "listpack";
     default: return "unknown";
     }
 }
@@ -1575,6 +1595,15 @@ void memoryCommand(client *c) {
     } else if (!strcasecmp(szFromObj(c->argv[1]),"malloc-stats") && c->argc == 2) {
 #if defined(USE_JEMALLOC)
         sds info = sdsempty();
+        unsigned carenas = zmalloc_arena_count();
+        if (carenas) {
+            info = sdscat(info, "___ KeyDB arena bindings ___\n");
+            for (unsigned iarena = 0; iarena < carenas; ++iarena) {
+                struct zmalloc_arena_info arena;
+                if (zmalloc_get_arena_info(iarena, &arena))
+                    info = sdscatprintf(info, "arena %u: %s\n", arena.arena, arena.label);
+            }
+        }
         malloc_stats_print(inputCatSds, &info, NULL);
         addReplyVerbatim(c,info,sdslen(info),"txt");
         sdsfree(info);
@@ -1728,6 +1757,61 @@ sds serializeStoredObject(robj_roptr o, sds sdsPrefix)
     serverPanic("Attempting to store unknown object type");
 }
 
+/* Duplicate a dict of sds elements, sharing the element strings with the source.
+ * Elements are plain strings until an object is first copied out of a snapshot,
+ * so they cost no refcount header when no snapshot needs them. Those are copied
+ * here into refcounted form, and the next snapshot copy of the new object only
+ * bumps reference counts. */
+static dict *dupSdsDictShared(dict *d, dictType *type, bool fVals)
+{
+    dict *dNew = dictCreate(type, nullptr);
+    dictExpand(dNew, dictSize(d));
+    dictIterator *di = dictGetIterator(d);
+    dictEntry *de;
+    while ((de = dictNext(di)) != nullptr) {
+        sds val = fVals ? sdsdupshared((sds)dictGetVal(de)) : nullptr;
+        dictAdd(dNew, sdsdupshared((sds)dictGetKey(de)), val);
+    }
+    dictReleaseIterator(di);
+    return dNew;
+}
+
+/* Copy an object that is still referenced by a snapshot so it can be modified.
+ * Hash tables for hashes and sets share their elements with the snapshot copy,
+ * blob encodings are copied directly and everything else goes through the
+ * storage serializer. */
+robj *dupObjectForSnapshot(robj_roptr o)
+{
+    robj *objNew = nullptr;
+    if (o->encoding == OBJ_ENCODING_HT && (o->type == OBJ_HASH || o->type == OBJ_SET)) {
+        if (o->type == OBJ_HASH)
+            objNew = createObject(OBJ_HASH, dupSdsDictShared((dict*)ptrFromObj(o), &hashDictType, true));
+        else
+            objNew = createObject(OBJ_SET, dupSdsDictShared((dict*)ptrFromObj(o), &setDictType, false));
+        objNew->encoding = OBJ_ENCODING_HT;
+    } else if (o->encoding == OBJ_ENCODING_ZIPLIST && (o->type == OBJ_HASH || o->type == OBJ_ZSET)) {
+        size_t cb = ziplistBlobLen((unsigned char*)ptrFromObj(o));
+        void *zl = zmalloc(cb, MALLOC_SHARED);
+        memcpy(zl, ptrFromObj(o), cb);
+        objNew = createObject(o->type, zl);
+        objNew->encoding = OBJ_ENCODING_ZIPLIST;
+    } else if (o->encoding == OBJ_ENCODING_INTSET) {
+        size_t cb = intsetBlobLen((intset*)ptrFromObj(o));
+        void *is = zmalloc(cb, MALLOC_SHARED);
+        memcpy(is, ptrFromObj(o), cb);
+        objNew = createObject(OBJ_SET, is);
+        objNew->encoding = OBJ_ENCODING_INTSET;
+    } else {
+        sds strT = serializeStoredObject(o);
+        objNew = deserializeStoredObject(strT, sdslen(strT));
+        sdsfree(strT);
+        return objNew;
+    }
+    objNew->lru = o->lru;
+    setMvccTstamp(objNew, mvccFromObj(o));
+    return objNew;
+}
+
 redisObjectStack::redisObjectStack()
 {
     // We need to ensure the Extended Object is first in the class layout
@@ -29,6 +29,12 @@
 
 #include "server.h"
 #include "lzf.h"    /* LZF compression library */
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 #include "zipmap.h"
 #include "endianconv.h"
 #include "stream.h"
@@ -337,13 +343,13 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
     return rdbEncodeInteger(value,enc);
 }
 
-ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
-                       size_t original_len) {
+ssize_t rdbSaveCompressedBlob(rio *rdb, int enctype, void *data, size_t compress_len,
+                              size_t original_len) {
     unsigned char byte;
     ssize_t n, nwritten = 0;
 
     /* Data compressed! Let's save it on disk */
-    byte = (RDB_ENCVAL<<6)|RDB_ENC_LZF;
+    byte = (RDB_ENCVAL<<6)|enctype;
     if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) goto writeerr;
     nwritten += n;
 
@@ -362,42 +368,141 @@ writeerr:
     return -1;
 }
 
-ssize_t rdbSaveLzfStringObject(rio *rdb, const unsigned char *s, size_t len) {
+/* Returns true if this build can save and load strings compressed with the
+ * given RDB_COMPRESSION_* algorithm. */
+int rdbCompressionSupported(int algorithm) {
+    switch (algorithm) {
+    case RDB_COMPRESSION_LZF:
+        return 1;
+#ifdef HAVE_LZ4
+    case RDB_COMPRESSION_LZ4:
+        return 1;
+#endif
+#ifdef HAVE_ZSTD
+    case RDB_COMPRESSION_ZSTD:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+#ifdef HAVE_ZSTD
+/* Zstd contexts are large to set up, keep one of each per thread. The RDB
+ * save threads come and go, so they are released on thread exit. */
+#define RDB_ZSTD_LEVEL 1
+struct rdbZstdContexts {
+    ZSTD_CCtx *cctx = nullptr;
+    ZSTD_DCtx *dctx = nullptr;
+    ~rdbZstdContexts() {
+        if (cctx) ZSTD_freeCCtx(cctx);
+        if (dctx) ZSTD_freeDCtx(dctx);
+    }
+};
+static thread_local rdbZstdContexts rdbZstd;
+#endif
+
+/* Compress 's' into 'out' with the algorithm of the stream. Returns the
+ * compressed length, or 0 if the result doesn't fit in 'outlen' bytes, and
+ * sets 'enctype' to the RDB_ENC_* of the output. */
+static size_t rdbCompressString(rio *rdb, const unsigned char *s, size_t len,
+                                void *out, size_t outlen, int *enctype) {
+    switch (rdb->compression) {
+#ifdef HAVE_LZ4
+    case RDB_COMPRESSION_LZ4:
+        if (len > LZ4_MAX_INPUT_SIZE) break;
+        *enctype = RDB_ENC_LZ4;
+        return LZ4_compress_default((const char*)s, (char*)out, (int)len,
+            (int)std::min(outlen, (size_t)LZ4_MAX_INPUT_SIZE));
+#endif
+#ifdef HAVE_ZSTD
+    case RDB_COMPRESSION_ZSTD: {
+        if (rdbZstd.cctx == nullptr && (rdbZstd.cctx = ZSTD_createCCtx()) == nullptr) break;
+        *enctype = RDB_ENC_ZSTD;
+        size_t comprlen = ZSTD_compressCCtx(rdbZstd.cctx, out, outlen, s, len, RDB_ZSTD_LEVEL);
+        return ZSTD_isError(comprlen) ? 0 : comprlen;
+    }
+#endif
+    }
+    *enctype = RDB_ENC_LZF;
+    return lzf_compress(s, len, out, outlen);
+}
+
+/* Uncompress a RDB_ENC_* string, returns true if it decoded to exactly 'len'
+ * bytes. */
+static int rdbDecompressString(int enctype, const unsigned char *c, size_t clen,
+                               char *val, size_t len) {
+    switch (enctype) {
+    case RDB_ENC_LZF:
+        return lzf_decompress(c,clen,val,len) == len;
+#ifdef HAVE_LZ4
+    case RDB_ENC_LZ4:
+        if (clen > INT_MAX || len > INT_MAX) return 0;
+        return LZ4_decompress_safe((const char*)c,val,(int)clen,(int)len) == (int)len;
+#endif
+#ifdef HAVE_ZSTD
+    case RDB_ENC_ZSTD: {
+        if (rdbZstd.dctx == nullptr && (rdbZstd.dctx = ZSTD_createDCtx()) == nullptr) return 0;
+        size_t n = ZSTD_decompressDCtx(rdbZstd.dctx,val,len,c,clen);
+        return !ZSTD_isError(n) && n == len;
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+static const char *rdbCompressedEncodingName(int enctype) {
+    switch (enctype) {
+    case RDB_ENC_LZ4: return "LZ4";
+    case RDB_ENC_ZSTD: return "Zstd";
+    default: return "LZF";
+    }
+}
+
+ssize_t rdbSaveCompressedStringObject(rio *rdb, const unsigned char *s, size_t len) {
     char rgbuf[2048];
     size_t comprlen, outlen;
     void *out = rgbuf;
+    int enctype;
 
     /* We require at least four bytes compression for this to be worth it */
     if (len <= 4) return 0;
     outlen = len-4;
     if (outlen >= sizeof(rgbuf))
         if ((out = zmalloc(outlen+1, MALLOC_LOCAL)) == NULL) return 0;
-    comprlen = lzf_compress(s, len, out, outlen);
+    comprlen = rdbCompressString(rdb, s, len, out, outlen, &enctype);
     if (comprlen == 0) {
         if (out != rgbuf)
             zfree(out);
         return 0;
     }
-    ssize_t nwritten = rdbSaveLzfBlob(rdb, out, comprlen, len);
+    ssize_t nwritten = rdbSaveCompressedBlob(rdb, enctype, out, comprlen, len);
     if (out != rgbuf)
         zfree(out);
     return nwritten;
 }
 
-/* Load an LZF compressed string in RDB format. The returned value
- * changes according to 'flags'. For more info check the
+/* Load a compressed string of the RDB_ENC_* type 'enctype' in RDB format.
+ * The returned value changes according to 'flags'. For more info check the
  * rdbGenericLoadStringObject() function. */
-void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
+void *rdbLoadCompressedStringObject(rio *rdb, int enctype, int flags, size_t *lenptr) {
     int plain = flags & RDB_LOAD_PLAIN;
     int sds = flags & RDB_LOAD_SDS;
     uint64_t len, clen;
     unsigned char *c = NULL;
     char *val = NULL;
 
+    if (enctype != RDB_ENC_LZF &&
+        !rdbCompressionSupported(enctype == RDB_ENC_LZ4 ? RDB_COMPRESSION_LZ4 : RDB_COMPRESSION_ZSTD)) {
+        rdbReportCorruptRDB("%s compressed string, but this server was built without %s support",
+            rdbCompressedEncodingName(enctype), rdbCompressedEncodingName(enctype));
+        return NULL;
+    }
     if ((clen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
     if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
     if ((c = (unsigned char*)ztrymalloc(clen)) == NULL) {
-        serverLog(g_pserver->loading? LL_WARNING: LL_VERBOSE, "rdbLoadLzfStringObject failed allocating %llu bytes", (unsigned long long)clen);
+        serverLog(g_pserver->loading? LL_WARNING: LL_VERBOSE, "rdbLoadCompressedStringObject failed allocating %llu bytes", (unsigned long long)clen);
         goto err;
     }
 
@@ -408,7 +513,7 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
         val = sdstrynewlen(SDS_NOINIT,len);
     }
     if (!val) {
-        serverLog(g_pserver->loading? LL_WARNING: LL_VERBOSE, "rdbLoadLzfStringObject failed allocating %llu bytes", (unsigned long long)len);
+        serverLog(g_pserver->loading? LL_WARNING: LL_VERBOSE, "rdbLoadCompressedStringObject failed allocating %llu bytes", (unsigned long long)len);
         goto err;
     }
 
@@ -416,8 +521,8 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
 
     /* Load the compressed representation and uncompress it to target. */
     if (rioRead(rdb,c,clen) == 0) goto err;
-    if (lzf_decompress(c,clen,val,len) != len) {
-        rdbReportCorruptRDB("Invalid LZF compressed string");
+    if (!rdbDecompressString(enctype,c,clen,val,len)) {
+        rdbReportCorruptRDB("Invalid %s compressed string", rdbCompressedEncodingName(enctype));
         goto err;
     }
     zfree(c);
@@ -451,10 +556,10 @@ ssize_t rdbSaveRawString(rio *rdb, const unsigned char *s, size_t len) {
         }
     }
 
-    /* Try LZF compression - under 20 bytes it's unable to compress even
+    /* Try compression - under 20 bytes it's unable to compress even
      * aaaaaaaaaaaaaaaaaa so skip it */
     if (g_pserver->rdb_compression && len > 20) {
-        n = rdbSaveLzfStringObject(rdb,(const unsigned char*)s,len);
+        n = rdbSaveCompressedStringObject(rdb,(const unsigned char*)s,len);
         if (n == -1) return -1;
         if (n > 0) return n;
         /* Return value of 0 means data can't be compressed, save the old way */
@@ -531,7 +636,9 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr) {
         case RDB_ENC_INT32:
             return rdbLoadIntegerObject(rdb,len,flags,lenptr);
         case RDB_ENC_LZF:
-            return rdbLoadLzfStringObject(rdb,flags,lenptr);
+        case RDB_ENC_LZ4:
+        case RDB_ENC_ZSTD:
+            return rdbLoadCompressedStringObject(rdb,len,flags,lenptr);
         default:
             rdbReportCorruptRDB("Unknown RDB string encoding type %llu",len);
             return NULL;
@@ -839,7 +946,7 @@ ssize_t rdbSaveObject(rio *rdb, robj_roptr o, robj_roptr key) {
                 if (quicklistNodeIsCompressed(node)) {
                     void *data;
                     size_t compress_len = quicklistGetLzf(node, &data);
-                    if ((n = rdbSaveLzfBlob(rdb,data,compress_len,node->sz)) == -1) return -1;
+                    if ((n = rdbSaveCompressedBlob(rdb,RDB_ENC_LZF,data,compress_len,node->sz)) == -1) return -1;
                     nwritten += n;
                 } else {
                     if ((n = rdbSaveRawString(rdb,node->zl,node->sz)) == -1) return -1;
@@ -1353,6 +1460,8 @@ int rdbSaveRio(rio *rdb, const redisDbPersistentDataSnapshot **rgpdb, int *error
     // 设置校验和计算回调函数
     if (g_pserver->rdb_checksum)
         rdb->update_cksum = rioGenericUpdateChecksum;
+    // 选择字符串压缩算法，全量同步时可能因从节点能力回退为 LZF
+    rdb->compression = (rsi && rsi->compression >= 0) ? rsi->compression : g_pserver->rdb_compression_algorithm;
     // 写入RDB文件魔数和版本号
     snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
     if (rdbWriteRaw(rdb,magic,9) == -1) goto werr;
@@ -68,6 +68,17 @@
 #define RDB_ENC_INT16 1       /* 16 bit signed integer */
 #define RDB_ENC_INT32 2       /* 32 bit signed integer */
 #define RDB_ENC_LZF 3         /* string compressed with FASTLZ */
+#define RDB_ENC_LZ4 4         /* string compressed with LZ4 */
+#define RDB_ENC_ZSTD 5        /* string compressed with Zstandard */
+
+/* Algorithms used for compressed strings, see rdb-compression-algorithm.
+ * RDB_ENC_LZ4 and RDB_ENC_ZSTD don't bump RDB_VERSION: a file only contains
+ * them when they were configured, and older servers reject it with an
+ * unknown string encoding error. Full syncs fall back to LZF for replicas
+ * that don't announce the matching capability. */
+#define RDB_COMPRESSION_LZF 0
+#define RDB_COMPRESSION_LZ4 1
+#define RDB_COMPRESSION_ZSTD 2
 
 /* Map object types to RDB object types. Macros starting with OBJ_ are for
  * memory storage and may change. Instead RDB types must be fixed because
@@ -168,6 +179,7 @@ robj *rdbLoadCheckModuleValue(rio *rdb, char *modulename);
 robj *rdbLoadStringObject(rio *rdb);
 ssize_t rdbSaveStringObject(rio *rdb, robj_roptr obj);
 ssize_t rdbSaveRawString(rio *rdb, const unsigned char *s, size_t len);
+int rdbCompressionSupported(int algorithm);
 void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr);
 int rdbSaveBinaryDoubleValue(rio *rdb, double val);
 int rdbLoadBinaryDoubleValue(rio *rdb, double *val);
@@ -43,12 +43,16 @@
 #include <math.h>
 #include <pthread.h>
 #include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
 extern "C" {
 #include "sdscompat.h" /* Use hiredis' sds compat header that maps sds calls to their hi_ variants */
 #include <sds.h> /* Use hiredis sds. */
 #include <hiredis.h>
 }
 #include "ae.h"
+#include "anet.h"
 #ifdef USE_OPENSSL
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -63,6 +67,7 @@ extern "C" {
 #include "hdr_histogram.h"
 #include "cli_common.h"
 #include "mt19937-64.h"
+#include "cmdtrace.h"
 
 #define UNUSED(V) ((void) V)
 #define RANDPTR_INITIAL_SIZE 8
@@ -130,6 +135,14 @@ static struct config {
     redisAtomic int is_updating_slots;
     redisAtomic int slots_last_update;
     int enable_tracking;
+    const char *replay_file;    /* --replay: MONITOR output to replay */
+    const char *workload_file;  /* --workload: declarative workload spec */
+    double rate;                /* --rate: open-loop target, requests/sec */
+    double replay_speed;        /* --replay-speed: follow trace timestamps */
+    double duration;            /* --duration: seconds per open-loop run */
+    double sweep_start;         /* --sweep: rate ramp, requests/sec */
+    double sweep_end;
+    double sweep_step;
     pthread_mutex_t liveclients_mutex;
     pthread_mutex_t is_updating_slots_mutex;
 } config;
@@ -991,9 +1004,16 @@ static void startBenchmarkThreads() {
         pthread_join(config.threads[i]->thread, NULL);
 }
 
+static void openLoopBenchmark(const char *title, const char *cmd, int len);
+
 static void benchmark(const char *title, const char *cmd, int len) {
     client c;
 
+    if (config.rate > 0 || config.sweep_end > 0) {
+        openLoopBenchmark(title,cmd,len);
+        return;
+    }
+
     config.title = title;
     config.requests_issued = 0;
     config.requests_finished = 0;
@@ -1421,6 +1441,1031 @@ static void genBenchmarkRandomData(char *data, int count) {
     }
 }
 
+/* Workload replay.
+ *
+ * Instead of hammering one fixed command, --replay and --workload drive the
+ * server with a realistic mix: either the commands captured in a MONITOR
+ * dump, or commands generated from a small declarative spec (command mix,
+ * key popularity and value sizes).
+ *
+ * Every request carries an intended send time. With --rate (or
+ * --replay-speed for traces) requests are scheduled open-loop and latency is
+ * measured from that intended time, so a server that falls behind shows up
+ * as queueing delay instead of a lower request rate. Without pacing each
+ * connection keeps -P requests in flight, like the classic benchmark.
+ * Latency is recorded in one hdr_histogram per command name.
+ *
+ * The built-in tests go through the same engine when --rate or --sweep is
+ * given: the test command is sent at a constant rate and --sweep repeats the
+ * run at increasing rates to locate the knee of the latency curve. */
+
+#define REPLAY_KEYS_UNIFORM 0
+#define REPLAY_KEYS_ZIPF 1
+#define REPLAY_KEYS_SEQUENTIAL 2
+
+#define REPLAY_VALUES_FIXED 0
+#define REPLAY_VALUES_UNIFORM 1
+#define REPLAY_VALUES_NORMAL 2
+
+#define REPLAY_ARG_LITERAL 0
+#define REPLAY_ARG_KEY 1
+#define REPLAY_ARG_VALUE 2
+
+#define REPLAY_MAX_VALUE_SIZE (64*1024*1024)
+
+typedef struct replayOp {
+    sds proto;              /* Command already encoded as RESP */
+    int cmd;                /* Index into replay.cmdnames */
+    int db;
+    long long ts;           /* Trace time (us) relative to the first command */
+    unsigned conn;          /* Global connection index, derived from the source client */
+} replayOp;
+
+typedef struct replayTemplate {
+    long long weight;       /* Cumulative weight, for the weighted pick */
+    int cmd;
+    std::vector<sds> args;
+    std::vector<int> argtype;
+} replayTemplate;
+
+typedef struct replayInflight {
+    long long intended;     /* When the request should have been sent (us) */
+    int cmd;                /* -1 for requests that are not measured (SELECT) */
+} replayInflight;
+
+struct replayThread;
+
+typedef struct replayConn {
+    redisContext *context;
+    std::deque<replayInflight> inflight;
+    int db;
+    int fWriteInstalled;
+    struct replayThread *thread;
+} replayConn;
+
+typedef struct replayThread {
+    int index;
+    pthread_t thread;
+    aeEventLoop *el;
+    std::vector<replayConn*> conns;
+    std::vector<size_t> ops;            /* Trace mode: indexes into replay.ops */
+    size_t nextop;
+    long long target;                   /* Requests this thread has to issue */
+    long long issued;
+    long long completed;
+    long long start;                    /* us */
+    long long maxlag;                   /* Worst delay between schedule and send (us) */
+    double rate;                        /* Requests per second, 0 = closed loop */
+    size_t rr;                          /* Round robin cursor over conns */
+    uint64_t rng;
+    std::vector<struct hdr_histogram*> hist;
+    std::vector<long long> errors;
+} replayThread;
+
+static struct replayState {
+    std::vector<std::string> cmdnames;
+    std::vector<replayOp> ops;
+    long long skipped;
+    long long noargs;                   /* Binary trace records without arguments */
+    /* Workload spec */
+    std::vector<replayTemplate> templates;
+    long long totalweight;
+    long long keyspace;
+    int keydist;
+    double theta, zetan, zipfalpha, zipfeta;
+    sds keyprefix;
+    int valuedist;
+    long long valuemin, valuemax;
+    double valuemean, valuestddev;
+    char *valuedata;
+    /* Built-in test sent open-loop: the command and its __rand_int__ offsets */
+    sds fixedproto;
+    std::vector<size_t> randoffsets;
+    /* Run state */
+    std::vector<replayThread*> threads;
+    redisAtomic long long completed;
+    long long start;                    /* ms */
+    long long previous_tick;
+    long long previous_completed;
+} replay;
+
+typedef struct replayResult {
+    long long completed;
+    double seconds;
+    double p50, p99, p999, max;     /* msec */
+    double maxlag;                  /* msec */
+} replayResult;
+
+static int replayCommandIndex(const char *name, size_t len) {
+    std::string lower(name, len);
+    for (auto &ch : lower) ch = tolower(ch);
+    for (size_t i = 0; i < replay.cmdnames.size(); ++i)
+        if (replay.cmdnames[i] == lower) return (int)i;
+    replay.cmdnames.push_back(lower);
+    return (int)replay.cmdnames.size()-1;
+}
+
+/* Commands that would desynchronize the request/reply stream, or that are
+ * already expressed by the trace itself (the db of every line), are not
+ * replayed. */
+static int replayIsSkippedCommand(const char *name) {
+    static const char *skipped[] = {"select","auth","hello","quit","reset",
+        "monitor","subscribe","psubscribe","unsubscribe","punsubscribe",
+        "sync","psync","replconf",NULL};
+    for (int i = 0; skipped[i]; i++)
+        if (!strcasecmp(name,skipped[i])) return 1;
+    return 0;
+}
+
+/* Parse one line of MONITOR output:
+ *
+ *   1339518083.107412 [0 127.0.0.1:60866] "set" "key" "value"
+ *
+ * Returns 1 if an op was added, 0 if the line was skipped. */
+static int replayParseMonitorLine(char *line, double *firstts) {
+    char *p = line;
+    char *eptr;
+    double ts = strtod(p,&eptr);
+    if (eptr == p || *eptr != ' ') return 0;
+    p = eptr+1;
+    if (*p != '[') return 0;
+    char *end = strchr(p,']');
+    if (end == NULL) return 0;
+    int db = (int)strtol(p+1,&eptr,10);
+    if (*eptr != ' ') return 0;
+    sds source = sdsnewlen(eptr+1,end-(eptr+1));
+    /* Commands issued by scripts are already covered by their EVAL. */
+    if (!strcmp(source,"lua")) {
+        sdsfree(source);
+        return 0;
+    }
+
+    int argc;
+    sds *argv = sdssplitargs(end+1,&argc);
+    if (argv == NULL || argc == 0) {
+        if (argv) sdsfreesplitres(argv,argc);
+        sdsfree(source);
+        return 0;
+    }
+    if (replayIsSkippedCommand(argv[0])) {
+        sdsfreesplitres(argv,argc);
+        sdsfree(source);
+        replay.skipped++;
+        return 0;
+    }
+
+    if (*firstts < 0) *firstts = ts;
+    replayOp op;
+    std::vector<size_t> argvlen(argc);
+    for (int j = 0; j < argc; j++) argvlen[j] = sdslen(argv[j]);
+    char *cmd;
+    long long len = redisFormatCommandArgv(&cmd,argc,(const char**)argv,argvlen.data());
+    op.proto = sdsnewlen(cmd,len);
+    free(cmd);
+    op.cmd = replayCommandIndex(argv[0],sdslen(argv[0]));
+    op.db = db;
+    op.ts = (long long)((ts - *firstts) * 1000000.0);
+    op.conn = (unsigned)dictGenHashFunction(source,sdslen(source));
+    replay.ops.push_back(op);
+    sdsfreesplitres(argv,argc);
+    sdsfree(source);
+    return 1;
+}
+
+/* Load a trace written by the server's command-trace (see cmdtrace.h). Only
+ * records captured with "command-trace-args all" carry the arguments, the
+ * others can not be replayed and are counted apart. */
+static int replayLoadBinaryTrace(FILE *fp, const char *filename) {
+    cmdtraceFileHeader fhdr;
+    if (fread(&fhdr,sizeof(fhdr),1,fp) != 1 || fhdr.version != CMDTRACE_VERSION ||
+        fseek(fp,fhdr.hdrlen,SEEK_SET) != 0)
+    {
+        fprintf(stderr,"Unsupported command trace '%s'\n",filename);
+        return 0;
+    }
+    std::vector<char> rec;
+    long long firstts = LLONG_MAX;
+    cmdtraceRecordHeader hdr;
+    while (fread(&hdr,sizeof(hdr),1,fp) == 1) {
+        if (hdr.len < sizeof(hdr)) break;
+        rec.resize(hdr.len-sizeof(hdr));
+        if (!rec.empty() && fread(rec.data(),rec.size(),1,fp) != 1) break;
+        std::string name(rec.data(),hdr.cmdlen);
+        if (hdr.flags & CMDTRACE_F_SCRIPT) continue;
+        if (replayIsSkippedCommand(name.c_str())) {
+            replay.skipped++;
+            continue;
+        }
+        if (hdr.argc > 1 && !(hdr.flags & CMDTRACE_F_ARGS)) {
+            replay.noargs++;
+            continue;
+        }
+        std::vector<const char*> argv;
+        std::vector<size_t> argvlen;
+        argv.push_back(name.c_str());
+        argvlen.push_back(name.size());
+        size_t off = hdr.cmdlen + hdr.nkeys*sizeof(uint64_t);
+        for (int j = 1; j < hdr.argc && (hdr.flags & CMDTRACE_F_ARGS); j++) {
+            uint32_t cb;
+            if (off + sizeof(cb) > rec.size()) break;
+            memcpy(&cb,rec.data()+off,sizeof(cb));
+            off += sizeof(cb);
+            if (off + cb > rec.size()) break;
+            argv.push_back(rec.data()+off);
+            argvlen.push_back(cb);
+            off += cb;
+        }
+        if ((int)argv.size() != hdr.argc) break;
+
+        replayOp op;
+        char *cmd;
+        long long len = redisFormatCommandArgv(&cmd,argv.size(),argv.data(),argvlen.data());
+        op.proto = sdsnewlen(cmd,len);
+        free(cmd);
+        op.cmd = replayCommandIndex(name.c_str(),name.size());
+        op.db = hdr.db;
+        op.ts = (long long)hdr.ts_us;
+        op.conn = (unsigned)dictGenHashFunction(&hdr.client_id,sizeof(hdr.client_id));
+        firstts = std::min(firstts,op.ts);
+        replay.ops.push_back(op);
+    }
+    /* Threads are drained in chunks so the file is a series of runs each
+     * ordered by time. Merge them so the ops are sent in the order they ran,
+     * records with the same timestamp keep their order in the file. */
+    std::stable_sort(replay.ops.begin(),replay.ops.end(),
+        [](const replayOp &a, const replayOp &b) { return a.ts < b.ts; });
+    for (replayOp &op : replay.ops) op.ts -= firstts;
+    return 1;
+}
+
+static int replayLoadTrace(const char *filename) {
+    FILE *fp = fopen(filename,"r");
+    if (fp == NULL) {
+        fprintf(stderr,"Can't open trace file '%s': %s\n",filename,strerror(errno));
+        return 0;
+    }
+    char magic[sizeof(((cmdtraceFileHeader*)0)->magic)];
+    if (fread(magic,sizeof(magic),1,fp) == 1 && !memcmp(magic,CMDTRACE_MAGIC,sizeof(magic))) {
+        rewind(fp);
+        int ok = replayLoadBinaryTrace(fp,filename);
+        fclose(fp);
+        if (ok && replay.ops.empty()) {
+            fprintf(stderr,"No replayable commands found in '%s'\n",filename);
+            return 0;
+        }
+        return ok;
+    }
+    rewind(fp);
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    double firstts = -1;
+    while ((len = getline(&line,&cap,fp)) != -1) {
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+            line[--len] = '\0';
+        replayParseMonitorLine(line,&firstts);
+    }
+    free(line);
+    fclose(fp);
+    if (replay.ops.empty()) {
+        fprintf(stderr,"No replayable commands found in '%s'\n",filename);
+        return 0;
+    }
+    return 1;
+}
+
+/* Parse a workload spec. One directive per line, '#' starts a comment:
+ *
+ *   keyspace 1000000                 number of distinct keys
+ *   keys zipf 0.99                   uniform | sequential | zipf <theta>
+ *   key-prefix user:                 default "key:"
+ *   values uniform 16 4096           fixed <n> | uniform <min> <max> |
+ *                                    normal <mean> <stddev>
+ *   pipeline 4                       same as -P
+ *   command 80 GET __key__           <weight> <command> [args...]
+ *   command 20 SET __key__ __value__
+ *
+ * __key__ is replaced by a key drawn from the key distribution, __value__
+ * by a value drawn from the value size distribution. */
+static int replayLoadWorkload(const char *filename) {
+    FILE *fp = fopen(filename,"r");
+    if (fp == NULL) {
+        fprintf(stderr,"Can't open workload file '%s': %s\n",filename,strerror(errno));
+        return 0;
+    }
+    replay.keyspace = 1000000;
+    replay.keydist = REPLAY_KEYS_UNIFORM;
+    replay.keyprefix = sdsnew("key:");
+    replay.valuedist = REPLAY_VALUES_FIXED;
+    replay.valuemin = replay.valuemax = config.datasize;
+
+    char *line = NULL;
+    size_t cap = 0;
+    int linenum = 0;
+    const char *err = NULL;
+    while (getline(&line,&cap,fp) != -1) {
+        linenum++;
+        int argc;
+        sds *argv = sdssplitargs(line,&argc);
+        if (argv == NULL) {
+            err = "Unbalanced quotes";
+            break;
+        }
+        if (argc == 0 || argv[0][0] == '#') {
+            sdsfreesplitres(argv,argc);
+            continue;
+        }
+        if (!strcasecmp(argv[0],"keyspace") && argc == 2) {
+            replay.keyspace = strtoll(argv[1],NULL,10);
+            if (replay.keyspace <= 0) err = "keyspace must be positive";
+        } else if (!strcasecmp(argv[0],"keys") && argc >= 2) {
+            if (!strcasecmp(argv[1],"uniform") && argc == 2) {
+                replay.keydist = REPLAY_KEYS_UNIFORM;
+            } else if (!strcasecmp(argv[1],"sequential") && argc == 2) {
+                replay.keydist = REPLAY_KEYS_SEQUENTIAL;
+            } else if (!strcasecmp(argv[1],"zipf") && argc == 3) {
+                replay.keydist = REPLAY_KEYS_ZIPF;
+                replay.theta = strtod(argv[2],NULL);
+                if (replay.theta <= 0 || replay.theta >= 1)
+                    err = "zipf theta must be in the (0,1) range";
+            } else {
+                err = "Unknown key distribution";
+            }
+        } else if (!strcasecmp(argv[0],"key-prefix") && argc == 2) {
+            sdsfree(replay.keyprefix);
+            replay.keyprefix = sdsdup(argv[1]);
+        } else if (!strcasecmp(argv[0],"values") && argc >= 3) {
+            if (!strcasecmp(argv[1],"fixed") && argc == 3) {
+                replay.valuedist = REPLAY_VALUES_FIXED;
+                replay.valuemin = replay.valuemax = strtoll(argv[2],NULL,10);
+            } else if (!strcasecmp(argv[1],"uniform") && argc == 4) {
+                replay.valuedist = REPLAY_VALUES_UNIFORM;
+                replay.valuemin = strtoll(argv[2],NULL,10);
+                replay.valuemax = strtoll(argv[3],NULL,10);
+            } else if (!strcasecmp(argv[1],"normal") && argc == 4) {
+                replay.valuedist = REPLAY_VALUES_NORMAL;
+                replay.valuemean = strtod(argv[2],NULL);
+                replay.valuestddev = strtod(argv[3],NULL);
+                replay.valuemin = 1;
+                replay.valuemax = (long long)(replay.valuemean + 6*replay.valuestddev);
+            } else {
+                err = "Unknown value size distribution";
+            }
+            if (!err && (replay.valuemin < 1 || replay.valuemax < replay.valuemin ||
+                         replay.valuemax > REPLAY_MAX_VALUE_SIZE))
+                err = "Invalid value sizes";
+        } else if (!strcasecmp(argv[0],"pipeline") && argc == 2) {
+            config.pipeline = atoi(argv[1]);
+            if (config.pipeline <= 0) config.pipeline = 1;
+        } else if (!strcasecmp(argv[0],"command") && argc >= 3) {
+            replayTemplate t;
+            long long weight = strtoll(argv[1],NULL,10);
+            if (weight <= 0) {
+                err = "Command weight must be positive";
+            } else {
+                replay.totalweight += weight;
+                t.weight = replay.totalweight;
+                t.cmd = replayCommandIndex(argv[2],sdslen(argv[2]));
+                for (int j = 2; j < argc; j++) {
+                    int type = REPLAY_ARG_LITERAL;
+                    if (!strcmp(argv[j],"__key__")) type = REPLAY_ARG_KEY;
+                    else if (!strcmp(argv[j],"__value__")) type = REPLAY_ARG_VALUE;
+                    t.args.push_back(sdsdup(argv[j]));
+                    t.argtype.push_back(type);
+                }
+                replay.templates.push_back(t);
+            }
+        } else {
+            err = "Unknown directive or wrong number of arguments";
+        }
+        sdsfreesplitres(argv,argc);
+        if (err) break;
+    }
+    free(line);
+    fclose(fp);
+    if (err) {
+        fprintf(stderr,"%s:%d: %s\n",filename,linenum,err);
+        return 0;
+    }
+    if (replay.templates.empty()) {
+        fprintf(stderr,"Workload '%s' has no 'command' directive\n",filename);
+        return 0;
+    }
+
+    if (replay.keydist == REPLAY_KEYS_ZIPF) {
+        /* Gray et al., "Quickly generating billion-record synthetic
+         * databases": O(keyspace) setup, O(1) per draw. */
+        double zetan = 0;
+        for (long long i = 1; i <= replay.keyspace; i++)
+            zetan += 1.0 / pow((double)i,replay.theta);
+        double zeta2 = 1.0 + pow(0.5,replay.theta);
+        replay.zetan = zetan;
+        replay.zipfalpha = 1.0 / (1.0 - replay.theta);
+        replay.zipfeta = (1.0 - pow(2.0/replay.keyspace,1.0-replay.theta)) /
+                         (1.0 - zeta2/zetan);
+    }
+    replay.valuedata = (char*)zmalloc(replay.valuemax+1, MALLOC_LOCAL);
+    genBenchmarkRandomData(replay.valuedata,replay.valuemax);
+    replay.valuedata[replay.valuemax] = '\0';
+    return 1;
+}
+
+/* xorshift64*, one state per thread. */
+static uint64_t replayRandom(replayThread *t) {
+    t->rng ^= t->rng >> 12;
+    t->rng ^= t->rng << 25;
+    t->rng ^= t->rng >> 27;
+    return t->rng * 2685821657736338717ULL;
+}
+
+static double replayRandomDouble(replayThread *t) {
+    return (replayRandom(t) >> 11) * (1.0/9007199254740992.0);
+}
+
+static long long replayNextKey(replayThread *t) {
+    switch (replay.keydist) {
+    case REPLAY_KEYS_SEQUENTIAL:
+        return (t->issued * (long long)replay.threads.size() + t->index) % replay.keyspace;
+    case REPLAY_KEYS_ZIPF: {
+        double u = replayRandomDouble(t);
+        double uz = u * replay.zetan;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + pow(0.5,replay.theta)) return std::min(1LL,replay.keyspace-1);
+        long long rank = (long long)(replay.keyspace *
+            pow(replay.zipfeta*u - replay.zipfeta + 1.0,replay.zipfalpha));
+        return std::min(rank,replay.keyspace-1);
+    }
+    default:
+        return (long long)(replayRandom(t) % (uint64_t)replay.keyspace);
+    }
+}
+
+static long long replayNextValueSize(replayThread *t) {
+    long long size;
+    switch (replay.valuedist) {
+    case REPLAY_VALUES_UNIFORM:
+        size = replay.valuemin + (long long)(replayRandom(t) %
+            (uint64_t)(replay.valuemax - replay.valuemin + 1));
+        break;
+    case REPLAY_VALUES_NORMAL: {
+        /* Box-Muller */
+        double u1 = replayRandomDouble(t), u2 = replayRandomDouble(t);
+        if (u1 < 1e-12) u1 = 1e-12;
+        double z = sqrt(-2.0*log(u1)) * cos(2*M_PI*u2);
+        size = (long long)(replay.valuemean + z*replay.valuestddev);
+        break;
+    }
+    default:
+        return replay.valuemin;
+    }
+    if (size < replay.valuemin) size = replay.valuemin;
+    if (size > replay.valuemax) size = replay.valuemax;
+    return size;
+}
+
+/* Append one generated request to 'buf', returns the command index. */
+static int replayGenerate(replayThread *t, sds *buf) {
+    if (replay.fixedproto != NULL) {
+        size_t off = sdslen(*buf);
+        *buf = sdscatlen(*buf,replay.fixedproto,sdslen(replay.fixedproto));
+        /* Same substitution as randomizeClientKey() */
+        for (size_t offset : replay.randoffsets) {
+            char *p = *buf+off+offset+11;
+            size_t r = 0;
+            if (config.randomkeys_keyspacelen != 0)
+                r = replayRandom(t) % config.randomkeys_keyspacelen;
+            for (int j = 0; j < 12; j++) {
+                *p-- = '0'+r%10;
+                r /= 10;
+            }
+        }
+        return 0;
+    }
+    long long pick = (long long)(replayRandom(t) % (uint64_t)replay.totalweight);
+    const replayTemplate *tmpl = nullptr;
+    for (const auto &candidate : replay.templates) {
+        if (pick < candidate.weight) {
+            tmpl = &candidate;
+            break;
+        }
+    }
+    char keybuf[256];
+    *buf = sdscatprintf(*buf,"*%zu\r\n",tmpl->args.size());
+    for (size_t j = 0; j < tmpl->args.size(); j++) {
+        const char *arg;
+        size_t len;
+        switch (tmpl->argtype[j]) {
+        case REPLAY_ARG_KEY:
+            len = (size_t)snprintf(keybuf,sizeof(keybuf),"%s%lld",replay.keyprefix,replayNextKey(t));
+            if (len >= sizeof(keybuf)) len = sizeof(keybuf)-1;
+            arg = keybuf;
+            break;
+        case REPLAY_ARG_VALUE:
+            len = replayNextValueSize(t);
+            arg = replay.valuedata;
+            break;
+        default:
+            arg = tmpl->args[j];
+            len = sdslen(tmpl->args[j]);
+            break;
+        }
+        *buf = sdscatprintf(*buf,"$%zu\r\n",len);
+        *buf = sdscatlen(*buf,arg,len);
+        *buf = sdscatlen(*buf,"\r\n",2);
+    }
+    return tmpl->cmd;
+}
+
+static void replayWriteHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+
+static void replayFlush(replayConn *conn) {
+    int done = 0;
+    if (redisBufferWrite(conn->context,&done) == REDIS_ERR) {
+        fprintf(stderr,"Error writing to the server: %s\n",conn->context->errstr);
+        exit(1);
+    }
+    aeEventLoop *el = conn->thread->el;
+    if (!done && !conn->fWriteInstalled) {
+        aeCreateFileEvent(el,conn->context->fd,AE_WRITABLE,replayWriteHandler,conn);
+        conn->fWriteInstalled = 1;
+    } else if (done && conn->fWriteInstalled) {
+        aeDeleteFileEvent(el,conn->context->fd,AE_WRITABLE);
+        conn->fWriteInstalled = 0;
+    }
+}
+
+static void replayWriteHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    UNUSED(el);
+    UNUSED(fd);
+    UNUSED(mask);
+    replayFlush((replayConn*)privdata);
+}
+
+static void replaySend(replayConn *conn, const char *proto, size_t len, int cmd,
+                       long long intended) {
+    redisContext *ctx = conn->context;
+    ctx->obuf = sdscatlen(ctx->obuf,proto,len);
+    conn->inflight.push_back({intended,cmd});
+}
+
+static int replayThreadDone(replayThread *t) {
+    return t->issued >= t->target && t->completed >= t->issued;
+}
+
+/* Issue every request that is due. Paced threads send whatever the schedule
+ * says is due no matter how many replies are outstanding; closed-loop
+ * threads keep at most config.pipeline requests in flight per connection. */
+static void replayDispatch(replayThread *t) {
+    int paced = t->rate > 0 || (config.replay_speed > 0 && !t->ops.empty());
+    long long now = ustime();
+    std::vector<replayConn*> dirty;
+
+    while (t->issued < t->target) {
+        long long intended = now;
+        replayConn *conn = nullptr;
+        const replayOp *op = nullptr;
+
+        if (!t->ops.empty()) {
+            op = &replay.ops[t->ops[t->nextop]];
+            conn = t->conns[(op->conn / replay.threads.size()) % t->conns.size()];
+            if (config.replay_speed > 0)
+                intended = t->start + (long long)(op->ts / config.replay_speed);
+        } else {
+            if (t->rate > 0) {
+                conn = t->conns[t->rr++ % t->conns.size()];
+            } else {
+                for (size_t i = 0; i < t->conns.size() && conn == nullptr; i++) {
+                    replayConn *candidate = t->conns[(t->rr + i) % t->conns.size()];
+                    if ((int)candidate->inflight.size() < config.pipeline) conn = candidate;
+                }
+                if (conn == nullptr) break;
+                t->rr++;
+            }
+        }
+        if (t->rate > 0)
+            intended = t->start + (long long)(t->issued * 1000000.0 / t->rate);
+        if (paced && intended > now) break;
+        if (!paced && (int)conn->inflight.size() >= config.pipeline) break;
+        if (now - intended > t->maxlag) t->maxlag = now - intended;
+
+        if (op != nullptr) {
+            if (op->db != conn->db) {
+                char dbstr[32];
+                int dblen = snprintf(dbstr,sizeof(dbstr),"%d",op->db);
+                sds select = sdscatprintf(sdsempty(),"*2\r\n$6\r\nSELECT\r\n$%d\r\n%s\r\n",
+                    dblen,dbstr);
+                replaySend(conn,select,sdslen(select),-1,intended);
+                sdsfree(select);
+                conn->db = op->db;
+            }
+            replaySend(conn,op->proto,sdslen(op->proto),op->cmd,intended);
+            t->nextop++;
+        } else {
+            sds buf = sdsempty();
+            int cmd = replayGenerate(t,&buf);
+            replaySend(conn,buf,sdslen(buf),cmd,intended);
+            sdsfree(buf);
+        }
+        t->issued++;
+        if (std::find(dirty.begin(),dirty.end(),conn) == dirty.end())
+            dirty.push_back(conn);
+    }
+    for (replayConn *conn : dirty)
+        replayFlush(conn);
+}
+
+static void replayRecord(replayThread *t, const replayInflight &req, long long now,
+                         redisReply *reply) {
+    if (req.cmd < 0) {
+        if (reply->type == REDIS_REPLY_ERROR) {
+            fprintf(stderr,"Error from server: %s\n",reply->str);
+            exit(1);
+        }
+        return;
+    }
+    long long latency = now - req.intended;
+    if (latency < 0) latency = 0;
+    if (latency > CONFIG_LATENCY_HISTOGRAM_MAX_VALUE)
+        latency = CONFIG_LATENCY_HISTOGRAM_MAX_VALUE;
+    hdr_record_value(t->hist[req.cmd],latency);
+    if (reply->type == REDIS_REPLY_ERROR) t->errors[req.cmd]++;
+    t->completed++;
+    atomicIncr(replay.completed,1);
+}
+
+static void replayReadHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    replayConn *conn = (replayConn*)privdata;
+    replayThread *t = conn->thread;
+    UNUSED(fd);
+    UNUSED(mask);
+
+    /* As in readHandler: parsing is not part of the latency. */
+    long long now = ustime();
+    if (redisBufferRead(conn->context) != REDIS_OK) {
+        fprintf(stderr,"Error: %s\n",conn->context->errstr);
+        exit(1);
+    }
+    void *reply = NULL;
+    while (!conn->inflight.empty()) {
+        if (redisGetReply(conn->context,&reply) != REDIS_OK) {
+            fprintf(stderr,"Error: %s\n",conn->context->errstr);
+            exit(1);
+        }
+        if (reply == NULL) break;
+        replayRecord(t,conn->inflight.front(),now,(redisReply*)reply);
+        conn->inflight.pop_front();
+        freeReplyObject(reply);
+    }
+    replayDispatch(t);
+    if (replayThreadDone(t)) aeStop(el);
+}
+
+static int replayTimer(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    UNUSED(id);
+    replayThread *t = (replayThread*)clientData;
+    replayDispatch(t);
+    if (replayThreadDone(t)) {
+        aeStop(eventLoop);
+        return AE_NOMORE;
+    }
+    return 1;
+}
+
+static int replayShowThroughput(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    UNUSED(eventLoop);
+    UNUSED(id);
+    UNUSED(clientData);
+    if (config.quiet || config.csv) return AE_NOMORE;
+    long long completed;
+    atomicGet(replay.completed,completed);
+    long long now = mstime();
+    double dt = (double)(now - replay.start)/1000.0;
+    double instantaneous_dt = (double)(now - replay.previous_tick)/1000.0;
+    double rps = dt > 0 ? completed/dt : 0;
+    double instantaneous_rps = instantaneous_dt > 0 ?
+        (completed - replay.previous_completed)/instantaneous_dt : 0;
+    replay.previous_tick = now;
+    replay.previous_completed = completed;
+    int printed_bytes = printf("%s: rps=%.1f (overall: %.1f) completed=%lld\r",
+        config.title, instantaneous_rps, rps, completed);
+    if (printed_bytes > config.last_printed_bytes)
+        config.last_printed_bytes = printed_bytes;
+    fflush(stdout);
+    return 250;
+}
+
+static void *execReplayThread(void *ptr) {
+    replayThread *t = (replayThread*)ptr;
+    aeThreadOnline();
+    for (replayConn *conn : t->conns)
+        aeCreateFileEvent(t->el,conn->context->fd,AE_READABLE,replayReadHandler,conn);
+    t->start = ustime();
+    if (t->rate > 0 || config.replay_speed > 0)
+        aeCreateTimeEvent(t->el,1,replayTimer,t,NULL);
+    if (t->index == 0)
+        aeCreateTimeEvent(t->el,250,replayShowThroughput,NULL,NULL);
+    replayDispatch(t);
+    if (!replayThreadDone(t)) aeMain(t->el);
+    aeThreadOffline();
+    return NULL;
+}
+
+static replayConn *replayConnect(replayThread *t) {
+    redisContext *ctx = getRedisContext(config.hostip,config.hostport,config.hostsocket);
+    if (ctx == NULL) exit(1);
+    if (config.enable_tracking) {
+        redisReply *reply = (redisReply*)redisCommand(ctx,"CLIENT TRACKING on");
+        if (reply) freeReplyObject(reply);
+    }
+    if (config.dbnum != 0) {
+        redisReply *reply = (redisReply*)redisCommand(ctx,"SELECT %d",config.dbnum);
+        if (reply == NULL || reply->type == REDIS_REPLY_ERROR) {
+            fprintf(stderr,"Failed to select db %d\n",config.dbnum);
+            exit(1);
+        }
+        freeReplyObject(reply);
+    }
+    anetNonBlock(NULL,ctx->fd);
+    ctx->flags &= ~REDIS_BLOCK;
+    ctx->reader->maxbuf = 0;
+
+    replayConn *conn = new replayConn();
+    conn->context = ctx;
+    conn->db = config.dbnum;
+    conn->fWriteInstalled = 0;
+    conn->thread = t;
+    return conn;
+}
+
+static struct hdr_histogram *replayCreateHistogram() {
+    struct hdr_histogram *h;
+    hdr_init(CONFIG_LATENCY_HISTOGRAM_MIN_VALUE,
+             CONFIG_LATENCY_HISTOGRAM_MAX_VALUE,
+             config.precision,
+             &h);
+    return h;
+}
+
+static void replayReportLine(const char *name, struct hdr_histogram *h, long long errors,
+                             double seconds) {
+    long long calls = h->total_count;
+    double rps = seconds > 0 ? calls/seconds : 0;
+    double avg = hdr_mean(h)/1000.0;
+    double p50 = hdr_value_at_percentile(h,50.0)/1000.0;
+    double p99 = hdr_value_at_percentile(h,99.0)/1000.0;
+    double p999 = hdr_value_at_percentile(h,99.9)/1000.0;
+    double max = hdr_max(h)/1000.0;
+    if (config.csv) {
+        printf("\"%s\",\"%lld\",\"%lld\",\"%.2f\",\"%.3f\",\"%.3f\",\"%.3f\",\"%.3f\",\"%.3f\"\n",
+            name, calls, errors, rps, avg, p50, p99, p999, max);
+    } else {
+        printf("  %-16s %10lld %8lld %12.2f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+            name, calls, errors, rps, avg, p50, p99, p999, max);
+    }
+}
+
+/* Merge the per-thread histograms into 'res' and print the report, unless
+ * 'fPrint' is false (--sweep prints one line per step instead). */
+static void replayReport(const char *title, double seconds, int fPrint, replayResult *res) {
+    size_t ncmds = replay.cmdnames.size();
+    std::vector<struct hdr_histogram*> merged(ncmds);
+    std::vector<long long> errors(ncmds,0);
+    struct hdr_histogram *total = replayCreateHistogram();
+    long long totalerrors = 0;
+    for (size_t i = 0; i < ncmds; i++) {
+        merged[i] = replayCreateHistogram();
+        for (replayThread *t : replay.threads) {
+            hdr_add(merged[i],t->hist[i]);
+            errors[i] += t->errors[i];
+        }
+        hdr_add(total,merged[i]);
+        totalerrors += errors[i];
+    }
+    res->completed = total->total_count;
+    res->seconds = seconds;
+    res->p50 = hdr_value_at_percentile(total,50.0)/1000.0;
+    res->p99 = hdr_value_at_percentile(total,99.0)/1000.0;
+    res->p999 = hdr_value_at_percentile(total,99.9)/1000.0;
+    res->max = hdr_max(total)/1000.0;
+    res->maxlag = 0;
+    for (replayThread *t : replay.threads)
+        res->maxlag = std::max(res->maxlag,t->maxlag/1000.0);
+
+    if (!fPrint) {
+        /* nothing */
+    } else if (config.csv) {
+        printf("\"command\",\"calls\",\"errors\",\"rps\",\"avg_latency_ms\",\"p50_latency_ms\",\"p99_latency_ms\",\"p999_latency_ms\",\"max_latency_ms\"\n");
+    } else {
+        printf("%*s\r", config.last_printed_bytes, " ");
+        printf("====== %s ======\n", title);
+        printf("  %lld requests completed in %.2f seconds\n", (long long)total->total_count, seconds);
+        printf("  %d parallel clients, %d threads\n", config.numclients, (int)replay.threads.size());
+        if (config.rate > 0)
+            printf("  target rate: %.0f requests per second (open loop)\n", config.rate);
+        else if (config.replay_speed > 0)
+            printf("  trace timing: %.2fx (open loop)\n", config.replay_speed);
+        else
+            printf("  pipeline: %d (closed loop)\n", config.pipeline);
+        if (replay.skipped)
+            printf("  %lld trace commands skipped (connection state or pubsub)\n", replay.skipped);
+        if (replay.noargs)
+            printf("  %lld trace records without arguments skipped (administrative, or command-trace-args keys)\n", replay.noargs);
+        if (config.rate > 0)
+            printf("  max send lag: %.3f msec\n", res->maxlag);
+        printf("\n");
+        printf("  %-16s %10s %8s %12s %9s %9s %9s %9s %9s\n",
+            "command", "calls", "errors", "rps", "avg", "p50", "p99", "p99.9", "max");
+    }
+    for (size_t i = 0; i < ncmds && fPrint; i++) {
+        if (merged[i]->total_count == 0) continue;
+        replayReportLine(replay.cmdnames[i].c_str(),merged[i],errors[i],seconds);
+    }
+    if (fPrint) {
+        replayReportLine("ALL",total,totalerrors,seconds);
+        if (!config.csv) printf("  (latencies in msec)\n\n");
+    }
+
+    for (size_t i = 0; i < ncmds; i++) hdr_close(merged[i]);
+    hdr_close(total);
+}
+
+static void replayRun(const char *title, int fPrint, replayResult *res) {
+    int nthreads = config.num_threads > 0 ? config.num_threads : 1;
+    if (nthreads > config.numclients) nthreads = config.numclients;
+    long long target = replay.ops.empty() ? config.requests : (long long)replay.ops.size();
+    if (replay.ops.empty() && config.rate > 0 && config.duration > 0)
+        target = (long long)(config.rate * config.duration);
+
+    config.title = title;
+    config.last_printed_bytes = 0;
+    replay.completed = 0;
+    replay.previous_completed = 0;
+    for (int i = 0; i < nthreads; i++) {
+        replayThread *t = new replayThread();
+        t->index = i;
+        t->el = aeCreateEventLoop(config.numclients*2+1024);
+        t->nextop = 0;
+        t->issued = t->completed = 0;
+        t->maxlag = 0;
+        t->rate = config.rate / nthreads;
+        t->rr = 0;
+        t->rng = (ustime() ^ ((uint64_t)getpid() << 16)) * (i+1) | 1;
+        for (size_t c = 0; c < replay.cmdnames.size(); c++) {
+            t->hist.push_back(replayCreateHistogram());
+            t->errors.push_back(0);
+        }
+        replay.threads.push_back(t);
+    }
+    for (int c = 0; c < config.numclients; c++) {
+        replayThread *t = replay.threads[c % nthreads];
+        t->conns.push_back(replayConnect(t));
+    }
+    if (replay.ops.empty()) {
+        for (int i = 0; i < nthreads; i++)
+            replay.threads[i]->target = target/nthreads + (i < target%nthreads ? 1 : 0);
+    } else {
+        /* All the commands of a source client go through the same connection,
+         * so per-client ordering is preserved. */
+        for (size_t i = 0; i < replay.ops.size(); i++) {
+            replay.ops[i].conn %= config.numclients;
+            replay.threads[replay.ops[i].conn % nthreads]->ops.push_back(i);
+        }
+        for (replayThread *t : replay.threads) t->target = t->ops.size();
+    }
+
+    replay.start = replay.previous_tick = mstime();
+    for (replayThread *t : replay.threads) {
+        if (pthread_create(&t->thread,NULL,execReplayThread,t)) {
+            fprintf(stderr,"FATAL: Failed to start thread %d.\n",t->index);
+            exit(1);
+        }
+    }
+    for (replayThread *t : replay.threads)
+        pthread_join(t->thread,NULL);
+    double seconds = (double)(mstime()-replay.start)/1000.0;
+
+    replayReport(title,seconds,fPrint,res);
+
+    for (replayThread *t : replay.threads) {
+        for (replayConn *conn : t->conns) {
+            redisFree(conn->context);
+            delete conn;
+        }
+        for (struct hdr_histogram *h : t->hist) hdr_close(h);
+        aeDeleteEventLoop(t->el);
+        delete t;
+    }
+    replay.threads.clear();
+}
+
+static int replayMain() {
+    if (config.cluster_mode) {
+        fprintf(stderr,"--replay and --workload do not support --cluster\n");
+        return 1;
+    }
+    if (config.replay_file && config.workload_file) {
+        fprintf(stderr,"--replay and --workload are mutually exclusive\n");
+        return 1;
+    }
+    if (config.rate > 0 && config.replay_speed > 0) {
+        fprintf(stderr,"--rate and --replay-speed are mutually exclusive\n");
+        return 1;
+    }
+    if (config.replay_speed > 0 && config.replay_file == NULL) {
+        fprintf(stderr,"--replay-speed requires --replay\n");
+        return 1;
+    }
+    const char *file = config.replay_file ? config.replay_file : config.workload_file;
+    if (config.replay_file ? !replayLoadTrace(file) : !replayLoadWorkload(file))
+        return 1;
+    sds title = sdscatprintf(sdsempty(),"%s %s",
+        config.replay_file ? "REPLAY" : "WORKLOAD", file);
+    do {
+        replayResult res;
+        replayRun(title,1,&res);
+    } while (config.loop);
+    sdsfree(title);
+    return 0;
+}
+
+/* Run one built-in test open-loop. With --sweep the rate goes from
+ * sweep_start to sweep_end and every step is reduced to one line; the knee
+ * is the last rate the server sustained (>= 95% of the target completed in
+ * time) before p99 took off (more than 10x the first step). */
+static void openLoopBenchmark(const char *title, const char *cmd, int len) {
+    replay.cmdnames.clear();
+    replay.cmdnames.push_back(title);
+    replay.fixedproto = sdsnewlen(cmd,len);
+    replay.randoffsets.clear();
+    if (config.randomkeys) {
+        const char *p = replay.fixedproto;
+        while ((p = strstr(p,"__rand_int__")) != NULL) {
+            replay.randoffsets.push_back(p - replay.fixedproto);
+            p += 12;
+        }
+    }
+
+    if (config.sweep_end <= 0) {
+        replayResult res;
+        replayRun(title,!config.quiet && !config.csv,&res);
+        if (config.csv) {
+            printf("\"%s\",\"%.0f\",\"%.2f\",\"%.3f\",\"%.3f\",\"%.3f\",\"%.3f\"\n",
+                title, config.rate, res.seconds > 0 ? res.completed/res.seconds : 0,
+                res.p50, res.p99, res.p999, res.max);
+        } else if (config.quiet) {
+            printf("%*s\r", config.last_printed_bytes, " ");
+            printf("%s: %.2f requests per second at %.0f target, p50=%.3f p99=%.3f msec\n",
+                title, res.seconds > 0 ? res.completed/res.seconds : 0, config.rate,
+                res.p50, res.p99);
+        }
+        sdsfree(replay.fixedproto);
+        replay.fixedproto = NULL;
+        return;
+    }
+
+    double rateSaved = config.rate;
+    double baseline = -1, knee = -1, kneeNext = -1;
+    const char *kneeReason = NULL;
+    if (!config.csv) {
+        printf("====== %s rate sweep ======\n", title);
+        printf("  %12s %12s %9s %9s %9s %9s %9s\n",
+            "target_rps", "rps", "p50", "p99", "p99.9", "max", "send_lag");
+    }
+    for (double rate = config.sweep_start; rate <= config.sweep_end; rate += config.sweep_step) {
+        replayResult res;
+        config.rate = rate;
+        replayRun(title,0,&res);
+        double rps = res.seconds > 0 ? res.completed/res.seconds : 0;
+        if (config.csv) {
+            printf("\"%s\",\"%.0f\",\"%.2f\",\"%.3f\",\"%.3f\",\"%.3f\",\"%.3f\"\n",
+                title, rate, rps, res.p50, res.p99, res.p999, res.max);
+        } else {
+            printf("%*s\r", config.last_printed_bytes, " ");
+            printf("  %12.0f %12.2f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+                rate, rps, res.p50, res.p99, res.p999, res.max, res.maxlag);
+        }
+        fflush(stdout);
+        if (baseline < 0) baseline = res.p99;
+        if (kneeNext < 0) {
+            if (rps < rate * 0.95) kneeReason = "throughput fell behind the target";
+            else if (res.p99 > baseline * 10 && res.p99 > 1.0) kneeReason = "p99 grew more than 10x";
+            if (kneeReason) kneeNext = rate;
+            else knee = rate;
+        }
+    }
+    if (!config.csv) {
+        if (kneeNext < 0)
+            printf("  knee: not reached up to %.0f requests per second\n\n", knee);
+        else if (knee < 0)
+            printf("  knee: below %.0f requests per second (%s)\n\n", kneeNext, kneeReason);
+        else
+            printf("  knee: ~%.0f requests per second (at %.0f %s)\n\n", knee, kneeNext, kneeReason);
+    }
+    config.rate = rateSaved;
+    sdsfree(replay.fixedproto);
+    replay.fixedproto = NULL;
+}
+
 /* Returns number of consumed options. */
 int parseOptions(int argc, const char **argv) {
     int i;
@@ -1522,6 +2567,30 @@ int parseOptions(int argc, const char **argv) {
             config.cluster_mode = 1;
         } else if (!strcmp(argv[i],"--enable-tracking")) {
             config.enable_tracking = 1;
+        } else if (!strcmp(argv[i],"--replay")) {
+            if (lastarg) goto invalid;
+            config.replay_file = argv[++i];
+        } else if (!strcmp(argv[i],"--workload")) {
+            if (lastarg) goto invalid;
+            config.workload_file = argv[++i];
+        } else if (!strcmp(argv[i],"--rate")) {
+            if (lastarg) goto invalid;
+            config.rate = strtod(argv[++i],NULL);
+            if (config.rate < 0) config.rate = 0;
+        } else if (!strcmp(argv[i],"--duration")) {
+            if (lastarg) goto invalid;
+            config.duration = strtod(argv[++i],NULL);
+            if (config.duration < 0) config.duration = 0;
+        } else if (!strcmp(argv[i],"--sweep")) {
+            if (lastarg) goto invalid;
+            if (sscanf(argv[++i],"%lf:%lf:%lf",&config.sweep_start,
+                       &config.sweep_end,&config.sweep_step) != 3 ||
+                config.sweep_start <= 0 || config.sweep_step <= 0 ||
+                config.sweep_end < config.sweep_start) goto invalid;
+        } else if (!strcmp(argv[i],"--replay-speed")) {
+            if (lastarg) goto invalid;
+            config.replay_speed = strtod(argv[++i],NULL);
+            if (config.replay_speed < 0) config.replay_speed = 0;
         } else if (!strcmp(argv[i],"--help")) {
             exit_status = 0;
             goto usage;
@@ -1599,6 +2668,23 @@ usage:
 " -t <tests>         Only run the comma separated list of tests. The test\n"
 "                    names are the same as the ones produced as output.\n"
 " -I                 Idle mode. Just open N idle connections and wait.\n"
+" --replay <file>    Replay the commands of a MONITOR capture, or of a server\n"
+"                    command trace (command-trace-args all), instead of the\n"
+"                    built-in tests. Commands of the same source client are\n"
+"                    sent in order on the same connection.\n"
+" --workload <file>  Generate requests from a workload spec: command mix,\n"
+"                    key distribution (uniform, sequential, zipf) and value\n"
+"                    sizes. See the replay section of redis-benchmark.cpp.\n"
+" --rate <req/sec>   Send requests open-loop at this total rate and measure\n"
+"                    latency from the scheduled send time, so queueing in the\n"
+"                    server is not hidden by clients waiting for replies.\n"
+"                    Works with the built-in tests, --replay and --workload.\n"
+" --duration <sec>   With --rate or --sweep, run each test for this long\n"
+"                    instead of -n requests.\n"
+" --sweep <from>:<to>:<step>\n"
+"                    Run every selected test open-loop at increasing rates and\n"
+"                    print throughput and latency per step, plus the knee.\n"
+" --replay-speed <x> With --replay, follow the capture timestamps sped up x times.\n"
 #ifdef USE_OPENSSL
 " --tls              Establish a secure TLS connection.\n"
 " --sni <host>       Server name indication for TLS.\n"
@@ -1636,6 +2722,14 @@ usage:
 "   $ keydb-benchmark -r 10000 -n 10000 lpush mylist __rand_int__\n\n"
 " On user specified command lines __rand_int__ is replaced with a random integer\n"
 " with a range of values selected by the -r option.\n"
+"\n"
+" Replay a MONITOR capture over 8 connections at 50k requests per second:\n"
+"   $ keydb-cli monitor > trace.txt\n"
+"   $ keydb-benchmark -c 8 --threads 2 --rate 50000 --replay trace.txt\n\n"
+" Drive a Zipfian 80/20 GET/SET mix described in mix.spec:\n"
+"   $ keydb-benchmark -n 1000000 --workload mix.spec\n\n"
+" Find the GET throughput at which p99 latency takes off:\n"
+"   $ keydb-benchmark -t get -r 100000 --duration 5 --sweep 20000:200000:20000\n"
     );
     exit(exit_status);
 }
@@ -1743,6 +2837,12 @@ int main(int argc, const char **argv) {
     config.is_updating_slots = 0;
     config.slots_last_update = 0;
     config.enable_tracking = 0;
+    config.replay_file = NULL;
+    config.workload_file = NULL;
+    config.rate = 0;
+    config.replay_speed = 0;
+    config.duration = 0;
+    config.sweep_start = config.sweep_end = config.sweep_step = 0;
 
     i = parseOptions(argc,argv);
     argc -= i;
@@ -1828,7 +2928,18 @@ int main(int argc, const char **argv) {
         else aeMain(config.el);
         /* and will wait for every */
     }
-    if(config.csv){
+    if (config.replay_file || config.workload_file) {
+        int ret = replayMain();
+        if (config.redis_config != NULL) freeRedisConfig(config.redis_config);
+        return ret;
+    }
+    if (config.cluster_mode && (config.rate > 0 || config.sweep_end > 0)) {
+        fprintf(stderr,"--rate and --sweep do not support --cluster\n");
+        return 1;
+    }
+    if (config.csv && (config.rate > 0 || config.sweep_end > 0)) {
+        printf("\"test\",\"target_rps\",\"rps\",\"p50_latency_ms\",\"p99_latency_ms\",\"p999_latency_ms\",\"max_latency_ms\"\n");
+    } else if(config.csv){
         printf("\"test\",\"rps\",\"avg_latency_ms\",\"min_latency_ms\",\"p50_latency_ms\",\"p95_latency_ms\",\"p99_latency_ms\",\"max_latency_ms\"\n");
     }
     /* Run benchmark with command in the remainder of the arguments. */
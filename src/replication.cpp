@@ -1265,6 +1265,17 @@ int rdbSaveSnapshotForReplication(rdbSaveInfo *rsi) {
     return retval;
 }
 
+/* The RDB_COMPRESSION_* algorithm a full sync to replicas with the
+ * capabilities 'mincapa' can use. */
+static int rdbCompressionForReplicas(int mincapa) {
+    int algorithm = g_pserver->rdb_compression_algorithm;
+    if (algorithm == RDB_COMPRESSION_LZ4 && !(mincapa & SLAVE_CAPA_RDB_LZ4))
+        return RDB_COMPRESSION_LZF;
+    if (algorithm == RDB_COMPRESSION_ZSTD && !(mincapa & SLAVE_CAPA_RDB_ZSTD))
+        return RDB_COMPRESSION_LZF;
+    return algorithm;
+}
+
 /* Start a BGSAVE for replication goals, which is, selecting the disk or
  * socket target depending on the configuration, and making sure that
  * the script cache is flushed before to start.
@@ -1300,6 +1311,8 @@ int startBgsaveForReplication(int mincapa) {
 
     rdbSaveInfo rsi, *rsiptr;
     rsiptr = rdbPopulateSaveInfo(&rsi);
+    /* Replicas that can't load the configured compression get LZF. */
+    rsi.compression = rdbCompressionForReplicas(mincapa);
     /* Only do rdbSave* when rsiptr is not NULL,
      * otherwise replica will miss repl-stream-db. */
     if (rsiptr) {
@@ -1675,6 +1688,10 @@ void replconfCommand(client *c) {
                 c->slave_capa |= SLAVE_CAPA_ACTIVE_EXPIRE;
             else if (!strcasecmp((const char*)ptrFromObj(c->argv[j+1]), "keydb-fastsync"))
                 c->slave_capa |= SLAVE_CAPA_KEYDB_FASTSYNC;
+            else if (!strcasecmp((const char*)ptrFromObj(c->argv[j+1]), "rdb-lz4"))
+                c->slave_capa |= SLAVE_CAPA_RDB_LZ4;
+            else if (!strcasecmp((const char*)ptrFromObj(c->argv[j+1]), "rdb-zstd"))
+                c->slave_capa |= SLAVE_CAPA_RDB_ZSTD;
 
             fCapaCommand = true;
         } else if (!strcasecmp((const char*)ptrFromObj(c->argv[j]),"ack")) {
@@ -3552,6 +3569,7 @@ retry_connect:
          *
          * EOF: supports EOF-style RDB transfer for diskless replication.
          * PSYNC2: supports PSYNC v2, so understands +CONTINUE <new repl ID>.
+         * RDB-LZ4, RDB-ZSTD: can load RDB strings compressed with LZ4 / Zstd.
          *
          * The master will ignore capabilities it does not understand. */
 
@@ -3566,6 +3584,14 @@ retry_connect:
             veccapabilities.push_back("capa");
             veccapabilities.push_back("keydb-fastsync");
         }
+        if (rdbCompressionSupported(RDB_COMPRESSION_LZ4)) {
+            veccapabilities.push_back("capa");
+            veccapabilities.push_back("rdb-lz4");
+        }
+        if (rdbCompressionSupported(RDB_COMPRESSION_ZSTD)) {
+            veccapabilities.push_back("capa");
+            veccapabilities.push_back("rdb-zstd");
+        }
 
         err = sendCommandArgv(conn, veccapabilities.size(), veccapabilities.data(), nullptr);
         if (err) goto write_error;
@@ -106,6 +106,7 @@ static const rio rioBufferIO = {
     0,              /* keys since last callback */
     0,              /* read/write chunk size */
     0,              /* last update time */
+    0,              /* string compression algorithm */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -122,6 +123,7 @@ static const rio rioConstBufferIO = {
     0,              /* keys since last callback */
     0,              /* read/write chunk size */
     0,              /* last update time */
+    0,              /* string compression algorithm */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -187,6 +189,7 @@ static const rio rioFileIO = {
     0,              /* keys since last callback */
     0,              /* read/write chunk size */
     0,              /* last update time */
+    0,              /* string compression algorithm */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -288,6 +291,7 @@ static const rio rioConnIO = {
     0,              /* keys since last callback */
     0,              /* read/write chunk size */
     0,              /* last update time */
+    0,              /* string compression algorithm */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -409,6 +413,7 @@ static const rio rioFdIO = {
     0,              /* keys since last callback */
     0,              /* read/write chunk size */
     0,              /* last update time */
+    0,              /* string compression algorithm */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -75,6 +75,10 @@ struct _rio {
     /* last update time */
     long long last_update;
 
+    /* RDB_COMPRESSION_* algorithm for compressed strings, set by rdbSaveRio().
+     * Streams used for anything else (DUMP payloads...) keep LZF. */
+    int compression;
+
     /* Backend-specific vars. */
     union {
         /* In-memory buffer target. */
@@ -273,6 +273,14 @@ static inline int sdsisshared(const char *s)
     return ((flags & SDS_TYPE_MASK) == SDS_TYPE_REFCOUNTED);
 }
 
+/* Number of owners of a refcounted string, 1 for any other string. */
+static inline unsigned sdsrefcount(const char *s)
+{
+    if (!sdsisshared(s))
+        return 1;
+    return __atomic_load_n(&SDS_HDR_REFCOUNTED(s)->refcount, __ATOMIC_RELAXED);
+}
+
 sds sdsnewlen(const void *init, ssize_t initlen);
 sds sdstrynewlen(const void *init, size_t initlen);
 sds sdsnew(const char *init);
@@ -530,6 +530,7 @@ void initSentinel(void) {
         if (populateCommandTableParseFlags(cmd,cmd->sflags) == C_ERR)
             serverPanic("Unsupported command flag");
     }
+    commandTableChanged();
 
     /* Initialize various data structures. */
     sentinel.current_epoch = 0;
@@ -2007,6 +2007,44 @@ void clientsCron(int iel) {
     freeClientsInAsyncFreeQueue(iel);
 }
 
+/* 线程再平衡：每秒由主线程调用。根据各事件循环的忙碌时间（非 poll 时间）估算负载，
+ * 当最忙与最闲线程的差距达到 thread-rebalance-threshold 时，让最忙的线程把约一半差距
+ * 对应的客户端交给最闲的线程。负载相同时按客户端数量决定方向。 */
+static void threadRebalanceCron() {
+    monotime now = getMonotonicUs();
+    monotime elapsed = now - g_pserver->mtime_rebalance_sampled;
+    g_pserver->mtime_rebalance_sampled = now;
+
+    int ielBusy = -1, ielIdle = -1;
+    for (int iel = 0; iel < cserver.cthreads; ++iel) {
+        redisServerThreadVars &tv = g_pserver->rgthreadvar[iel];
+        unsigned long long busy = tv.usec_busy_total.load(std::memory_order_relaxed);
+        tv.rebalance_load_pct = elapsed ? (int)std::min<unsigned long long>(100, (busy - tv.usec_busy_sampled) * 100 / elapsed) : 0;
+        tv.usec_busy_sampled = busy;
+        auto fBusier = [&](int a, int b) {
+            const redisServerThreadVars &ta = g_pserver->rgthreadvar[a], &tb = g_pserver->rgthreadvar[b];
+            if (ta.rebalance_load_pct != tb.rebalance_load_pct) return ta.rebalance_load_pct > tb.rebalance_load_pct;
+            return ta.cclients > tb.cclients;
+        };
+        if (ielBusy < 0 || fBusier(iel, ielBusy)) ielBusy = iel;
+        if (ielIdle < 0 || fBusier(ielIdle, iel)) ielIdle = iel;
+    }
+
+    /* 集群模式下连接由 SO_REUSEPORT 分配，且大多短暂，不做迁移 */
+    if (!g_pserver->thread_rebalance || cserver.cthreads < 2 || g_pserver->cluster_enabled || g_pserver->loading)
+        return;
+    int loadBusy = g_pserver->rgthreadvar[ielBusy].rebalance_load_pct;
+    int loadIdle = g_pserver->rgthreadvar[ielIdle].rebalance_load_pct;
+    if (ielBusy == ielIdle || loadBusy - loadIdle < g_pserver->thread_rebalance_threshold)
+        return;
+
+    double fraction = (double)(loadBusy - loadIdle) / 2 / loadBusy;
+    g_pserver->stat_thread_rebalance_cycles++;
+    aePostFunction(g_pserver->rgthreadvar[ielBusy].el, [ielIdle, fraction]{
+        rebalanceClientsToThread(ielIdle, fraction);
+    });
+}
+
 bool expireOwnKeys()
 {
     if (iAmMaster()) {
@@ -2345,6 +2383,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* 软件看门狗：如果我们返回不够快，则传递将到达信号处理程序的 SIGALRM。 */
     if (g_pserver->watchdog_period) watchdogScheduleSignal(g_pserver->watchdog_period);
 
+    /* 将采样分析器环形缓冲区中的样本合并到栈统计表中，避免环形缓冲区被覆盖。 */
+    run_with_period(100) profilerDrainSamples();
+
     g_pserver->hz = g_pserver->config_hz;
     /* 使 g_pserver->hz 值适应已配置客户端的数量。如果我们有很多客户端，
      * 我们希望以更高的频率调用 serverCron()。 */
@@ -2560,6 +2601,11 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         fastlock_auto_adjust_waits();
     }
 
+    /* 在事件循环之间迁移客户端以平衡负载 */
+    run_with_period(1000) {
+        threadRebalanceCron();
+    }
+
     /* 如果需要，重新加载 TLS 证书。如果磁盘上的证书已更改，
      * 但 KeyDB 服务器尚未收到通知，则此操作实际上会轮换证书。 */
     run_with_period(1000){
@@ -2746,6 +2792,37 @@ void whileBlockedCron() {
 
 extern __thread int ProcessingEventsWhileBlocked;
 
+/* 记录本线程事件循环某个阶段的耗时（微秒），供 INFO threads 使用。
+ * 统计只由所属线程写入，CONFIG RESETSTAT 通过递增 epoch 让各线程自行清零。 */
+void threadPhaseRecord(int phase, monotime us) {
+    if (serverTL == nullptr) return;
+    unsigned long long epoch = g_pserver->thread_phase_stats_epoch.load(std::memory_order_relaxed);
+    if (serverTL->phase_stats_epoch != epoch) {
+        memset(serverTL->rgphase, 0, sizeof(serverTL->rgphase));
+        serverTL->phase_stats_epoch = epoch;
+    }
+    /* 顶层阶段互不重叠，除 poll 外都计入忙碌时间（线程再平衡使用） */
+    if (phase < AE_PHASE_COUNT && phase != AE_PHASE_POLL)
+        serverTL->usec_busy_total.store(serverTL->usec_busy_total.load(std::memory_order_relaxed) + us, std::memory_order_relaxed);
+    threadPhaseStats &stats = serverTL->rgphase[phase];
+    stats.calls++;
+    stats.usec += us;
+    if (us > stats.max_usec) stats.max_usec = us;
+    stats.hist[aeHistBucket(us)]++;
+}
+
+/* 记录从 start 到现在的耗时，并返回当前时间作为下一阶段的起点 */
+monotime threadPhaseEnd(int phase, monotime start) {
+    monotime now = getMonotonicUs();
+    threadPhaseRecord(phase, now - start);
+    return now;
+}
+
+static void threadLoopPhase(aeEventLoop *eventLoop, int phase, monotime us) {
+    UNUSED(eventLoop);
+    threadPhaseRecord(phase, us);
+}
+
 /* 每当 Redis 进入事件驱动库的主循环时，即在为就绪文件描述符休眠之前，都会调用此函数。
  *
  * 注意：此函数（目前）由两个函数调用：
@@ -2762,7 +2839,21 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
 
     tlsProcessPendingData();
 
+    monotime mtimeLockStart = getMonotonicUs();
+    monotime mtimePhase = mtimeLockStart;
+    if (g_pserver->lock_wait_io_rounds > 0 && cserver.cthreads > 1 && !ProcessingEventsWhileBlocked) {
+        /* 全局锁被占用时不空等：继续读取、解析客户端请求并发送回复，
+         * 拿到锁后 processClients 一次执行更大的批次。没有就绪的 I/O 时直接等待 */
+        for (int round = 0; round < g_pserver->lock_wait_io_rounds && !locker.tryArm(); ++round) {
+            if (aeProcessThreadSafeFileEvents(eventLoop) == 0)
+                break;
+            tlsProcessPendingData();
+            mtimePhase = threadPhaseEnd(THREAD_PHASE_LOCK_WAIT_IO, mtimePhase);
+        }
+    }
     locker.arm();
+    mtimePhase = threadPhaseEnd(THREAD_PHASE_LOCK_WAIT, mtimePhase);
+    long long lock_wait_us = (long long)(mtimePhase - mtimeLockStart);
 
     /* 结束由快速异步命令创建的任何快照 */
     for (int idb = 0; idb < cserver.dbnum; ++idb) {
@@ -2778,7 +2869,10 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     
     serverAssert(g_pserver->repl_batch_offStart < 0);
 
+    serverTL->lock_wait_us = lock_wait_us;  /* 供延迟直方图的 lock 阶段使用 */
     runAndPropogateToReplicas(processClients);
+    serverTL->lock_wait_us = -1;
+    mtimePhase = threadPhaseEnd(THREAD_PHASE_PROCESS_CLIENTS, mtimePhase);
 
     /* 如果我们从 processEventsWhileBlocked() 重新进入事件循环，则只调用一部分重要函数。
      * 注意，在这种情况下，我们会跟踪正在处理的事件数量，
@@ -2798,15 +2892,18 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     handleBlockedClientsTimeout();
 
     /* 如果 tls 仍有待处理的未读数据，则根本不休眠。 */
-    aeSetDontWait(eventLoop, tlsHasPendingData());
+    aeSetDontWait(eventLoop, tlsHasPendingData() || !serverTL->vecclientsProcess.empty());
 
     /* 调用 Redis 集群休眠前函数。请注意，此函数可能会更改 Redis 集群的状态
      * （从正常到失败，反之亦然），因此最好在此函数稍后为未阻塞的客户端提供服务之前调用它。 */
     if (g_pserver->cluster_enabled) clusterBeforeSleep();
+    mtimePhase = threadPhaseEnd(THREAD_PHASE_HOUSEKEEPING, mtimePhase);
 
     /* 运行快速过期周期（如果不需要快速周期，则被调用函数将尽快返回）。 */
-    if (g_pserver->active_expire_enabled && (listLength(g_pserver->masters) == 0 || g_pserver->fActiveReplica))
+    if (g_pserver->active_expire_enabled && (listLength(g_pserver->masters) == 0 || g_pserver->fActiveReplica)) {
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST);
+        mtimePhase = threadPhaseEnd(THREAD_PHASE_EXPIRE, mtimePhase);
+    }
 
     /* 解除在 WAIT 中为同步复制而阻塞的所有客户端的阻塞。 */
     if (listLength(g_pserver->clients_waiting_acks))
@@ -2820,6 +2917,7 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     {
         processUnblockedClients(iel);
     }
+    mtimePhase = threadPhaseEnd(THREAD_PHASE_BLOCKED_CLIENTS, mtimePhase);
 
     /* 如果在前一个事件循环迭代期间至少有一个客户端被阻塞，则向所有从属服务器发送 ACK 请求。
      * 请注意，我们在 processUnblockedClients() 之后执行此操作，因此如果存在多个流水线的 WAIT，
@@ -2842,13 +2940,17 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
      * 这不能在收到 ACK 的地方完成，因为故障转移会断开我们客户端的连接。 */
     if (iel == IDX_EVENT_LOOP_MAIN)
         updateFailoverStatus();
+    mtimePhase = threadPhaseEnd(THREAD_PHASE_HOUSEKEEPING, mtimePhase);
 
     /* 将无效消息发送到以广播 (BCAST) 模式参与客户端缓存协议的客户端。 */
     trackingBroadcastInvalidationMessages();
+    mtimePhase = threadPhaseEnd(THREAD_PHASE_TRACKING, mtimePhase);
 
     /* 将 AOF 缓冲区写入磁盘 */
-    if (g_pserver->aof_state == AOF_ON)
+    if (g_pserver->aof_state == AOF_ON) {
         flushAppendOnlyFile(0);
+        mtimePhase = threadPhaseEnd(THREAD_PHASE_AOF_FLUSH, mtimePhase);
+    }
 
     static thread_local bool fFirstRun = true;
     // 注意：我们还复制了 DB 指针，以防在释放锁时完成 DB 交换
@@ -2882,6 +2984,8 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     }
     latencyEndMonitor(commit_latency);
     latencyAddSampleIfNeeded("storage-commit", commit_latency);
+    if (cserver.storage_memory_model == STORAGE_WRITETHROUGH || g_pserver->m_pstorageFactory != nullptr)
+        mtimePhase = threadPhaseEnd(THREAD_PHASE_STORAGE, mtimePhase);
 
     /* 我们尝试在最后处理写入，这样就不必重新获取锁，
         但是如果存在挂起的异步关闭，我们需要确保写入首先发生，
@@ -2893,7 +2997,9 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
         ul.unlock();
         locker.disarm();
         handleClientsWithPendingWrites(iel, aof_state);
+        mtimePhase = threadPhaseEnd(THREAD_PHASE_PENDING_WRITES, mtimePhase);
         locker.arm();
+        mtimePhase = threadPhaseEnd(THREAD_PHASE_LOCK_WAIT, mtimePhase);
         fSentReplies = true;
     } else {
         ul.unlock();
@@ -2909,16 +3015,20 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     if (!serverTL->gcEpoch.isReset())
         g_pserver->garbageCollector.endEpoch(serverTL->gcEpoch, true /*fNoFree*/);
     serverTL->gcEpoch.reset();
+    mtimePhase = threadPhaseEnd(THREAD_PHASE_FREE_CLIENTS, mtimePhase);
 
     /* 每隔一段时间尝试处理阻塞的客户端。例如：一个模块从计时器回调中调用 RM_SignalKeyAsReady（因此我们根本不会访问 processCommand()）。 */
     handleClientsBlockedOnKeys();
+    mtimePhase = threadPhaseEnd(THREAD_PHASE_BLOCKED_CLIENTS, mtimePhase);
 
     /* 在我们进入休眠之前，通过释放 GIL 让线程访问数据集。
      * Redis 主线程此时不会触碰任何东西。 */
     serverAssert(g_pserver->repl_batch_offStart < 0);
     locker.disarm();
-    if (!fSentReplies)
+    if (!fSentReplies) {
         handleClientsWithPendingWrites(iel, aof_state);
+        threadPhaseEnd(THREAD_PHASE_PENDING_WRITES, mtimePhase);
+    }
 
     aeThreadOffline();
     // 作用域锁守卫
@@ -2961,7 +3071,9 @@ void afterSleep(struct aeEventLoop *eventLoop) {
         serverAssert(serverTL->gcEpoch.isReset());
         serverTL->gcEpoch = g_pserver->garbageCollector.startEpoch();
 
+        monotime mtimeLockStart = getMonotonicUs();
         aeAcquireLock();
+        threadPhaseEnd(THREAD_PHASE_LOCK_WAIT, mtimeLockStart);
         for (int idb = 0; idb < cserver.dbnum; ++idb)
             g_pserver->db[idb]->trackChanges(false);
         aeReleaseLock();
@@ -3659,9 +3771,25 @@ void resetServerStats(void) {
     g_pserver->stat_net_input_bytes = 0;
     g_pserver->stat_net_output_bytes = 0;
     g_pserver->stat_unexpected_error_replies = 0;
-    for (int iel = 0; iel < cserver.cthreads; ++iel)
+    for (int iel = 0; iel < cserver.cthreads; ++iel) {
         g_pserver->rgthreadvar[iel].stat_total_error_replies = 0;
+        g_pserver->rgthreadvar[iel].stat_argv_pool_hits = 0;
+        g_pserver->rgthreadvar[iel].stat_argv_pool_misses = 0;
+    }
     g_pserver->stat_dump_payload_sanitizations = 0;
+    g_pserver->stat_snapshot_consolidations = 0;
+    g_pserver->stat_snapshot_consolidations_async = 0;
+    g_pserver->stat_snapshot_consolidation_us = 0;
+    g_pserver->stat_snapshot_consolidation_max_us = 0;
+    g_pserver->stat_snapshot_consolidation_bg_us = 0;
+    g_pserver->stat_snapshot_tombstones_incremental = 0;
+    g_pserver->stat_thread_rebalance_cycles = 0;
+    g_pserver->stat_thread_migrations = 0;
+    g_pserver->stat_lock_batches = 0;
+    g_pserver->stat_lock_batch_commands = 0;
+    g_pserver->stat_lock_batches_truncated = 0;
+    aeLockProfileReset();   /* global_lock_acquisitions 与 total_commands_processed 同步清零 */
+    g_pserver->thread_phase_stats_epoch++;
     g_pserver->aof_delayed_fsync = 0;
 }
 
@@ -3811,6 +3939,7 @@ static void initServerThread(struct redisServerThreadVars *pvar, int fMain)
     }
     aeSetBeforeSleepProc(pvar->el, beforeSleep, AE_SLEEP_THREADSAFE);
     aeSetAfterSleepProc(pvar->el, afterSleep, AE_SLEEP_THREADSAFE);
+    aeSetLoopPhaseProc(pvar->el, threadLoopPhase);
 
     fastlock_init(&pvar->lockPendingWrite, "lockPendingWrite");
 
@@ -3838,6 +3967,9 @@ void initServer(void) {
     setupSignalHandlers();// 设置其它信号处理器
     makeThreadKillable(); // 确保线程可以被干净地终止
 
+    if (cserver.jemalloc_keyspace_arena && zmalloc_keyspace_arena_enable() < 0)
+        serverLog(LL_WARNING, "Failed to create the keyspace allocator arena, keyspace objects will use the thread arenas");
+
     zfree(g_pserver->db);   // initServerConfig created a dummy array, free that now
     g_pserver->db = (redisDb**)zmalloc(sizeof(redisDb*)*cserver.dbnum, MALLOC_LOCAL);// 为每个数据库分配内存并初始化
 
@@ -4168,6 +4300,7 @@ void populateCommandTable(void) {
         retval2 = dictAdd(g_pserver->orig_commands, sdsnew(c->name), c);
         serverAssert(retval1 == DICT_OK && retval2 == DICT_OK);
     }
+    commandTableChanged();
 }
 
 void resetCommandTableStats(void) {
@@ -4185,6 +4318,7 @@ void resetCommandTableStats(void) {
     }
     dictReleaseIterator(di);
 
+    latencyHistogramResetAll();
 }
 
 static void zfree_noconst(void *p) {
@@ -4242,17 +4376,173 @@ void redisOpArrayFree(redisOpArray *oa) {
 
 /* ====================== Commands lookup and execution ===================== */
 
+/* Command names are resolved through a perfect hash of g_pserver->commands
+ * instead of the dict: the name is hashed once (case folded), the bucket
+ * displacement picks its slot and a single name comparison confirms it.
+ * The table is rebuilt by commandTableChanged() whenever the command table
+ * changes (rename-command, MODULE LOAD/UNLOAD, sentinel mode). Lookups also
+ * happen outside the global lock (async commands, key prefetch), so a new
+ * table is published atomically and the old one goes to the garbage
+ * collector. Everything lives in a single allocation for that reason. */
+struct commandLookupSlot {
+    const char *name;           /* NULL for an empty slot */
+    size_t len;
+    struct redisCommand *cmd;
+};
+
+struct commandLookupTable {
+    uint64_t mask;              /* Slots (and buckets) - 1 */
+    uint32_t *displace;         /* Per bucket seed of the slot hash */
+    commandLookupSlot *slots;
+};
+
+static std::atomic<commandLookupTable*> commandLookup {nullptr};
+static std::atomic<uint64_t> commandLookupGeneration {0};
+
+/* FNV-1a over the names folded with |0x20: names strcasecmp() considers
+ * equal always hash the same, which is all the hash needs. */
+static inline uint64_t commandNameHash(const char *name, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t j = 0; j < len; j++) {
+        h ^= (unsigned char)(name[j] | 0x20);
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static inline uint64_t commandSlotHash(uint64_t h, uint32_t seed) {
+    h ^= seed * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+static struct redisCommand *commandLookupFind(const commandLookupTable *t, const char *name, size_t len) {
+    uint64_t h = commandNameHash(name,len);
+    uint32_t seed = t->displace[commandSlotHash(h,0) & t->mask];
+    const commandLookupSlot &slot = t->slots[commandSlotHash(h,seed) & t->mask];
+    if (slot.len != len || slot.name == NULL || strncasecmp(slot.name,name,len) != 0)
+        return NULL;
+    return slot.cmd;
+}
+
+/* Build the perfect hash with the hash and displace method: buckets are
+ * placed largest first, each one trying seeds until all its names land on
+ * free slots. Returns NULL if no seed works (only possible on a full 64 bit
+ * collision of two names), lookups then use the dict. */
+static commandLookupTable *commandLookupBuild(dict *commands) {
+    struct entry {
+        sds name;
+        struct redisCommand *cmd;
+        uint64_t h;
+    };
+    std::vector<entry> entries;
+    size_t namebytes = 0;
+    dictIterator *di = dictGetIterator(commands);
+    dictEntry *de;
+    while ((de = dictNext(di)) != NULL) {
+        sds name = (sds)dictGetKey(de);
+        entries.push_back({name, (struct redisCommand*)dictGetVal(de), commandNameHash(name,sdslen(name))});
+        namebytes += sdslen(name)+1;
+    }
+    dictReleaseIterator(di);
+
+    size_t nslots = 16;
+    while (nslots < entries.size()*2) nslots <<= 1;
+    uint64_t mask = nslots-1;
+    std::vector<std::vector<size_t>> buckets(nslots);
+    for (size_t j = 0; j < entries.size(); j++)
+        buckets[commandSlotHash(entries[j].h,0) & mask].push_back(j);
+    std::vector<size_t> order(nslots);
+    for (size_t j = 0; j < nslots; j++) order[j] = j;
+    std::stable_sort(order.begin(),order.end(),[&](size_t a, size_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    size_t cb = sizeof(commandLookupTable) + nslots*sizeof(commandLookupSlot) +
+        nslots*sizeof(uint32_t) + namebytes;
+    commandLookupTable *t = (commandLookupTable*)zcalloc(cb, MALLOC_LOCAL);
+    t->mask = mask;
+    t->slots = (commandLookupSlot*)(t+1);
+    t->displace = (uint32_t*)(t->slots+nslots);
+    char *names = (char*)(t->displace+nslots);
+
+    std::vector<size_t> placed;
+    for (size_t b : order) {
+        if (buckets[b].empty()) break;
+        uint32_t seed;
+        for (seed = 1; seed < (1U<<20); seed++) {
+            placed.clear();
+            for (size_t idx : buckets[b]) {
+                size_t slot = commandSlotHash(entries[idx].h,seed) & mask;
+                if (t->slots[slot].cmd != NULL) break;
+                if (std::find(placed.begin(),placed.end(),slot) != placed.end()) break;
+                placed.push_back(slot);
+            }
+            if (placed.size() == buckets[b].size()) break;
+        }
+        if (placed.size() != buckets[b].size()) {
+            zfree(t);
+            return NULL;
+        }
+        t->displace[b] = seed;
+        for (size_t j = 0; j < placed.size(); j++) {
+            const entry &e = entries[buckets[b][j]];
+            commandLookupSlot &slot = t->slots[placed[j]];
+            memcpy(names,e.name,sdslen(e.name)+1);
+            slot.name = names;
+            slot.len = sdslen(e.name);
+            slot.cmd = e.cmd;
+            names += slot.len+1;
+        }
+    }
+    return t;
+}
+
+/* Must be called after every change of g_pserver->commands. */
+void commandTableChanged(void) {
+    commandLookupTable *t = commandLookupBuild(g_pserver->commands);
+    if (t == NULL)
+        serverLog(LL_WARNING, "Unable to build the command lookup table, falling back to the command dict");
+    commandLookupTable *old = commandLookup.exchange(t, std::memory_order_acq_rel);
+    commandLookupGeneration.fetch_add(1, std::memory_order_release);
+    if (old == NULL) return;
+    if (serverTL == nullptr || serverTL->gcEpoch.isReset())
+        zfree(old);
+    else
+        g_pserver->garbageCollector.enqueueCPtr(serverTL->gcEpoch, old);
+}
+
+static struct redisCommand *lookupCommandLen(const char *name, size_t len) {
+    const commandLookupTable *t = commandLookup.load(std::memory_order_acquire);
+    if (t != NULL) return commandLookupFind(t,name,len);
+
+    sds sdsname = sdsnewlen(name,len);
+    struct redisCommand *cmd = (struct redisCommand*)dictFetchValue(g_pserver->commands, sdsname);
+    sdsfree(sdsname);
+    return cmd;
+}
+
 struct redisCommand *lookupCommand(sds name) {
-    return (struct redisCommand*)dictFetchValue(g_pserver->commands, name);
+    return lookupCommandLen(name,sdslen(name));
 }
 
 struct redisCommand *lookupCommandByCString(const char *s) {
-    struct redisCommand *cmd;
-    sds name = sdsnew(s);
+    return lookupCommandLen(s,strlen(s));
+}
 
-    cmd = (struct redisCommand*)dictFetchValue(g_pserver->commands, name);
-    sdsfree(name);
-    return cmd;
+/* Return the command argv[0] of a parsed command refers to. It is resolved
+ * once, when the command is parsed, and reused by every later stage (async
+ * eligibility, key prefetch, processCommand()) unless the command table
+ * changed in between. */
+struct redisCommand *lookupParsedCommand(parsed_command &cmd) {
+    uint64_t generation = commandLookupGeneration.load(std::memory_order_acquire);
+    if (cmd.cmdGeneration != generation) {
+        cmd.cmd = (cmd.argc > 0) ? lookupCommand(szFromObj(cmd.argv[0])) : nullptr;
+        cmd.cmdGeneration = generation;
+    }
+    return cmd.cmd;
 }
 
 /* Lookup the command in the current table, if not found also check in
@@ -4263,7 +4553,7 @@ struct redisCommand *lookupCommandByCString(const char *s) {
  * rewriteClientCommandVector() in order to set client->cmd pointer
  * correctly even if the command was renamed. */
 struct redisCommand *lookupCommandOrOriginal(sds name) {
-    struct redisCommand *cmd = (struct redisCommand*)dictFetchValue(g_pserver->commands, name);
+    struct redisCommand *cmd = lookupCommand(name);
 
     if (!cmd) cmd = (struct redisCommand*)dictFetchValue(g_pserver->orig_commands,name);
     return cmd;
@@ -4442,6 +4732,7 @@ void call(client *c, int flags) {
     serverTL->prev_err_count = serverTL->stat_total_error_replies;
     g_pserver->fixed_time_expire++;
     incrementMvccTstamp();
+    unsigned long long reply_queued = c->reply_queued_total;
     elapsedStart(&call_timer);
     try {
         c->cmd->proc(c);
@@ -4525,6 +4816,14 @@ void call(client *c, int flags) {
         replicationFeedMonitors(c,g_pserver->monitors,c->db->id,argv,argc);
     }
 
+    /* Record the command as the client sent it, before any rewrite. */
+    if (g_pserver->command_trace_enabled) {
+        robj **argv = c->original_argv ? c->original_argv : c->argv;
+        int argc = c->original_argv ? c->original_argc : c->argc;
+        commandTraceRecord(c,real_cmd,argv,argc,ustime()-duration,duration,
+            c->reply_queued_total-reply_queued);
+    }
+
     /* Clear the original argv.
      * If the client is blocked we will handle slowlog when it is unblocked. */
     if (!(c->flags & CLIENT_BLOCKED))
@@ -4534,8 +4833,22 @@ void call(client *c, int flags) {
     if (flags & CMD_CALL_STATS) {
         __atomic_fetch_add(&real_cmd->microseconds, duration, __ATOMIC_RELAXED);
         __atomic_fetch_add(&real_cmd->calls, 1, __ATOMIC_RELAXED);
+        /* Blocked commands are recorded when they are unblocked. */
+        if (g_pserver->latency_tracking_enabled && !(c->flags & CLIENT_BLOCKED)) {
+            latencyHistogramRecordCommand(real_cmd, duration);
+            /* Commands nested in EXEC or a script are part of the outer
+             * command's execution phase. */
+            if (!serverTL->in_exec && !(c->flags & CLIENT_LUA))
+                latencyHistogramRecordPhase(LATENCY_PHASE_EXECUTE, duration);
+        }
     }
 
+    /* Start timing the write phase with the first reply left unsent, it ends
+     * once writeToClient() has flushed everything. */
+    if (g_pserver->latency_tracking_enabled && c->conn && c->mtimeReplyPending == 0 &&
+        clientHasPendingReplies(c))
+        c->mtimeReplyPending = getMonotonicUs();
+
     /* Propagate the command into the AOF and replication link */
     if (flags & CMD_CALL_PROPAGATE &&
         (c->flags & CLIENT_PREVENT_PROP) != CLIENT_PREVENT_PROP)
@@ -4726,6 +5039,7 @@ int processCommand(client *c, int callFlags) {
     if (moduleHasCommandFilters())
     {
         moduleCallCommandFilters(c);
+        c->parsed_cmd = NULL;   /* Filters may rewrite argv[0] */
     }
 
     /* The QUIT command is handled separately. Normal command procs will
@@ -4740,7 +5054,8 @@ int processCommand(client *c, int callFlags) {
 
     /* Now lookup the command and check ASAP about trivial error conditions
      * such as wrong arity, bad command name and so forth. */
-    c->cmd = c->lastcmd = lookupCommand((sds)ptrFromObj(c->argv[0]));
+    c->cmd = c->lastcmd = c->parsed_cmd ? c->parsed_cmd : lookupCommand((sds)ptrFromObj(c->argv[0]));
+    c->parsed_cmd = NULL;
     if (!c->cmd) {
         sds args = sdsempty();
         int i;
@@ -5230,6 +5545,9 @@ int prepareForShutdown(int flags) {
     /* 触发关闭模块事件。 */
     moduleFireServerEvent(REDISMODULE_EVENT_SHUTDOWN,0,NULL);
 
+    /* 将命令追踪缓冲区中剩余的记录写入文件。 */
+    commandTraceStop();
+
     /* 如果可能且需要，则删除 pid 文件。 */
     if (cserver.daemonize || cserver.pidfile) {
         serverLog(LL_NOTICE,"正在删除 pid 文件。");
@@ -5776,6 +6094,18 @@ sds genRedisInfoString(const char *section) {
             available_system_mem
         );
         freeMemoryOverheadData(mh);
+
+        /* Arenas created by jemalloc-thread-arenas / jemalloc-keyspace-arena, the
+         * allocator stats were just refreshed by the cron so no epoch bump here */
+        unsigned carenas = zmalloc_arena_count();
+        for (unsigned iarena = 0; iarena < carenas; ++iarena) {
+            struct zmalloc_arena_info arena;
+            if (!zmalloc_get_arena_info(iarena, &arena))
+                continue;
+            info = sdscatprintf(info,
+                "allocator_arena_%u:label=%s,allocated=%zu,active=%zu,dirty=%zu,resident=%zu\r\n",
+                arena.arena, arena.label, arena.allocated, arena.active, arena.dirty, arena.resident);
+        }
     }
 
     /* Persistence */
@@ -5919,9 +6249,13 @@ sds genRedisInfoString(const char *section) {
         stat_net_input_bytes = g_pserver->stat_net_input_bytes.load(std::memory_order_relaxed);
         stat_net_output_bytes = g_pserver->stat_net_output_bytes.load(std::memory_order_relaxed);
 
-        long long stat_total_error_replies = 0;
-        for (int iel = 0; iel < cserver.cthreads; ++iel)
+        long long stat_total_error_replies = 0, stat_argv_pool_hits = 0, stat_argv_pool_misses = 0;
+        for (int iel = 0; iel < cserver.cthreads; ++iel) {
             stat_total_error_replies += g_pserver->rgthreadvar[iel].stat_total_error_replies;
+            stat_argv_pool_hits += g_pserver->rgthreadvar[iel].stat_argv_pool_hits;
+            stat_argv_pool_misses += g_pserver->rgthreadvar[iel].stat_argv_pool_misses;
+        }
+        unsigned long long lockAcquisitions = aeLockProfileAcquisitions();
 
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info,
@@ -5964,6 +6298,13 @@ sds genRedisInfoString(const char *section) {
             "total_writes_processed:%lld\r\n"
             "instantaneous_lock_contention:%d\r\n"
             "avg_lock_contention:%f\r\n"
+            "global_lock_acquisitions:%llu\r\n"
+            "lock_acquisitions_per_command:%.4f\r\n"
+            "lock_batches:%lld\r\n"
+            "lock_batch_commands:%lld\r\n"
+            "lock_batches_truncated:%lld\r\n"
+            "argv_pool_hits:%lld\r\n"
+            "argv_pool_misses:%lld\r\n"
             "storage_provider_read_hits:%lld\r\n"
             "storage_provider_read_misses:%lld\r\n",
             g_pserver->stat_numconnections,
@@ -6004,8 +6345,16 @@ sds genRedisInfoString(const char *section) {
             stat_total_writes_processed,
             aeLockContention(),
             avgLockContention,
+            lockAcquisitions,
+            g_pserver->stat_numcommands ? (double)lockAcquisitions / g_pserver->stat_numcommands : 0.0,
+            g_pserver->stat_lock_batches.load(std::memory_order_relaxed),
+            g_pserver->stat_lock_batch_commands.load(std::memory_order_relaxed),
+            g_pserver->stat_lock_batches_truncated.load(std::memory_order_relaxed),
+            stat_argv_pool_hits,
+            stat_argv_pool_misses,
             g_pserver->stat_storage_provider_read_hits,
             g_pserver->stat_storage_provider_read_misses);
+        info = genCommandTraceInfoString(info);
     }
 
     /* Replication */
@@ -6240,6 +6589,49 @@ sds genRedisInfoString(const char *section) {
         }
         dictReleaseIterator(di);
     }
+    /* Latency statistics */
+    if (allsections || !strcasecmp(section,"latencystats")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscat(info, "# Latencystats\r\n");
+        info = genLatencyStatsInfoString(info);
+    }
+    /* Thread event loop statistics */
+    if (allsections || !strcasecmp(section,"threads")) {
+        static const char *rgszPhase[THREAD_PHASE_COUNT] = {
+            "before_sleep", "poll", "after_sleep", "file_events", "time_events",
+            "lock_wait", "process_clients", "expire", "blocked_clients", "tracking",
+            "aof_flush", "storage", "free_clients", "pending_writes", "async_writes",
+            "housekeeping", "lock_wait_io"
+        };
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscat(info, "# Threads\r\n");
+        unsigned long long epoch = g_pserver->thread_phase_stats_epoch.load(std::memory_order_relaxed);
+        for (int iel = 0; iel < cserver.cthreads; ++iel) {
+            /* 统计由各线程无锁写入，这里读到的是近似快照；epoch 不一致说明该线程尚未响应 RESETSTAT */
+            const redisServerThreadVars &tv = g_pserver->rgthreadvar[iel];
+            bool fStale = tv.phase_stats_epoch != epoch;
+            unsigned long long usecTotal = 0, usecBusy = 0;
+            if (!fStale) {
+                /* AE_PHASE_* 是事件循环的顶层阶段，互不重叠，除 poll 外都算忙碌时间 */
+                for (int phase = 0; phase < AE_PHASE_COUNT; ++phase)
+                    usecTotal += tv.rgphase[phase].usec;
+                usecBusy = usecTotal - tv.rgphase[AE_PHASE_POLL].usec;
+            }
+            info = sdscatprintf(info, "thread_%d:loops=%llu,busy_pct=%.2f,clients=%d,load_pct=%d\r\n",
+                iel, fStale ? 0ULL : tv.rgphase[AE_PHASE_POLL].calls,
+                usecTotal ? (double)usecBusy * 100 / usecTotal : 0.0,
+                tv.cclients, tv.rebalance_load_pct);
+            for (int phase = 0; phase < THREAD_PHASE_COUNT && !fStale; ++phase) {
+                const threadPhaseStats &stats = tv.rgphase[phase];
+                if (stats.calls == 0) continue;
+                info = sdscatprintf(info,
+                    "thread_%d_phase_%s:calls=%llu,usec=%llu,usec_per_call=%.2f,p99_usec=%llu,max_usec=%llu\r\n",
+                    iel, rgszPhase[phase], stats.calls, stats.usec,
+                    (double)stats.usec / stats.calls,
+                    aeHistPercentile(stats.hist, 99.0), stats.max_usec);
+            }
+        }
+    }
     /* Error statistics */
     if (allsections || defsections || !strcasecmp(section,"errorstats")) {
         if (sections++) info = sdscat(info,"\r\n");
@@ -6298,15 +6690,41 @@ sds genRedisInfoString(const char *section) {
     if (allsections || defsections || !strcasecmp(section,"keydb")) {
         // Compute the MVCC depth
         int mvcc_depth = 0;
+        size_t snapshot_tombstones = 0;
         for (int idb = 0; idb < cserver.dbnum; ++idb) {
             mvcc_depth = std::max(mvcc_depth, g_pserver->db[idb]->snapshot_depth());
+            snapshot_tombstones += g_pserver->db[idb]->tombstone_count();
         }
 
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info, 
             "# KeyDB\r\n"
-            "mvcc_depth:%d\r\n",
-            mvcc_depth
+            "mvcc_depth:%d\r\n"
+            "snapshot_tombstones:%zu\r\n"
+            "snapshot_consolidations:%lld\r\n"
+            "snapshot_consolidations_async:%lld\r\n"
+            "snapshot_consolidation_usec:%lld\r\n"
+            "snapshot_consolidation_max_usec:%lld\r\n"
+            "snapshot_consolidation_bg_usec:%lld\r\n"
+            "snapshot_tombstones_incremental:%lld\r\n"
+            "gc_pending_objects:%zu\r\n"
+            "gc_freed_objects:%llu\r\n"
+            "gc_epochs:%llu\r\n"
+            "thread_rebalance_cycles:%lld\r\n"
+            "thread_migrations:%lld\r\n",
+            mvcc_depth,
+            snapshot_tombstones,
+            g_pserver->stat_snapshot_consolidations,
+            g_pserver->stat_snapshot_consolidations_async,
+            g_pserver->stat_snapshot_consolidation_us,
+            g_pserver->stat_snapshot_consolidation_max_us,
+            g_pserver->stat_snapshot_consolidation_bg_us.load(std::memory_order_relaxed),
+            g_pserver->stat_snapshot_tombstones_incremental,
+            g_pserver->garbageCollector.pendingCount(),
+            (unsigned long long)g_pserver->garbageCollector.objectsFreed(),
+            (unsigned long long)g_pserver->garbageCollector.epochsStarted(),
+            g_pserver->stat_thread_rebalance_cycles.load(std::memory_order_relaxed),
+            g_pserver->stat_thread_migrations.load(std::memory_order_relaxed)
         );
     }
 
@@ -6549,7 +6967,8 @@ void usage(void) {
     fprintf(stderr,"       ./keydb-server - (read config from stdin)\n");
     fprintf(stderr,"       ./keydb-server -v or --version\n");
     fprintf(stderr,"       ./keydb-server -h or --help\n");
-    fprintf(stderr,"       ./keydb-server --test-memory <megabytes>\n\n");
+    fprintf(stderr,"       ./keydb-server --test-memory <megabytes>\n");
+    fprintf(stderr,"       ./keydb-server bench <group|all|list> [--runs <n>] [--warmup <n>] [--time <ms>] [--json]\n\n");
     fprintf(stderr,"Examples:\n");
     fprintf(stderr,"       ./keydb-server (run the server with default conf)\n");
     fprintf(stderr,"       ./keydb-server /etc/keydb/6379.conf\n");
@@ -7333,6 +7752,12 @@ void *workerThreadMain(void *parg)
     serverTL = g_pserver->rgthreadvar+iel;  // set the TLS threadsafe global
     tlsInitThread();
 
+    if (cserver.jemalloc_thread_arenas) {
+        char label[32];
+        snprintf(label, sizeof(label), "server-thread-%d", iel);
+        zmalloc_thread_arena_bind(label);
+    }
+
     if (iel != IDX_EVENT_LOOP_MAIN)
     {
         aeThreadOnline();
@@ -7404,7 +7829,8 @@ struct redisTest {
     {"crc64", crc64Test},
     {"zmalloc", zmalloc_test},
     {"sds", sdsTest},
-    {"dict", dictTest}
+    {"dict", dictTest},
+    {"gc", gcTest}
 };
 redisTestProc *getTestProcByName(const char *name) {
     int numtests = sizeof(redisTests)/sizeof(struct redisTest);
@@ -7524,6 +7950,10 @@ int main(int argc, char **argv) {
     else if (strstr(argv[0],"keydb-check-aof") != NULL)
         redis_check_aof_main(argc,argv);
 
+    /* keydb-server bench 运行核心数据结构的微基准测试，然后退出。 */
+    if (argc >= 2 && !strcasecmp(argv[1],"bench"))
+        return microbenchMain(argc-2,argv+2);
+
     if (argc >= 2) {
         j = 1; /* argv[] 中要解析的第一个选项 */
         sds options = sdsempty();
@@ -7605,6 +8035,7 @@ int main(int argc, char **argv) {
     }
 
     validateConfiguration();
+    fastlock_set_policy(g_pserver->lock_spin_policy);
 
     if (!g_pserver->sentinel_mode) {
     #ifdef __linux__
@@ -7676,6 +8107,9 @@ int main(int argc, char **argv) {
 
         InitServerLast();
 
+        if (g_pserver->command_trace_enabled && commandTraceStart(NULL) == C_ERR)
+            g_pserver->command_trace_enabled = 0;
+
         try {
             loadDataFromDisk();
         } catch (ShutdownException) {
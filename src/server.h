@@ -39,7 +39,7 @@
 #include "rio.h"
 #include "atomicvar.h"
 
-#include &lt;cstddef&gt;
+#include <cstddef>
 #include <concurrentqueue.h>
 #include <blockingconcurrentqueue.h>
 
@@ -47,7 +47,7 @@
 #include <stdlib.h>
 #include <cmath>
 #include <string.h>
-#include &lt;cstddef&gt;
+#include <cstddef>
 #include <string>
 #include <time.h>
 #include <limits.h>
@@ -406,6 +406,9 @@ inline bool operator!=(const void *p, const robj_sharedptr &rhs)
 #define PROTO_ASYNC_REPLY_CHUNK_BYTES (1024)
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* 内联读取的最大大小 */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define ARGV_POOL_CLASSES       8          /* 可复用的 EMBSTR 参数对象按 8 字节分配粒度分级（最大 64 字节） */
+#define ARGV_POOL_SIZE          256        /* 每个线程每级（以及 argv 数组）最多缓存的个数 */
+#define ARGV_POOL_ARRAY_SLOTS   8          /* 可复用 argv 数组的最少槽位数 */
 #define LONG_STR_SIZE      21          /* long转字符串+结尾符所需字节数 */
 #define REDIS_AUTOSYNC_BYTES (1024*1024*32) /* 每写32MB做一次fdatasync */
 
@@ -600,6 +603,8 @@ typedef enum {
 #define SLAVE_CAPA_PSYNC2 (1<<1) /* 支持 PSYNC2 协议。*/
 #define SLAVE_CAPA_ACTIVE_EXPIRE (1<<2) /* 从节点是否会自行执行过期操作？（不发送删除）*/
 #define SLAVE_CAPA_KEYDB_FASTSYNC (1<<3)
+#define SLAVE_CAPA_RDB_LZ4 (1<<4)      /* 可以加载 LZ4 压缩的 RDB 字符串。*/
+#define SLAVE_CAPA_RDB_ZSTD (1<<5)     /* 可以加载 Zstd 压缩的 RDB 字符串。*/
 
 /* 同步读取超时 - 副本端 */
 #define CONFIG_REPL_SYNCIO_TIMEOUT 5
@@ -899,6 +904,7 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_EMBSTR 8  /* 嵌入式 sds 字符串编码 */
 #define OBJ_ENCODING_QUICKLIST 9 /* 编码为 ziplist 的链表 */
 #define OBJ_ENCODING_STREAM 10 /* 编码为 listpack 的基数树 */
+#define OBJ_ENCODING_LISTPACK 11 /* 编码为 listpack */
 
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* obj->lru 的最大值 */
@@ -918,6 +924,7 @@ struct redisObjectExtended {
 
 typedef struct redisObject {
     friend redisObject *createEmbeddedStringObject(const char *ptr, size_t len);
+    friend redisObject *resetEmbeddedStringObject(redisObject *o, const char *ptr, size_t len);
     friend redisObject *createObject(int type, void *ptr);
 protected:
     redisObject() {}
@@ -1493,6 +1500,12 @@ private:
      */
     void recursiveFreeSnapshots(redisDbPersistentDataSnapshot *psnapshot);
 
+    /**
+     * @brief 合并前分批将墓碑应用到即将结束的快照，批次之间释放全局锁
+     * @param psnapshot 快照指针，必须是当前直接持有的快照
+     */
+    void applyTombstonesIncremental(const redisDbPersistentDataSnapshot *psnapshot);
+
     // 键空间相关成员
     dict *m_pdict = nullptr;                 ///< 主键空间字典
     dict *m_pdictTombstone = nullptr;         ///< 快照模式下的墓碑字典
@@ -1514,6 +1527,7 @@ private:
     dict *m_dictChangedStorageFlush = nullptr;
 
     int m_refCount = 0;  ///< 引用计数
+    bool m_fTombstonesApplied = false;  ///< 上层墓碑已分批应用到本快照，不能再复用给新的读者
 };
 
 
@@ -1555,6 +1569,11 @@ public:
      * @return 返回快照深度整数值。
      */
     int snapshot_depth() const;
+    /**
+     * @brief 统计当前快照链上所有层级的墓碑条目总数。
+     * @return 返回墓碑条目数量。
+     */
+    size_t tombstone_count() const;
     /**
      * @brief 调试用方法，检查当前实例是否会释放子对象。
      * @return 若存在关联的快照持有者则返回true，表示将释放子对象。
@@ -1815,6 +1834,8 @@ typedef struct {
     list *passwords; /* 此用户的 SDS 有效密码列表。*/
     list *patterns;  /* 允许的键模式列表。如果此字段为 NULL，则用户不能在命令中提及任何键，除非在用户中设置了 ALLKEYS 标志。*/
     list *channels;  /* 允许的 Pub/Sub 通道模式列表。如果此字段为 NULL，则用户不能在 `PUBLISH` 或 [P][UNSUBSCRIBE] 命令中提及任何通道，除非在用户中设置了 ALLCHANNELS 标志。*/
+    struct aclMatcher *compiled_patterns;   /* patterns 编译成的匹配器（见 aclmatch.h），首次检查时构建，patterns 变化时释放 */
+    struct aclMatcher *compiled_channels;   /* channels 编译成的匹配器，同上 */
 } user;
 
 /* 对于多路复用，我们需要获取每个客户端的状态。
@@ -1822,15 +1843,21 @@ typedef struct {
 
 #define CLIENT_ID_AOF (UINT64_MAX) /* 为 AOF 客户端保留的 ID。如果您需要更多保留 ID，请使用 UINT64_MAX-1、-2 等。*/
 
+robj **argvPoolAllocArray(int argc);
+void argvPoolReleaseArray(robj **argv);
+
 struct parsed_command {
     robj** argv = nullptr;
     int argc = 0;
     int argcMax;
     long long reploff = 0;
     size_t argv_len_sum = 0;    /* Sum of lengths of objects in argv list. */
+    monotime mtimeParsed = 0;   /* When the command was fully parsed (latency tracking) */
+    struct redisCommand *cmd = nullptr;  /* argv[0] resolved at parse time, see lookupParsedCommand() */
+    uint64_t cmdGeneration = 0;          /* Command table generation cmd was resolved against, 0 if not yet */
 
     parsed_command(int maxargs) {
-        argv = (robj**)zmalloc(sizeof(robj*)*maxargs);
+        argv = argvPoolAllocArray(maxargs);
         argcMax = maxargs;
     }
 
@@ -1839,6 +1866,9 @@ struct parsed_command {
         argc = o.argc;
         argcMax = o.argcMax;
         reploff = o.reploff;
+        mtimeParsed = o.mtimeParsed;
+        cmd = o.cmd;
+        cmdGeneration = o.cmdGeneration;
         o.argv = nullptr;
         o.argc = 0;
         o.argcMax = 0;
@@ -1852,6 +1882,9 @@ struct parsed_command {
         argc = o.argc;
         argcMax = o.argcMax;
         reploff = o.reploff;
+        mtimeParsed = o.mtimeParsed;
+        cmd = o.cmd;
+        cmdGeneration = o.cmdGeneration;
         o.argv = nullptr;
         o.argc = 0;
         o.argcMax = 0;
@@ -1863,7 +1896,7 @@ struct parsed_command {
             for (int i = 0; i < argc; ++i) {
                 decrRefCount(argv[i]);
             }
-            zfree(argv);
+            argvPoolReleaseArray(argv);
         }
     }
 };
@@ -1884,6 +1917,8 @@ struct client {
     int original_argc;      /* Num of arguments of original command if arguments were rewritten. */
     robj **original_argv;   /* Arguments of original command if arguments were rewritten. */
     struct redisCommand *cmd, *lastcmd;  /* Last command executed. */
+    struct redisCommand *parsed_cmd;     /* argv[0] as resolved when parsed, saves
+                                            processCommand() the lookup. */
     ::user *user;             /* User associated with this connection. If the
                                user is set to NULL the connection can do
                                anything (admin). */
@@ -1896,6 +1931,10 @@ struct client {
                                buffer or object being sent. */
     time_t ctime;           /* Client creation time. */
     long duration;          /* Current command duration. Used for measuring latency of blocking/non-blocking cmds */
+    monotime mtimeReplyPending = 0; /* When the first unsent reply was queued (latency tracking) */
+    unsigned long long reply_queued_total = 0; /* Protocol bytes ever queued for this client (command trace) */
+    unsigned long long commands_processed = 0; /* Commands executed for this client */
+    unsigned long long commands_processed_mark = 0; /* commands_processed at the last thread rebalance */
     time_t lastinteraction; /* Time of the last interaction, used for timeout */
     time_t obuf_soft_limit_reached_time;
     std::atomic<uint64_t> flags;              /* Client flags: CLIENT_* macros. */
@@ -2254,6 +2293,7 @@ public:
         repl_offset = -1;
         fForceSetKey = TRUE;
         mvccMinThreshold = 0;
+        compression = -1;
     }
 
     /**
@@ -2276,6 +2316,7 @@ public:
         vecmastersaveinfo = other.vecmastersaveinfo;
         master_repl_offset = other.master_repl_offset;
         mi = other.mi;
+        compression = other.compression;
     }
 
     /**
@@ -2297,6 +2338,7 @@ public:
         vecmastersaveinfo = other.vecmastersaveinfo;
         master_repl_offset = other.master_repl_offset;
         mi = other.mi;
+        compression = other.compression;
 
         return *this;
     }
@@ -2388,6 +2430,15 @@ public:
      */
     std::vector<MasterSaveInfo> vecmastersaveinfo;
 
+    /**
+     * @brief 字符串压缩算法
+     *
+     * 保存时使用的RDB_COMPRESSION_*算法
+     * -1表示使用rdb-compression-algorithm配置，
+     * 向不支持该算法的从节点全量同步时设置为LZF
+     */
+    int compression;
+
     /**
      * @brief Redis主节点指针
      *
@@ -2545,6 +2596,22 @@ public:
         return garbageCollectorGeneric.empty() && garbageCollectorSnapshot.empty();
     }
 
+    size_t pendingCount() const
+    {
+        return garbageCollectorGeneric.pendingCount() + garbageCollectorSnapshot.pendingCount();
+    }
+
+    uint64_t objectsFreed() const
+    {
+        return garbageCollectorGeneric.objectsFreed() + garbageCollectorSnapshot.objectsFreed();
+    }
+
+    uint64_t epochsStarted() const
+    {
+        // both collectors start an epoch together so only count one of them
+        return garbageCollectorGeneric.epochsStarted();
+    }
+
     void shutdown()
     {
         garbageCollectorSnapshot.shutdown();
@@ -2570,6 +2637,35 @@ public:
 };
 
 // 可在没有锁的情况下访问的每线程变量
+/* 工作线程事件循环的各阶段，前几个由 ae 上报，其余为 beforeSleep 内部的子阶段 */
+#define THREAD_PHASE_BEFORE_SLEEP AE_PHASE_BEFORE_SLEEP
+#define THREAD_PHASE_POLL AE_PHASE_POLL
+#define THREAD_PHASE_AFTER_SLEEP AE_PHASE_AFTER_SLEEP
+#define THREAD_PHASE_FILE_EVENTS AE_PHASE_FILE_EVENTS
+#define THREAD_PHASE_TIME_EVENTS AE_PHASE_TIME_EVENTS
+#define THREAD_PHASE_LOCK_WAIT (AE_PHASE_COUNT+0)       /* beforeSleep/afterSleep 等待全局锁 */
+#define THREAD_PHASE_PROCESS_CLIENTS (AE_PHASE_COUNT+1) /* 批量执行已解析的命令 */
+#define THREAD_PHASE_EXPIRE (AE_PHASE_COUNT+2)          /* 快速主动过期周期 */
+#define THREAD_PHASE_BLOCKED_CLIENTS (AE_PHASE_COUNT+3) /* 解除阻塞/模块阻塞客户端 */
+#define THREAD_PHASE_TRACKING (AE_PHASE_COUNT+4)        /* 客户端缓存失效广播 */
+#define THREAD_PHASE_AOF_FLUSH (AE_PHASE_COUNT+5)
+#define THREAD_PHASE_STORAGE (AE_PHASE_COUNT+6)         /* 存储提供者的变更处理与提交 */
+#define THREAD_PHASE_FREE_CLIENTS (AE_PHASE_COUNT+7)    /* 异步释放客户端 */
+#define THREAD_PHASE_PENDING_WRITES (AE_PHASE_COUNT+8)  /* handleClientsWithPendingWrites */
+#define THREAD_PHASE_ASYNC_WRITES (AE_PHASE_COUNT+9)    /* ProcessPendingAsyncWrites */
+#define THREAD_PHASE_HOUSEKEEPING (AE_PHASE_COUNT+10)   /* beforeSleep 中的其余工作 */
+#define THREAD_PHASE_LOCK_WAIT_IO (AE_PHASE_COUNT+11)   /* 等待全局锁期间处理的 socket I/O */
+#define THREAD_PHASE_COUNT (AE_PHASE_COUNT+12)
+
+struct threadPhaseStats {
+    unsigned long long calls;
+    unsigned long long usec;
+    unsigned long long max_usec;
+    unsigned long long hist[AE_HIST_BUCKETS];   /* log2 微秒分桶 */
+};
+
+struct commandTraceRing;
+
 struct redisServerThreadVars {
     aeEventLoop *el = nullptr;
     socketFds ipfd;             /* TCP 套接字文件描述符 */
@@ -2590,6 +2686,10 @@ struct redisServerThreadVars {
     GarbageCollectorCollection::Epoch gcEpoch;
     const redisDbPersistentDataSnapshot **rgdbSnapshot = nullptr;
     long long stat_total_error_replies; /* 发出的错误回复总数（命令 + 拒绝的错误） */
+    std::vector<robj*> argvObjPool[ARGV_POOL_CLASSES];  /* 命令执行完后回收的 EMBSTR 参数对象，按分配大小分级 */
+    std::vector<robj**> argvArrayPool;  /* 回收的 argv 数组，至少 ARGV_POOL_ARRAY_SLOTS 个槽位 */
+    long long stat_argv_pool_hits = 0;  /* 从池中取得的参数对象与 argv 数组数 */
+    long long stat_argv_pool_misses = 0;    /* 池为空、只能新分配的次数 */
     long long prev_err_count; /* 调用期间现有错误的每线程标记 */
     bool fRetrySetAofEvent = false;
     bool modulesEnabledThisAeLoop = false; /* 在 aeMain 的这个循环中，模块是否在之前启用了
@@ -2600,6 +2700,18 @@ struct redisServerThreadVars {
     int client_pause_in_transaction = 0; /* 在此 Exec 期间是否执行了客户端暂停？ */
     std::vector<client*> vecclientsProcess;
     dictAsyncRehashCtl *rehashCtl = nullptr;
+    struct hdr_histogram *latency_phase_histogram[LATENCY_PHASE_COUNT] = {}; /* 各阶段（排队/锁/执行/写）延迟直方图 */
+    unsigned long long latency_phase_histogram_epoch[LATENCY_PHASE_COUNT] = {}; /* 同上，落后时视为空 */
+    long long lock_wait_us = -1;    /* 本轮处理客户端前等待全局锁的时间，-1 表示未测量 */
+    threadPhaseStats rgphase[THREAD_PHASE_COUNT] = {}; /* 事件循环各阶段耗时，仅由本线程写入 */
+    unsigned long long phase_stats_epoch = 0;   /* 落后于 g_pserver->thread_phase_stats_epoch 时清零 rgphase */
+    struct commandTraceRing *trace_ring = nullptr; /* 命令追踪环形缓冲区，首次记录时分配 */
+    std::atomic<unsigned long long> usec_busy_total {0}; /* 事件循环非 poll 累计耗时，不随 RESETSTAT 清零，仅由本线程写入 */
+    unsigned long long usec_busy_sampled = 0;   /* 线程再平衡上次采样的 usec_busy_total（仅主线程访问） */
+    int rebalance_load_pct = 0;                 /* 线程再平衡最近一次采样的负载百分比 */
+    bool lock_batch_active = false;             /* 正在 processClients 的批次中执行命令 */
+    long long lock_batch_commands = 0;          /* 当前批次已执行的命令数 */
+    monotime lock_batch_deadline = 0;           /* 当前批次的截止时间，0 表示不限 */
 
     int getRdbKeySaveDelay();
 private:
@@ -2638,12 +2750,15 @@ struct redisServerConst {
     int active_expire_enabled;      /* 出于测试目的可以禁用。 */
     int active_defrag_enabled;
     int jemalloc_bg_thread;         /* 启用 jemalloc 后台线程 */
+    int jemalloc_thread_arenas;     /* 每个事件循环/后台线程绑定独立的 jemalloc arena */
+    int jemalloc_keyspace_arena;    /* MALLOC_SHARED 分配（键空间对象）使用专用 arena */
     size_t active_defrag_ignore_bytes; /* 启动主动碎片的最小碎片浪费量 */
     int active_defrag_threshold_lower; /* 启动主动碎片的最小碎片百分比 */
     int active_defrag_threshold_upper; /* 我们使用最大努力时的最大碎片百分比 */
     int active_defrag_cycle_min;       /* CPU 百分比中碎片整理的最小努力 */
     int active_defrag_cycle_max;       /* CPU 百分比中碎片整理的最大努力 */
     unsigned long active_defrag_max_scan_fields; /* 从主字典扫描中处理的 set/hash/zset/list 的最大字段数 */
+    int active_defrag_threads;         /* 并行扫描主字典的碎片整理线程数 */
     size_t client_max_querybuf_len; /* 客户端查询缓冲区长度限制 */
     int dbnum = 0;                      /* 配置的数据库总数 */
     int supervised;                 /* 如果受监管则为 1，否则为 0。 */
@@ -2776,6 +2891,12 @@ struct redisServer {
     long long slowlog_entry_id;     /* SLOWLOG 当前条目 ID */
     long long slowlog_log_slower_than; /* SLOWLOG 时间限制 (用于记录) */
     unsigned long slowlog_max_len;     /* SLOWLOG 记录的最大条目数 */
+    int command_trace_enabled;         /* 是否将执行的命令写入二进制追踪文件 */
+    int command_trace_args;            /* CMDTRACE_ARGS_KEYS 或 CMDTRACE_ARGS_ALL */
+    char *command_trace_file;          /* 追踪文件路径，下次启用时生效 */
+    size_t command_trace_max_size;     /* 超过该大小时轮转追踪文件，0 表示不轮转 */
+    int command_trace_max_files;       /* 保留的已轮转追踪文件数量 */
+    size_t command_trace_buffer_size;  /* 每个线程的追踪环形缓冲区大小 */
     struct malloc_stats cron_malloc_stats; /* 在 serverCron() 中采样。 */
     std::atomic<long long> stat_net_input_bytes; /* 从网络读取的字节数。 */
     std::atomic<long long> stat_net_output_bytes; /* 写入网络的字节数。 */
@@ -2794,6 +2915,12 @@ struct redisServer {
     std::atomic<long long> stat_total_writes_processed; /* 已处理的写入事件总数 */
     long long stat_storage_provider_read_hits;
     long long stat_storage_provider_read_misses;
+    long long stat_snapshot_consolidations;         /* 快照合并回父级的次数 */
+    long long stat_snapshot_consolidations_async;   /* 将墓碑清理交给后台线程的合并次数 */
+    long long stat_snapshot_consolidation_us;       /* 持有全局锁进行快照合并的累计耗时（微秒） */
+    long long stat_snapshot_consolidation_max_us;   /* 单次持锁快照合并的最大耗时（微秒） */
+    std::atomic<long long> stat_snapshot_consolidation_bg_us; /* 后台线程清理墓碑的累计耗时（微秒） */
+    long long stat_snapshot_tombstones_incremental; /* 合并前分批（每批短暂持锁）应用到快照的墓碑数 */
     /* 以下两个用于跟踪瞬时指标，例如
      * 每秒操作数、网络流量。 */
     struct {
@@ -2862,6 +2989,7 @@ struct redisServer {
     char *rdb_filename;             /* RDB 文件名 */
     char *rdb_s3bucketpath;         /* RDB 文件的 AWS S3 备份路径 */
     int rdb_compression;            /* 是否在 RDB 中使用压缩？ */
+    int rdb_compression_algorithm;  /* 压缩字符串使用的算法，RDB_COMPRESSION_* */
     int rdb_checksum;               /* 是否使用 RDB 校验和？ */
     int rdb_del_sync_files;         /* 如果实例不使用持久化，是否删除仅用于 SYNC 的 RDB 文件。
                                        */
@@ -2996,6 +3124,8 @@ struct redisServer {
     size_t hll_sparse_max_bytes;
     size_t stream_node_max_bytes;
     long long stream_node_max_entries;
+    size_t nested_hash_max_listpack_entries;
+    size_t nested_hash_max_listpack_value;
     /* 列表参数 */
     int list_max_ziplist_size;
     int list_compress_depth;
@@ -3063,6 +3193,9 @@ struct redisServer {
     int lazyfree_lazy_user_flush;
     /* 延迟监视器 */
     long long latency_monitor_threshold;
+    int latency_tracking_enabled;   /* 是否记录每个命令的延迟直方图 */
+    std::atomic<unsigned long long> thread_phase_stats_epoch {0}; /* CONFIG RESETSTAT 时递增 */
+    std::atomic<unsigned long long> latency_histogram_epoch {0}; /* CONFIG RESETSTAT 时递增，直方图由所属线程在下次记录时清零 */
     ::dict *latency_events;
     /* ACL */
     char *acl_filename;           /* ACL 用户文件。如果未配置，则为 NULL。 */
@@ -3092,6 +3225,7 @@ struct redisServer {
     int storage_flush_period;   // CRON作业中执行存储刷新的时间间隔
 
     long long snapshot_slip = 500;   // 允许快照落后当前数据库的时间量（毫秒）
+    size_t snapshot_consolidate_sync_limit; // 墓碑数低于该值时在全局锁内同步合并快照，否则交给后台线程
 
     /* TLS 配置参数 */
     int tls_cluster;            // 集群通信TLS启用标志
@@ -3123,6 +3257,19 @@ struct redisServer {
     int enable_async_commands;
     int multithread_load_enabled = 0;
     int active_client_balancing = 1;
+    int thread_rebalance = 0;               /* 按线程负载在事件循环之间迁移已连接的客户端 */
+    int thread_rebalance_threshold;         /* 最忙与最闲线程的负载差（百分比）达到该值才迁移 */
+    int thread_rebalance_max_clients;       /* 每轮最多迁移的客户端数 */
+    monotime mtime_rebalance_sampled = 0;   /* 上次负载采样的时间 */
+    std::atomic<long long> stat_thread_rebalance_cycles {0}; /* 触发迁移的再平衡轮数 */
+    std::atomic<long long> stat_thread_migrations {0};       /* 已迁移的客户端数 */
+    int lock_wait_io_rounds;                /* 全局锁被占用时最多额外处理几轮 socket I/O，0 表示直接等待 */
+    int lock_batch_max_commands;            /* 每次持锁批量执行的命令数上限，0 表示不限 */
+    int lock_batch_max_usec;                /* 每次持锁批量执行的时间上限（微秒），0 表示不限 */
+    int lock_spin_policy;                   /* fastlock 等待策略：FASTLOCK_POLICY_* */
+    std::atomic<long long> stat_lock_batches {0};            /* 至少执行了一条命令的批次数 */
+    std::atomic<long long> stat_lock_batch_commands {0};     /* 批次中执行的命令总数 */
+    std::atomic<long long> stat_lock_batches_truncated {0};  /* 因达到上限而把剩余命令留到下一批的次数 */
 
     long long repl_batch_offStart = -1;
     long long repl_batch_idxStart = -1;
@@ -3193,6 +3340,10 @@ struct redisCommand {
     int id;     /* 命令 ID。这是一个从 0 开始的渐进式 ID，在运行时分配，
                    用于检查 ACL。如果与连接关联的用户在允许的命令位图中
                    设置了此命令位，则连接能够执行给定的命令。 */
+    /* 每个事件循环线程一个延迟直方图（最后一个槽位给模块等其他线程），
+       首次记录时惰性创建，读取时合并。 */
+    struct hdr_histogram *latency_histogram[MAX_EVENT_LOOPS+1];
+    unsigned long long latency_histogram_epoch[MAX_EVENT_LOOPS+1]; /* 落后于 g_pserver->latency_histogram_epoch 的槽位视为空 */
 };
 
 struct redisError {
@@ -3354,6 +3505,8 @@ bool freeClient(client *c);
 void freeClientAsync(client *c);
 void resetClient(client *c);
 void freeClientOriginalArgv(client *c);
+robj *argvPoolCreateString(const char *ptr, size_t len);
+void argvPoolRelease(robj *o);
 void sendReplyToClient(connection *conn);
 void *addReplyDeferredLen(client *c);
 void setDeferredArrayLen(client *c, void *node, long length);
@@ -3418,6 +3571,7 @@ void replaceClientCommandVector(client *c, int argc, robj **argv);
 void redactClientCommandArgument(client *c, int argc);
 unsigned long getClientOutputBufferMemoryUsage(client *c);
 int freeClientsInAsyncFreeQueue(int iel);
+void rebalanceClientsToThread(int ielTarget, double fraction);
 int closeClientOnOutputBufferLimitReached(client *c, int async);
 int getClientType(client *c);
 int getClientTypeByName(const char *name);
@@ -3523,6 +3677,8 @@ robj *createObject(int type, void *ptr);
 robj *createStringObject(const char *ptr, size_t len);
 robj *createRawStringObject(const char *ptr, size_t len);
 robj *createEmbeddedStringObject(const char *ptr, size_t len);
+size_t embeddedStringObjectAllocSize(size_t len);
+robj *resetEmbeddedStringObject(robj *o, const char *ptr, size_t len);
 robj *tryCreateRawStringObject(const char *ptr, size_t len);
 robj *tryCreateStringObject(const char *ptr, size_t len);
 robj *dupStringObject(const robj *o);
@@ -3568,6 +3724,7 @@ robj *deserializeStoredObject(const void *data, size_t cb);
 std::unique_ptr<expireEntry> deserializeExpire(const char *str, size_t cch, size_t *poffset);
 sds serializeStoredObject(robj_roptr o, sds sdsPrefix = nullptr);
 sds serializeStoredObjectAndExpire(robj_roptr o);
+robj *dupObjectForSnapshot(robj_roptr o);
 
 #define sdsEncodedObject(objptr) (objptr->encoding == OBJ_ENCODING_RAW || objptr->encoding == OBJ_ENCODING_EMBSTR)
 
@@ -3782,7 +3939,14 @@ int changeBindAddr(sds *addrlist, int addrlist_len, bool fFirstCall);
 struct redisCommand *lookupCommand(sds name);
 struct redisCommand *lookupCommandByCString(const char *s);
 struct redisCommand *lookupCommandOrOriginal(sds name);
+struct redisCommand *lookupParsedCommand(struct parsed_command &cmd);
+void commandTableChanged(void);
 void call(client *c, int flags);
+void commandTraceRecord(client *c, struct redisCommand *cmd, robj **argv, int argc,
+                        long long start_us, long long duration, unsigned long long reply_bytes);
+int commandTraceStart(const char **err);
+void commandTraceStop(void);
+sds genCommandTraceInfoString(sds info);
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int flags);
 void alsoPropagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int target);
 void redisOpArrayInit(redisOpArray *oa);
@@ -4001,6 +4165,7 @@ void sentinelCheckConfigFile(void);
 int redis_check_rdb(const char *rdbfilename, FILE *fp);
 int redis_check_rdb_main(int argc, const char **argv, FILE *fp);
 int redis_check_aof_main(int argc, char **argv);
+int microbenchMain(int argc, char **argv);
 
 /* Scripting */
 void scriptingInit(int setup);
@@ -4330,6 +4495,9 @@ sds genModulesInfoString(sds info);
 void enableWatchdog(int period);
 void disableWatchdog(void);
 void watchdogScheduleSignal(int period);
+void profilerDrainSamples(void);
+monotime threadPhaseEnd(int phase, monotime start);
+void threadPhaseRecord(int phase, monotime us);
 void serverLogHexDump(int level, const char *descr, void *value, size_t len);
 extern "C" int memtest_preserving_test(unsigned long *m, size_t bytes, int passes);
 void mixDigest(unsigned char *digest, const void *ptr, size_t len);
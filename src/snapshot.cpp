@@ -1,9 +1,19 @@
 #include "server.h"
 #include "aelocker.h"
 
-static const size_t c_elementsSmallLimit = 500000;
+static const int c_snapshotDepthMax = 6;        // optional snapshots beyond this depth are refused to bound the chain
 static fastlock s_lock {"consolidate_children"};    // this lock ensures only one thread is consolidating at a time
 
+// Called under the global lock once a snapshot has actually been merged back into its parent
+static void updateSnapshotConsolidationStats(long long us)
+{
+    serverAssert(GlobalLocksAcquired());
+    g_pserver->stat_snapshot_consolidations++;
+    g_pserver->stat_snapshot_consolidation_us += us;
+    if (us > g_pserver->stat_snapshot_consolidation_max_us)
+        g_pserver->stat_snapshot_consolidation_max_us = us;
+}
+
 class LazyFree : public ICollectable
 {
 public:
@@ -47,7 +57,8 @@ const redisDbPersistentDataSnapshot *redisDbPersistentData::createSnapshot(uint6
         // If possible reuse an existing snapshot (we want to minimize nesting)
         if (mvccCheckpoint <= m_spdbSnapshotHOLDER->m_mvccCheckpoint)
         {
-            if (!m_spdbSnapshotHOLDER->FStale())
+            // A snapshot the tombstones above are being applied to no longer shows one point in time
+            if (!m_spdbSnapshotHOLDER->FStale() && !m_spdbSnapshotHOLDER->m_fTombstonesApplied)
             {
                 m_spdbSnapshotHOLDER->m_refCount++;
                 return m_spdbSnapshotHOLDER.get();
@@ -57,7 +68,7 @@ const redisDbPersistentDataSnapshot *redisDbPersistentData::createSnapshot(uint6
     }
 
     // See if we have too many levels and can bail out of this to reduce load
-    if (fOptional && (levels >= 6))
+    if (fOptional && (levels >= c_snapshotDepthMax))
     {
         serverLog(LL_DEBUG, "Snapshot nesting too deep, abondoning");
         return nullptr;
@@ -181,6 +192,9 @@ void redisDbPersistentData::endSnapshotAsync(const redisDbPersistentDataSnapshot
     mstime_t latency;
 
     aeAcquireLock();
+    if (dictSize(m_pdictTombstone) >= g_pserver->snapshot_consolidate_sync_limit)
+        applyTombstonesIncremental(psnapshot);
+
     while (dictIsRehashing(m_pdict) || dictIsRehashing(m_pdictTombstone)) {
         dictRehashMilliseconds(m_pdict, 1);
         dictRehashMilliseconds(m_pdictTombstone, 1);
@@ -202,7 +216,7 @@ void redisDbPersistentData::endSnapshotAsync(const redisDbPersistentDataSnapshot
         // if neither dict is rehashing then the merge is O(1) so don't count the size
         if (dictIsRehashing(psnapshot->m_pdict) || dictIsRehashing(m_pdict))
             elements += dictSize(m_pdict);
-        if (elements < c_elementsSmallLimit || psnapshot != m_spdbSnapshotHOLDER.get())  // heuristic
+        if (elements < g_pserver->snapshot_consolidate_sync_limit || psnapshot != m_spdbSnapshotHOLDER.get())  // heuristic
         {
             // For small snapshots it makes more sense just to merge it directly
             endSnapshot(psnapshot);
@@ -216,13 +230,17 @@ void redisDbPersistentData::endSnapshotAsync(const redisDbPersistentDataSnapshot
         auto psnapshotT = createSnapshot(LLONG_MAX, false);
         endSnapshot(psnapshot); // this will just dec the ref count since our new snapshot has a ref 
         psnapshot = nullptr;
+        g_pserver->stat_snapshot_consolidations_async++;
 
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("end-snapshot-async-phase-1", latency);
     aeReleaseLock();
 
     // do the expensive work of merging snapshots outside the ref
-    if (const_cast<redisDbPersistentDataSnapshot*>(psnapshotT)->freeTombstoneObjects(1))    // depth is one because we just creted it
+    long long usStart = ustime();
+    bool fFreed = const_cast<redisDbPersistentDataSnapshot*>(psnapshotT)->freeTombstoneObjects(1);    // depth is one because we just creted it
+    g_pserver->stat_snapshot_consolidation_bg_us += ustime() - usStart;
+    if (fFreed)
     {
         aeAcquireLock();
         if (m_pdbSnapshotASYNC != nullptr)
@@ -245,6 +263,75 @@ void redisDbPersistentData::endSnapshotAsync(const redisDbPersistentDataSnapshot
     aeReleaseLock();
 }
 
+// Applies our tombstones to the snapshot about to be merged into us a bucket range at a time,
+//  dropping the global lock between batches.  As long as nobody else holds the snapshot only
+//  we read it, so removing an entry from it together with its tombstone changes no lookup.
+//  endSnapshot() is left with the tombstones added in the meantime, the ones for older
+//  snapshots and the swap of the dicts.
+void redisDbPersistentData::applyTombstonesIncremental(const redisDbPersistentDataSnapshot *psnapshot)
+{
+    static const size_t c_ctombstoneBatch = 1024;
+    serverAssert(GlobalLocksAcquired());
+
+    std::vector<dictEntry*> vecde;
+    std::vector<sds> veckeyApplied;
+    unsigned long cursor = 0;
+    do
+    {
+        // Bail out to the regular merge once someone else may read the snapshot
+        if (m_spdbSnapshotHOLDER.get() != psnapshot || m_pdbSnapshot != psnapshot || psnapshot->m_refCount != 1)
+            return;
+        m_spdbSnapshotHOLDER->m_fTombstonesApplied = true;
+
+        mstime_t latency;
+        latencyStartMonitor(latency);
+        vecde.clear();
+        do {
+            cursor = dictScan(m_pdictTombstone, cursor, [](void *privdata, const dictEntry *de) {
+                ((std::vector<dictEntry*>*)privdata)->push_back(const_cast<dictEntry*>(de));
+            }, nullptr, &vecde);
+        } while (cursor != 0 && vecde.size() < c_ctombstoneBatch);
+
+        dict *dictSnapshot = m_spdbSnapshotHOLDER->m_pdict;
+        auto splazy = std::make_unique<LazyFree>();
+        veckeyApplied.clear();
+        dictPauseRehashing(dictSnapshot);
+        for (dictEntry *de : vecde)
+        {
+            dictEntry **dePrev;
+            dictht *ht;
+            dictEntry *deSnapshot = dictFindWithPrev(dictSnapshot, dictGetKey(de), (uint64_t)dictGetVal(de), &dePrev, &ht, false);
+            if (deSnapshot == nullptr)
+                continue;   // The key lives in an older snapshot, endSnapshot() propagates the tombstone
+
+            *dePrev = deSnapshot->next;
+            if (dictSnapshot->asyncdata != nullptr)
+                dictFreeUnlinkedEntry(dictSnapshot, deSnapshot);
+            else
+                splazy->vecde.push_back(deSnapshot);
+            ht->used--;
+            veckeyApplied.push_back((sds)dictGetKey(de));
+        }
+        dictResumeRehashing(dictSnapshot);
+        for (sds key : veckeyApplied)
+            dictDelete(m_pdictTombstone, key);
+        g_pserver->stat_snapshot_tombstones_incremental += veckeyApplied.size();
+        if (serverTL != nullptr && !serverTL->gcEpoch.isReset())
+            g_pserver->garbageCollector.enqueue(serverTL->gcEpoch, std::move(splazy));
+        splazy = nullptr;
+        latencyEndMonitor(latency);
+        latencyAddSampleIfNeeded("end-snapshot-async-incremental", latency);
+
+        if (cursor != 0)
+        {
+            // Give someone else a chance
+            aeReleaseLock();
+            usleep(300);
+            aeAcquireLock();
+        }
+    } while (cursor != 0);
+}
+
 bool redisDbPersistentDataSnapshot::freeTombstoneObjects(int depth)
 {
     if (m_pdbSnapshot == nullptr)
@@ -339,6 +426,7 @@ void redisDbPersistentData::endSnapshot(const redisDbPersistentDataSnapshot *psn
 
     mstime_t latency_endsnapshot;
     latencyStartMonitor(latency_endsnapshot);
+    long long usStart = ustime();
 
     // Alright we're ready to be free'd, but first dump all the refs on our child snapshots
     if (m_spdbSnapshotHOLDER->m_refCount == 1)
@@ -451,6 +539,7 @@ void redisDbPersistentData::endSnapshot(const redisDbPersistentDataSnapshot *psn
 
     latencyEndMonitor(latency_endsnapshot);
     latencyAddSampleIfNeeded("end-mvcc-snapshot", latency_endsnapshot);
+    updateSnapshotConsolidationStats(ustime() - usStart);
 
     performEvictions(false);
 }
@@ -635,6 +724,14 @@ int redisDbPersistentDataSnapshot::snapshot_depth() const
     return 0;
 }
 
+size_t redisDbPersistentDataSnapshot::tombstone_count() const
+{
+    size_t count = dictSize(m_pdictTombstone);
+    if (m_pdbSnapshot)
+        count += m_pdbSnapshot->tombstone_count();
+    return count;
+}
+
 bool redisDbPersistentDataSnapshot::FStale() const
 {
     return ((getMvccTstamp() - m_mvccCheckpoint) >> MVCC_MS_SHIFT) >= static_cast<uint64_t>(g_pserver->snapshot_slip);
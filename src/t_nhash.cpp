@@ -28,6 +28,8 @@
  */
 
 #include "server.h"
+#include "t_nhash.h"
+#include "listpack.h"
 #include <math.h>
 
 void dictObjectDestructor(void *privdata, void *val);
@@ -40,146 +42,347 @@ dictType nestedHashDictType {
     dictObjectDestructor,      /* val destructor */
 };
 
-robj *createNestHashBucket() {
-    dict *d = dictCreate(&nestedHashDictType, nullptr);
-    return createObject(OBJ_NESTEDHASH, d);
-}
+// Buckets start out as a listpack of field/value pairs and are converted to a
+// dict once they get more than nested-hash-max-listpack-entries fields, a
+// field or string value longer than nested-hash-max-listpack-value, or a value
+// that isn't a string (a child bucket or a list). Listpacks only ever hold the
+// bytes of their strings, so they own no references and a path only walks
+// listpacks at its leaves. Values are prefixed with a tag byte so listpack
+// never stores them as integers and hands back a pointer into the bucket.
+#define NHASH_LP_STRING 's'
 
-void freeNestedHashObject(robj_roptr o) {
-    dictRelease((dict*)ptrFromObj(o));
+robj *createNestHashBucket() {
+    robj *o;
+    if (g_pserver->nested_hash_max_listpack_entries == 0) {
+        o = createObject(OBJ_NESTEDHASH, dictCreate(&nestedHashDictType, nullptr));
+        o->encoding = OBJ_ENCODING_HT;
+    } else {
+        o = createObject(OBJ_NESTEDHASH, lpNew(0));
+        o->encoding = OBJ_ENCODING_LISTPACK;
+    }
+    return o;
 }
 
-class DbDictWrapper {
+// Splits a dotted path into its components without copying them
+class NestedPathTokenizer {
 public:
-    DbDictWrapper() = default;
-
-    DbDictWrapper(dict *d)
-        : m_dict(d)
+    NestedPathTokenizer(const char *path, size_t cch)
+        : m_pchCur(path), m_pchMax(path + cch)
     {}
 
-    DbDictWrapper(redisDb *db)
-        : m_db(db)
-    {}
-
-    dict_iter find(const char *key) {
-        if (m_db != nullptr) {
-            return m_db->find(key);
-        } else if (m_dict != nullptr) {
-            dictEntry *de = dictFind(m_dict, key);
-            return dict_iter(m_dict, de);
+    // Moves to the next component, returns false after the last one
+    bool next() {
+        if (m_fLast)
+            return false;
+        const char *pchEnd = (const char*)memchr(m_pchCur, '.', m_pchMax - m_pchCur);
+        if (pchEnd == nullptr) {
+            pchEnd = m_pchMax;
+            m_fLast = true;
         }
-        return dict_iter(nullptr);
+        if (pchEnd == m_pchCur)
+            throw shared.syntaxerr; // malformed
+        m_pch = m_pchCur;
+        m_cch = pchEnd - m_pchCur;
+        m_pchCur = pchEnd + 1;
+        return true;
     }
 
-    bool add(sds key, robj *val) {
-        bool result = false;
-        if (m_db != nullptr) {
-            result = m_db->insert(key, val, true);
-        } else if (m_dict != nullptr) {
-            result = dictAdd(m_dict, key, val) == DICT_OK;
+    bool fLast() const { return m_fLast; }
+    const char *pch() const { return m_pch; }
+    size_t cch() const { return m_cch; }
+
+private:
+    const char *m_pchCur;
+    const char *m_pchMax;
+    const char *m_pch = nullptr;
+    size_t m_cch = 0;
+    bool m_fLast = false;
+};
+
+// A path component as an sds for dict lookups. Short ones live on the stack
+// so walking a path doesn't allocate.
+class NestedPathKey {
+public:
+    NestedPathKey(const char *pch, size_t cch) {
+        if (cch <= UINT8_MAX) {
+            struct sdshdr8 *sh = (struct sdshdr8*)m_rgch;
+            sh->len = sh->alloc = (uint8_t)cch;
+            sh->flags = SDS_TYPE_8;
+            m_sds = sh->buf();
+            memcpy(m_sds, pch, cch);
+            m_sds[cch] = '\0';
+        } else {
+            m_sds = sdsnewlen(pch, cch);
+            m_fHeap = true;
         }
-        return result;
     }
 
+    ~NestedPathKey() {
+        if (m_fHeap)
+            sdsfree(m_sds);
+    }
+
+    NestedPathKey(const NestedPathKey &) = delete;
+    NestedPathKey &operator=(const NestedPathKey &) = delete;
+
+    sds get() const { return m_sds; }
+    sds dup() const { return sdsnewlen(m_sds, sdslen(m_sds)); }
+
 private:
-    redisDb *m_db = nullptr;
-    dict *m_dict = nullptr;
+    char m_rgch[sizeof(struct sdshdr8) + UINT8_MAX + 1];
+    sds m_sds;
+    bool m_fHeap = false;
 };
 
-robj *fetchFromKey(redisDb *db, robj_roptr key) {
-    const char *pchCur = szFromObj(key);
-    const char *pchStart = pchCur;
-    const char *pchMax = pchCur + sdslen(pchCur);
-    robj *o = nullptr;
+static nhashValue nhashLpValue(unsigned char *p) {
+    int64_t cch;
+    unsigned char *ele = lpGet(p, &cch, nullptr);
+    serverAssert(ele != nullptr && cch >= 1);
+    serverAssert(ele[0] == NHASH_LP_STRING);
+    nhashValue v;
+    v.str = (const char*)ele + 1;
+    v.len = cch - 1;
+    return v;
+}
+
+// Returns true if 'val' can be stored inline in a listpack bucket
+static bool nhashLpCanHold(robj *val) {
+    return val->type == OBJ_STRING && stringObjectLen(val) <= g_pserver->nested_hash_max_listpack_value;
+}
+
+// Returns the entry of 'field' in a listpack bucket, its value is the next one
+static unsigned char *nhashLpFind(unsigned char *lp, const char *field, size_t cch) {
+    unsigned char *p = lpFirst(lp);
+    if (p == nullptr)
+        return nullptr;
+    // Fields are every other entry, lpFind skips the values in between
+    return lpFind(lp, p, (unsigned char*)field, cch, 1);
+}
+
+// Writes the string 'val' as the value entry at 'p', or appends it if 'p' is
+// NULL. Releases the caller's reference to 'val', the listpack keeps a copy.
+static unsigned char *nhashLpWriteValue(unsigned char *lp, unsigned char *p, robj *val) {
+    serverAssert(nhashLpCanHold(val));
+    char rgch[128];
+    char *entry = rgch;
+    char rgchNum[LONG_STR_SIZE];
+    const char *str;
+    size_t len;
+    if (sdsEncodedObject(val)) {
+        str = szFromObj(val);
+        len = sdslen(szFromObj(val));
+    } else {
+        len = ll2string(rgchNum, sizeof(rgchNum), (long)ptrFromObj(val));
+        str = rgchNum;
+    }
+    size_t cch = len + 1;
+    if (cch > sizeof(rgch))
+        entry = (char*)zmalloc(cch, MALLOC_LOCAL);
+    entry[0] = NHASH_LP_STRING;
+    memcpy(entry + 1, str, len);
+    decrRefCount(val);
+
+    if (p == nullptr)
+        lp = lpAppend(lp, (unsigned char*)entry, cch);
+    else
+        lp = lpInsert(lp, (unsigned char*)entry, cch, p, LP_REPLACE, nullptr);
+    if (entry != rgch)
+        zfree(entry);
+    return lp;
+}
+
+static size_t nhashBucketSize(robj_roptr bucket) {
+    if (bucket->encoding == OBJ_ENCODING_LISTPACK)
+        return lpLength((unsigned char*)ptrFromObj(bucket)) / 2;
+    return dictSize((dict*)ptrFromObj(bucket));
+}
+
+// Calls fn(field, cch, value) for every field of a bucket
+template<typename FN>
+static void nhashBucketForEach(robj_roptr bucket, FN fn) {
+    if (bucket->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = (unsigned char*)ptrFromObj(bucket);
+        unsigned char *p = lpFirst(lp);
+        while (p != nullptr) {
+            unsigned char intbuf[LP_INTBUF_SIZE];
+            int64_t cchField;
+            unsigned char *field = lpGet(p, &cchField, intbuf);
+            p = lpNext(lp, p);
+            fn((const char*)field, (size_t)cchField, nhashLpValue(p));
+            p = lpNext(lp, p);
+        }
+    } else {
+        dictIterator *di = dictGetIterator((dict*)ptrFromObj(bucket));
+        dictEntry *de;
+        while ((de = dictNext(di))) {
+            sds field = (sds)dictGetKey(de);
+            nhashValue v;
+            v.o = (robj*)dictGetVal(de);
+            fn((const char*)field, sdslen(field), v);
+        }
+        dictReleaseIterator(di);
+    }
+}
+
+static bool nhashBucketFind(robj *bucket, const char *field, size_t cch, nhashValue *pv) {
+    if (bucket->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = (unsigned char*)ptrFromObj(bucket);
+        unsigned char *p = nhashLpFind(lp, field, cch);
+        if (p == nullptr)
+            return false;
+        *pv = nhashLpValue(lpNext(lp, p));
+        return true;
+    }
+
+    NestedPathKey key(field, cch);
+    dictEntry *de = dictFind((dict*)ptrFromObj(bucket), key.get());
+    if (de == nullptr)
+        return false;
+    *pv = nhashValue();
+    pv->o = (robj*)dictGetVal(de);
+    return true;
+}
 
-    while (pchCur <= pchMax) {
-        if (pchCur == pchMax || *pchCur == '.') {
-            // WARNING: Don't deref pchCur as it may be pchMax
+static void nhashConvertToDict(robj *bucket) {
+    serverAssert(bucket->encoding == OBJ_ENCODING_LISTPACK);
+    unsigned char *lp = (unsigned char*)ptrFromObj(bucket);
+    dict *d = dictCreate(&nestedHashDictType, nullptr);
+    dictExpand(d, lpLength(lp) / 2);
+    nhashBucketForEach(bucket, [&](const char *field, size_t cch, const nhashValue &v) {
+        serverAssert(dictAdd(d, sdsnewlen(field, cch), createStringObject(v.str, v.len)) == DICT_OK);
+    });
+    lpFree(lp);
+    bucket->m_ptr = d;
+    bucket->encoding = OBJ_ENCODING_HT;
+}
 
-            // New word
-            if ((pchCur - pchStart) < 1) {
-                throw shared.syntaxerr; // malformed
+// Sets 'field' of a bucket to 'val', taking over the caller's reference to it.
+// Returns true if we overwrote a value.
+static bool nhashBucketSet(robj *bucket, const char *field, size_t cch, robj *val) {
+    if (bucket->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = (unsigned char*)ptrFromObj(bucket);
+        if (nhashLpCanHold(val)) {
+            unsigned char *p = nhashLpFind(lp, field, cch);
+            if (p != nullptr) {
+                bucket->m_ptr = nhashLpWriteValue(lp, lpNext(lp, p), val);
+                return true;
             }
+            if (cch <= g_pserver->nested_hash_max_listpack_value
+                    && lpLength(lp) / 2 < g_pserver->nested_hash_max_listpack_entries) {
+                lp = lpAppend(lp, (unsigned char*)field, cch);
+                bucket->m_ptr = nhashLpWriteValue(lp, nullptr, val);
+                return false;
+            }
+        }
+        nhashConvertToDict(bucket);
+    }
 
-            DbDictWrapper srcDb;
-            if (o == nullptr)
-                srcDb = db;
-            else
-                srcDb = (dict*)ptrFromObj(o);
-            
-            sdsstring str(pchStart, pchCur - pchStart);
-            o = srcDb.find(str.get()).val();
-
-            if (o == nullptr) throw shared.nokeyerr;   // Not Found
-            serverAssert(o->type == OBJ_NESTEDHASH || o->type == OBJ_STRING || o->type == OBJ_LIST);
-            if (o->type == OBJ_STRING && pchCur != pchMax)
-                throw shared.nokeyerr; // Past the end
+    dict *d = (dict*)ptrFromObj(bucket);
+    NestedPathKey key(field, cch);
+    dictEntry *de = dictFind(d, key.get());
+    if (de != nullptr) {
+        decrRefCount((robj*)dictGetVal(de));
+        dictSetVal(d, de, val);
+        return true;
+    }
+    dictAdd(d, key.dup(), val);
+    return false;
+}
 
-            pchStart = pchCur + 1;
+void freeNestedHashObject(robj_roptr o) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
+        lpFree((unsigned char*)ptrFromObj(o));
+    } else {
+        dictRelease((dict*)ptrFromObj(o));
+    }
+}
+
+nhashValue fetchFromKey(redisDb *db, robj_roptr key) {
+    const char *path = szFromObj(key);
+    NestedPathTokenizer tokenizer(path, sdslen(path));
+    nhashValue v;
+    bool fRoot = true;
+
+    while (tokenizer.next()) {
+        if (fRoot) {
+            NestedPathKey keyT(tokenizer.pch(), tokenizer.cch());
+            v.o = db->find(keyT.get()).val();
+            if (v.o == nullptr) throw shared.nokeyerr;   // Not Found
+            if (v.o->type != OBJ_NESTEDHASH && v.o->type != OBJ_STRING && v.o->type != OBJ_LIST)
+                throw shared.wrongtypeerr;
+            fRoot = false;
+        } else {
+            if (v.o == nullptr || v.o->type != OBJ_NESTEDHASH)
+                throw shared.nokeyerr; // Past the end
+            if (!nhashBucketFind(v.o, tokenizer.pch(), tokenizer.cch(), &v))
+                throw shared.nokeyerr;   // Not Found
         }
-        ++pchCur;
     }
 
-    return o;
+    return v;
 }
 
 // Returns one if we overwrote a value
 bool setWithKey(redisDb *db, robj_roptr key, robj *val, bool fCreateBuckets) {
-    const char *pchCur = szFromObj(key);
-    const char *pchStart = pchCur;
-    const char *pchMax = pchCur + sdslen(pchCur);
-    robj *o = nullptr;
-
-    while (pchCur <= pchMax) {
-        if (pchCur == pchMax || *pchCur == '.') {
-            // WARNING: Don't deref pchCur as it may be pchMax
-
-            // New word
-            if ((pchCur - pchStart) < 1) {
-                throw shared.syntaxerr; // malformed
-            }
+    const char *path = szFromObj(key);
+    NestedPathTokenizer tokenizer(path, sdslen(path));
+    robj *bucket = nullptr;     // Holds the current component, NULL for the db
 
-            DbDictWrapper src;
-            if (o == nullptr)
-                src = db;
-            else
-                src = (dict*)ptrFromObj(o);
-            
-            sdsstring str(pchStart, pchCur - pchStart);
-            dict_iter di = src.find(str.get());
+    while (tokenizer.next()) {
+        const char *pch = tokenizer.pch();
+        size_t cch = tokenizer.cch();
 
-            if (pchCur == pchMax) {
+        if (bucket == nullptr) {
+            NestedPathKey keyT(pch, cch);
+            dict_iter di = db->find(keyT.get());
+
+            if (tokenizer.fLast()) {
                 val->addref();
                 if (di.val() != nullptr) {
                     decrRefCount(di.val());
                     di.setval(val);
                     return true;
                 } else {
-                    src.add(str.release(), val);
+                    db->insert(keyT.dup(), val, true);
                     return false;
                 }
-            } else {
-                o = di.val();
-
-                if (o == nullptr) {
-                    if (!fCreateBuckets)
-                        throw shared.nokeyerr;   // Not Found
-                    o = createNestHashBucket();
-                    serverAssert(src.add(str.release(), o));
-                } else if (o->type != OBJ_NESTEDHASH) {
-                    decrRefCount(o);
-                    o = createNestHashBucket();
-                    di.setval(o);
-                }
             }
 
-            pchStart = pchCur + 1;
+            bucket = di.val();
+            if (bucket == nullptr) {
+                if (!fCreateBuckets)
+                    throw shared.nokeyerr;   // Not Found
+                bucket = createNestHashBucket();
+                serverAssert(db->insert(keyT.dup(), bucket, true));
+            } else if (bucket->type != OBJ_NESTEDHASH) {
+                decrRefCount(bucket);
+                bucket = createNestHashBucket();
+                di.setval(bucket);
+            }
+        } else {
+            if (tokenizer.fLast()) {
+                val->addref();
+                return nhashBucketSet(bucket, pch, cch, val);
+            }
+
+            nhashValue v;
+            bool fFound = nhashBucketFind(bucket, pch, cch, &v);
+            if (fFound && v.o != nullptr && v.o->type == OBJ_NESTEDHASH) {
+                bucket = v.o;
+            } else {
+                if (!fFound && !fCreateBuckets)
+                    throw shared.nokeyerr;   // Not Found
+                robj *child = createNestHashBucket();
+                nhashBucketSet(bucket, pch, cch, child);
+                bucket = child;
+            }
         }
-        ++pchCur;
     }
     throw "Internal Error";
 }
 
+void writeNestedValueToClient(client *c, const nhashValue &v);
+
 void writeNestedHashToClient(client *c, robj_roptr o) {
     if (o == nullptr) {
         addReply(c, shared.null[c->resp]);
@@ -205,27 +408,26 @@ void writeNestedHashToClient(client *c, robj_roptr o) {
         }
     } else {
         serverAssert(o->type == OBJ_NESTEDHASH );
-        dict *d = (dict*)ptrFromObj(o);
+        size_t cfield = nhashBucketSize(o);
 
-        if (dictSize(d) > 1)
-            addReplyArrayLen(c, dictSize(d));
-        
-        dictIterator *di = dictGetIterator(d);
-        dictEntry *de;
-        while ((de = dictNext(di))) {
-            robj_roptr oT = (robj*)dictGetVal(de);
+        if (cfield > 1)
+            addReplyArrayLen(c, cfield);
+
+        nhashBucketForEach(o, [&](const char *field, size_t cch, const nhashValue &v) {
             addReplyArrayLen(c, 2);
-            addReplyBulkCBuffer(c, (sds)dictGetKey(de), sdslen((sds)dictGetKey(de)));
-            if (oT->type == OBJ_STRING) {
-                addReplyBulk(c, oT);
-            } else {
-                writeNestedHashToClient(c, oT);
-            }
-        }
-        dictReleaseIterator(di);
+            addReplyBulkCBuffer(c, field, cch);
+            writeNestedValueToClient(c, v);
+        });
     }
 }
 
+void writeNestedValueToClient(client *c, const nhashValue &v) {
+    if (v.o != nullptr)
+        writeNestedHashToClient(c, v.o);
+    else
+        addReplyBulkCBuffer(c, v.str, v.len);
+}
+
 inline bool FSimpleJsonEscapeCh(char ch) {
     return (ch == '"' || ch == '\\');
 }
@@ -289,6 +491,8 @@ sds writeJsonValue(sds output, sds val) {
     return writeJsonValue(output, (const char*)val, sdslen(val));
 }
 
+sds writeNestedValueAsJson(sds output, const nhashValue &v);
+
 sds writeNestedHashAsJson(sds output, robj_roptr o) {
     if (o->type == OBJ_STRING) {
         output = writeJsonValue(output, (sds)szFromObj(o));
@@ -317,24 +521,26 @@ sds writeNestedHashAsJson(sds output, robj_roptr o) {
         output = sdscat(output, "]");
     } else {
         output = sdscat(output, "{");
-        dictIterator *di = dictGetIterator((dict*)ptrFromObj(o));
-        dictEntry *de;
         bool fFirst = true;
-        while ((de = dictNext(di))) {
-            robj_roptr oT = (robj*)dictGetVal(de);
+        nhashBucketForEach(o, [&](const char *field, size_t cch, const nhashValue &v) {
             if (!fFirst)
                 output = sdscat(output, ",");
             fFirst = false;
-            output = writeJsonValue(output, (sds)dictGetKey(de));
+            output = writeJsonValue(output, field, cch);
             output = sdscat(output, " : ");
-            output = writeNestedHashAsJson(output, oT);
-        }
-        dictReleaseIterator(di);
+            output = writeNestedValueAsJson(output, v);
+        });
         output = sdscat(output, "}");
     }
     return output;
 }
 
+sds writeNestedValueAsJson(sds output, const nhashValue &v) {
+    if (v.o != nullptr)
+        return writeNestedHashAsJson(output, v.o);
+    return writeJsonValue(output, v.str, v.len);
+}
+
 void nhsetCommand(client *c) {
     if (c->argc < 3)
         throw shared.syntaxerr;
@@ -379,11 +585,11 @@ void nhgetCommand(client *c) {
         }
     }
 
-    robj *o = fetchFromKey(c->db, c->argv[argOffset + 1]);
+    nhashValue v = fetchFromKey(c->db, c->argv[argOffset + 1]);
     if (fJson) {
-        sds val = writeNestedHashAsJson(sdsnew(nullptr), o);
+        sds val = writeNestedValueAsJson(sdsnew(nullptr), v);
         addReplyBulkSds(c, val);
     } else { 
-        writeNestedHashToClient(c, o);
+        writeNestedValueToClient(c, v);
     }
 }
\ No newline at end of file
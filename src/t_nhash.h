@@ -1,6 +1,18 @@
 #pragma once
 
+// What a nested hash path resolved to. Strings kept inline in a listpack
+// bucket have no object of their own, so they come back as a buffer pointing
+// into the bucket, valid until it is modified.
+struct nhashValue {
+    robj *o = nullptr;              // A bucket, list or string object...
+    const char *str = nullptr;      // ...or a string stored inline in a bucket
+    size_t len = 0;
+};
+
+robj *createNestHashBucket();
 void freeNestedHashObject(robj_roptr o);
+nhashValue fetchFromKey(redisDb *db, robj_roptr key);
+bool setWithKey(redisDb *db, robj_roptr key, robj *val, bool fCreateBuckets);
 
 void nhsetCommand(client *c);
 void nhgetCommand(client *c);
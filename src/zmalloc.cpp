@@ -44,6 +44,16 @@ extern "C" void zlibc_free(void *ptr) {
 
 #include <string.h>
 #include <pthread.h>
+#ifdef REDIS_TEST
+/* Before zmalloc.h, its __str macro trips over libstdc++ */
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#endif
 #include "config.h"
 #include "zmalloc.h"
 #include "atomicvar.h"
@@ -126,9 +136,52 @@ void *ztrymalloc_usable(size_t size, size_t *usable) {
 #endif
 }
 
+#if defined(USE_JEMALLOC)
+/* Arena used for MALLOC_SHARED allocations (robj headers, dict entries and the
+ * like that live in the keyspace), -1 when they just use the calling thread's
+ * arena.  Each thread uses its own explicit tcache for these so they don't mix
+ * with the thread's short lived allocations. */
+static int keyspace_arena = -1;
+
+struct KeyspaceTcache {
+    int tcache = -1;
+    ~KeyspaceTcache() {
+        /* Threads come and go (defrag workers, module threads), give the slot back */
+        if (tcache >= 0) {
+            unsigned utcache = (unsigned)tcache;
+            mallctl("tcache.destroy", NULL, NULL, &utcache, sizeof(utcache));
+        }
+    }
+};
+static thread_local KeyspaceTcache keyspace_tcache;
+
+static int zmalloc_keyspace_flags() {
+    if (keyspace_tcache.tcache < 0) {
+        unsigned tcache;
+        size_t sz = sizeof(tcache);
+        if (mallctl("tcache.create", &tcache, &sz, NULL, 0) == 0)
+            keyspace_tcache.tcache = (int)tcache;
+    }
+    int flags = MALLOCX_ARENA(keyspace_arena);
+    return flags | (keyspace_tcache.tcache >= 0 ? MALLOCX_TCACHE(keyspace_tcache.tcache) : MALLOCX_TCACHE_NONE);
+}
+
+static void *ztrymalloc_class(size_t size, enum MALLOC_CLASS mclass, int zero) {
+    if (mclass != MALLOC_SHARED || keyspace_arena < 0)
+        return zero ? ztrycalloc_usable(size, NULL) : ztrymalloc_usable(size, NULL);
+    void *ptr = mallocx(MALLOC_MIN_SIZE(size), zmalloc_keyspace_flags() | (zero ? MALLOCX_ZERO : 0));
+    if (ptr != NULL) update_zmalloc_stat_alloc(zmalloc_size(ptr));
+    return ptr;
+}
+#else
+static void *ztrymalloc_class(size_t size, enum MALLOC_CLASS /*mclass*/, int zero) {
+    return zero ? ztrycalloc_usable(size, NULL) : ztrymalloc_usable(size, NULL);
+}
+#endif
+
 /* Allocate memory or panic */
-void *zmalloc(size_t size, enum MALLOC_CLASS /*mclass*/) {
-    void *ptr = ztrymalloc_usable(size, NULL);
+void *zmalloc(size_t size, enum MALLOC_CLASS mclass) {
+    void *ptr = ztrymalloc_class(size, mclass, 0);
     if (!ptr) zmalloc_oom_handler(size);
     return ptr;
 }
@@ -187,8 +240,8 @@ void *ztrycalloc_usable(size_t size, size_t *usable) {
 }
 
 /* Allocate memory and zero it or panic */
-void *zcalloc(size_t size, enum MALLOC_CLASS /*mclass*/) {
-    void *ptr = ztrycalloc_usable(size, NULL);
+void *zcalloc(size_t size, enum MALLOC_CLASS mclass) {
+    void *ptr = ztrymalloc_class(size, mclass, 1);
     if (!ptr) zmalloc_oom_handler(size);
     return ptr;
 }
@@ -258,7 +311,19 @@ void *ztryrealloc_usable(void *ptr, size_t size, size_t *usable) {
 }
 
 /* Reallocate memory and zero it or panic */
-void *zrealloc(void *ptr, size_t size, enum MALLOC_CLASS /*mclass*/) {
+void *zrealloc(void *ptr, size_t size, enum MALLOC_CLASS mclass) {
+#if defined(USE_JEMALLOC)
+    if (mclass == MALLOC_SHARED && keyspace_arena >= 0 && ptr != NULL && size != 0) {
+        size_t oldsize = zmalloc_size(ptr);
+        void *newptr = rallocx(ptr, size, zmalloc_keyspace_flags());
+        if (!newptr) zmalloc_oom_handler(size);
+        update_zmalloc_stat_free(oldsize);
+        update_zmalloc_stat_alloc(zmalloc_size(newptr));
+        return newptr;
+    }
+#else
+    (void)mclass;
+#endif
     ptr = ztryrealloc_usable(ptr, size, NULL);
     if (!ptr && size != 0) zmalloc_oom_handler(size);
     return ptr;
@@ -528,6 +593,96 @@ int jemalloc_purge() {
     return -1;
 }
 
+/* Arenas we created ourselves, kept so INFO and MEMORY MALLOC-STATS can tell
+ * which thread (or the keyspace) an arena index belongs to. */
+#define ZMALLOC_MAX_ARENA_LABELS 256
+static struct {
+    unsigned arena;
+    char label[32];
+} arena_labels[ZMALLOC_MAX_ARENA_LABELS];
+static unsigned arena_label_count = 0;
+static pthread_mutex_t arena_label_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int zmalloc_create_arena(const char *label) {
+    unsigned arena;
+    size_t sz = sizeof(arena);
+    if (mallctl("arenas.create", &arena, &sz, NULL, 0))
+        return -1;
+    pthread_mutex_lock(&arena_label_mutex);
+    if (arena_label_count < ZMALLOC_MAX_ARENA_LABELS) {
+        arena_labels[arena_label_count].arena = arena;
+        snprintf(arena_labels[arena_label_count].label, sizeof(arena_labels[0].label), "%s", label);
+        ++arena_label_count;
+    }
+    pthread_mutex_unlock(&arena_label_mutex);
+    return (int)arena;
+}
+
+/* Create a new arena and make it the default one for the calling thread, so
+ * memory allocated by different event loops / background threads doesn't share
+ * arena bins.  Returns the arena index or -1 on error. */
+int zmalloc_thread_arena_bind(const char *label) {
+    int arena = zmalloc_create_arena(label);
+    if (arena < 0)
+        return -1;
+    unsigned uarena = (unsigned)arena;
+    if (mallctl("thread.arena", NULL, NULL, &uarena, sizeof(uarena)))
+        return -1;
+    return arena;
+}
+
+/* Route MALLOC_SHARED allocations to a dedicated arena.  Must be called before
+ * any MALLOC_SHARED allocation that may later be realloc'd with the keyspace
+ * flags is made by another thread, i.e. during startup. */
+int zmalloc_keyspace_arena_enable(void) {
+    if (keyspace_arena >= 0)
+        return keyspace_arena;
+    keyspace_arena = zmalloc_create_arena("keyspace");
+    return keyspace_arena;
+}
+
+/* Number of arenas registered via the functions above */
+unsigned zmalloc_arena_count(void) {
+    pthread_mutex_lock(&arena_label_mutex);
+    unsigned count = arena_label_count;
+    pthread_mutex_unlock(&arena_label_mutex);
+    return count;
+}
+
+/* Stats of the idx'th registered arena, the caller is expected to refresh the
+ * jemalloc epoch first (zmalloc_get_allocator_info() does that). */
+int zmalloc_get_arena_info(unsigned idx, struct zmalloc_arena_info *info) {
+    char tmp[64];
+    size_t sz, small = 0, large = 0, pactive = 0, pdirty = 0, page = 0;
+
+    pthread_mutex_lock(&arena_label_mutex);
+    if (idx >= arena_label_count) {
+        pthread_mutex_unlock(&arena_label_mutex);
+        return 0;
+    }
+    info->arena = arena_labels[idx].arena;
+    snprintf(info->label, sizeof(info->label), "%s", arena_labels[idx].label);
+    pthread_mutex_unlock(&arena_label_mutex);
+
+    sz = sizeof(size_t);
+    mallctl("arenas.page", &page, &sz, NULL, 0);
+    snprintf(tmp, sizeof(tmp), "stats.arenas.%u.small.allocated", info->arena);
+    mallctl(tmp, &small, &sz, NULL, 0);
+    snprintf(tmp, sizeof(tmp), "stats.arenas.%u.large.allocated", info->arena);
+    mallctl(tmp, &large, &sz, NULL, 0);
+    snprintf(tmp, sizeof(tmp), "stats.arenas.%u.pactive", info->arena);
+    mallctl(tmp, &pactive, &sz, NULL, 0);
+    snprintf(tmp, sizeof(tmp), "stats.arenas.%u.pdirty", info->arena);
+    mallctl(tmp, &pdirty, &sz, NULL, 0);
+    snprintf(tmp, sizeof(tmp), "stats.arenas.%u.resident", info->arena);
+    info->resident = 0;
+    mallctl(tmp, &info->resident, &sz, NULL, 0);
+    info->allocated = small + large;
+    info->active = pactive * page;
+    info->dirty = pdirty * page;
+    return 1;
+}
+
 #else
 
 int zmalloc_get_allocator_info(size_t *allocated,
@@ -545,6 +700,25 @@ int jemalloc_purge() {
     return 0;
 }
 
+int zmalloc_thread_arena_bind(const char *label) {
+    ((void)(label));
+    return -1;
+}
+
+int zmalloc_keyspace_arena_enable(void) {
+    return -1;
+}
+
+unsigned zmalloc_arena_count(void) {
+    return 0;
+}
+
+int zmalloc_get_arena_info(unsigned idx, struct zmalloc_arena_info *info) {
+    ((void)(idx));
+    ((void)(info));
+    return 0;
+}
+
 #endif
 
 #if defined(__APPLE__)
@@ -692,12 +866,81 @@ size_t zmalloc_get_memory_size(void) {
 
 #ifdef REDIS_TEST
 #define UNUSED(x) ((void)(x))
+
+/* Mimics the server: several threads allocate, keep part of what they allocate
+ * (the keyspace) and hand the rest to a single thread to free (lazyfree/GC). */
+static void zmalloc_arena_bench(int cthreads, long count, bool thread_arenas) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::vector<void*>> queue;
+    bool done = false;
+    std::vector<std::vector<void*>> kept(cthreads);
+
+    std::thread freer([&]{
+        if (thread_arenas) zmalloc_thread_arena_bind("bench-freer");
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            while (queue.empty() && !done) cv.wait(lock);
+            if (queue.empty()) break;
+            std::vector<void*> batch = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            for (void *ptr : batch) zfree(ptr);
+            lock.lock();
+        }
+    });
+
+    size_t allocated0, active0, resident0;
+    zmalloc_get_allocator_info(&allocated0, &active0, &resident0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int ithread = 0; ithread < cthreads; ++ithread) {
+        threads.emplace_back([&, ithread]{
+            if (thread_arenas) zmalloc_thread_arena_bind("bench-worker");
+            unsigned seed = ithread;
+            std::vector<void*> batch;
+            for (long i = 0; i < count; ++i) {
+                void *ptr = zmalloc(16 + rand_r(&seed) % 496, MALLOC_SHARED);
+                if ((i % 4) == 0) {
+                    kept[ithread].push_back(ptr);
+                    continue;
+                }
+                batch.push_back(ptr);
+                if (batch.size() == 256) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    queue.push_back(std::move(batch));
+                    cv.notify_one();
+                    batch.clear();
+                }
+            }
+            for (void *ptr : batch) zfree(ptr);
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done = true;
+        cv.notify_one();
+    }
+    freer.join();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    /* Only what this run added, the previous run may have left partly used slabs behind */
+    size_t allocated, active, resident;
+    zmalloc_get_allocator_info(&allocated, &active, &resident);
+    allocated -= std::min(allocated, allocated0);
+    active -= std::min(active, active0);
+    printf("%s arenas: %.2f M allocs/sec, frag ratio %.3f (active %zu / allocated %zu)\n",
+        thread_arenas ? "per-thread" : "shared", (double)(cthreads*count)/(elapsed ? elapsed : 1),
+        allocated ? (double)active/allocated : 0.0, active, allocated);
+    for (auto &vec : kept)
+        for (void *ptr : vec) zfree(ptr);
+}
+
 int zmalloc_test(int argc, char **argv, int accurate) {
     void *ptr;
 
-    UNUSED(argc);
     UNUSED(argv);
-    UNUSED(accurate);
     printf("Malloc prefix size: %d\n", (int) PREFIX_SIZE);
     printf("Initial used memory: %zu\n", zmalloc_used_memory());
     ptr = zmalloc(123);
@@ -706,6 +949,18 @@ int zmalloc_test(int argc, char **argv, int accurate) {
     printf("Reallocated to 456 bytes; used: %zu\n", zmalloc_used_memory());
     zfree(ptr);
     printf("Freed pointer; used: %zu\n", zmalloc_used_memory());
+
+#if defined(USE_JEMALLOC)
+    long count = accurate ? 2000000 : 200000;
+    if (argc == 4 && !accurate) count = strtol(argv[3], NULL, 10);
+    int cthreads = std::max(2U, std::thread::hardware_concurrency());
+    zmalloc_arena_bench(cthreads, count, false);
+    jemalloc_purge();
+    zmalloc_arena_bench(cthreads, count, true);
+#else
+    UNUSED(argc);
+    UNUSED(accurate);
+#endif
     return 0;
 }
 #endif
@@ -105,6 +105,15 @@
 extern "C" {
 #endif
 
+struct zmalloc_arena_info {
+    unsigned arena;
+    char label[32];
+    size_t allocated;   /* bytes handed out by the arena */
+    size_t active;      /* bytes in pages backing those allocations */
+    size_t dirty;       /* unused pages not yet returned to the OS */
+    size_t resident;
+};
+
 #ifdef __cplusplus
 void *zmalloc(size_t size, enum MALLOC_CLASS mclass = MALLOC_LOCAL);
 void *zcalloc(size_t size, enum MALLOC_CLASS mclass = MALLOC_LOCAL);
@@ -132,6 +141,10 @@ size_t zmalloc_get_rss(void);
 int zmalloc_get_allocator_info(size_t *allocated, size_t *active, size_t *resident);
 void set_jemalloc_bg_thread(int enable);
 int jemalloc_purge();
+int zmalloc_thread_arena_bind(const char *label);
+int zmalloc_keyspace_arena_enable(void);
+unsigned zmalloc_arena_count(void);
+int zmalloc_get_arena_info(unsigned idx, struct zmalloc_arena_info *info);
 size_t zmalloc_get_private_dirty(long pid);
 size_t zmalloc_get_smap_bytes_by_field(const char *field, long pid);
 size_t zmalloc_get_memory_size(void);
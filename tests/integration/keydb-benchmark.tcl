@@ -124,6 +124,145 @@ start_server {tags {"benchmark network"}} {
             assert_match  {50} [scan [regexp -inline {keys\=([\d]*)} [r info keyspace]] keys=%d]
         }
 
+        test {benchmark: workload spec} {
+            r flushall
+            r config resetstat
+            set spec [tmpfile "workload"]
+            set fd [open $spec w]
+            puts $fd "# hot keys, 3:1 reads"
+            puts $fd "keyspace 100"
+            puts $fd "keys zipf 0.99"
+            puts $fd "values uniform 5 50"
+            puts $fd "command 3 GET __key__"
+            puts $fd "command 1 SET __key__ __value__"
+            close $fd
+            set cmd [redisbenchmark $master_host $master_port "-c 4 -n 2000 --dbnum 9 --csv --workload $spec"]
+            if {[catch { exec {*}$cmd } output]} {
+                set first_line [lindex [split $output "\n"] 0]
+                puts [colorstr red "keydb-benchmark non zero code. first line: $first_line"]
+                fail "keydb-benchmark non zero code. first line: $first_line"
+            }
+            assert_match {*"get",*} $output
+            assert_match {*"set",*} $output
+            assert_match {*"ALL","2000",*} $output
+            set sets [scan [regexp -inline {calls=([\d]*)} [cmdstat set]] calls=%d]
+            set gets [scan [regexp -inline {calls=([\d]*)} [cmdstat get]] calls=%d]
+            assert_equal 2000 [expr {$sets + $gets}]
+            assert {$gets > $sets}
+            # zipf: the hottest rank is always written at some point
+            assert {[r dbsize] <= 100}
+            assert_equal 1 [r exists key:0]
+        }
+
+        test {benchmark: open-loop workload at a fixed rate} {
+            r flushall
+            set spec [tmpfile "workload"]
+            set fd [open $spec w]
+            puts $fd "command 1 INCR counter"
+            close $fd
+            set start [clock milliseconds]
+            set cmd [redisbenchmark $master_host $master_port "-c 2 -n 500 --rate 1000 --dbnum 9 --csv --workload $spec"]
+            if {[catch { exec {*}$cmd } output]} {
+                fail "keydb-benchmark non zero code: [lindex [split $output "\n"] 0]"
+            }
+            # 500 requests scheduled at 1000/sec can not finish much sooner than 0.5s
+            assert {[clock milliseconds] - $start >= 450}
+            assert_equal 500 [r get counter]
+        }
+
+        test {benchmark: open-loop rate sweep} {
+            r flushall
+            set cmd [redisbenchmark $master_host $master_port "-c 2 -t set -r 100 --dbnum 9 --csv --duration 0.4 --sweep 500:1000:500"]
+            if {[catch { exec {*}$cmd } output]} {
+                fail "keydb-benchmark non zero code: [lindex [split $output "\n"] 0]"
+            }
+            assert_match {*"test","target_rps","rps",*} $output
+            assert_match {*"SET","500",*} $output
+            assert_match {*"SET","1000",*} $output
+            # keys come from -r, not a single fixed key
+            assert {[r dbsize] > 1}
+        }
+
+        test {benchmark: replay MONITOR capture} {
+            r flushall
+            r config resetstat
+            set trace [tmpfile "trace"]
+            set fd [open $trace w]
+            puts $fd {1700000000.000000 [9 127.0.0.1:1111] "set" "a" "1"}
+            puts $fd {1700000000.000100 [0 127.0.0.1:2222] "select" "3"}
+            puts $fd {1700000000.000200 [3 127.0.0.1:2222] "rpush" "list" "x\x00y"}
+            puts $fd {1700000000.000300 [9 lua] "set" "fromscript" "1"}
+            puts $fd {1700000000.000400 [3 127.0.0.1:2222] "rpush" "list" "two words"}
+            puts $fd {1700000000.000500 [9 127.0.0.1:1111] "incr" "a"}
+            close $fd
+            set cmd [redisbenchmark $master_host $master_port "-c 3 --csv --replay $trace"]
+            if {[catch { exec {*}$cmd } output]} {
+                fail "keydb-benchmark non zero code: [lindex [split $output "\n"] 0]"
+            }
+            assert_match {*"ALL","4",*} $output
+            assert_equal 2 [r get a]
+            assert_equal 0 [r exists fromscript]
+            r select 3
+            assert_equal [list "x\x00y" "two words"] [r lrange list 0 -1]
+            r select 9
+        }
+
+        test {benchmark: replay a server command trace} {
+            r flushall
+            set trace [file join [lindex [r config get dir] 1] replay.ktrace]
+            file delete $trace
+            r config set command-trace-file $trace
+            r config set command-trace-args all
+            r config set command-trace yes
+            r set a 1
+            r rpush list "x\x00y" "two words"
+            r multi
+            r incr a
+            r exec
+            r eval {redis.call('incr','a')} 0
+            r config set command-trace no
+            r config set command-trace-args keys
+            r flushall
+
+            set cmd [redisbenchmark $master_host $master_port "-c 2 --csv --replay $trace"]
+            if {[catch { exec {*}$cmd } output]} {
+                fail "keydb-benchmark non zero code: [lindex [split $output "\n"] 0]"
+            }
+            file delete $trace
+            assert_equal 3 [r get a]
+            assert_equal [list "x\x00y" "two words"] [r lrange list 0 -1]
+        }
+
+        test {benchmark: replay a server command trace in time order} {
+            # The writer drains the thread rings in chunks, write two chunks
+            # the way it would with the later one first
+            proc trace_record {ts client args} {
+                set body "rpush"
+                foreach arg $args {
+                    append body [binary format i [string length $arg]] $arg
+                }
+                set len [expr {40 + [string length $body]}]
+                return [binary format isswwiissscc $len 1 9 $ts $client 0 0 0 [expr {[llength $args]+1}] 0 5 0]$body
+            }
+            set trace [file join [lindex [r config get dir] 1] replay-order.ktrace]
+            set fd [open $trace w]
+            fconfigure $fd -translation binary
+            puts -nonewline $fd [binary format a8iiw KDBTRACE 1 24 0]
+            puts -nonewline $fd [trace_record 1000002 2 order 2]
+            puts -nonewline $fd [trace_record 1000004 2 order 4]
+            puts -nonewline $fd [trace_record 1000001 1 order 1]
+            puts -nonewline $fd [trace_record 1000003 1 order 3]
+            close $fd
+            r flushall
+
+            set cmd [redisbenchmark $master_host $master_port "-c 1 --csv --replay $trace"]
+            if {[catch { exec {*}$cmd } output]} {
+                fail "keydb-benchmark non zero code: [lindex [split $output "\n"] 0]"
+            }
+            file delete $trace
+            assert_equal {1 2 3 4} [r lrange order 0 -1]
+        }
+
         # tls specific tests
         if {$::tls} {
             test {benchmark: specific tls-ciphers} {
@@ -214,6 +214,29 @@ test {repeated load} {
     }
 }
 
+test {RDB compression algorithms round trip} {
+    start_server {} {
+        r debug populate 1000 key 100
+        r set text [string repeat "the quick brown fox jumps over the lazy dog " 200]
+        r set incompressible [string repeat "a1b2" 3]
+        r hset hash field [string repeat "x" 200]
+        for {set j 0} {$j < 200} {incr j} {
+            r rpush list [string repeat "item:$j " 10]
+        }
+        set digest [r debug digest]
+        foreach algorithm {lzf lz4 zstd} {
+            if {[catch {r config set rdb-compression-algorithm $algorithm} err]} {
+                # lz4 and zstd are optional build features
+                assert_match {*compiled without support*} $err
+                continue
+            }
+            assert_equal $algorithm [lindex [r config get rdb-compression-algorithm] 1]
+            r debug reload
+            assert_equal $digest [r debug digest]
+        }
+    }
+}
+
 # Our COW metrics (Private_Dirty) work only on Linux
 set system_name [string tolower [exec uname -s]]
 if {$system_name eq {linux}} {
@@ -229,3 +229,54 @@ start_server {tags {"repl"}} {
         }
     }
 }
+
+start_server {tags {"repl"} overrides {repl-diskless-sync no}} {
+    # The first of lz4 / zstd this build supports, if any
+    set algorithm {}
+    foreach candidate {lz4 zstd} {
+        if {![catch {r config set rdb-compression-algorithm $candidate}]} {
+            set algorithm $candidate
+            break
+        }
+    }
+
+    if {$algorithm ne {}} {
+        r set compressed-key [string repeat "abcdefgh" 100]
+
+        test "Full sync falls back to LZF for replicas without rdb-$algorithm" {
+            # A bare SYNC announces no capabilities, like an older replica
+            set s [socket [srv 0 host] [srv 0 port]]
+            fconfigure $s -translation binary
+            puts -nonewline $s "SYNC\r\n"
+            flush $s
+            while {[set count [gets $s]] eq {}} {}
+            assert_match {$*} $count
+            set count [string range $count 1 end]
+            set payload {}
+            while {[string length $payload] < $count} {
+                append payload [read $s [expr {$count-[string length $payload]}]]
+            }
+            close $s
+
+            # string type, key length, key, then the value encoding: 0xc3 is
+            # an LZF compressed string
+            set idx [string first "[binary format cc 0 14]compressed-key" $payload]
+            assert {$idx >= 0}
+            binary scan [string index $payload [expr {$idx+16}]] cu enc
+            assert_equal [expr 0xc3] $enc
+        }
+
+        start_server {} {
+            test "Full sync uses $algorithm with replicas announcing it" {
+                r replicaof [srv -1 host] [srv -1 port]
+                wait_for_condition 50 100 {
+                    [s master_link_status] eq {up}
+                } else {
+                    fail "Replica didn't sync"
+                }
+                assert_equal [r -1 debug digest] [r debug digest]
+                assert_equal [string repeat "abcdefgh" 100] [r get compressed-key]
+            }
+        }
+    }
+}
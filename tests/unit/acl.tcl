@@ -81,6 +81,23 @@ start_server {tags {"acl"}} {
         set e
     } {*NOPERM*key*}
 
+    test {Key patterns mixing literals, prefixes and globs are all honored} {
+        r ACL setuser newuser allcommands resetkeys ~exact ~pre:* ~g?b:\[xy\]* ~esc\\*
+        r SET exact 1
+        r SET pre:any:thing 1
+        r SET gab:y1 1
+        r SET esc* 1
+        foreach key {exac exact2 pre gab:z1 gb:x esca} {
+            assert_error {*NOPERM*key*} [list r SET $key 1]
+        }
+        # Changing the patterns must be taken into account right away
+        r ACL setuser newuser ~other
+        r SET other 1
+        r ACL setuser newuser resetkeys ~other
+        assert_error {*NOPERM*key*} {r SET exact 1}
+        r ACL setuser newuser allkeys; # Undo keys ACL
+    }
+
     test {By default users are able to publish to any channel} {
         r ACL setuser psuser on >pspass +acl +client +@pubsub
         r AUTH psuser pspass
@@ -629,3 +646,48 @@ start_server {overrides {user "default on nopass ~* +@all"}} {
         r PUBLISH hello world
     }
 }
+
+start_server {tags {"acl"} overrides {server-threads 2 enable-async-commands yes}} {
+    test {Revoked key patterns stay revoked while async reads check them} {
+        # Plenty of glob patterns so building the matcher takes a while
+        set globs {}
+        for {set j 0} {$j < 200} {incr j} {
+            lappend globs "~g$j:?\[ab\]*"
+        }
+        r ACL setuser reader on nopass +get resetkeys ~pub:* {*}$globs
+        r SET pub:1 a
+        r SET secret b
+        set clients {}
+        for {set j 0} {$j < 4} {incr j} {
+            set rd [redis_deferring_client]
+            $rd AUTH reader anypass
+            $rd read
+            lappend clients $rd
+        }
+        for {set round 0} {$round < 50} {incr round} {
+            r ACL setuser reader ~secret
+            foreach rd $clients {
+                for {set k 0} {$k < 20} {incr k} {
+                    $rd GET pub:1
+                    $rd GET secret
+                }
+            }
+            # Revoke while the reads above are still being checked
+            r ACL setuser reader resetkeys ~pub:* {*}$globs
+            foreach rd $clients {
+                for {set k 0} {$k < 40} {incr k} {
+                    catch {$rd read}
+                }
+            }
+            foreach rd $clients {
+                $rd GET secret
+                assert_error {*NOPERM*key*} {$rd read}
+                $rd GET pub:1
+                assert_equal a [$rd read]
+            }
+        }
+        foreach rd $clients {
+            $rd close
+        }
+    }
+}
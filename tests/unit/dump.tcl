@@ -93,6 +93,23 @@ start_server {tags {"dump"}} {
         set e
     } {*syntax*}
 
+    test {DUMP / RESTORE checksum covers payloads of every size} {
+        foreach size {1 15 16 63 64 65 127 1000 8191 8192 70001} {
+            r set foo [string repeat "ab\x00\xff" [expr {($size+3)/4}]]
+            set value [r get foo]
+            set encoded [r dump foo]
+            r del foo
+            assert_equal OK [r restore foo 0 $encoded]
+            assert_equal $value [r get foo]
+            # Flipping a byte of the value must be caught by the CRC64
+            set pos [expr {[string length $encoded]/2}]
+            set byte [scan [string index $encoded $pos] %c]
+            set corrupted [string replace $encoded $pos $pos [format %c [expr {$byte ^ 1}]]]
+            r del foo
+            assert_error {*payload version or checksum*} {r restore foo 0 $corrupted}
+        }
+    }
+
     test {DUMP of non existing key returns nil} {
         r dump nonexisting_key
     } {}
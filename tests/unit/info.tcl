@@ -172,4 +172,242 @@ start_server {tags {"info"}} {
             assert_match {*cmdstat_host_:calls=1*} $info
         }
     }
+
+    start_server {overrides {use-fork no}} {
+        test {Snapshot consolidation stats are reported in INFO keydb} {
+            r config resetstat
+            assert_equal [s snapshot_consolidations] 0
+            r debug populate 1000
+            r bgsave
+            waitForBgsave r
+            wait_for_condition 50 100 {
+                [s snapshot_consolidations] > 0
+            } else {
+                fail "snapshot was never consolidated"
+            }
+            assert_equal [s mvcc_depth] 0
+            assert_equal [s snapshot_tombstones] 0
+            assert {[s snapshot_consolidation_max_usec] <= [s snapshot_consolidation_usec]}
+        }
+
+        test {Tombstones of a large snapshot are applied in batches before the merge} {
+            r flushall
+            r config resetstat
+            r config set snapshot-consolidation-sync-limit 1000
+            r debug populate 20000
+            r config set rdb-key-save-delay 100
+            r bgsave
+            # Deleted while the save holds the snapshot, so each one leaves a tombstone
+            r eval {for i=0,9999 do redis.call('del','key:'..i) end} 0
+            r config set rdb-key-save-delay 0
+            waitForBgsave r
+            wait_for_condition 50 100 {
+                [s snapshot_tombstones] == 0
+            } else {
+                fail "snapshot was never consolidated"
+            }
+            assert_equal 10000 [s snapshot_tombstones_incremental]
+            assert_equal 10000 [r dbsize]
+            assert_equal 0 [r exists key:0]
+            assert_equal 1 [r exists key:10000]
+            r config set snapshot-consolidation-sync-limit 100000
+        }
+    }
+
+    start_server {overrides {jemalloc-thread-arenas yes jemalloc-keyspace-arena yes}} {
+        test {Dedicated allocator arenas are reported in INFO memory} {
+            if {[string match {*jemalloc*} [s mem_allocator]]} {
+                r debug populate 10000
+                r hset myhash field value
+                assert_equal [r hget myhash field] value
+                set info [r info memory]
+                assert_match {*allocator_arena_*:label=keyspace,allocated=*} $info
+                assert_match {*allocator_arena_*:label=server-thread-0,*} $info
+                assert_match {*label=bio-*} $info
+                assert_match {*KeyDB arena bindings*keyspace*} [r memory malloc-stats]
+                r flushall
+                assert_equal [r dbsize] 0
+            }
+        }
+    }
+
+    start_server {} {
+        test {INFO threads reports event loop phase breakdown} {
+            r set foo bar
+            r get foo
+            after 200
+            set info [r info threads]
+            assert_match {*thread_0:loops=*,busy_pct=*} $info
+            assert_match {*thread_0_phase_poll:calls=*,usec=*,usec_per_call=*,p99_usec=*,max_usec=*} $info
+            assert_match {*thread_0_phase_before_sleep:*} $info
+            assert_match {*thread_0_phase_process_clients:*} $info
+            assert_match {*thread_0_phase_file_events:*} $info
+            regexp {thread_0:loops=(\d+),busy_pct=([0-9.]+)} $info -> loops busy
+            assert {$loops > 0}
+            assert {$busy >= 0 && $busy <= 100}
+            # the section is only emitted on request or with INFO ALL
+            assert_no_match {*thread_0:loops*} [r info]
+            assert_match {*thread_0:loops*} [r info all]
+        }
+
+        test {INFO stats reports global lock acquisitions per command} {
+            r config resetstat
+            for {set j 0} {$j < 10} {incr j} {
+                r ping
+            }
+            assert {[status r global_lock_acquisitions] > 0}
+            assert {[status r lock_acquisitions_per_command] > 0}
+        }
+
+        test {Recycled command arguments keep their values} {
+            r config resetstat
+            set rd [redis_deferring_client]
+            # Every length up to past the EMBSTR limit, so pooled objects of
+            # every size class get reused for shorter and longer arguments
+            for {set len 0} {$len <= 60} {incr len} {
+                $rd set argvpool:$len [string repeat [format %c [expr {65 + $len % 26}]] $len]
+                $rd get argvpool:[expr {60 - $len}]
+            }
+            for {set len 0} {$len <= 60} {incr len} {$rd read; $rd read}
+            $rd close
+            for {set len 0} {$len <= 60} {incr len} {
+                assert_equal [string repeat [format %c [expr {65 + $len % 26}]] $len] [r get argvpool:$len]
+            }
+            assert {[status r argv_pool_hits] > 0}
+            r config resetstat
+            assert {[status r argv_pool_hits] < 10}
+        }
+
+        test {INFO threads is cleared by CONFIG RESETSTAT} {
+            r config resetstat
+            set info [r info threads]
+            regexp {thread_0_phase_poll:calls=(\d+)} $info -> calls
+            assert {$calls < 10}
+        }
+    }
+
+    start_server {overrides {server-threads 2 thread-rebalance yes thread-rebalance-threshold 1}} {
+        test {Thread rebalance stats are reported and reset} {
+            assert_match {*thread_rebalance_cycles:*thread_migrations:*} [r info keydb]
+            r config resetstat
+            assert_equal 0 [status r thread_migrations]
+        }
+
+        # server-threads is truncated to the core count
+        if {[status r server_threads] > 1} {
+            test {Busy clients are migrated to an idle thread} {
+                set rd1 [redis_client]
+                set rd2 [redis_client]
+                wait_for_condition 100 100 {
+                    [$rd1 incr counter] > 0 && [$rd2 incr counter] > 0 &&
+                    [status r thread_migrations] > 0
+                } else {
+                    fail "No client was migrated: [r info threads]"
+                }
+                assert {[status r thread_rebalance_cycles] > 0}
+                # migrated clients keep their state and keep working
+                $rd1 select 5
+                $rd1 set foo bar
+                for {set j 0} {$j < 20} {incr j} {
+                    $rd1 incr counter
+                    $rd2 incr counter
+                    after 50
+                }
+                assert_equal bar [$rd1 get foo]
+                assert_equal {} [$rd2 get foo]
+                assert_match {*thread_0:*,clients=*,load_pct=*} [r info threads]
+                $rd1 close
+                $rd2 close
+            }
+
+            test {Lock batches are bounded by lock-batch-max-commands} {
+                r config set lock-batch-max-commands 10
+                r config resetstat
+                r del counter
+                set rd [redis_deferring_client]
+                for {set i 0} {$i < 1000} {incr i} {
+                    $rd incr counter
+                }
+                $rd flush
+                for {set i 0} {$i < 1000} {incr i} {
+                    assert_equal [expr {$i+1}] [$rd read]
+                }
+                $rd close
+                assert {[status r lock_batches_truncated] > 0}
+                assert {[status r lock_batch_commands] >= 1000}
+                r config set lock-batch-max-commands 0
+            }
+
+            test {Lock batches run at least one command with lock-batch-max-usec 1} {
+                # The deadline passes before most commands start, each batch
+                # must still make progress or the client is never served
+                r config set lock-batch-max-usec 1
+                r config resetstat
+                r del counter
+                set rd [redis_deferring_client]
+                for {set i 0} {$i < 1000} {incr i} {
+                    $rd incr counter
+                }
+                $rd flush
+                for {set i 0} {$i < 1000} {incr i} {
+                    assert_equal [expr {$i+1}] [$rd read]
+                }
+                $rd close
+                # A batch cut short without running anything isn't counted in
+                # lock_batches but still is in lock_batches_truncated
+                assert {[status r lock_batches_truncated] > 0}
+                assert {[status r lock_batches_truncated] <= [status r lock_batches]}
+                assert {[status r lock_batch_commands] >= 1000}
+                r config set lock-batch-max-usec 0
+            }
+        }
+    }
+
+    start_server {overrides {server-threads 3}} {
+        # Clients are spread over the threads other than the main one, so
+        # two of them are needed to keep one waiting on the other's lock
+        if {[status r server_threads] > 2} {
+            test {Clients keep being served while waiting for the global lock} {
+                r config set lock-wait-io-rounds 16
+                r config resetstat
+                r del counter
+                # DEBUG SLEEP holds the global lock on its thread while the
+                # clients of the other thread send their requests
+                set sleeper [redis_deferring_client]
+                set clients {}
+                for {set j 0} {$j < 16} {incr j} {
+                    lappend clients [redis_deferring_client]
+                }
+                $sleeper debug sleep 1
+                after 100
+                foreach rd $clients {
+                    for {set i 0} {$i < 250} {incr i} {
+                        $rd incr counter
+                    }
+                    $rd flush
+                }
+                assert_equal OK [$sleeper read]
+                foreach rd $clients {
+                    for {set i 0} {$i < 250} {incr i} {
+                        $rd read
+                    }
+                    $rd close
+                }
+                $sleeper close
+                assert_equal 4000 [r get counter]
+
+                # The waiting thread kept reading and parsing while the lock
+                # was held...
+                set calls 0
+                foreach {-> c} [regexp -all -inline {thread_\d+_phase_lock_wait_io:calls=(\d+)} [r info threads]] {
+                    incr calls $c
+                }
+                assert {$calls > 0}
+                # ...so the queued requests ran in large batches once it was free
+                assert {[status r lock_batch_commands] >= 4000}
+                assert {[status r lock_batch_commands] / [status r lock_batches] > 50}
+                r config set lock-wait-io-rounds 0
+            }
+        }
+    }
 }
@@ -77,6 +77,42 @@ start_server {tags {"introspection"}} {
         $rd close
     }
 
+    test {Command trace records executed commands} {
+        set tracefile [file join [lindex [r config get dir] 1] introspection.ktrace]
+        file delete $tracefile
+        r config set command-trace-file $tracefile
+        r config set command-trace-args all
+        r config set command-trace yes
+        r set tracekey tracevalue
+        r incr tracecounter
+        r config set command-trace no
+
+        set fd [open $tracefile rb]
+        set data [read $fd]
+        close $fd
+        file delete $tracefile
+        assert_equal KDBTRACE [string range $data 0 7]
+        binary scan $data @12i hdrlen
+
+        # Walk the records: len flags db ts client duration reply thread argc nkeys cmdlen
+        set off $hdrlen
+        set records {}
+        while {$off < [string length $data]} {
+            binary scan $data @${off}iususwwiiusususcu \
+                len flags db ts id duration reply thread argc nkeys cmdlen
+            set name [string range $data [expr {$off+40}] [expr {$off+40+$cmdlen-1}]]
+            lappend records [list $name $argc $nkeys $reply [expr {$flags & 1}]]
+            incr off $len
+        }
+        assert_equal $off [string length $data]
+        assert_equal {set 3 1 5 1} [lsearch -inline -index 0 $records set]
+        assert_equal {incr 2 1 4 1} [lsearch -inline -index 0 $records incr]
+        # CONFIG is administrative, its arguments are never written
+        assert_equal 0 [lindex [lsearch -inline -index 0 $records config] 4]
+        assert {[status r command_trace_records] >= 3}
+        r config set command-trace-args keys
+    }
+
     test {CLIENT GETNAME should return NIL if name is not assigned} {
         r client getname
     } {}
@@ -161,6 +197,8 @@ start_server {tags {"introspection"}} {
             bio_cpulist
             aof_rewrite_cpulist
             time-thread-priority
+            jemalloc-thread-arenas
+            jemalloc-keyspace-arena
             bgsave_cpulist
 	    storage-cache-mode
 	    storage-provider-options
@@ -172,6 +210,7 @@ start_server {tags {"introspection"}} {
             repl-backlog-disk-reserve
 	    tls-allowlist
             db-s3-object
+            command-trace-buffer-size
         }
 
         if {!$::tls} {
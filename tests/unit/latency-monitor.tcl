@@ -72,6 +72,63 @@ start_server {tags {"latency-monitor"}} {
         assert_match {*expire-cycle*} [r latency latest]
     }
 
+    test {LATENCY HISTOGRAM reports the calls of the given commands} {
+        r config resetstat
+        for {set j 0} {$j < 10} {incr j} {
+            r set foo bar
+        }
+        r get foo
+        set res [r latency histogram set get blabla]
+        assert_equal [llength $res] 4
+        set histo [dict get $res set]
+        assert_equal [dict get $histo calls] 10
+        # The distribution is cumulative, its last bucket holds every call.
+        assert_equal [lindex [dict get $histo histogram_usec] end] 10
+        assert_equal [dict get [dict get $res get] calls] 1
+    }
+
+    test {INFO latencystats reports command percentiles and phases} {
+        set info [r info latencystats]
+        assert_match {*latency_percentiles_usec_set:p50=*,p99=*,p99.9=*,count=10*} $info
+        assert_match {*latency_phase_usec_execute:*} $info
+        assert_match {*latency_phase_usec_queue:*} $info
+        r config resetstat
+        assert_no_match {*latency_percentiles_usec_set:*} [r info latencystats]
+        assert_equal [r latency histogram set] {}
+        # The samples from before the reset are gone once recording resumes
+        r set foo bar
+        assert_equal [dict get [dict get [r latency histogram set] set] calls] 1
+        assert_match {*latency_percentiles_usec_set:*count=1*} [r info latencystats]
+        r config resetstat
+    }
+
+    test {latency-tracking can be disabled} {
+        r config set latency-tracking no
+        r set foo bar
+        assert_equal [r latency histogram set] {}
+        r config set latency-tracking yes
+    }
+
+    test {LATENCY LOCKSTATS attributes global lock holds to call sites} {
+        r latency lockstats reset
+        for {set j 0} {$j < 10} {incr j} {
+            r set foo bar
+        }
+        set sites [r latency lockstats 1000]
+        assert {[llength $sites] > 0}
+        set acquisitions 0
+        foreach site $sites {
+            assert_match {* (*:*)} [dict get $site site]
+            assert {[dict get $site contended] <= [dict get $site acquisitions]}
+            assert {[dict get $site wait_p50_usec] <= [dict get $site wait_p99_usec]}
+            assert {[dict get $site hold_p50_usec] <= [dict get $site hold_p99_usec]}
+            incr acquisitions [dict get $site acquisitions]
+        }
+        assert {$acquisitions >= 10}
+        assert_equal 1 [llength [r latency lockstats 1]]
+        assert_error {*value is out of range*} {r latency lockstats 0}
+    }
+
     test {LATENCY HELP should not have unexpected options} {
         catch {r LATENCY help xxx} e
         assert_match "*Unknown subcommand or wrong number of arguments*" $e
@@ -587,5 +587,56 @@ start_server {tags {"defrag"} overrides {server-threads 1 active-replica yes} }
         } {OK}
     }
 }
+start_server {tags {"defrag"} overrides {server-threads 1 active-defrag-threads 4 save ""} } { ;#test defrag with the main dictionary scanned by several threads
+    if {[string match {*jemalloc*} [s mem_allocator]] && [r debug mallctl arenas.page] <= 8192} {
+
+        test "Active defrag with parallel threads" {
+            r config set hz 100
+            r config set activedefrag no
+            r config set active-defrag-threshold-lower 5
+            r config set active-defrag-cycle-min 65
+            r config set active-defrag-cycle-max 75
+            r config set active-defrag-ignore-bytes 2mb
+            r config set maxmemory 100mb
+            r config set maxmemory-policy allkeys-lru
+            for {set i 0} {$i < 10} {incr i} {
+                populate 700000 asdf1 150
+                populate 170000 asdf2 300
+                r ping ;# trigger eviction following the previous population
+                after 120 ;# serverCron only updates the info once in 100ms
+                set frag [s allocator_frag_ratio]
+                if {$frag >= 1.4} {break}
+            }
+            assert {$frag >= 1.4}
+
+            r config set maxmemory 110mb ;# prevent further eviction (not to fail the digest test)
+            set digest [r debug digest]
+            catch {r config set activedefrag yes} e
+            if {[r config get activedefrag] eq "activedefrag yes"} {
+                wait_for_condition 50 100 {
+                    [s active_defrag_running] ne 0
+                } else {
+                    fail "defrag not started."
+                }
+                # Let the threads move a good share of the keyspace around
+                wait_for_condition 150 100 {
+                    [s active_defrag_key_hits] > 100000
+                } else {
+                    fail "parallel defrag made no progress."
+                }
+                r config set activedefrag no
+                if {$::verbose} {
+                    puts "frag [s allocator_frag_ratio]"
+                    puts "hits: [s active_defrag_hits]"
+                    puts "misses: [s active_defrag_misses]"
+                }
+            }
+            # verify the data isn't corrupted or changed
+            set newdigest [r debug digest]
+            assert {$digest eq $newdigest}
+            r save ;# saving an rdb iterates over all the data / pointers
+        } {OK}
+    }
+}
 } ;# run solo
 
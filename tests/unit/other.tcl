@@ -374,3 +374,91 @@ start_server {tags {"other"}} {
         }
     }
 }
+
+start_server {tags {"other"}} {
+    test {DEBUG PROFILE samples busy threads as collapsed stacks} {
+        if {[exec uname] == "Linux" && !$::valgrind} {
+            r debug profile reset
+            r debug profile start 1000
+            assert_error {*already running*} {r debug profile start}
+            # Burn some CPU on the event loop thread
+            r eval {
+                local i = 0
+                while (i < 3000000) do i = i + 1 end
+            } 0
+            r debug profile stop
+            set status [r debug profile status]
+            assert_equal 0 [dict get $status running]
+            assert {[dict get $status samples] > 0}
+            set stacks [r debug profile dump]
+            foreach line [split [string trim $stacks] "\n"] {
+                assert_match {event-loop-*;* [0-9]*} $line
+            }
+            assert_match {*evalCommand*} $stacks
+            r debug profile reset
+            assert_equal {} [r debug profile dump]
+        }
+    }
+
+    test {DEBUG PROFILE START accepts a one second period and rejects bad rates} {
+        if {[exec uname] == "Linux" && !$::valgrind} {
+            assert_equal OK [r debug profile start 1]
+            assert_equal 1 [dict get [r debug profile status] hz]
+            r debug profile stop
+            assert_error {*value is out of range*} {r debug profile start 0}
+            assert_error {*value is out of range*} {r debug profile start 1001}
+            assert_equal 0 [dict get [r debug profile status] running]
+        }
+    }
+}
+
+test {keydb-server bench runs micro-benchmarks and reports JSON} {
+    set out [exec src/keydb-server bench sds --runs 3 --warmup 1 --time 5 --json]
+    assert_match {\{"version":*"results":\[*\]\}*} $out
+    foreach name {sds-new-free-16b sds-catlen-16b sds-cmp-22b} {
+        assert_match "*\"name\":\"$name\",\"iterations\":*\"samples_ns\":\\\[*,*,*\\\]*" $out
+    }
+    catch {exec src/keydb-server bench nosuchgroup} err
+    assert_match {*Unknown benchmark group*} $err
+}
+
+start_server {tags {"other"} overrides {server-threads 2 lock-spin-policy queued}} {
+    test {lock-spin-policy can be changed at runtime} {
+        assert_equal {lock-spin-policy queued} [r config get lock-spin-policy]
+        foreach policy {adaptive fixed queued} {
+            r config set lock-spin-policy $policy
+            set clients {}
+            for {set j 0} {$j < 4} {incr j} {
+                set rd [redis_deferring_client]
+                for {set i 0} {$i < 100} {incr i} {$rd incr lockspin:$policy}
+                lappend clients $rd
+            }
+            foreach rd $clients {
+                for {set i 0} {$i < 100} {incr i} {$rd read}
+                $rd close
+            }
+            assert_equal 400 [r get lockspin:$policy]
+        }
+        assert_error {*must be one of*} {r config set lock-spin-policy spinny}
+    }
+}
+
+start_server {tags {"other"} overrides {rename-command {incr keydb-incr}}} {
+    test {Command lookup is case insensitive and follows rename-command} {
+        r SeT cmdlookup:a 1
+        assert_equal 1 [r gEt cmdlookup:a]
+        assert_equal 2 [r keydb-INCR cmdlookup:a]
+        assert_error {*unknown command*} {r incr cmdlookup:a}
+        assert_error {*unknown command*} {r nosuchcommand}
+        # Pipelined commands are resolved while parsing, ahead of execution
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 50} {incr j} {
+            $rd KEYDB-incr cmdlookup:n
+            $rd HSET cmdlookup:h f$j $j
+        }
+        for {set j 0} {$j < 100} {incr j} {$rd read}
+        $rd close
+        assert_equal 50 [r get cmdlookup:n]
+        assert_equal 50 [r hlen cmdlookup:h]
+    }
+}
@@ -838,3 +838,66 @@ start_server {tags {"hash"}} {
         assert_equal 0 [r exists hfoo]
     }
 }
+
+start_server {tags {"hash"} overrides {use-fork no}} {
+    test {Hash table encoded hash written during a snapshot keeps both versions intact} {
+        r config set rdb-key-save-delay 100000
+        r del bighash
+        for {set i 0} {$i < 1000} {incr i} {
+            r hset bighash f$i v$i
+        }
+        assert_encoding hashtable bighash
+        r bgsave
+        wait_for_condition 50 100 {
+            [s rdb_bgsave_in_progress] == 1
+        } else {
+            fail "bgsave did not start"
+        }
+        r hset bighash f0 changed
+        r hdel bighash f1
+        r hset bighash newfield newval
+        r config set rdb-key-save-delay 0
+        waitForBgsave r
+        assert_equal 1000 [r hlen bighash]
+        assert_equal changed [r hget bighash f0]
+        assert_equal {} [r hget bighash f1]
+        assert_equal v999 [r hget bighash f999]
+        r debug reload
+        assert_equal 1000 [r hlen bighash]
+        assert_equal changed [r hget bighash f0]
+    }
+
+    test {A hash copied out of a snapshot shares its elements with the next copy} {
+        r config set rdb-key-save-delay 0
+        r flushall
+        set payload [string repeat x 200]
+        for {set i 0} {$i < 2000} {incr i} {
+            r hset bighash f$i $payload
+        }
+        assert_encoding hashtable bighash
+        # Keep the snapshot alive with a second key that takes long to save
+        r set other 1
+        set growth {}
+        foreach round {1 2} {
+            r config set rdb-key-save-delay 1000000
+            r bgsave
+            wait_for_condition 50 100 {
+                [s rdb_bgsave_in_progress] == 1
+            } else {
+                fail "bgsave did not start"
+            }
+            set before [s used_memory]
+            r hset bighash f0 changed$round
+            lappend growth [expr {[s used_memory] - $before}]
+            r config set rdb-key-save-delay 0
+            waitForBgsave r
+        }
+        # The element payload is 2000 * 200 bytes. Elements are plain strings
+        # until the first copy, which converts them to refcounted strings. The
+        # second copy shares them and only allocates its dict.
+        assert_morethan [lindex $growth 0] 400000
+        assert_lessthan [lindex $growth 1] 200000
+        assert_equal changed2 [r hget bighash f0]
+        assert_equal $payload [r hget bighash f1999]
+    }
+}
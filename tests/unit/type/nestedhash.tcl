@@ -49,6 +49,94 @@ start_server {tags {"nested_hash"}} {
         assert_equal [r expire a.b 100] 0
     }
 
+    test {small objects are listpack encoded} {
+        r flushall
+        r keydb.nhset dict.name alice
+        assert_equal hashtable [r object encoding dict]
+        r config set nested-hash-max-listpack-entries 128
+        r keydb.nhset doc.name alice
+        r keydb.nhset doc.age 42
+        assert_equal listpack [r object encoding doc]
+        assert_equal [r keydb.nhget json doc] {{"name" : "alice","age" : "42"}}
+        assert_equal [r keydb.nhget doc.age] 42
+        # Objects with children are dicts, listpacks only hold strings
+        r keydb.nhset doc.address.city paris
+        assert_equal hashtable [r object encoding doc]
+        assert_equal [r keydb.nhget json doc.address] {{"city" : "paris"}}
+        assert_equal [r keydb.nhget doc.name] alice
+        assert_equal [r keydb.nhget doc.address.city] paris
+    }
+
+    test {listpack object overwrites} {
+        assert_equal [r keydb.nhset flat.age 42] 0
+        assert_equal [r keydb.nhset flat.age 43] 1
+        assert_equal [r keydb.nhget flat.age] 43
+        assert_equal listpack [r object encoding flat]
+        # string replaced by an object and back
+        assert_equal [r keydb.nhset doc.age 43] 1
+        r keydb.nhset doc.name.first alice
+        assert_equal [r keydb.nhget json doc.name] {{"first" : "alice"}}
+        assert_equal [r keydb.nhset doc.name bob] 1
+        assert_equal [r keydb.nhget doc.name] bob
+        # lists and strings past nested-hash-max-listpack-value convert it
+        set long [string repeat x 100]
+        r keydb.nhset doc.tags a b c
+        r keydb.nhset doc.bio $long
+        assert_equal [r keydb.nhget doc.tags] {a b c}
+        assert_equal [r keydb.nhget doc.bio] $long
+        r keydb.nhset flat.tags a b c
+        assert_equal hashtable [r object encoding flat]
+        r keydb.nhset flat2.name alice
+        r keydb.nhset flat2.name $long
+        assert_equal hashtable [r object encoding flat2]
+        assert_equal [r keydb.nhget flat2.name] $long
+        assert_equal [r keydb.nhget flat.age] 43
+    }
+
+    test {missing and past the end paths} {
+        assert_error {*no such key*} {r keydb.nhget doc.missing}
+        assert_error {*no such key*} {r keydb.nhget doc.name.first}
+        assert_error {*no such key*} {r keydb.nhget doc.tags.a}
+        assert_error {*syntax*} {r keydb.nhget doc..name}
+    }
+
+    test {listpack converts to a dict past nested-hash-max-listpack-entries} {
+        r flushall
+        r config set nested-hash-max-listpack-entries 4
+        for {set j 0} {$j < 4} {incr j} {
+            r keydb.nhset doc.f$j v$j
+        }
+        assert_equal listpack [r object encoding doc]
+        r keydb.nhset doc.f4 v4
+        assert_equal hashtable [r object encoding doc]
+        for {set j 0} {$j < 5} {incr j} {
+            assert_equal [r keydb.nhget doc.f$j] v$j
+        }
+        r config set nested-hash-max-listpack-entries 128
+    }
+
+    test {listpack converts to a dict on long field names} {
+        r flushall
+        r keydb.nhset doc.b 1
+        assert_equal listpack [r object encoding doc]
+        r keydb.nhset doc.[string repeat k 100] 2
+        assert_equal hashtable [r object encoding doc]
+        assert_equal [r keydb.nhget json doc.b] {"1"}
+        assert_equal [r keydb.nhget doc.[string repeat k 100]] 2
+    }
+
+    test {integer field names and values} {
+        r flushall
+        for {set j 0} {$j < 10} {incr j} {
+            r keydb.nhset arr.$j [expr {$j * 1000}]
+        }
+        for {set j 0} {$j < 10} {incr j} {
+            assert_equal [r keydb.nhget arr.$j] [expr {$j * 1000}]
+        }
+        assert_equal [r keydb.nhset arr.5 -1] 1
+        assert_equal [r keydb.nhget arr.5] -1
+    }
+
     # Save not implemented so ensure we don't crash saving the RDB on shutdown
     r flushall
 }
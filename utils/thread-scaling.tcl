@@ -0,0 +1,300 @@
+#!/usr/bin/env tclsh8.5
+# Released under the BSD license like Redis itself
+#
+# Measure how throughput scales with server-threads.
+#
+# For every thread count a fresh keydb-server is started from ../src, filled
+# with a keyspace, and driven by keydb-benchmark with a few command mixes.
+# For each run the script records:
+#
+#   ops/sec             as reported by keydb-benchmark
+#   ops/sec per thread  ops/sec divided by server-threads
+#   scaling             ops/sec relative to the same mix with 1 thread
+#   lock wait %         share of the busy event loop time spent waiting for
+#                       the global lock around beforeSleep/afterSleep
+#                       (INFO threads, lock_wait phase)
+#   avg contention      avg_lock_contention from INFO stats
+#   long waits          long_lock_waits from INFO cpu (process lifetime)
+#   ops per cpu-ms      requests served per millisecond of server CPU time
+#
+# With --save <file> the results are stored as a baseline. With --baseline
+# <file> every run is compared against it and flagged when ops/sec or the
+# scaling factor dropped by more than --tolerance percent; the script then
+# exits with status 1, so it can be used as a regression gate.
+#
+# Example:
+#   cd utils; ./thread-scaling.tcl --save scaling.baseline
+#   (change the code, rebuild)
+#   ./thread-scaling.tcl --baseline scaling.baseline
+
+source ../tests/support/keydb.tcl
+set ::port 12124
+set ::threads {1 2 4 8 16}
+set ::mixes {get-async mixed set pipelined lua}
+set ::requests 200000
+set ::clients 100
+# keydb-benchmark threads spin, so only use them when there are spare CPUs
+if {[catch {set ::cpus [exec getconf _NPROCESSORS_ONLN]}]} {set ::cpus 1}
+set ::bench_threads [expr {$::cpus >= 8 ? 4 : 1}]
+set ::keyspace 100000
+set ::tolerance 10
+set ::baseline {}
+set ::save {}
+
+# name -> keydb-benchmark arguments. "mixed" is filled in by main since it
+# needs a workload file.
+array set ::mixargs {
+    get-async {-t get}
+    set {-t set}
+    pipelined {-t get -P 16}
+    lua {eval "redis.call('incr',KEYS[1]) return redis.call('get',KEYS[1])" 1 counter:__rand_int__}
+}
+
+proc start-server {threads} {
+    set pid [exec ../src/keydb-server --port $::port --server-threads $threads \
+        --save "" --appendonly no --loglevel warning > /dev/null 2> /dev/null &]
+    for {set j 0} {$j < 100} {incr j} {
+        if {![catch {set r [redis 127.0.0.1 $::port]}]} {
+            if {![catch {$r ping}]} {return [list $pid $r]}
+            $r close
+        }
+        after 100
+    }
+    catch {exec kill -9 $pid}
+    puts "keydb-server --server-threads $threads did not start"
+    exit 1
+}
+
+proc info-fields {r section} {
+    set fields {}
+    foreach line [split [$r info $section] "\n"] {
+        set line [string trim $line]
+        if {$line eq {} || [string index $line 0] eq "#"} continue
+        set idx [string first : $line]
+        dict set fields [string range $line 0 [expr {$idx-1}]] [string range $line [expr {$idx+1}] end]
+    }
+    return $fields
+}
+
+proc cpu-seconds {r} {
+    set cpu [info-fields $r cpu]
+    expr {[dict get $cpu used_cpu_sys] + [dict get $cpu used_cpu_user]}
+}
+
+# Percentage of the busy event loop time all threads spent in lock_wait.
+proc lock-wait-pct {r} {
+    set busy 0
+    set wait 0
+    dict for {key value} [info-fields $r threads] {
+        if {![regexp {^thread_\d+_phase_(\w+)$} $key -> phase]} continue
+        regexp {usec=(\d+)} $value -> usec
+        # lock_wait is nested inside the top level phases, don't count it twice
+        if {$phase eq "lock_wait"} {
+            incr wait $usec
+        } elseif {$phase in {before_sleep after_sleep file_events time_events}} {
+            incr busy $usec
+        }
+    }
+    expr {$busy ? 100.0*$wait/$busy : 0.0}
+}
+
+# Throughput from keydb-benchmark --csv: the last data row of the regular
+# tests, or the "ALL" row of a --workload run. Fields are taken from the end
+# since the test name of a custom command may contain commas.
+proc csv-rps {output} {
+    set rps 0
+    foreach line [split [string trim $output] "\n"] {
+        set fields [split [string map {\" {}} $line] ","]
+        if {[lindex $fields 0] eq "test" || [lindex $fields 0] eq "command"} continue
+        if {[lindex $fields 0] eq "ALL"} {
+            set rps [lindex $fields end-5]
+        } else {
+            set rps [lindex $fields end-6]
+        }
+    }
+    return $rps
+}
+
+proc run-mix {r mix threads} {
+    $r config set enable-async-commands [expr {$mix eq "get-async" ? "yes" : "no"}]
+    $r config resetstat
+    set cpu [cpu-seconds $r]
+    set start [clock milliseconds]
+    set args [list -p $::port -c $::clients -n $::requests -r $::keyspace --csv]
+    if {$::bench_threads > 1} {lappend args --threads $::bench_threads}
+    set output [exec ../src/keydb-benchmark {*}$args {*}$::mixargs($mix)]
+    set elapsed [expr {([clock milliseconds]-$start)/1000.0}]
+    set cpu [expr {[cpu-seconds $r] - $cpu}]
+    set stats [info-fields $r stats]
+    set rps [csv-rps $output]
+    dict create rps $rps \
+        per_thread [expr {$rps/$threads}] \
+        lock_wait_pct [lock-wait-pct $r] \
+        avg_contention [dict get $stats avg_lock_contention] \
+        long_lock_waits [dict get [info-fields $r cpu] long_lock_waits] \
+        ops_per_cpu_ms [expr {$cpu > 0 ? $::requests/($cpu*1000) : 0}] \
+        cores [expr {$elapsed > 0 ? $cpu/$elapsed : 0}]
+}
+
+proc run-all {} {
+    set results {}
+    foreach threads $::threads {
+        puts "server-threads $threads"
+        lassign [start-server $threads] pid r
+        exec ../src/keydb-benchmark -p $::port -c $::clients -n $::keyspace \
+            -r $::keyspace -t set -q > /dev/null
+        foreach mix $::mixes {
+            puts -nonewline "  $mix... "
+            flush stdout
+            if {[catch {set res [run-mix $r $mix $threads]} err]} {
+                catch {exec kill -9 $pid}
+                error $err
+            }
+            puts [format "%.0f ops/sec" [dict get $res rps]]
+            dict set results $mix $threads $res
+        }
+        $r close
+        catch {exec kill -9 $pid}
+        after 500
+    }
+    return $results
+}
+
+proc scaling {results mix threads} {
+    set base [dict get $results $mix [lindex $::threads 0]]
+    set rps1 [dict get $base rps]
+    expr {$rps1 > 0 ? [dict get $results $mix $threads rps]/$rps1 : 0}
+}
+
+proc report {results} {
+    set regressions 0
+    if {$::baseline ne {}} {
+        set fd [open $::baseline]
+        set base [read $fd]
+        close $fd
+    }
+    puts ""
+    puts "# requests=$::requests clients=$::clients benchmark-threads=$::bench_threads keyspace=$::keyspace cpus=$::cpus"
+    foreach mix $::mixes {
+        puts ""
+        puts $mix
+        puts [format "  %7s %12s %12s %8s %10s %10s %10s %10s %10s  %s" \
+            threads ops/sec per-thread scaling lock-wait% contention long-waits ops/cpu-ms cores {}]
+        foreach threads $::threads {
+            set res [dict get $results $mix $threads]
+            set rps [dict get $res rps]
+            set scale [scaling $results $mix $threads]
+            set flag {}
+            if {$::baseline ne {} && [dict exists $base $mix $threads]} {
+                set min [expr {1.0 - $::tolerance/100.0}]
+                set brps [dict get $base $mix $threads rps]
+                set bscale [scaling $base $mix $threads]
+                if {$rps < $brps*$min} {
+                    append flag [format " REGRESSION ops/sec %.0f -> %.0f" $brps $rps]
+                }
+                if {$scale < $bscale*$min} {
+                    append flag [format " REGRESSION scaling %.2fx -> %.2fx" $bscale $scale]
+                }
+                if {$flag ne {}} {incr regressions}
+            }
+            puts [format "  %7d %12.0f %12.0f %7.2fx %10.1f %10.2f %10d %10.1f %10.2f %s" \
+                $threads $rps [dict get $res per_thread] $scale \
+                [dict get $res lock_wait_pct] [dict get $res avg_contention] \
+                [dict get $res long_lock_waits] \
+                [dict get $res ops_per_cpu_ms] [dict get $res cores] $flag]
+        }
+    }
+    if {$::baseline ne {}} {
+        puts ""
+        puts "$regressions regression(s) against $::baseline (tolerance $::tolerance%)"
+    }
+    return $regressions
+}
+
+proc main {} {
+    set spec /tmp/keydb-thread-scaling-[pid].spec
+    set fd [open $spec w]
+    puts $fd "keyspace $::keyspace"
+    puts $fd "keys zipf 0.99"
+    puts $fd "values fixed 64"
+    puts $fd "command 80 GET __key__"
+    puts $fd "command 20 SET __key__ __value__"
+    close $fd
+    set ::mixargs(mixed) [list --workload $spec]
+
+    set results [run-all]
+    file delete $spec
+    if {$::save ne {}} {
+        set fd [open $::save w]
+        puts $fd $results
+        close $fd
+        puts "Baseline saved to $::save"
+    }
+    if {[report $results]} {exit 1}
+}
+
+# Force the user to run the script from the 'utils' directory.
+if {![file exists thread-scaling.tcl]} {
+    puts "Please make sure to run thread-scaling.tcl while inside /utils."
+    puts "Example: cd utils; ./thread-scaling.tcl"
+    exit 1
+}
+
+# parse arguments
+for {set j 0} {$j < [llength $argv]} {incr j} {
+    set opt [lindex $argv $j]
+    set arg [lindex $argv [expr $j+1]]
+    if {$opt eq {--threads}} {
+        set ::threads [split $arg ,]
+        incr j
+    } elseif {$opt eq {--mixes}} {
+        set ::mixes [split $arg ,]
+        incr j
+    } elseif {$opt eq {--requests}} {
+        set ::requests $arg
+        incr j
+    } elseif {$opt eq {--clients}} {
+        set ::clients $arg
+        incr j
+    } elseif {$opt eq {--benchmark-threads}} {
+        set ::bench_threads $arg
+        incr j
+    } elseif {$opt eq {--keyspace}} {
+        set ::keyspace $arg
+        incr j
+    } elseif {$opt eq {--port}} {
+        set ::port $arg
+        incr j
+    } elseif {$opt eq {--baseline}} {
+        set ::baseline $arg
+        incr j
+    } elseif {$opt eq {--save}} {
+        set ::save $arg
+        incr j
+    } elseif {$opt eq {--tolerance}} {
+        set ::tolerance $arg
+        incr j
+    } else {
+        puts "Wrong argument: $opt"
+        puts "Usage: ./thread-scaling.tcl \[--threads 1,2,4,8,16\] \[--mixes get-async,mixed,set,pipelined,lua\]"
+        puts "       \[--requests <n>\] \[--clients <n>\] \[--benchmark-threads <n>\] \[--keyspace <n>\]"
+        puts "       \[--port <port>\] \[--save <file>\] \[--baseline <file>\] \[--tolerance <percent>\]"
+        exit 1
+    }
+}
+
+foreach mix $::mixes {
+    if {$mix ne "mixed" && ![info exists ::mixargs($mix)]} {
+        puts "Unknown mix '$mix', available: get-async mixed set pipelined lua"
+        exit 1
+    }
+}
+
+# Make sure there is not already a server running on the port
+set is_not_running [catch {set r [redis 127.0.0.1 $::port]}]
+if {!$is_not_running} {
+    puts "Sorry, you have a running server on port $::port"
+    exit 1
+}
+
+main